@@ -33,10 +33,11 @@ static size_t db_alignment_from_read(dBAlignment *aln, const read_t *r,
   size_t contig_start, contig_end = 0, search_start = 0;
   const size_t kmer_size = db_graph->kmer_size;
 
-  BinaryKmer bkmer, tmp_key;
+  // Kmers are looked up in batches so hash table buckets can be prefetched
+  BinaryKmer bkmer, bkmers[HT_BATCH_SIZE], bkeys[HT_BATCH_SIZE];
+  hkey_t hkeys[HT_BATCH_SIZE];
   Nucleotide nuc;
-  hkey_t node;
-  size_t i, offset, nxtbse;
+  size_t i, j, m, offset, nxtbse;
 
   dBNodeBuffer *nodes = &aln->nodes;
   Int32Buffer *rpos = &aln->rpos;
@@ -59,20 +60,29 @@ static size_t db_alignment_from_read(dBAlignment *aln, const read_t *r,
     bkmer = binary_kmer_from_str(contig, kmer_size);
     bkmer = binary_kmer_right_shift_one_base(bkmer);
 
-    for(offset=contig_start, nxtbse=kmer_size-1; nxtbse < contig_len; nxtbse++,offset++)
+    for(offset=contig_start, nxtbse=kmer_size-1; nxtbse < contig_len; )
     {
-      nuc = dna_char_to_nuc(contig[nxtbse]);
-      bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
-      tmp_key = binary_kmer_get_key(bkmer, kmer_size);
-      node = hash_table_find(&db_graph->ht, tmp_key);
+      m = MIN2(contig_len - nxtbse, HT_BATCH_SIZE);
 
-      if(node != HASH_NOT_FOUND &&
-         (colour == -1 || db_node_has_col(db_graph, node, colour)))
+      for(j = 0; j < m; j++) {
+        nuc = dna_char_to_nuc(contig[nxtbse+j]);
+        bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
+        bkmers[j] = bkmer;
+        bkeys[j] = binary_kmer_get_key(bkmer, kmer_size);
+      }
+
+      hash_table_find_batch(&db_graph->ht, bkeys, m, hkeys);
+
+      for(j = 0; j < m; j++, nxtbse++, offset++)
       {
-        nodes->b[n].key = node;
-        nodes->b[n].orient = bkmer_get_orientation(bkmer, tmp_key);
-        rpos->b[n] = offset;
-        n++;
+        if(hkeys[j] != HASH_NOT_FOUND &&
+           (colour == -1 || db_node_has_col(db_graph, hkeys[j], colour)))
+        {
+          nodes->b[n].key = hkeys[j];
+          nodes->b[n].orient = bkmer_get_orientation(bkmers[j], bkeys[j]);
+          rpos->b[n] = offset;
+          n++;
+        }
       }
     }
   }
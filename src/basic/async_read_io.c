@@ -3,8 +3,52 @@
 #include "seq_reader.h"
 #include "file_util.h"
 #include "util.h" // util_run_threads()
+#include "bgzf_reader.h"
+#include "gzip_reader.h"
 
 #include <pthread.h>
+#include <signal.h> // pthread_sigmask()
+#include <unistd.h> // pipe()
+#include <sys/stat.h> // stat()
+
+//
+// Reading is a pipeline:
+//   1. inflate: compressed input is decompressed ahead of the parser by a
+//      pool of threads (BgzfReader for BGZF, GzipReader for other gzip files,
+//      htslib for BAM)
+//   2. parse: one thread per input splits records and pushes them to the pool
+//      in batches of `asyncio_batch_size` reads
+//   3. check: `num_readers` threads take batches from the pool and check bases
+//      and quality scores (see seq_read_check())
+//   4. process: the same threads pass each read in the batch to the job
+//
+// Reads are swapped in and out of batches, so their buffers are recycled
+// through the pool rather than reallocated.
+//
+
+#define ASYNCIO_INFLATE_BUFSIZE (1<<20)
+
+static size_t asyncio_batch_size = ASYNCIO_DEFAULT_BATCH;
+
+// Counters for each stage, summed over threads (updated atomically)
+typedef struct
+{
+  size_t bytes_in, bytes_out; // compressed bytes read, bytes inflated
+  size_t nreads; // reads (pairs) parsed
+  size_t inflate_usecs, parse_usecs, check_usecs;
+} AsyncIOStats;
+
+// Inflate one compressed input, writing the data to a pipe read by the parser
+typedef struct
+{
+  pthread_t thread;
+  FILE *fh;
+  BgzfReader *bgzf; // BGZF input
+  GzipReader *gzr; // other gzip input
+  int fd; // write end of the pipe
+  const char *path;
+  AsyncIOStats *stats;
+} AsyncIOInflater;
 
 struct AsyncIOWorker
 {
@@ -12,6 +56,12 @@ struct AsyncIOWorker
   MsgPool *const pool;
   AsyncIOInput task;
   size_t *const num_running;
+  size_t nreads; // number of reads (pairs) added to the pool
+  AsyncIOBatch *batch; // batch being filled, claimed at pool position `pos`
+  int pos;
+  size_t inflate_threads; // per input file
+  AsyncIOStats *stats;
+  SeqReadCheck chks[2]; // for file1, file2
 };
 
 
@@ -86,6 +136,25 @@ void asyncio_task_close(AsyncIOInput *task)
   task->file1 = task->file2 = NULL;
 }
 
+static seq_file_t* asyncio_reopen_file(seq_file_t *sf)
+{
+  if(sf == NULL) return NULL;
+  if(strcmp(sf->path, "-") == 0) die("Cannot read STDIN twice");
+  StrBuf path;
+  strbuf_alloc(&path, strlen(sf->path)+1);
+  strbuf_set(&path, sf->path);
+  seq_close(sf);
+  if((sf = seq_open(path.b)) == NULL) die("Cannot re-open file: %s", path.b);
+  strbuf_dealloc(&path);
+  return sf;
+}
+
+void asyncio_task_reopen(AsyncIOInput *task)
+{
+  task->file1 = asyncio_reopen_file(task->file1);
+  task->file2 = asyncio_reopen_file(task->file2);
+}
+
 void asynciodata_alloc(AsyncIOData *iod)
 {
   if(seq_read_alloc(&iod->r1) == NULL ||
@@ -98,46 +167,211 @@ void asynciodata_dealloc(AsyncIOData *iod)
   seq_read_dealloc(&iod->r2);
 }
 
+void asyncio_set_batch_size(size_t n)
+{
+  ctx_assert(n > 0);
+  asyncio_batch_size = n;
+}
+
+size_t asyncio_get_batch_size()
+{
+  return asyncio_batch_size;
+}
+
+void asynciobatch_alloc(AsyncIOBatch *batch, size_t n)
+{
+  size_t i;
+  batch->data = ctx_malloc(n * sizeof(AsyncIOData));
+  for(i = 0; i < n; i++) asynciodata_alloc(&batch->data[i]);
+  batch->len = 0;
+}
+
+void asynciobatch_dealloc(AsyncIOBatch *batch, size_t n)
+{
+  size_t i;
+  for(i = 0; i < n; i++) asynciodata_dealloc(&batch->data[i]);
+  ctx_free(batch->data);
+  memset(batch, 0, sizeof(*batch));
+}
+
 void asynciodata_pool_init(void *el, size_t idx, void *args)
 {
   // status("alloc: %zu %p", idx, el);
-  AsyncIOData *store = (AsyncIOData*)args, *data = store + idx;
-  memcpy(el, &data, sizeof(AsyncIOData*));
+  AsyncIOBatch *store = (AsyncIOBatch*)args, *batch = store + idx;
+  memcpy(el, &batch, sizeof(AsyncIOBatch*));
 }
 
 // No memory allocated for io worker
 static void async_io_worker_init(AsyncIOWorker *wrkr,
                                  const AsyncIOInput *task,
-                                 MsgPool *pool, size_t *num_running)
+                                 MsgPool *pool, size_t *num_running,
+                                 size_t inflate_threads, AsyncIOStats *stats)
 {
-  ctx_assert(pool->elsize == sizeof(AsyncIOData*));
-  AsyncIOWorker tmp = {.pool = pool, .task = *task, .num_running = num_running};
+  ctx_assert(pool->elsize == sizeof(AsyncIOBatch*));
+  AsyncIOWorker tmp = {.pool = pool, .task = *task, .num_running = num_running,
+                       .batch = NULL, .pos = -1,
+                       .inflate_threads = inflate_threads, .stats = stats};
   memcpy(wrkr, &tmp, sizeof(AsyncIOWorker));
 }
 
+// Pass the batch being filled to the workers
+static void flush_to_pool(AsyncIOWorker *wrkr)
+{
+  if(wrkr->pos < 0) return;
+  msgpool_release(wrkr->pool, wrkr->pos, MPOOL_FULL);
+  wrkr->batch = NULL;
+  wrkr->pos = -1;
+}
+
 static void add_to_pool(read_t *r1, read_t *r2,
                         uint8_t fq_offset1, uint8_t fq_offset2,
                         void *arg)
 {
   AsyncIOWorker *wrkr = (AsyncIOWorker*)arg;
   MsgPool *pool = wrkr->pool;
-  int pos;
   AsyncIOData *data;
 
-  // Swap reads and parameters into the data obj
-  pos = msgpool_claim_write(pool);
-  memcpy(&data, msgpool_get_ptr(pool, pos), sizeof(AsyncIOData*));
+  // Claim an empty batch to fill
+  if(wrkr->pos < 0) {
+    wrkr->pos = msgpool_claim_write(pool);
+    memcpy(&wrkr->batch, msgpool_get_ptr(pool, wrkr->pos),
+           sizeof(AsyncIOBatch*));
+    wrkr->batch->len = 0;
+  }
 
+  // Swap reads and parameters into the data obj
+  data = &wrkr->batch->data[wrkr->batch->len++];
   data->fq_offset1 = fq_offset1;
   data->fq_offset2 = fq_offset2;
   data->ptr = wrkr->task.ptr;
+  data->idx = wrkr->nreads++;
+  data->chk1 = &wrkr->chks[0];
+  data->chk2 = r2 == NULL ? NULL : &wrkr->chks[wrkr->task.interleaved ? 0 : 1];
 
   SWAP(data->r1, *r1);
 
   if(r2) SWAP(data->r2, *r2);
   else seq_read_reset(&data->r2);
 
-  msgpool_release(pool, pos, MPOOL_FULL);
+  if(wrkr->batch->len == asyncio_batch_size) flush_to_pool(wrkr);
+}
+
+static void* async_io_inflate(void *ptr)
+{
+  AsyncIOInflater *inf = (AsyncIOInflater*)ptr;
+  uint8_t *buf = ctx_malloc(ASYNCIO_INFLATE_BUFSIZE);
+  double start = util_wall_time();
+  size_t n, i, nbytes = 0;
+  ssize_t w;
+
+  // If the parser stops early, write() fails with EPIPE rather than the
+  // process being killed
+  sigset_t sigs;
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+  while(1)
+  {
+    if(inf->bgzf != NULL)
+      n = bgzf_reader_read(inf->bgzf, buf, ASYNCIO_INFLATE_BUFSIZE);
+    else
+      n = gzip_reader_read(inf->gzr, buf, ASYNCIO_INFLATE_BUFSIZE);
+
+    if(n == 0) break;
+
+    for(i = 0; i < n; ) {
+      if((w = write(inf->fd, buf+i, n-i)) > 0) i += w;
+      else if(errno == EPIPE) goto finished;
+      else if(errno != EINTR)
+        die("Cannot write to pipe: %s [%s]", inf->path, strerror(errno));
+    }
+
+    nbytes += n;
+  }
+
+  finished:
+  close(inf->fd);
+  ctx_free(buf);
+
+  __sync_fetch_and_add(&inf->stats->bytes_out, nbytes);
+  __sync_fetch_and_add(&inf->stats->inflate_usecs,
+                       (size_t)((util_wall_time() - start) * 1e6));
+  return NULL;
+}
+
+// If `sf` is compressed, start inflating it on other threads and return a
+// new seq_file_t that reads the inflated data from a pipe. Otherwise `sf` is
+// returned and `inf->fh` is NULL.
+static seq_file_t* async_io_inflate_start(seq_file_t *sf, AsyncIOInflater *inf,
+                                          size_t nthreads, AsyncIOStats *stats)
+{
+  memset(inf, 0, sizeof(AsyncIOInflater));
+  if(sf == NULL) return NULL;
+
+  // htslib decompresses BAM with its own thread pool
+  if(sf->s_file != NULL) {
+    if(nthreads > 1) hts_set_threads(sf->s_file, nthreads);
+    return sf;
+  }
+
+  // Only regular files can be opened a second time from the start
+  struct stat st;
+  if(strcmp(sf->path, "-") == 0 || stat(sf->path, &st) != 0 ||
+     !S_ISREG(st.st_mode)) return sf;
+
+  uint8_t hdr[BGZF_HDR_SIZE];
+  FILE *fh = fopen(sf->path, "r");
+  if(fh == NULL) return sf;
+  size_t n = fread(hdr, 1, BGZF_HDR_SIZE, fh);
+
+  // gzip magic number
+  if(n < 2 || hdr[0] != 0x1f || hdr[1] != 0x8b) { fclose(fh); return sf; }
+
+  // We read the file through `fh` from here on, so close the gzip stream
+  // opened by seq_open() (seq_close() skips it once NULL)
+  if(sf->gz_file != NULL) { gzclose(sf->gz_file); sf->gz_file = NULL; }
+
+  int fds[2];
+  if(pipe(fds) != 0) die("Cannot create pipe [%s]", strerror(errno));
+
+  inf->path = sf->path;
+  inf->fd = fds[1];
+  inf->stats = stats;
+
+  rewind(fh);
+  inf->fh = fh;
+
+  if(n == BGZF_HDR_SIZE && bgzf_is_block(hdr, n))
+    inf->bgzf = bgzf_reader_new(fh, sf->path, nthreads, NULL);
+  else
+    inf->gzr = gzip_reader_new(fh, sf->path, nthreads);
+
+  seq_file_t *pipe_sf = seq_dopen(fds[0], false, false,
+                                  ASYNCIO_INFLATE_BUFSIZE);
+  if(pipe_sf == NULL) die("Cannot read from pipe: %s", sf->path);
+
+  int rc = pthread_create(&inf->thread, NULL, async_io_inflate, inf);
+  if(rc != 0) die("Creating thread failed: %s", strerror(rc));
+
+  return pipe_sf;
+}
+
+static void async_io_inflate_finish(seq_file_t *sf, AsyncIOInflater *inf)
+{
+  if(inf->fh == NULL) return;
+
+  seq_close(sf); // closes the read end of the pipe
+
+  int rc = pthread_join(inf->thread, NULL);
+  if(rc != 0) die("Joining thread failed: %s", strerror(rc));
+
+  if(inf->bgzf != NULL) bgzf_reader_close(inf->bgzf);
+  if(inf->gzr != NULL) gzip_reader_close(inf->gzr);
+  fclose(inf->fh);
+
+  off_t fsize = futil_get_file_size(inf->path);
+  if(fsize > 0) __sync_fetch_and_add(&inf->stats->bytes_in, (size_t)fsize);
 }
 
 static void* async_io_reader(void *ptr) __attribute__((noreturn));
@@ -146,23 +380,41 @@ static void* async_io_reader(void *ptr)
 {
   AsyncIOWorker *wrkr = (AsyncIOWorker*)ptr;
   AsyncIOInput *task = &wrkr->task;
+  AsyncIOStats *stats = wrkr->stats;
+  AsyncIOInflater inf1, inf2;
+  seq_file_t *sf1, *sf2;
+  double start = util_wall_time();
 
   read_t r1, r2;
   seq_read_alloc(&r1);
   seq_read_alloc(&r2);
 
+  sf1 = async_io_inflate_start(task->file1, &inf1, wrkr->inflate_threads,
+                               stats);
+  sf2 = async_io_inflate_start(task->file2, &inf2, wrkr->inflate_threads,
+                               stats);
+
   if(task->interleaved)
   {
-    seq_parse_interleaved_sf(task->file1, task->fq_offset,
-                             &r1, &r2, add_to_pool, wrkr);
+    seq_parse_interleaved_sf(sf1, task->fq_offset,
+                             &r1, &r2, add_to_pool, wrkr, wrkr->chks);
   } else {
-    seq_parse_pe_sf(task->file1, task->file2, task->fq_offset,
-                    &r1, &r2, add_to_pool, wrkr);
+    seq_parse_pe_sf(sf1, sf2, task->fq_offset,
+                    &r1, &r2, add_to_pool, wrkr, wrkr->chks);
   }
 
+  flush_to_pool(wrkr);
+
+  async_io_inflate_finish(sf1, &inf1);
+  async_io_inflate_finish(sf2, &inf2);
+
   seq_read_dealloc(&r1);
   seq_read_dealloc(&r2);
 
+  __sync_fetch_and_add(&stats->nreads, wrkr->nreads);
+  __sync_fetch_and_add(&stats->parse_usecs,
+                       (size_t)((util_wall_time() - start) * 1e6));
+
   // Check if we are the last thread to finish, if so close the pool
   size_t n = __sync_sub_and_fetch((volatile size_t*)wrkr->num_running, 1);
 
@@ -177,9 +429,12 @@ static void* async_io_reader(void *ptr)
 // Start loading into a pool
 // returns an array of AsyncIOWorker of length len_files, each is a running
 // thread putting reading into the pool passed.
+// `inflate_threads` is the number of threads decompressing each input file
 static AsyncIOWorker* asyncio_read_start(MsgPool *pool,
                                          const AsyncIOInput *inputs,
-                                         size_t num_inputs)
+                                         size_t num_inputs,
+                                         size_t inflate_threads,
+                                         AsyncIOStats *stats)
 {
   if(num_inputs == 0) return NULL;
 
@@ -187,7 +442,7 @@ static AsyncIOWorker* asyncio_read_start(MsgPool *pool,
   int rc;
 
   // Initiate all reads in the pool
-  ctx_assert(pool->elsize == sizeof(AsyncIOData*));
+  ctx_assert(pool->elsize == sizeof(AsyncIOBatch*));
 
   // Create workers
   AsyncIOWorker *workers = ctx_malloc(num_inputs * sizeof(AsyncIOWorker));
@@ -198,7 +453,8 @@ static AsyncIOWorker* asyncio_read_start(MsgPool *pool,
   *num_running = num_inputs;
 
   for(i = 0; i < num_inputs; i++)
-    async_io_worker_init(&workers[i], &inputs[i], pool, num_running);
+    async_io_worker_init(&workers[i], &inputs[i], pool, num_running,
+                         inflate_threads, stats);
 
   // Start threads
   pthread_attr_t thread_attr;
@@ -237,45 +493,115 @@ static void asyncio_read_finish(AsyncIOWorker *workers, size_t num_workers)
   ctx_free(workers);
 }
 
-void asyncio_run_threads(MsgPool *pool,
-                         AsyncIOInput *asyncio_inputs, size_t num_inputs,
-                         void (*job)(void *_arg, size_t _tid),
-                         void *args, size_t num_readers, size_t elsize)
+// Rate of each stage is per thread: amount / time spent in that stage
+static void asyncio_print_stats(const AsyncIOStats *stats, double secs)
+{
+  char in_str[50], out_str[50], rate_str[50], nreads_str[50];
+  double inflate_secs = stats->inflate_usecs / 1e6;
+  double parse_secs = stats->parse_usecs / 1e6;
+
+  if(stats->bytes_out > 0) {
+    bytes_to_str(stats->bytes_in, 1, in_str);
+    bytes_to_str(stats->bytes_out, 1, out_str);
+    bytes_to_str(inflate_secs > 0 ? stats->bytes_out / inflate_secs : 0, 1,
+                 rate_str);
+    status("[asyncio] inflate: %s -> %s in %.2f secs (%s/sec per file)",
+           in_str, out_str, inflate_secs, rate_str);
+  }
+
+  ulong_to_str(stats->nreads, nreads_str);
+  num_to_str(parse_secs > 0 ? stats->nreads / parse_secs : 0, 1, rate_str);
+  status("[asyncio] parse: %s reads in %.2f secs (%s reads/sec per input)",
+         nreads_str, parse_secs, rate_str);
+
+  if(stats->check_usecs > 0) {
+    double check_secs = stats->check_usecs / 1e6;
+    num_to_str(stats->nreads / check_secs, 1, rate_str);
+    status("[asyncio] check: %.2f secs (%s reads/sec per thread)",
+           check_secs, rate_str);
+  }
+
+  num_to_str(secs > 0 ? stats->nreads / secs : 0, 1, rate_str);
+  status("[asyncio] process: %.2f secs (%s reads/sec)", secs, rate_str);
+}
+
+static void asyncio_run_threads_stats(MsgPool *pool,
+                                      AsyncIOInput *asyncio_inputs,
+                                      size_t num_inputs,
+                                      void (*job)(void *_arg, size_t _tid),
+                                      void *args, size_t num_readers,
+                                      size_t elsize, AsyncIOStats *stats)
 {
   if(!num_inputs) return;
   ctx_assert(num_readers > 0);
 
-  status("[asyncio] Inputs: %zu; Threads: %zu", num_inputs, num_readers);
+  status("[asyncio] Inputs: %zu; Threads: %zu; Batch size: %zu",
+         num_inputs, num_readers, asyncio_batch_size);
+
+  // Compressed files share the processing threads' cores, since a slow
+  // inflate stage leaves the processing threads waiting anyway
+  size_t inflate_threads = MAX2(num_readers / num_inputs, 1);
+  double start = util_wall_time();
 
   // Start async io reading
   AsyncIOWorker *asyncio_workers;
-  asyncio_workers = asyncio_read_start(pool, asyncio_inputs, num_inputs);
+  asyncio_workers = asyncio_read_start(pool, asyncio_inputs, num_inputs,
+                                       inflate_threads, stats);
 
   util_run_threads(args, num_readers, elsize, num_readers, job);
 
   // Finish with the async io (waits until queue is empty)
   asyncio_read_finish(asyncio_workers, num_inputs);
+
+  asyncio_print_stats(stats, util_wall_time() - start);
+}
+
+void asyncio_run_threads(MsgPool *pool,
+                         AsyncIOInput *asyncio_inputs, size_t num_inputs,
+                         void (*job)(void *_arg, size_t _tid),
+                         void *args, size_t num_readers, size_t elsize)
+{
+  AsyncIOStats stats;
+  memset(&stats, 0, sizeof(stats));
+  asyncio_run_threads_stats(pool, asyncio_inputs, num_inputs, job,
+                            args, num_readers, elsize, &stats);
 }
 
 typedef struct {
   MsgPool *pool;
   void (*func)(AsyncIOData *_data, size_t _tid, void *_arg);
   void *arg;
+  AsyncIOStats *stats;
 } PoolFuncPair;
 
-// pthread method, loop: reads from pool, call function
+// pthread method, loop: reads from pool, check reads, call function
 static void grab_reads_from_pool(void *arg, size_t threadid)
 {
   PoolFuncPair wrkr = *(PoolFuncPair*)arg;
   int pos;
-  AsyncIOData *data = NULL;
+  size_t i, check_usecs = 0;
+  AsyncIOBatch *batch = NULL;
+  AsyncIOData *data;
+  double start;
 
   while((pos = msgpool_claim_read(wrkr.pool)) != -1)
   {
-    memcpy(&data, msgpool_get_ptr(wrkr.pool, pos), sizeof(AsyncIOData*));
-    wrkr.func(data, threadid, wrkr.arg);
+    memcpy(&batch, msgpool_get_ptr(wrkr.pool, pos), sizeof(AsyncIOBatch*));
+
+    start = util_wall_time();
+    for(i = 0; i < batch->len; i++) {
+      data = &batch->data[i];
+      seq_read_check(&data->r1, data->chk1);
+      if(data->chk2 != NULL) seq_read_check(&data->r2, data->chk2);
+    }
+    check_usecs += (size_t)((util_wall_time() - start) * 1e6);
+
+    for(i = 0; i < batch->len; i++)
+      wrkr.func(&batch->data[i], threadid, wrkr.arg);
     msgpool_release(wrkr.pool, pos, MPOOL_EMPTY);
   }
+
+  __sync_fetch_and_add(&wrkr.stats->check_usecs, check_usecs);
 }
 
 // `num_inputs` number of threads pushing reads into the pool
@@ -284,28 +610,37 @@ void asyncio_run_pool(AsyncIOInput *asyncio_inputs, size_t num_inputs,
                       void (*job)(AsyncIOData *_data, size_t _tid, void *_arg),
                       void *args, size_t num_readers, size_t elsize)
 {
-  size_t i;
-  AsyncIOData *data = ctx_malloc(MSGPOOLSIZE * sizeof(AsyncIOData));
-  for(i = 0; i < MSGPOOLSIZE; i++) asynciodata_alloc(&data[i]);
+  size_t i, batch_size = asyncio_batch_size;
+
+  // Keep about MSGPOOLSIZE reads in the pool, with enough batches for every
+  // thread to hold one while others are queued
+  size_t nbatches = MAX2(MSGPOOLSIZE / batch_size, 4*(num_inputs+num_readers));
+  AsyncIOBatch *batches = ctx_malloc(nbatches * sizeof(AsyncIOBatch));
+  for(i = 0; i < nbatches; i++) asynciobatch_alloc(&batches[i], batch_size);
 
   MsgPool pool;
-  msgpool_alloc(&pool, MSGPOOLSIZE, sizeof(AsyncIOData*), USE_MSG_POOL);
-  msgpool_iterate(&pool, asynciodata_pool_init, data);
+  msgpool_alloc(&pool, nbatches, sizeof(AsyncIOBatch*), USE_MSG_POOL);
+  msgpool_iterate(&pool, asynciodata_pool_init, batches);
+
+  AsyncIOStats stats;
+  memset(&stats, 0, sizeof(stats));
 
   PoolFuncPair *poolfunc = ctx_calloc(num_readers, sizeof(PoolFuncPair));
 
   for(i = 0; i < num_readers; i++) {
     poolfunc[i] = (PoolFuncPair){.pool = &pool, .func = job,
-                                 .arg = (char*)args+i*elsize};
+                                 .arg = (char*)args+i*elsize,
+                                 .stats = &stats};
   }
 
-  asyncio_run_threads(&pool, asyncio_inputs, num_inputs, grab_reads_from_pool,
-                      poolfunc, num_readers, sizeof(PoolFuncPair));
+  asyncio_run_threads_stats(&pool, asyncio_inputs, num_inputs,
+                            grab_reads_from_pool, poolfunc, num_readers,
+                            sizeof(PoolFuncPair), &stats);
 
   ctx_free(poolfunc);
 
-  for(i = 0; i < MSGPOOLSIZE; i++) asynciodata_dealloc(&data[i]);
-  ctx_free(data);
+  for(i = 0; i < nbatches; i++) asynciobatch_dealloc(&batches[i], batch_size);
+  ctx_free(batches);
   msgpool_dealloc(&pool);
 }
 
@@ -5,6 +5,7 @@
 #include "msg-pool/msgpool.h"
 
 #include "seq_loading_stats.h"
+#include "seq_reader.h"
 
 // Rename async_read_io.h -> async_read.h
 // AsyncIOInput->AsyncReadFiles AsyncIOData->AsyncReadData
@@ -22,8 +23,20 @@ typedef struct
   read_t r1, r2;
   void *ptr; // pointer from AsyncIOInput (specific to source sequence file(s))
   uint8_t fq_offset1, fq_offset2;
+  size_t idx; // read (pair) number in its input, starting from zero
+  SeqReadCheck *chk1, *chk2; // quality range of the files r1, r2 came from
 } AsyncIOData;
 
+// Reads (pairs) are passed from reader threads to workers in batches
+typedef struct
+{
+  AsyncIOData *data;
+  size_t len;
+} AsyncIOBatch;
+
+// One read per batch; larger batches cut locking per read, for short reads
+#define ASYNCIO_DEFAULT_BATCH 1
+
 #define asyncio_task_is_pe(a) ((a)->file2 != NULL || (a)->interleaved)
 
 // if out_base != NULL, we expect an output string as well:
@@ -40,11 +53,24 @@ void asyncio_task_parse(AsyncIOInput *task, char shortopt, char *path_arg,
 
 void asyncio_task_close(AsyncIOInput *task);
 
+// Close and re-open input files to read them again from the start.
+// Dies if an input is STDIN
+void asyncio_task_reopen(AsyncIOInput *task);
+
 void asynciodata_alloc(AsyncIOData *iod);
 void asynciodata_dealloc(AsyncIOData *iod);
 
+// Allocate batch with room for `n` reads (pairs)
+void asynciobatch_alloc(AsyncIOBatch *batch, size_t n);
+void asynciobatch_dealloc(AsyncIOBatch *batch, size_t n);
+
+// Number of reads (pairs) per batch passed between threads
+void asyncio_set_batch_size(size_t n);
+size_t asyncio_get_batch_size();
+
 typedef struct AsyncIOWorker AsyncIOWorker;
 
+// Set pool element `idx` to point to the AsyncIOBatch args[idx]
 void asynciodata_pool_init(void *el, size_t idx, void *args);
 void asynciodata_pool_destroy(void *el, size_t idx, void *args);
 
@@ -0,0 +1,554 @@
+#include "global.h"
+#include "bgzf_reader.h"
+#include "file_util.h"
+
+#include <pthread.h>
+#include <unistd.h> // pread()
+
+// Number of blocks per decompression thread that can be read ahead
+#define BGZF_BLOCKS_PER_THREAD 4
+
+typedef struct
+{
+  uint8_t *cdata, *data;
+  size_t clen, len;
+  uint64_t uoff; // offset of the block in the uncompressed data
+  bool done; // block has been decompressed
+} BgzfReadBlock;
+
+struct BgzfReader
+{
+  FILE *fh;
+  char *path;
+  const BgzfIndex *idx;
+  size_t nthreads, nblocks;
+  BgzfReadBlock *blocks;
+
+  // Blocks [nused, nread) have been read from the file, we are reading data
+  // from block nused. Blocks from ndecomp have not been picked up by a
+  // decompression thread yet. Block i is blocks[i % nblocks].
+  // Only the reading thread changes nused and nread.
+  size_t nread, ndecomp, nused;
+  size_t pos; // offset in block nused
+  bool cur_done; // block nused is known to be decompressed
+  uint64_t unext; // uncompressed offset of the next block read from the file
+  bool eof, closing, started;
+
+  pthread_t *threads;
+  pthread_mutex_t lock;
+  pthread_cond_t block_read, block_done;
+};
+
+static inline uint32_t bgzf_get32(const uint8_t *ptr)
+{
+  return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+bool bgzf_is_block(const uint8_t *h, size_t len)
+{
+  return len >= BGZF_HDR_SIZE &&
+         h[0] == 0x1f && h[1] == 0x8b && h[2] == 8 && (h[3] & 4) &&
+         h[10] == 6 && h[11] == 0 && h[12] == 'B' && h[13] == 'C' &&
+         h[14] == 2 && h[15] == 0;
+}
+
+// Get the size of a block from its header
+static size_t bgzf_block_size(const uint8_t *hdr, const char *path)
+{
+  if(!bgzf_is_block(hdr, BGZF_HDR_SIZE))
+    die("Not a BGZF file (compress with bgzip): %s", path);
+  size_t bsize = (size_t)(hdr[16] | (hdr[17] << 8)) + 1;
+  if(bsize < BGZF_HDR_SIZE + BGZF_FTR_SIZE)
+    die("Corrupt BGZF block: %s", path);
+  return bsize;
+}
+
+// Decompress a block of `clen` bytes into `data`, which must have
+// BGZF_MAX_BLOCK_SIZE bytes. Returns length of uncompressed data.
+static size_t bgzf_inflate_block(z_stream *zs, uint8_t *cdata, size_t clen,
+                                 uint8_t *data, const char *path)
+{
+  size_t len = bgzf_get32(cdata + clen - 4);
+  uint32_t crc = bgzf_get32(cdata + clen - 8);
+  int ret;
+
+  if(len > BGZF_MAX_BLOCK_SIZE) die("Corrupt BGZF block: %s", path);
+  if(len == 0) return 0; // end-of-file marker
+
+  zs->next_in = cdata + BGZF_HDR_SIZE;
+  zs->avail_in = clen - BGZF_HDR_SIZE - BGZF_FTR_SIZE;
+  zs->next_out = data;
+  zs->avail_out = len;
+
+  if((ret = inflate(zs, Z_FINISH)) != Z_STREAM_END || zs->avail_out != 0)
+    die("Corrupt BGZF block [%i]: %s", ret, path);
+
+  if(crc32(crc32(0, NULL, 0), data, len) != crc)
+    die("BGZF block checksum failed: %s", path);
+
+  if(inflateReset(zs) != Z_OK) die("inflateReset failed");
+  return len;
+}
+
+static void bgzf_inflate_init(z_stream *zs)
+{
+  memset(zs, 0, sizeof(*zs));
+  // -15 => raw deflate without a zlib header
+  if(inflateInit2(zs, -15) != Z_OK) die("inflateInit2 failed");
+}
+
+//
+// Index
+//
+
+void bgzf_index_alloc(BgzfIndex *idx)
+{
+  idx->capacity = 1024;
+  idx->coff = ctx_calloc(idx->capacity, sizeof(uint64_t));
+  idx->uoff = ctx_calloc(idx->capacity, sizeof(uint64_t));
+  idx->n = 0;
+}
+
+void bgzf_index_dealloc(BgzfIndex *idx)
+{
+  ctx_free(idx->coff);
+  ctx_free(idx->uoff);
+  memset(idx, 0, sizeof(*idx));
+}
+
+void bgzf_index_add(BgzfIndex *idx, uint64_t coff, uint64_t uoff)
+{
+  if(idx->n+2 > idx->capacity) {
+    idx->coff = ctx_recallocarray(idx->coff, idx->capacity, idx->capacity*2,
+                                  sizeof(uint64_t));
+    idx->uoff = ctx_recallocarray(idx->uoff, idx->capacity, idx->capacity*2,
+                                  sizeof(uint64_t));
+    idx->capacity *= 2;
+  }
+  idx->n++;
+  idx->coff[idx->n] = coff;
+  idx->uoff[idx->n] = uoff;
+}
+
+// .gzi format: number of entries (uint64_t) then for every block except the
+// first: compressed offset, uncompressed offset (uint64_t)
+bool bgzf_index_load(BgzfIndex *idx, const char *path)
+{
+  FILE *fh = fopen(path, "r");
+  if(fh == NULL) return false;
+
+  uint64_t i, n, offs[2];
+  bool success = (fread(&n, sizeof(n), 1, fh) == 1);
+
+  idx->n = 0;
+  idx->coff[0] = idx->uoff[0] = 0;
+  for(i = 0; success && i < n; i++) {
+    success = (fread(offs, sizeof(uint64_t), 2, fh) == 2 &&
+               offs[0] > idx->coff[idx->n] && offs[1] >= idx->uoff[idx->n]);
+    if(success) bgzf_index_add(idx, offs[0], offs[1]);
+  }
+
+  fclose(fh);
+
+  if(!success) {
+    warn("Cannot read BGZF index: %s", path);
+    idx->n = 0;
+  }
+  return success;
+}
+
+void bgzf_index_save(const BgzfIndex *idx, const char *path)
+{
+  FILE *fh = futil_fopen(path, "w");
+  uint64_t i, n = idx->n, offs[2];
+  bool success = (fwrite(&n, sizeof(n), 1, fh) == 1);
+  for(i = 1; success && i <= n; i++) {
+    offs[0] = idx->coff[i];
+    offs[1] = idx->uoff[i];
+    success = (fwrite(offs, sizeof(uint64_t), 2, fh) == 2);
+  }
+  if(!success) die("Cannot write BGZF index: %s [%s]", path, strerror(errno));
+  fclose(fh);
+}
+
+void bgzf_index_scan(BgzfIndex *idx, int fd, const char *path)
+{
+  uint64_t coff = idx->coff[idx->n], uoff = idx->uoff[idx->n];
+  uint8_t hdr[BGZF_HDR_SIZE], isize[4];
+  ssize_t n;
+  size_t bsize, len;
+
+  while((n = pread(fd, hdr, BGZF_HDR_SIZE, coff)) != 0)
+  {
+    if(n != BGZF_HDR_SIZE) die("Truncated BGZF file: %s", path);
+    bsize = bgzf_block_size(hdr, path);
+    if(pread(fd, isize, 4, coff+bsize-4) != 4)
+      die("Truncated BGZF file: %s", path);
+    len = bgzf_get32(isize);
+    coff += bsize;
+    uoff += len;
+    // skip empty blocks such as the end-of-file marker
+    if(len > 0) bgzf_index_add(idx, coff, uoff);
+    else idx->coff[idx->n] = coff;
+  }
+}
+
+size_t bgzf_index_find(const BgzfIndex *idx, uint64_t uoff)
+{
+  size_t l = 0, r = idx->n, mid;
+  while(l < r) {
+    mid = (l+r+1)/2;
+    if(idx->uoff[mid] <= uoff) l = mid;
+    else r = mid-1;
+  }
+  return l;
+}
+
+//
+// Random access
+//
+
+void bgzf_cache_dealloc(BgzfCache *cache)
+{
+  ctx_free(cache->data);
+  ctx_free(cache->cdata);
+  if(cache->zs_init) inflateEnd(&cache->zs);
+  cache->blk = SIZE_MAX;
+  cache->data = cache->cdata = NULL;
+  cache->zs_init = false;
+}
+
+static void bgzf_cache_load(BgzfCache *cache, int fd, const BgzfIndex *idx,
+                            size_t blk, const char *path)
+{
+  if(cache->data == NULL) {
+    cache->data = ctx_malloc(BGZF_MAX_BLOCK_SIZE);
+    cache->cdata = ctx_malloc(BGZF_MAX_BLOCK_SIZE);
+  }
+  if(!cache->zs_init) { bgzf_inflate_init(&cache->zs); cache->zs_init = true; }
+
+  size_t clen = MIN2(idx->coff[blk+1] - idx->coff[blk], BGZF_MAX_BLOCK_SIZE);
+  ssize_t n = pread(fd, cache->cdata, clen, idx->coff[blk]);
+  if(n < BGZF_HDR_SIZE)
+    die("Cannot read BGZF block: %s [%s]", path, strerror(errno));
+
+  size_t bsize = bgzf_block_size(cache->cdata, path);
+  if(bsize > (size_t)n) die("Truncated BGZF file: %s", path);
+
+  cache->blk = SIZE_MAX;
+  cache->len = bgzf_inflate_block(&cache->zs, cache->cdata, bsize,
+                                  cache->data, path);
+  cache->blk = blk;
+}
+
+size_t bgzf_pread(int fd, const BgzfIndex *idx, void *ptr, size_t len,
+                  uint64_t uoff, BgzfCache *cache, const char *path)
+{
+  uint8_t *out = (uint8_t*)ptr;
+  size_t blk, n, offset, total = 0;
+
+  while(len > 0)
+  {
+    blk = cache->blk;
+    if(blk == SIZE_MAX || uoff < idx->uoff[blk] ||
+       uoff >= idx->uoff[blk] + cache->len)
+    {
+      if((blk = bgzf_index_find(idx, uoff)) >= idx->n) break;
+      bgzf_cache_load(cache, fd, idx, blk, path);
+      if(cache->len == 0) break;
+    }
+
+    offset = uoff - idx->uoff[blk];
+    n = MIN2(len, cache->len - offset);
+    memcpy(out, cache->data + offset, n);
+    out += n; uoff += n; len -= n; total += n;
+  }
+
+  return total;
+}
+
+//
+// Streaming
+//
+
+static void* bgzf_decompress_thread(void *arg)
+{
+  BgzfReader *br = (BgzfReader*)arg;
+  BgzfReadBlock *blk;
+  z_stream zs;
+
+  bgzf_inflate_init(&zs);
+
+  pthread_mutex_lock(&br->lock);
+  while(1)
+  {
+    while(br->ndecomp == br->nread && !br->closing)
+      pthread_cond_wait(&br->block_read, &br->lock);
+
+    if(br->closing) break;
+
+    blk = &br->blocks[br->ndecomp++ % br->nblocks];
+    pthread_mutex_unlock(&br->lock);
+
+    blk->len = bgzf_inflate_block(&zs, blk->cdata, blk->clen, blk->data,
+                                  br->path);
+
+    pthread_mutex_lock(&br->lock);
+    blk->done = true;
+    pthread_cond_broadcast(&br->block_done);
+  }
+  pthread_mutex_unlock(&br->lock);
+
+  inflateEnd(&zs);
+  return NULL;
+}
+
+static void bgzf_reader_start_threads(BgzfReader *br)
+{
+  size_t i;
+  int rc;
+  for(i = 0; i < br->nthreads; i++) {
+    rc = pthread_create(&br->threads[i], NULL, bgzf_decompress_thread, br);
+    if(rc != 0) die("Creating thread failed: %s", strerror(rc));
+  }
+  br->started = true;
+}
+
+// Read the next compressed block from the file into a free slot and pass it
+// to the decompression threads. Returns false at the end of the file.
+static bool bgzf_reader_fill(BgzfReader *br)
+{
+  BgzfReadBlock *blk = &br->blocks[br->nread % br->nblocks];
+  size_t n = fread(blk->cdata, 1, BGZF_HDR_SIZE, br->fh);
+
+  if(n == 0) {
+    if(ferror(br->fh))
+      die("Cannot read file: %s [%s]", br->path, strerror(errno));
+    br->eof = true;
+    return false;
+  }
+
+  if(n != BGZF_HDR_SIZE) die("Truncated BGZF file: %s", br->path);
+  blk->clen = bgzf_block_size(blk->cdata, br->path);
+  n = blk->clen - BGZF_HDR_SIZE;
+  if(fread(blk->cdata + BGZF_HDR_SIZE, 1, n, br->fh) != n)
+    die("Truncated BGZF file: %s", br->path);
+
+  blk->uoff = br->unext;
+  blk->done = false;
+  br->unext += bgzf_get32(blk->cdata + blk->clen - 4);
+
+  pthread_mutex_lock(&br->lock);
+  br->nread++;
+  if(!br->started) bgzf_reader_start_threads(br);
+  pthread_cond_signal(&br->block_read);
+  pthread_mutex_unlock(&br->lock);
+
+  return true;
+}
+
+// Wait for all blocks that have been read to be decompressed, then drop them
+static void bgzf_reader_drain(BgzfReader *br)
+{
+  size_t i;
+  pthread_mutex_lock(&br->lock);
+  for(i = br->nused; i < br->nread; i++)
+    while(!br->blocks[i % br->nblocks].done)
+      pthread_cond_wait(&br->block_done, &br->lock);
+  br->nused = br->nread;
+  pthread_mutex_unlock(&br->lock);
+  br->pos = 0;
+  br->cur_done = false;
+}
+
+// Block buffers and threads are only allocated on the first read, so that the
+// number of threads can still be changed after opening
+static void bgzf_reader_alloc_blocks(BgzfReader *br)
+{
+  size_t i;
+  br->nblocks = br->nthreads * BGZF_BLOCKS_PER_THREAD;
+  br->blocks = ctx_calloc(br->nblocks, sizeof(BgzfReadBlock));
+  br->threads = ctx_calloc(br->nthreads, sizeof(pthread_t));
+
+  for(i = 0; i < br->nblocks; i++) {
+    br->blocks[i].cdata = ctx_malloc(BGZF_MAX_BLOCK_SIZE);
+    br->blocks[i].data = ctx_malloc(BGZF_MAX_BLOCK_SIZE);
+  }
+}
+
+// Stop decompression threads and free block buffers
+static void bgzf_reader_free_blocks(BgzfReader *br)
+{
+  size_t i;
+
+  pthread_mutex_lock(&br->lock);
+  br->closing = true;
+  pthread_cond_broadcast(&br->block_read);
+  pthread_mutex_unlock(&br->lock);
+
+  if(br->started) {
+    for(i = 0; i < br->nthreads; i++) {
+      int rc = pthread_join(br->threads[i], NULL);
+      if(rc != 0) die("Joining thread failed: %s", strerror(rc));
+    }
+  }
+
+  for(i = 0; i < br->nblocks; i++) {
+    ctx_free(br->blocks[i].cdata);
+    ctx_free(br->blocks[i].data);
+  }
+
+  ctx_free(br->blocks);
+  ctx_free(br->threads);
+  br->blocks = NULL;
+  br->threads = NULL;
+  br->nblocks = 0;
+  br->started = br->closing = false;
+}
+
+BgzfReader* bgzf_reader_new(FILE *fh, const char *path, size_t nthreads,
+                            const BgzfIndex *idx)
+{
+  BgzfReader *br = ctx_calloc(1, sizeof(BgzfReader));
+  br->fh = fh;
+  br->path = strdup(futil_inpath_str(path));
+  br->idx = idx;
+  br->nthreads = MAX2(nthreads, 1);
+
+  if(pthread_mutex_init(&br->lock, NULL) != 0) die("Mutex init failed");
+  if(pthread_cond_init(&br->block_read, NULL) != 0 ||
+     pthread_cond_init(&br->block_done, NULL) != 0)
+    die("Condition variable init failed");
+
+  return br;
+}
+
+void bgzf_reader_close(BgzfReader *br)
+{
+  bgzf_reader_free_blocks(br);
+
+  pthread_mutex_destroy(&br->lock);
+  pthread_cond_destroy(&br->block_read);
+  pthread_cond_destroy(&br->block_done);
+
+  free(br->path);
+  ctx_free(br);
+}
+
+void bgzf_reader_set_threads(BgzfReader *br, size_t nthreads)
+{
+  nthreads = MAX2(nthreads, 1);
+  if(nthreads == br->nthreads) return;
+
+  if(br->blocks == NULL) { br->nthreads = nthreads; return; }
+
+  // Blocks have been read ahead. Drop them and re-read from the current
+  // position, which requires a file we can seek in.
+  uint64_t uoff = bgzf_reader_tell(br);
+  if(fseek(br->fh, 0, SEEK_CUR) != 0) return;
+
+  bgzf_reader_free_blocks(br);
+  br->nthreads = nthreads;
+  br->nread = br->ndecomp = br->nused = 0;
+  br->pos = 0;
+  br->cur_done = false;
+
+  // File is now at the block starting at unext, which is >= uoff
+  if(bgzf_reader_seek(br, uoff) != 0)
+    die("Cannot seek in BGZF file: %s", br->path);
+}
+
+size_t bgzf_reader_read(BgzfReader *br, void *ptr, size_t len)
+{
+  uint8_t *out = (uint8_t*)ptr;
+  BgzfReadBlock *blk;
+  size_t n, total = 0;
+
+  if(br->blocks == NULL) bgzf_reader_alloc_blocks(br);
+
+  while(len > 0)
+  {
+    // Keep blocks ahead of us being decompressed
+    while(!br->eof && br->nread < br->nused + br->nblocks)
+      bgzf_reader_fill(br);
+
+    if(br->nused == br->nread) break; // end of file
+
+    blk = &br->blocks[br->nused % br->nblocks];
+
+    if(!br->cur_done) {
+      pthread_mutex_lock(&br->lock);
+      while(!blk->done) pthread_cond_wait(&br->block_done, &br->lock);
+      pthread_mutex_unlock(&br->lock);
+      br->cur_done = true;
+      if(br->pos > blk->len) die("Corrupt BGZF index: %s", br->path);
+    }
+
+    n = MIN2(len, blk->len - br->pos);
+    memcpy(out, blk->data + br->pos, n);
+    out += n; len -= n; total += n;
+    br->pos += n;
+
+    if(br->pos == blk->len) {
+      // Only this thread reads nused, block is free once nused moves past it
+      br->nused++;
+      br->pos = 0;
+      br->cur_done = false;
+    }
+  }
+
+  return total;
+}
+
+uint64_t bgzf_reader_tell(const BgzfReader *br)
+{
+  uint64_t start = br->nused < br->nread ? br->blocks[br->nused % br->nblocks].uoff
+                                         : br->unext;
+  return start + br->pos;
+}
+
+int bgzf_reader_seek(BgzfReader *br, uint64_t uoff)
+{
+  uint64_t curr = bgzf_reader_tell(br);
+  size_t blk, n;
+
+  if(uoff == curr) return 0;
+
+  // Seek within the current block
+  if(uoff > curr && br->cur_done &&
+     uoff - curr < br->blocks[br->nused % br->nblocks].len - br->pos) {
+    br->pos += uoff - curr;
+    return 0;
+  }
+
+  if(br->idx != NULL)
+  {
+    blk = bgzf_index_find(br->idx, uoff);
+    if(blk == br->idx->n && uoff > bgzf_index_usize(br->idx)) return -1;
+    bgzf_reader_drain(br);
+    if(fseek(br->fh, br->idx->coff[blk], SEEK_SET) != 0) return -1;
+    br->unext = br->idx->uoff[blk];
+    br->pos = uoff - br->idx->uoff[blk];
+    br->eof = false;
+    return 0;
+  }
+
+  // No index: go back to the start of the file if needed, then read forward
+  if(uoff < curr) {
+    bgzf_reader_drain(br);
+    if(fseek(br->fh, 0, SEEK_SET) != 0) return -1;
+    br->unext = 0;
+    br->eof = false;
+    curr = 0;
+  }
+
+  uint8_t *tmp = ctx_malloc(BGZF_MAX_BLOCK_SIZE);
+  while(curr < uoff) {
+    n = bgzf_reader_read(br, tmp, MIN2(uoff - curr, BGZF_MAX_BLOCK_SIZE));
+    if(n == 0) break;
+    curr += n;
+  }
+  ctx_free(tmp);
+
+  return curr == uoff ? 0 : -1;
+}
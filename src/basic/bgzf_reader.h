@@ -0,0 +1,107 @@
+#ifndef BGZF_READER_H_
+#define BGZF_READER_H_
+
+//
+// Read BGZF files (see bgzf_writer.h)
+//
+// BgzfReader streams a file, decompressing blocks ahead of the reader with a
+// pool of threads. Only one thread may read from a BgzfReader.
+//
+// A BgzfIndex lists the offset of each block in the compressed file and in the
+// uncompressed data. It is saved as <file>.gzi in the same format as htslib
+// (`bgzip -i` / `bgzip -r`). With an index a BgzfReader can seek, and
+// bgzf_pread() can read from any offset. bgzf_pread() does not change any
+// shared state, so many threads can call it at once, each with their own
+// BgzfCache.
+//
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <zlib.h>
+
+#include "bgzf_writer.h"
+
+// Block i starts at coff[i] in the file and uoff[i] in the uncompressed data.
+// coff[n],uoff[n] are the end of the file / data.
+typedef struct
+{
+  uint64_t *coff, *uoff;
+  size_t n, capacity;
+} BgzfIndex;
+
+typedef struct BgzfReader BgzfReader;
+
+// One decompressed block, used by bgzf_pread()
+typedef struct
+{
+  size_t blk, len; // block number and length of data
+  uint8_t *data, *cdata;
+  z_stream zs;
+  bool zs_init;
+} BgzfCache;
+
+#define BGZF_CACHE_INIT {.blk = SIZE_MAX, .len = 0, .data = NULL, .cdata = NULL,\
+                         .zs_init = false}
+
+// Returns true if `hdr` is the start of a BGZF block, requires `len` >= 18
+bool bgzf_is_block(const uint8_t *hdr, size_t len);
+
+//
+// Index
+//
+void bgzf_index_alloc(BgzfIndex *idx);
+void bgzf_index_dealloc(BgzfIndex *idx);
+
+// Add the start of the next block
+void bgzf_index_add(BgzfIndex *idx, uint64_t coff, uint64_t uoff);
+
+// Load a .gzi index file. Returns false if it cannot be read.
+bool bgzf_index_load(BgzfIndex *idx, const char *path);
+void bgzf_index_save(const BgzfIndex *idx, const char *path);
+
+// Add blocks to the index by reading block headers from the end of the index
+// to the end of the file. Builds a whole index if `idx` is empty.
+void bgzf_index_scan(BgzfIndex *idx, int fd, const char *path);
+
+// Get the block containing uncompressed offset `uoff`, idx->n if past the end
+size_t bgzf_index_find(const BgzfIndex *idx, uint64_t uoff);
+
+// Length of uncompressed data
+#define bgzf_index_usize(idx) ((idx)->uoff[(idx)->n])
+
+//
+// Random access
+//
+void bgzf_cache_dealloc(BgzfCache *cache);
+
+// Read `len` bytes of uncompressed data from offset `uoff` in file `fd`.
+// Returns number of bytes read, which is less than `len` at the end of the file
+size_t bgzf_pread(int fd, const BgzfIndex *idx, void *ptr, size_t len,
+                  uint64_t uoff, BgzfCache *cache, const char *path);
+
+//
+// Streaming
+//
+
+// Read from `fh` which is not closed by bgzf_reader_close(). `idx` may be NULL,
+// in which case seeking is done by reading from the start of the file.
+BgzfReader* bgzf_reader_new(FILE *fh, const char *path, size_t nthreads,
+                            const BgzfIndex *idx);
+void bgzf_reader_close(BgzfReader *br);
+
+// Change the number of decompression threads. Buffers and threads are created
+// on the first read, so this is cheapest straight after opening. Has no effect
+// if blocks have already been read ahead from a file we cannot seek in.
+void bgzf_reader_set_threads(BgzfReader *br, size_t nthreads);
+
+// Returns number of bytes read, less than `len` only at the end of the file
+size_t bgzf_reader_read(BgzfReader *br, void *ptr, size_t len);
+
+// Seek to an offset in the uncompressed data. Returns 0 on success, -1 on error
+int bgzf_reader_seek(BgzfReader *br, uint64_t uoff);
+
+// Offset in the uncompressed data
+uint64_t bgzf_reader_tell(const BgzfReader *br);
+
+#endif /* BGZF_READER_H_ */
@@ -0,0 +1,412 @@
+// fopencookie() is a GNU extension
+#if !defined(__APPLE__)
+  #define _GNU_SOURCE
+#endif
+
+#include "global.h"
+#include "bgzf_writer.h"
+#include "bgzf_reader.h" // BgzfIndex
+#include "file_util.h"
+
+#include <pthread.h>
+
+// Number of blocks per compression thread that can be waiting to be
+// compressed or written
+#define BGZF_BLOCKS_PER_THREAD 4
+
+// gzip header with a BC extra field, block size is set in bytes 16,17
+static const uint8_t bgzf_hdr[BGZF_HDR_SIZE] = {0x1f,0x8b,8,4, 0,0,0,0, 0,0xff,
+                                                6,0, 'B','C', 2,0, 0,0};
+
+// Empty block marks end-of-file
+static const uint8_t bgzf_eof[28] = {0x1f,0x8b,8,4, 0,0,0,0, 0,0xff, 6,0,
+                                     'B','C', 2,0, 0x1b,0, 3,0, 0,0,0,0,
+                                     0,0,0,0};
+
+typedef struct
+{
+  uint8_t *data, *cdata;
+  size_t len, clen;
+  bool compressed;
+} BgzfBlock;
+
+struct BgzfWriter
+{
+  FILE *fh;
+  char *path;
+  size_t nthreads, nblocks;
+  BgzfBlock *blocks;
+
+  // Blocks [nwritten, nfilled) are waiting to be compressed or written,
+  // block nfilled is being filled. Blocks from ncompress have not been
+  // picked up by a compression thread yet. Block i is blocks[i % nblocks].
+  size_t nfilled, ncompress, nwritten, nbytes;
+  bool closing, started;
+  bool filling; // block nfilled is free and being filled
+
+  pthread_t *threads; // nthreads compression threads, one writer thread
+
+  // Block index, only used by the writer thread until closing
+  char *idx_path;
+  BgzfIndex idx;
+  uint64_t coff, uoff; // compressed and uncompressed bytes written
+
+  // write_lock is held for a whole bgzf_writer_write() call,
+  // lock protects state shared with compression and writer threads
+  pthread_mutex_t write_lock, lock;
+  pthread_cond_t block_free, block_filled, block_compressed;
+};
+
+static inline void bgzf_put16(uint8_t *ptr, uint32_t x)
+{
+  ptr[0] = x & 0xff; ptr[1] = (x >> 8) & 0xff;
+}
+
+static inline void bgzf_put32(uint8_t *ptr, uint32_t x)
+{
+  bgzf_put16(ptr, x & 0xffff); bgzf_put16(ptr+2, x >> 16);
+}
+
+// Compress blk->data into blk->cdata as a BGZF block
+// `zs` uses default compression, `zs0` no compression for data that doesn't
+// compress into a single block
+static void bgzf_compress_block(BgzfBlock *blk, z_stream *zs, z_stream *zs0)
+{
+  const size_t max_out = BGZF_MAX_BLOCK_SIZE - BGZF_HDR_SIZE - BGZF_FTR_SIZE;
+  int ret;
+
+  zs->next_in = blk->data;
+  zs->avail_in = blk->len;
+  zs->next_out = blk->cdata + BGZF_HDR_SIZE;
+  zs->avail_out = max_out;
+
+  if((ret = deflate(zs, Z_FINISH)) != Z_STREAM_END) {
+    if(ret != Z_OK && ret != Z_BUF_ERROR) die("deflate failed: %i", ret);
+    zs0->next_in = blk->data;
+    zs0->avail_in = blk->len;
+    zs0->next_out = blk->cdata + BGZF_HDR_SIZE;
+    zs0->avail_out = max_out;
+    if((ret = deflate(zs0, Z_FINISH)) != Z_STREAM_END)
+      die("deflate failed: %i", ret);
+    zs = zs0;
+  }
+
+  size_t deflated = max_out - zs->avail_out;
+  blk->clen = BGZF_HDR_SIZE + deflated + BGZF_FTR_SIZE;
+  ctx_assert(blk->clen <= BGZF_MAX_BLOCK_SIZE);
+
+  memcpy(blk->cdata, bgzf_hdr, BGZF_HDR_SIZE);
+  bgzf_put16(blk->cdata+16, blk->clen-1);
+  uint8_t *ftr = blk->cdata + BGZF_HDR_SIZE + deflated;
+  bgzf_put32(ftr, crc32(crc32(0, NULL, 0), blk->data, blk->len));
+  bgzf_put32(ftr+4, blk->len);
+
+  if(deflateReset(zs) != Z_OK) die("deflateReset failed");
+}
+
+static void bgzf_deflate_init(z_stream *zs, int level)
+{
+  memset(zs, 0, sizeof(*zs));
+  // -15 => raw deflate without a zlib header
+  if(deflateInit2(zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    die("deflateInit2 failed");
+}
+
+static void* bgzf_compress_thread(void *arg)
+{
+  BgzfWriter *bw = (BgzfWriter*)arg;
+  BgzfBlock *blk;
+  z_stream zs, zs0;
+
+  bgzf_deflate_init(&zs, Z_DEFAULT_COMPRESSION);
+  bgzf_deflate_init(&zs0, Z_NO_COMPRESSION);
+
+  pthread_mutex_lock(&bw->lock);
+  while(1)
+  {
+    while(bw->ncompress == bw->nfilled && !bw->closing)
+      pthread_cond_wait(&bw->block_filled, &bw->lock);
+
+    if(bw->ncompress == bw->nfilled) break; // closing and no work left
+
+    blk = &bw->blocks[bw->ncompress++ % bw->nblocks];
+    pthread_mutex_unlock(&bw->lock);
+
+    bgzf_compress_block(blk, &zs, &zs0);
+
+    pthread_mutex_lock(&bw->lock);
+    blk->compressed = true;
+    pthread_cond_broadcast(&bw->block_compressed);
+  }
+  pthread_mutex_unlock(&bw->lock);
+
+  deflateEnd(&zs);
+  deflateEnd(&zs0);
+  return NULL;
+}
+
+// Write compressed blocks in order
+static void* bgzf_write_thread(void *arg)
+{
+  BgzfWriter *bw = (BgzfWriter*)arg;
+  BgzfBlock *blk;
+
+  pthread_mutex_lock(&bw->lock);
+  while(1)
+  {
+    blk = &bw->blocks[bw->nwritten % bw->nblocks];
+
+    while(!(bw->nwritten < bw->nfilled && blk->compressed) &&
+          !(bw->closing && bw->nwritten == bw->nfilled))
+      pthread_cond_wait(&bw->block_compressed, &bw->lock);
+
+    if(bw->nwritten == bw->nfilled) break; // closing and all blocks written
+
+    pthread_mutex_unlock(&bw->lock);
+
+    if(fwrite(blk->cdata, 1, blk->clen, bw->fh) != blk->clen)
+      die("Cannot write to file: %s [%s]", bw->path, strerror(errno));
+
+    bw->coff += blk->clen;
+    bw->uoff += blk->len;
+    if(bw->idx_path != NULL) bgzf_index_add(&bw->idx, bw->coff, bw->uoff);
+
+    pthread_mutex_lock(&bw->lock);
+    blk->compressed = false;
+    blk->len = 0;
+    bw->nwritten++;
+    pthread_cond_broadcast(&bw->block_free);
+  }
+  pthread_mutex_unlock(&bw->lock);
+
+  return NULL;
+}
+
+static void bgzf_start_threads(BgzfWriter *bw)
+{
+  size_t i;
+  int rc;
+  for(i = 0; i < bw->nthreads; i++) {
+    rc = pthread_create(&bw->threads[i], NULL, bgzf_compress_thread, bw);
+    if(rc != 0) die("Creating thread failed: %s", strerror(rc));
+  }
+  rc = pthread_create(&bw->threads[bw->nthreads], NULL, bgzf_write_thread, bw);
+  if(rc != 0) die("Creating thread failed: %s", strerror(rc));
+  bw->started = true;
+}
+
+// Hand the block being filled to the compression threads
+// Must hold bw->lock
+static void bgzf_submit_block(BgzfWriter *bw)
+{
+  bw->filling = false;
+  bw->nfilled++;
+  if(!bw->started) bgzf_start_threads(bw);
+  pthread_cond_broadcast(&bw->block_filled);
+}
+
+BgzfWriter* bgzf_writer_new(FILE *fh, const char *path, size_t nthreads)
+{
+  size_t i;
+  BgzfWriter *bw = ctx_calloc(1, sizeof(BgzfWriter));
+  bw->fh = fh;
+  bw->path = strdup(futil_outpath_str(path));
+  bw->nthreads = MAX2(nthreads, 1);
+  bw->nblocks = bw->nthreads * BGZF_BLOCKS_PER_THREAD;
+  bw->blocks = ctx_calloc(bw->nblocks, sizeof(BgzfBlock));
+  bw->threads = ctx_calloc(bw->nthreads+1, sizeof(pthread_t));
+
+  for(i = 0; i < bw->nblocks; i++) {
+    bw->blocks[i].data = ctx_malloc(BGZF_BLOCK_SIZE);
+    bw->blocks[i].cdata = ctx_malloc(BGZF_MAX_BLOCK_SIZE);
+  }
+
+  if(pthread_mutex_init(&bw->write_lock, NULL) != 0 ||
+     pthread_mutex_init(&bw->lock, NULL) != 0) die("Mutex init failed");
+
+  if(pthread_cond_init(&bw->block_free, NULL) != 0 ||
+     pthread_cond_init(&bw->block_filled, NULL) != 0 ||
+     pthread_cond_init(&bw->block_compressed, NULL) != 0)
+    die("Condition variable init failed");
+
+  return bw;
+}
+
+BgzfWriter* bgzf_writer_open(const char *path, size_t nthreads)
+{
+  FILE *fh = futil_fopen_create(path, "w");
+  return bgzf_writer_new(fh, path, nthreads);
+}
+
+void bgzf_writer_set_index(BgzfWriter *bw, const char *idx_path)
+{
+  ctx_assert(bw->nbytes == 0);
+  ctx_assert(bw->idx_path == NULL);
+  bw->idx_path = strdup(idx_path);
+  bgzf_index_alloc(&bw->idx);
+}
+
+void bgzf_writer_close(BgzfWriter *bw)
+{
+  size_t i, nthreads = bw->nthreads;
+
+  pthread_mutex_lock(&bw->write_lock);
+  pthread_mutex_lock(&bw->lock);
+  if(bw->filling && bw->blocks[bw->nfilled % bw->nblocks].len > 0)
+    bgzf_submit_block(bw);
+  bw->closing = true;
+  pthread_cond_broadcast(&bw->block_filled);
+  pthread_cond_broadcast(&bw->block_compressed);
+  pthread_mutex_unlock(&bw->lock);
+  pthread_mutex_unlock(&bw->write_lock);
+
+  if(bw->started) {
+    for(i = 0; i <= nthreads; i++) {
+      int rc = pthread_join(bw->threads[i], NULL);
+      if(rc != 0) die("Joining thread failed: %s", strerror(rc));
+    }
+  }
+
+  if(fwrite(bgzf_eof, 1, sizeof(bgzf_eof), bw->fh) != sizeof(bgzf_eof))
+    die("Cannot write to file: %s [%s]", bw->path, strerror(errno));
+
+  futil_fclose(bw->fh);
+
+  if(bw->idx_path != NULL) {
+    bgzf_index_save(&bw->idx, bw->idx_path);
+    bgzf_index_dealloc(&bw->idx);
+    free(bw->idx_path);
+  }
+
+  for(i = 0; i < bw->nblocks; i++) {
+    ctx_free(bw->blocks[i].data);
+    ctx_free(bw->blocks[i].cdata);
+  }
+
+  pthread_mutex_destroy(&bw->write_lock);
+  pthread_mutex_destroy(&bw->lock);
+  pthread_cond_destroy(&bw->block_free);
+  pthread_cond_destroy(&bw->block_filled);
+  pthread_cond_destroy(&bw->block_compressed);
+
+  ctx_free(bw->blocks);
+  ctx_free(bw->threads);
+  free(bw->path);
+  ctx_free(bw);
+}
+
+void bgzf_writer_write(BgzfWriter *bw, const void *ptr, size_t len)
+{
+  const uint8_t *data = (const uint8_t*)ptr;
+  BgzfBlock *blk;
+  size_t n;
+
+  pthread_mutex_lock(&bw->write_lock);
+
+  bw->nbytes += len;
+
+  while(len > 0)
+  {
+    if(!bw->filling) {
+      // Wait for block to be written before we reuse it
+      pthread_mutex_lock(&bw->lock);
+      while(bw->nfilled >= bw->nwritten + bw->nblocks)
+        pthread_cond_wait(&bw->block_free, &bw->lock);
+      pthread_mutex_unlock(&bw->lock);
+      bw->filling = true;
+    }
+
+    // Other threads do not touch the block being filled
+    blk = &bw->blocks[bw->nfilled % bw->nblocks];
+    n = MIN2(len, BGZF_BLOCK_SIZE - blk->len);
+    memcpy(blk->data + blk->len, data, n);
+    blk->len += n;
+    data += n;
+    len -= n;
+
+    if(blk->len == BGZF_BLOCK_SIZE) {
+      pthread_mutex_lock(&bw->lock);
+      bgzf_submit_block(bw);
+      pthread_mutex_unlock(&bw->lock);
+    }
+  }
+
+  pthread_mutex_unlock(&bw->write_lock);
+}
+
+void bgzf_writer_puts(BgzfWriter *bw, const char *str)
+{
+  bgzf_writer_write(bw, str, strlen(str));
+}
+
+size_t bgzf_writer_nbytes(const BgzfWriter *bw)
+{
+  return bw->nbytes;
+}
+
+//
+// FILE* interface
+//
+
+#if defined(__APPLE__)
+
+static int bgzf_cookie_write(void *cookie, const char *buf, int size)
+{
+  bgzf_writer_write((BgzfWriter*)cookie, buf, size);
+  return size;
+}
+
+static int bgzf_cookie_close(void *cookie)
+{
+  bgzf_writer_close((BgzfWriter*)cookie);
+  return 0;
+}
+
+static FILE* bgzf_cookie_fopen(BgzfWriter *bw)
+{
+  return funopen(bw, NULL, bgzf_cookie_write, NULL, bgzf_cookie_close);
+}
+
+#else
+
+static ssize_t bgzf_cookie_write(void *cookie, const char *buf, size_t size)
+{
+  bgzf_writer_write((BgzfWriter*)cookie, buf, size);
+  return size;
+}
+
+static int bgzf_cookie_close(void *cookie)
+{
+  bgzf_writer_close((BgzfWriter*)cookie);
+  return 0;
+}
+
+static FILE* bgzf_cookie_fopen(BgzfWriter *bw)
+{
+  cookie_io_functions_t funcs = {.read = NULL, .write = bgzf_cookie_write,
+                                 .seek = NULL, .close = bgzf_cookie_close};
+  return fopencookie(bw, "w", funcs);
+}
+
+#endif
+
+FILE* bgzf_writer_fopen(FILE *fh, const char *path, size_t nthreads)
+{
+  BgzfWriter *bw = bgzf_writer_new(fh, path, nthreads);
+
+  if(strcmp(path, "-") != 0) {
+    StrBuf idx_path = {0,0,0};
+    strbuf_sprintf(&idx_path, "%s.gzi", path);
+    bgzf_writer_set_index(bw, idx_path.b);
+    strbuf_dealloc(&idx_path);
+  }
+
+  FILE *out = bgzf_cookie_fopen(bw);
+  if(out == NULL) die("Cannot open file: %s [%s]", path, strerror(errno));
+
+  // Pass whole blocks to the writer
+  if(setvbuf(out, NULL, _IOFBF, BGZF_BLOCK_SIZE) != 0)
+    warn("Couldn't set buffer size: %s", path);
+
+  return out;
+}
@@ -0,0 +1,57 @@
+#ifndef BGZF_WRITER_H_
+#define BGZF_WRITER_H_
+
+//
+// Multithreaded gzip output
+//
+// Data is collected into blocks of up to BGZF_BLOCK_SIZE bytes. Each block is
+// compressed by a pool of threads as a separate gzip member in the BGZF format
+// (as used by BAM/tabix), so output can be read with any gzip reader. Blocks
+// are written in the order they were filled by a single writer thread.
+//
+// bgzf_writer_write() is thread safe and bytes from a single call are never
+// split up by writes from other threads. It only holds a lock while copying
+// data into the current block, so threads never wait for compression unless
+// all blocks are in use.
+//
+
+#include <stdio.h>
+
+// Max bytes of data per block, same as htslib
+#define BGZF_BLOCK_SIZE 0xff00
+// Max size of a compressed block
+#define BGZF_MAX_BLOCK_SIZE 0x10000
+
+// Bytes in block header and footer
+#define BGZF_HDR_SIZE 18
+#define BGZF_FTR_SIZE 8
+
+typedef struct BgzfWriter BgzfWriter;
+
+// Write to `fh`, which is closed by bgzf_writer_close(). `path` is only used
+// in error messages. `nthreads` is the number of compression threads, which
+// are started when the first block is full.
+BgzfWriter* bgzf_writer_new(FILE *fh, const char *path, size_t nthreads);
+
+// Create and open `path`, "-" for STDOUT. Calls die() on error.
+BgzfWriter* bgzf_writer_open(const char *path, size_t nthreads);
+
+// Save an index of blocks to `idx_path` when closed (see bgzf_reader.h)
+// Must be called before any data is written.
+void bgzf_writer_set_index(BgzfWriter *bw, const char *idx_path);
+
+// Get a FILE* that compresses data written to it with a BgzfWriter on `fh`.
+// An index is saved to <path>.gzi unless `path` is "-". Calling fclose() on
+// the returned FILE* closes the BgzfWriter and `fh`.
+FILE* bgzf_writer_fopen(FILE *fh, const char *path, size_t nthreads);
+
+// Write remaining data and the BGZF end-of-file marker, close file and free
+void bgzf_writer_close(BgzfWriter *bw);
+
+void bgzf_writer_write(BgzfWriter *bw, const void *ptr, size_t len);
+void bgzf_writer_puts(BgzfWriter *bw, const char *str);
+
+// Number of bytes of uncompressed data written so far
+size_t bgzf_writer_nbytes(const BgzfWriter *bw);
+
+#endif /* BGZF_WRITER_H_ */
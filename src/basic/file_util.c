@@ -3,6 +3,7 @@
 
 #include <libgen.h> // dirname
 #include <fcntl.h> // open
+#include <sys/resource.h> // getrlimit, setrlimit
 
 bool force_file_overwrite = false;
 
@@ -300,6 +301,31 @@ bool futil_path_has_extension(const char *path, const char *ext)
   return (ext_len <= path_len && strcasecmp(path+path_len-ext_len, ext) == 0);
 }
 
+// Creates <base>.tmp.<rand>, opened for reading and writing
+// File is unlinked immediately, so is removed when closed
+FILE* futil_create_tmp_file(StrBuf *path, const char *base)
+{
+  size_t i;
+  const size_t attempt_limit = 100;
+  FILE *fh;
+
+  for(i = 0; i < attempt_limit; i++) {
+    size_t r = rand() % 9999;
+    strbuf_reset(path);
+    strbuf_sprintf(path, "%s.tmp.%04zu", base, r);
+    if(!futil_file_exists(path->b)) break;
+  }
+  if(i == attempt_limit)
+    die("Temporary files already exist (%zu tries): %s", attempt_limit, path->b);
+
+  if((fh = futil_fopen_create(path->b, "r+")) == NULL) {
+    die("Cannot write temporary file: %s [%s]", path->b, strerror(errno));
+  }
+
+  unlink(path->b); // Immediately unlink to hide temp file
+  return fh;
+}
+
 // Usage:
 //     FILE **tmp_files = futil_create_tmp_files(num_tmp);
 // to clear up:
@@ -354,3 +380,27 @@ void futil_merge_tmp_files(FILE **tmp_files, size_t num_files, FILE *fout)
 
   #undef TMP_BUF_SIZE
 }
+
+// Raise the soft limit on open files to `nfiles` if the hard limit allows it.
+// Returns the new soft limit.
+size_t futil_raise_open_files_limit(size_t nfiles)
+{
+  struct rlimit rl;
+  if(getrlimit(RLIMIT_NOFILE, &rl) != 0) {
+    warn("Cannot get open files limit [%s]", strerror(errno));
+    return 0;
+  }
+
+  if(rl.rlim_cur == RLIM_INFINITY) return SIZE_MAX;
+  if(rl.rlim_cur >= nfiles) return rl.rlim_cur;
+
+  size_t limit = rl.rlim_cur;
+  rl.rlim_cur = rl.rlim_max == RLIM_INFINITY ? nfiles : MIN2(nfiles, rl.rlim_max);
+
+  if(setrlimit(RLIMIT_NOFILE, &rl) != 0)
+    warn("Cannot raise open files limit [%s]", strerror(errno));
+  else
+    limit = rl.rlim_cur;
+
+  return limit;
+}
@@ -113,6 +113,10 @@ char* futil_get_current_dir(char abspath[PATH_MAX+1]);
 // Case insensitive comparision of path with given extension
 bool futil_path_has_extension(const char *path, const char *ext);
 
+// Creates and opens <base>.tmp.<rand> for reading and writing, sets `path`
+// File is unlinked immediately, so is removed when closed
+FILE* futil_create_tmp_file(StrBuf *path, const char *base);
+
 // Usage:
 //   FILE **tmp_files = futil_create_tmp_files(num_tmp);
 // To clear up:
@@ -123,4 +127,8 @@ FILE** futil_create_tmp_files(size_t num_tmp_files);
 // Merge temporary files, closes tmp files
 void futil_merge_tmp_files(FILE **tmp_files, size_t num_files, FILE *fout);
 
+// Raise the soft limit on open files to `nfiles` if the hard limit allows it.
+// Returns the new soft limit.
+size_t futil_raise_open_files_limit(size_t nfiles);
+
 #endif /* FILE_UTIL_H_ */
@@ -0,0 +1,752 @@
+#include "global.h"
+#include "gzip_reader.h"
+
+#include <pthread.h>
+#include <unistd.h> // pread()
+#include <sys/stat.h>
+#include <zlib.h>
+
+// Compressed bytes per chunk
+#define GZIP_MIN_CHUNK (1UL<<18)
+#define GZIP_MAX_CHUNK (1UL<<20)
+// Number of chunks per thread that can be decoded ahead of the reader
+#define GZIP_CHUNKS_PER_THREAD 2
+
+#define GZIP_WINDOW (1UL<<15) // deflate history
+#define GZIP_INBUF (1UL<<16) // compressed bytes read at once
+#define GZIP_TRIAL_OUT (1UL<<13) // bytes decoded to test a block start
+
+// Stands in for the unknown history when looking for a block start
+static const uint8_t gzip_zeros[GZIP_WINDOW];
+
+typedef struct
+{
+  uint8_t *b;
+  size_t len, cap;
+} GzipBuf;
+
+typedef struct
+{
+  // `out` is decoded with history gr->dict_lo and `hi` with gr->dict_hi.
+  // Bytes >= 128 in out[0..nfix) were copied from the history at position
+  // (hi[i] << 7) | (out[i] & 127), if `ascii` is true.
+  GzipBuf out, hi;
+  uint64_t start, end; // bit offsets of the first block and the end
+  size_t nfix;
+  uint32_t crc; // crc32 of out[nfix..]
+  bool found, valid, final, ascii, done;
+} GzipChunk;
+
+// Decoder for a raw deflate stream, reading from the file with pread()
+typedef struct
+{
+  z_stream zs;
+  uint8_t *in;
+  uint64_t inoff; // file offset of in[0]
+} GzipInflater;
+
+struct GzipReader
+{
+  FILE *fh;
+  int fd;
+  char *path;
+  uint64_t fsize;
+
+  // Parallel decoding of the first member
+  size_t nthreads, nchunks, nslots, chunk;
+  GzipChunk *slots; // chunk i is slots[i % nslots]
+  size_t next_job, ncur; // next chunk to decode, chunk being read
+  size_t rpos; // offset in chunk ncur
+  bool ready; // chunk ncur has been checked and fixed
+  bool closing;
+  pthread_t *threads;
+  pthread_mutex_t lock;
+  pthread_cond_t job_cond, done_cond;
+
+  // Unknown history before a chunk, each byte encodes its position
+  uint8_t *dict_lo, *dict_hi;
+
+  // State of the reading thread
+  GzipInflater zi;
+  uint64_t bitpos; // end of the last chunk read
+  uint8_t *window; // last GZIP_WINDOW bytes output
+  size_t wlen;
+  uint32_t crc, isize; // crc32 and length of the member so far
+
+  // Serial decoding (after the first member, or if not parallel)
+  bool serial, eof;
+  z_stream szs;
+  uint8_t *sin;
+};
+
+static size_t gzip_pread(const GzipReader *gr, void *ptr, size_t len,
+                         uint64_t off)
+{
+  uint8_t *buf = (uint8_t*)ptr;
+  size_t total = 0;
+  ssize_t n;
+  while(total < len) {
+    n = pread(gr->fd, buf+total, len-total, off+total);
+    if(n > 0) total += n;
+    else if(n == 0) break;
+    else if(errno != EINTR)
+      die("Cannot read file: %s [%s]", gr->path, strerror(errno));
+  }
+  return total;
+}
+
+static void gzip_buf_grow(GzipBuf *buf, size_t limit)
+{
+  size_t cap = MIN2(MAX2(buf->cap*2, GZIP_INBUF), limit);
+  buf->b = ctx_realloc(buf->b, cap);
+  buf->cap = cap;
+}
+
+static void gzip_inflater_alloc(GzipInflater *zi)
+{
+  memset(zi, 0, sizeof(*zi));
+  // -15 => raw deflate without a header
+  if(inflateInit2(&zi->zs, -15) != Z_OK) die("inflateInit2 failed");
+  zi->in = ctx_malloc(GZIP_INBUF);
+}
+
+static void gzip_inflater_dealloc(GzipInflater *zi)
+{
+  inflateEnd(&zi->zs);
+  ctx_free(zi->in);
+}
+
+//
+// Deflate blocks
+//
+
+// Get `n` <= 25 bits from bit `bit` in `p`
+static inline uint32_t gzip_bits(const uint8_t *p, uint64_t bit, size_t n)
+{
+  const uint8_t *q = p + bit/8;
+  uint32_t v = q[0] | (q[1] << 8) | (q[2] << 16) | ((uint32_t)q[3] << 24);
+  return (v >> (bit & 7)) & ((1U << n) - 1);
+}
+
+// A dynamic block header is at most ~290 bytes. gzip_bits() reads 4 bytes.
+#define GZIP_MAX_HDR 320
+#define GZIP_HDR_PAD 4
+
+// Returns true if zlib accepts code lengths `lens`: the code must be complete
+// unless it is empty or has a single code
+static bool gzip_code_valid(const uint8_t *lens, size_t n)
+{
+  uint32_t i, kraft = 0, max = 0;
+  for(i = 0; i < n; i++) {
+    if(lens[i]) { kraft += 1U << (15 - lens[i]); max = MAX2(max, lens[i]); }
+  }
+  return kraft == (1U << 15) || (max <= 1 && kraft <= (1U << 15));
+}
+
+// Read the header of a block compressed with dynamic Huffman codes, starting
+// at bit `bit` of `p` (`len` bytes). Returns false if it is not a valid header,
+// which rules out almost every bit offset that is not the start of a block.
+// On success `lens` has the code lengths of the literals/lengths then the
+// distances, and `nlit` is the number of literals/lengths.
+static bool gzip_block_header(const uint8_t *p, size_t len, uint64_t bit,
+                              uint8_t lens[288+32], uint32_t *nlit)
+{
+  static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4,
+                                    12, 3, 13, 2, 14, 1, 15};
+  uint8_t clens[19] = {0}, syms[8][128];
+  uint32_t i, l, n, ncodes, code, count[8] = {0}, next[8], rep, val;
+  int sym;
+
+  if(bit + 17 + 19*3 > len * 8) return false;
+  if(gzip_bits(p, bit+1, 2) != 2) return false;
+  *nlit = gzip_bits(p, bit+3, 5) + 257;
+  ncodes = *nlit + gzip_bits(p, bit+8, 5) + 1;
+  n = gzip_bits(p, bit+13, 4) + 4;
+  if(*nlit > 286 || ncodes > *nlit + 30) return false;
+  bit += 17;
+  for(i = 0; i < n; i++, bit += 3) clens[order[i]] = gzip_bits(p, bit, 3);
+
+  // zlib only accepts a complete code for the code lengths
+  for(i = 0, val = 0; i < 19; i++) if(clens[i]) val += 128 >> clens[i];
+  if(val != 128) return false;
+
+  // Canonical Huffman code for the code lengths
+  memset(syms, 0xff, sizeof(syms));
+  for(i = 0; i < 19; i++) count[clens[i]]++;
+  for(code = 0, count[0] = 0, l = 1; l < 8; l++) {
+    code = (code + count[l-1]) << 1;
+    next[l] = code;
+  }
+  for(i = 0; i < 19; i++)
+    if(clens[i]) syms[clens[i]][next[clens[i]]++] = i;
+
+  for(n = 0; n < ncodes; )
+  {
+    if(bit + 16 > len * 8) return false;
+    for(sym = -1, code = 0, l = 1; l < 8 && sym < 0; l++) {
+      code = (code << 1) | gzip_bits(p, bit++, 1);
+      if(syms[l][code] != 0xff) sym = syms[l][code];
+    }
+    if(sym < 0) return false;
+    if(sym < 16) { lens[n++] = sym; continue; }
+
+    if(sym == 16) {
+      if(n == 0) return false;
+      val = lens[n-1]; rep = 3 + gzip_bits(p, bit, 2); bit += 2;
+    }
+    else if(sym == 17) { val = 0; rep = 3 + gzip_bits(p, bit, 3); bit += 3; }
+    else { val = 0; rep = 11 + gzip_bits(p, bit, 7); bit += 7; }
+
+    if(n + rep > ncodes) return false;
+    memset(lens + n, val, rep);
+    n += rep;
+  }
+
+  // Must have an end-of-block code
+  return lens[256] > 0 && gzip_code_valid(lens, *nlit) &&
+         gzip_code_valid(lens + *nlit, ncodes - *nlit);
+}
+
+// Returns true if the block at bit `bit` in `p` has dynamic Huffman codes and
+// cannot output literals >= 128
+static bool gzip_block_ascii(const uint8_t *p, size_t len, uint64_t bit)
+{
+  uint8_t lens[288+32];
+  uint32_t i, nlit;
+  if(!gzip_block_header(p, len, bit, lens, &nlit)) return false;
+  for(i = 128; i < 256; i++)
+    if(lens[i]) return false;
+  return true;
+}
+
+static bool gzip_block_is_ascii(const GzipReader *gr, uint64_t bit)
+{
+  uint8_t buf[GZIP_MAX_HDR + GZIP_HDR_PAD] = {0};
+  size_t n = gzip_pread(gr, buf, GZIP_MAX_HDR, bit/8);
+  return gzip_block_ascii(buf, n, bit & 7);
+}
+
+//
+// Decoding
+//
+
+// Decode raw deflate data from bit `start` in the file, appending to `out`.
+// `dict` is the history before `start`. Stops at the end of the first block
+// that ends at or after bit `stop`, setting `end` to the bit offset where the
+// next block starts. If `ascii` is not NULL, it is set to false if any block
+// may output bytes >= 128. Returns:
+//   Z_OK at the end of a block, Z_STREAM_END at the end of the last block,
+//   Z_BUF_ERROR if `out` reached `limit` bytes, or a zlib error code
+static int gzip_inflate(const GzipReader *gr, GzipInflater *zi,
+                        uint64_t start, uint64_t stop,
+                        const uint8_t *dict, size_t dictlen,
+                        GzipBuf *out, size_t limit, uint64_t *end,
+                        bool *ascii)
+{
+  z_stream *zs = &zi->zs;
+  uint64_t off = start / 8, bitpos;
+  size_t n;
+  uint8_t byte;
+  int ret;
+
+  if(inflateReset(zs) != Z_OK) die("inflateReset failed");
+  if(dictlen && (ret = inflateSetDictionary(zs, dict, dictlen)) != Z_OK)
+    return ret;
+
+  // Start part way through a byte
+  if(start & 7) {
+    if(gzip_pread(gr, &byte, 1, off) != 1) return Z_DATA_ERROR;
+    ret = inflatePrime(zs, 8 - (start & 7), byte >> (start & 7));
+    if(ret != Z_OK) return ret;
+    off++;
+  }
+
+  zs->avail_in = 0;
+  if(ascii) *ascii = gzip_block_is_ascii(gr, start);
+
+  while(1)
+  {
+    if(zs->avail_in == 0) {
+      // raw deflate data does not end at the end of the file
+      n = gzip_pread(gr, zi->in, GZIP_INBUF, off);
+      if(n == 0) return Z_DATA_ERROR;
+      zi->inoff = off;
+      off += n;
+      zs->next_in = zi->in;
+      zs->avail_in = n;
+    }
+
+    if(out->len == MIN2(out->cap, limit)) {
+      if(out->len == limit) return Z_BUF_ERROR;
+      gzip_buf_grow(out, limit);
+    }
+
+    zs->next_out = out->b + out->len;
+    zs->avail_out = MIN2(out->cap, limit) - out->len;
+    ret = inflate(zs, Z_BLOCK);
+    out->len = zs->next_out - out->b;
+
+    if(ret != Z_OK && ret != Z_BUF_ERROR && ret != Z_STREAM_END) return ret;
+
+    // data_type has the number of unused bits in the last byte, plus 128 at
+    // the end of a block and 64 if it was the last block
+    if(ret == Z_STREAM_END || (zs->data_type & 128)) {
+      bitpos = (zi->inoff + (zs->next_in - zi->in)) * 8 - (zs->data_type & 7);
+      *end = bitpos;
+      if(ret == Z_STREAM_END || (zs->data_type & 64)) return Z_STREAM_END;
+      if(bitpos >= stop) return Z_OK;
+      if(ascii && *ascii) *ascii = gzip_block_is_ascii(gr, bitpos);
+    }
+  }
+}
+
+//
+// Finding deflate blocks
+//
+
+static inline bool gzip_is_text(uint8_t c)
+{
+  return (c >= ' ' && c <= '~') || c == '\n' || c == '\r' || c == '\t' || !c;
+}
+
+// Decode a little from a possible block start. Reject it if zlib fails or if
+// the output is not text
+static bool gzip_block_test(const GzipReader *gr, GzipInflater *zi,
+                            uint64_t bit, GzipBuf *tmp)
+{
+  uint64_t end;
+  size_t i;
+  tmp->len = 0;
+  int ret = gzip_inflate(gr, zi, bit, UINT64_MAX, gzip_zeros, GZIP_WINDOW,
+                         tmp, GZIP_TRIAL_OUT, &end, NULL);
+  if(ret != Z_BUF_ERROR && ret != Z_STREAM_END) return false;
+  for(i = 0; i < tmp->len && gzip_is_text(tmp->b[i]); i++) {}
+  return tmp->len > 0 && i == tmp->len;
+}
+
+// Find the first block start in [lo, hi) bits
+static bool gzip_block_find(const GzipReader *gr, GzipInflater *zi,
+                            uint64_t lo, uint64_t hi, GzipBuf *tmp,
+                            uint64_t *start)
+{
+  size_t nbytes = (hi - lo + 7) / 8 + GZIP_MAX_HDR;
+  uint8_t *buf = ctx_calloc(nbytes + GZIP_HDR_PAD, 1);
+  uint8_t lens[288+32];
+  uint64_t bit, base = (lo/8)*8;
+  uint32_t nlit;
+  bool found = false;
+
+  nbytes = gzip_pread(gr, buf, nbytes, lo/8);
+
+  for(bit = lo; bit < hi && !found; bit++) {
+    found = gzip_block_header(buf, nbytes, bit - base, lens, &nlit) &&
+            gzip_block_test(gr, zi, bit, tmp);
+  }
+
+  ctx_free(buf);
+  *start = bit - 1;
+  return found;
+}
+
+//
+// Parallel decoding
+//
+
+// Decode chunk k from the first block that starts in it, to the end of the
+// first block that ends in the next chunk
+static void gzip_chunk_decode(const GzipReader *gr, GzipInflater *zi,
+                              size_t k, GzipChunk *c, GzipBuf *tmp)
+{
+  uint64_t lo = k * gr->chunk * 8;
+  uint64_t hi = MIN2((k+1) * gr->chunk, gr->fsize) * 8, end;
+  int ret;
+
+  c->out.len = c->nfix = 0;
+  c->valid = c->final = false;
+
+  if(k == 0) { c->start = gr->bitpos; c->found = true; }
+  else c->found = gzip_block_find(gr, zi, lo, hi, tmp, &c->start);
+
+  if(!c->found) return;
+
+  ret = gzip_inflate(gr, zi, c->start, hi,
+                     k ? gr->dict_lo : NULL, k ? GZIP_WINDOW : 0,
+                     &c->out, SIZE_MAX, &c->end, k ? &c->ascii : NULL);
+
+  c->valid = (ret == Z_OK || ret == Z_STREAM_END);
+  c->final = (ret == Z_STREAM_END);
+
+  // Bytes up to the last one >= 128 may have come from the history. Decode
+  // them again to get the rest of their position in the history.
+  if(c->valid && k > 0) {
+    for(c->nfix = c->out.len; c->nfix > 0 && c->out.b[c->nfix-1] < 128;
+        c->nfix--) {}
+    if(c->nfix > 0 && c->ascii) {
+      c->hi.len = 0;
+      gzip_inflate(gr, zi, c->start, UINT64_MAX, gr->dict_hi, GZIP_WINDOW,
+                   &c->hi, c->nfix, &end, NULL);
+      c->ascii = (c->hi.len == c->nfix);
+    }
+  }
+
+  c->crc = crc32(crc32(0, NULL, 0), c->out.b + c->nfix, c->out.len - c->nfix);
+}
+
+static void* gzip_decode_thread(void *arg)
+{
+  GzipReader *gr = (GzipReader*)arg;
+  GzipInflater zi;
+  GzipBuf tmp = {.b = NULL, .len = 0, .cap = 0};
+  GzipChunk *c;
+  size_t k;
+
+  gzip_inflater_alloc(&zi);
+
+  pthread_mutex_lock(&gr->lock);
+  while(1)
+  {
+    while(!gr->closing && (gr->next_job == gr->nchunks ||
+                           gr->next_job == gr->ncur + gr->nslots))
+      pthread_cond_wait(&gr->job_cond, &gr->lock);
+
+    if(gr->closing) break;
+
+    k = gr->next_job++;
+    c = &gr->slots[k % gr->nslots];
+    pthread_mutex_unlock(&gr->lock);
+
+    gzip_chunk_decode(gr, &zi, k, c, &tmp);
+
+    pthread_mutex_lock(&gr->lock);
+    c->done = true;
+    pthread_cond_broadcast(&gr->done_cond);
+  }
+  pthread_mutex_unlock(&gr->lock);
+
+  gzip_inflater_dealloc(&zi);
+  ctx_free(tmp.b);
+  return NULL;
+}
+
+static void gzip_stop_threads(GzipReader *gr)
+{
+  size_t i;
+  int rc;
+
+  if(gr->threads == NULL) return;
+
+  pthread_mutex_lock(&gr->lock);
+  gr->closing = true;
+  pthread_cond_broadcast(&gr->job_cond);
+  pthread_mutex_unlock(&gr->lock);
+
+  for(i = 0; i < gr->nthreads; i++) {
+    rc = pthread_join(gr->threads[i], NULL);
+    if(rc != 0) die("Joining thread failed: %s", strerror(rc));
+  }
+
+  ctx_free(gr->threads);
+  gr->threads = NULL;
+}
+
+// Keep the last GZIP_WINDOW bytes of output
+static void gzip_window_add(GzipReader *gr, const uint8_t *data, size_t len)
+{
+  size_t keep;
+  if(len >= GZIP_WINDOW) {
+    memcpy(gr->window, data + len - GZIP_WINDOW, GZIP_WINDOW);
+    gr->wlen = GZIP_WINDOW;
+  } else {
+    keep = MIN2(gr->wlen, GZIP_WINDOW - len);
+    memmove(gr->window, gr->window + gr->wlen - keep, keep);
+    memcpy(gr->window + keep, data, len);
+    gr->wlen = keep + len;
+  }
+}
+
+// Wait for chunk ncur to be decoded, then fix it using the end of the
+// previous chunk
+static GzipChunk* gzip_chunk_get(GzipReader *gr)
+{
+  GzipChunk *c = &gr->slots[gr->ncur % gr->nslots];
+  uint64_t end, stop = (gr->ncur+1) * gr->chunk * 8;
+  size_t i, len;
+  uint8_t b;
+  int ret;
+
+  if(gr->ready) return c;
+
+  pthread_mutex_lock(&gr->lock);
+  while(!c->done) pthread_cond_wait(&gr->done_cond, &gr->lock);
+  pthread_mutex_unlock(&gr->lock);
+
+  if(!c->valid || c->start != gr->bitpos)
+  {
+    // Guessed the wrong block start, or didn't find one
+    c->out.len = c->nfix = 0;
+    ret = gzip_inflate(gr, &gr->zi, gr->bitpos, stop, gr->window, gr->wlen,
+                       &c->out, SIZE_MAX, &c->end, NULL);
+    if(ret != Z_OK && ret != Z_STREAM_END)
+      die("Corrupt gzip file [%i]: %s", ret, gr->path);
+    c->final = (ret == Z_STREAM_END);
+    c->crc = crc32(crc32(0, NULL, 0), c->out.b, c->out.len);
+  }
+  else if(c->nfix > 0)
+  {
+    if(c->ascii && gr->wlen == GZIP_WINDOW) {
+      // Copy bytes from the history. Other bytes are text so `hi` holds the
+      // same byte, which keeps the index in the window.
+      uint8_t *out = c->out.b, *hi = c->hi.b;
+      for(i = 0; i < c->nfix; i++) {
+        b = gr->window[(hi[i] << 7) | (out[i] & 127)];
+        out[i] = (out[i] & 128) ? b : out[i];
+      }
+    }
+    else {
+      // Decode the data that depended on the history again
+      len = c->out.len;
+      c->out.len = 0;
+      ret = gzip_inflate(gr, &gr->zi, c->start, UINT64_MAX,
+                         gr->window, gr->wlen, &c->out, c->nfix, &end, NULL);
+      if(c->out.len != c->nfix)
+        die("Corrupt gzip file [%i]: %s", ret, gr->path);
+      c->out.len = len;
+    }
+    c->crc = crc32_combine(crc32(crc32(0, NULL, 0), c->out.b, c->nfix),
+                           c->crc, c->out.len - c->nfix);
+  }
+
+  gr->crc = crc32_combine(gr->crc, c->crc, c->out.len);
+  gr->isize += c->out.len;
+  gzip_window_add(gr, c->out.b, c->out.len);
+  gr->bitpos = c->end;
+  gr->rpos = 0;
+  gr->ready = true;
+
+  return c;
+}
+
+static void gzip_serial_start(GzipReader *gr, uint64_t off);
+
+static inline uint32_t gzip_get32(const uint8_t *ptr)
+{
+  return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+// Finished reading chunk ncur
+static void gzip_chunk_next(GzipReader *gr, GzipChunk *c)
+{
+  uint8_t trailer[8];
+  uint64_t off;
+
+  if(c->final)
+  {
+    // gzip trailer: crc32 and length of the data
+    off = (c->end + 7) / 8;
+    if(gzip_pread(gr, trailer, 8, off) != 8)
+      die("Truncated gzip file: %s", gr->path);
+    if(gzip_get32(trailer) != gr->crc || gzip_get32(trailer+4) != gr->isize)
+      die("gzip checksum failed: %s", gr->path);
+
+    gzip_stop_threads(gr);
+    off += 8;
+    if(off < gr->fsize) gzip_serial_start(gr, off);
+    else gr->eof = true;
+    return;
+  }
+
+  if(gr->ncur+1 == gr->nchunks) die("Truncated gzip file: %s", gr->path);
+
+  pthread_mutex_lock(&gr->lock);
+  c->done = false;
+  gr->ncur++;
+  gr->ready = false;
+  pthread_cond_broadcast(&gr->job_cond);
+  pthread_mutex_unlock(&gr->lock);
+}
+
+//
+// Serial decoding
+//
+
+// Decode from byte `off` to the end of the file with zlib's gzip support
+static void gzip_serial_start(GzipReader *gr, uint64_t off)
+{
+  if(off > 0 && fseeko(gr->fh, off, SEEK_SET) != 0)
+    die("Cannot seek in file: %s [%s]", gr->path, strerror(errno));
+
+  memset(&gr->szs, 0, sizeof(gr->szs));
+  // 15+16 => gzip header and trailer
+  if(inflateInit2(&gr->szs, 15+16) != Z_OK) die("inflateInit2 failed");
+  gr->sin = ctx_malloc(GZIP_INBUF);
+  gr->serial = true;
+}
+
+static size_t gzip_serial_read(GzipReader *gr, uint8_t *ptr, size_t len)
+{
+  z_stream *zs = &gr->szs;
+  size_t n;
+  int ret;
+
+  zs->next_out = ptr;
+  zs->avail_out = len;
+
+  while(zs->avail_out > 0)
+  {
+    if(zs->avail_in == 0) {
+      n = fread(gr->sin, 1, GZIP_INBUF, gr->fh);
+      if(n == 0) {
+        if(ferror(gr->fh))
+          die("Cannot read file: %s [%s]", gr->path, strerror(errno));
+        if(zs->total_in > 0) die("Truncated gzip file: %s", gr->path);
+        gr->eof = true;
+        break;
+      }
+      zs->next_in = gr->sin;
+      zs->avail_in = n;
+    }
+
+    ret = inflate(zs, Z_NO_FLUSH);
+
+    if(ret == Z_STREAM_END) {
+      // Another member may follow (concatenated gzip files)
+      if(inflateReset(zs) != Z_OK) die("inflateReset failed");
+    }
+    else if(ret != Z_OK && ret != Z_BUF_ERROR)
+      die("Corrupt gzip file [%i]: %s", ret, gr->path);
+  }
+
+  return len - zs->avail_out;
+}
+
+//
+// Reader
+//
+
+// Get the length of the gzip header at the start of `h`, returns 0 if we
+// cannot read it
+static size_t gzip_header_size(const uint8_t *h, size_t n)
+{
+  size_t p = 10;
+  if(n < p || h[0] != 0x1f || h[1] != 0x8b || h[2] != 8) return 0;
+  if(h[3] & 4) { if(p+2 > n) return 0; p += 2 + (h[p] | (h[p+1] << 8)); }
+  if(h[3] & 8) { while(p < n && h[p]) p++; p++; } // file name
+  if(h[3] & 16) { while(p < n && h[p]) p++; p++; } // comment
+  if(h[3] & 2) p += 2; // header crc
+  return p < n ? p : 0;
+}
+
+GzipReader* gzip_reader_new(FILE *fh, const char *path, size_t nthreads)
+{
+  size_t i, hsize = 0;
+  struct stat st;
+  int rc;
+
+  GzipReader *gr = ctx_calloc(1, sizeof(GzipReader));
+  gr->fh = fh;
+  gr->fd = fileno(fh);
+  gr->path = strdup(path);
+  gr->nthreads = MAX2(nthreads, 1);
+
+  if(pthread_mutex_init(&gr->lock, NULL) != 0) die("Mutex init failed");
+  if(pthread_cond_init(&gr->job_cond, NULL) != 0 ||
+     pthread_cond_init(&gr->done_cond, NULL) != 0)
+    die("Condition variable init failed");
+
+  // Need to pread() a regular file, starting at the beginning
+  if(gr->nthreads > 1 && fstat(gr->fd, &st) == 0 && S_ISREG(st.st_mode) &&
+     ftello(fh) == 0)
+  {
+    gr->fsize = st.st_size;
+    uint8_t *hdr = ctx_malloc(GZIP_INBUF);
+    hsize = gzip_header_size(hdr, gzip_pread(gr, hdr, GZIP_INBUF, 0));
+    ctx_free(hdr);
+  }
+
+  // Chunks must be big enough that each holds many blocks
+  gr->chunk = gr->fsize / (gr->nthreads * GZIP_CHUNKS_PER_THREAD * 4);
+  gr->chunk = MAX2(MIN2(gr->chunk, GZIP_MAX_CHUNK), GZIP_MIN_CHUNK);
+  gr->nchunks = (gr->fsize + gr->chunk - 1) / gr->chunk;
+
+  if(hsize == 0 || gr->nchunks < 2) {
+    gzip_serial_start(gr, 0);
+    return gr;
+  }
+
+  gr->bitpos = hsize * 8;
+  gr->crc = crc32(0, NULL, 0);
+  gr->window = ctx_malloc(GZIP_WINDOW);
+  gr->dict_lo = ctx_malloc(GZIP_WINDOW);
+  gr->dict_hi = ctx_malloc(GZIP_WINDOW);
+  for(i = 0; i < GZIP_WINDOW; i++) {
+    gr->dict_lo[i] = 128 | (i & 127);
+    gr->dict_hi[i] = i >> 7;
+  }
+  gzip_inflater_alloc(&gr->zi);
+
+  gr->nslots = gr->nthreads * GZIP_CHUNKS_PER_THREAD;
+  gr->slots = ctx_calloc(gr->nslots, sizeof(GzipChunk));
+  gr->threads = ctx_calloc(gr->nthreads, sizeof(pthread_t));
+
+  for(i = 0; i < gr->nthreads; i++) {
+    rc = pthread_create(&gr->threads[i], NULL, gzip_decode_thread, gr);
+    if(rc != 0) die("Creating thread failed: %s", strerror(rc));
+  }
+
+  return gr;
+}
+
+void gzip_reader_close(GzipReader *gr)
+{
+  size_t i;
+
+  gzip_stop_threads(gr);
+
+  if(gr->slots != NULL) {
+    for(i = 0; i < gr->nslots; i++) {
+      ctx_free(gr->slots[i].out.b);
+      ctx_free(gr->slots[i].hi.b);
+    }
+    ctx_free(gr->slots);
+    gzip_inflater_dealloc(&gr->zi);
+    ctx_free(gr->window);
+    ctx_free(gr->dict_lo);
+    ctx_free(gr->dict_hi);
+  }
+
+  if(gr->serial) {
+    inflateEnd(&gr->szs);
+    ctx_free(gr->sin);
+  }
+
+  pthread_mutex_destroy(&gr->lock);
+  pthread_cond_destroy(&gr->job_cond);
+  pthread_cond_destroy(&gr->done_cond);
+
+  free(gr->path);
+  ctx_free(gr);
+}
+
+size_t gzip_reader_read(GzipReader *gr, void *ptr, size_t len)
+{
+  uint8_t *out = (uint8_t*)ptr;
+  GzipChunk *c;
+  size_t n, total = 0;
+
+  while(len > 0 && !gr->eof)
+  {
+    if(gr->serial) {
+      n = gzip_serial_read(gr, out, len);
+    }
+    else {
+      c = gzip_chunk_get(gr);
+      n = MIN2(len, c->out.len - gr->rpos);
+      memcpy(out, c->out.b + gr->rpos, n);
+      gr->rpos += n;
+      if(gr->rpos == c->out.len) gzip_chunk_next(gr, c);
+    }
+    out += n; len -= n; total += n;
+  }
+
+  return total;
+}
@@ -0,0 +1,37 @@
+#ifndef GZIP_READER_H_
+#define GZIP_READER_H_
+
+//
+// Read gzip files that were not compressed with bgzip (see bgzf_reader.h)
+//
+// Deflate data can only be decoded from the start, since each block refers
+// back to the 32KB before it. GzipReader splits the file into chunks and
+// searches each chunk for the start of a deflate block. A pool of threads
+// decodes the chunks without knowing the 32KB window before each chunk. The
+// window is filled with bytes >= 128, where each byte gives the low 7 bits of
+// its position; a second decode of the chunk start gives the high 8 bits.
+// Sequence files are text, so if no block in the chunk codes a literal >= 128,
+// a byte >= 128 in the output marks data copied from the unknown window and
+// where from. Once the previous chunk has been read, the reading thread copies
+// these bytes from the real window, or decodes the start of the chunk again
+// if blocks were not text-only. A chunk is decoded again in full if its start
+// was guessed wrongly.
+//
+// Only the first gzip member is decoded in parallel. Any further members
+// (concatenated files) and files we cannot pread() from are decoded on the
+// reading thread.
+//
+
+#include <stdio.h>
+#include <stdbool.h>
+
+typedef struct GzipReader GzipReader;
+
+// Read from `fh` which is not closed by gzip_reader_close()
+GzipReader* gzip_reader_new(FILE *fh, const char *path, size_t nthreads);
+void gzip_reader_close(GzipReader *gr);
+
+// Returns number of bytes read, less than `len` only at the end of the file
+size_t gzip_reader_read(GzipReader *gr, void *ptr, size_t len);
+
+#endif /* GZIP_READER_H_ */
@@ -45,6 +45,10 @@ size_t hash_table_mem_limit(size_t memlimit, size_t entrybits, uint64_t *nkmers_
 
   bktsize = MIN2(bktsize, MAX_BUCKET_SIZE);
 
+  // Tags (if compiled with HASH_TAGS) are not counted above
+  while(bktsize > 1 && ht_mem(bktsize, num_of_buckets, entrybits) > memlimit)
+    bktsize--;
+
   if(nkmers_ptr != NULL) *nkmers_ptr = num_of_buckets * bktsize;
 
   return ht_mem(bktsize,num_of_buckets,entrybits);
@@ -7,10 +7,25 @@
 // bucket size must be <256
 #define MAX_BUCKET_SIZE 48
 
+// Compile with HASH_TAGS=1 to store a one byte fingerprint per entry. The
+// tags for a bucket are padded to a power of two bytes, so with buckets of at
+// most 64 entries a bucket's tags never straddle a cache line.
+static inline size_t ht_tag_stride(size_t bktsize) {
+  #ifdef HASH_TAGS
+    size_t s = 1;
+    while(s < bktsize) s <<= 1;
+    return s;
+  #else
+    (void)bktsize;
+    return 0;
+  #endif
+}
+
 // Hash table capacity is x*(2^y) where x and y are parameters
-// memory is x*(2^y)*sizeof(BinaryKmer) + (2^y) * 2
+// memory is x*(2^y)*sizeof(BinaryKmer) + (2^y) * 2 [+ tags]
 static inline size_t ht_mem(size_t bktsize, size_t nbkts, size_t nbits) {
-  return (bktsize * nbkts * nbits)/8 + (nbkts) * sizeof(uint8_t[2]);
+  return (bktsize * nbkts * nbits)/8 + (nbkts) * sizeof(uint8_t[2]) +
+         nbkts * ht_tag_stride(bktsize);
 }
 
 // Returns capacity of a hash table that holds at least nkmers
@@ -187,6 +187,7 @@ size_t seq_contig_end(const read_t *r, size_t contig_start, size_t kmer_size,
 #define WFLAG_QLEN_MISMATCH 2
 #define WFLAG_QUAL_TOOSMALL 4
 #define WFLAG_QUAL_TOOBIG   8
+#define WFLAG_ALL           15
 
 // Takes, updates and returns warnings that were printed
 // Warnings are only printed once per file
@@ -246,6 +247,25 @@ static uint8_t check_new_read(const read_t *r, uint8_t qmin, uint8_t qmax,
   return warn_flags;
 }
 
+void seq_read_check(const read_t *r, SeqReadCheck *chk)
+{
+  uint8_t flags = chk->warn_flags, newflags;
+  if(flags == WFLAG_ALL) return;
+  newflags = check_new_read(r, chk->qmin, chk->qmax, chk->path, flags);
+  if(newflags != flags) __sync_fetch_and_or(&chk->warn_flags, newflags);
+}
+
+// Reads are checked on this thread if `chk` is NULL, otherwise `chk` is set up
+// for the caller to check reads with seq_read_check()
+static inline void init_read_check(SeqReadCheck *chk, const seq_file_t *sf,
+                                   uint8_t qmin, uint8_t qmax)
+{
+  if(chk == NULL) return;
+  SeqReadCheck tmp = {.qmin = qmin, .qmax = qmax, .warn_flags = 0,
+                      .path = sf->path};
+  memcpy(chk, &tmp, sizeof(SeqReadCheck));
+}
+
 // Load reads into a buffer and use them to guess the quality score offset
 // Returns -1 if no quality scores
 // Defaults to 0 if not recognisable (offset:33, min:33, max:126)
@@ -292,7 +312,7 @@ void seq_parse_interleaved_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
                                                 uint8_t _qoffset1,
                                                 uint8_t _qoffset2,
                                                 void *_ptr),
-                              void *reader_ptr)
+                              void *reader_ptr, SeqReadCheck *chk)
 {
   status("[seq] Reading a (possibly) interleaved file (expect both S.E. & P.E. reads)");
 
@@ -308,6 +328,8 @@ void seq_parse_interleaved_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
     qoffset = (uint8_t)FASTQ_OFFSET[format];
   }
 
+  init_read_check(chk, sf, qmin, qmax);
+
   read_t *r[2] = {r1,r2};
   int ridx = 0, s;
   uint8_t warn_flags = 0;
@@ -315,7 +337,8 @@ void seq_parse_interleaved_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
 
   while((s = seq_read_primary(sf, r[ridx])) > 0)
   {
-    warn_flags = check_new_read(r[ridx], qmin, qmax, sf->path, warn_flags);
+    if(chk == NULL)
+      warn_flags = check_new_read(r[ridx], qmin, qmax, sf->path, warn_flags);
 
     if(ridx)
     {
@@ -356,10 +379,10 @@ void seq_parse_pe_sf(seq_file_t *sf1, seq_file_t *sf2, uint8_t ascii_fq_offset,
                      void (*read_func)(read_t *_r1, read_t *_r2,
                                        uint8_t _qoffset1, uint8_t _qoffset2,
                                        void *_ptr),
-                     void *reader_ptr)
+                     void *reader_ptr, SeqReadCheck chks[2])
 {
   if(sf2 == NULL) {
-    seq_parse_se_sf(sf1, ascii_fq_offset, r1, read_func, reader_ptr);
+    seq_parse_se_sf(sf1, ascii_fq_offset, r1, read_func, reader_ptr, chks);
     return;
   }
 
@@ -385,6 +408,11 @@ void seq_parse_pe_sf(seq_file_t *sf1, seq_file_t *sf2, uint8_t ascii_fq_offset,
     }
   }
 
+  if(chks != NULL) {
+    init_read_check(&chks[0], sf1, qmin1, qmax1);
+    init_read_check(&chks[1], sf2, qmin2, qmax2);
+  }
+
   // warn_flags keeps track of which of the error msgs have been printed
   // (only print each error msg once per file)
   uint8_t warn_flags = 0;
@@ -406,8 +434,10 @@ void seq_parse_pe_sf(seq_file_t *sf1, seq_file_t *sf2, uint8_t ascii_fq_offset,
 
     // PE
     // We don't care about read orientation at this point
-    warn_flags = check_new_read(r1, qmin1, qmax1, sf1->path, warn_flags);
-    warn_flags = check_new_read(r2, qmin2, qmax2, sf2->path, warn_flags);
+    if(chks == NULL) {
+      warn_flags = check_new_read(r1, qmin1, qmax1, sf1->path, warn_flags);
+      warn_flags = check_new_read(r2, qmin2, qmax2, sf2->path, warn_flags);
+    }
     read_func(r1, r2, qoffset1, qoffset2, reader_ptr);
     num_pe_pairs++;
   }
@@ -423,7 +453,7 @@ void seq_parse_se_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
                      void (*read_func)(read_t *r1, read_t *r2,
                                        uint8_t qoffset1, uint8_t qoffset2,
                                        void *ptr),
-                     void *reader_ptr)
+                     void *reader_ptr, SeqReadCheck *chk)
 {
   status("[seq] Parsing sequence file %s", futil_inpath_str(sf->path));
 
@@ -439,6 +469,8 @@ void seq_parse_se_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
     qoffset = (uint8_t)FASTQ_OFFSET[format];
   }
 
+  init_read_check(chk, sf, qmin, qmax);
+
   // warn_flags keeps track of which of the error msgs have been printed
   // (only print each error msg once per file)
   uint8_t warn_flags = 0;
@@ -447,7 +479,8 @@ void seq_parse_se_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
 
   while((s = seq_read_primary(sf, r1)) > 0)
   {
-    warn_flags = check_new_read(r1, qmin, qmax, sf->path, warn_flags);
+    if(chk == NULL)
+      warn_flags = check_new_read(r1, qmin, qmax, sf->path, warn_flags);
     read_func(r1, NULL, qoffset, 0, reader_ptr);
     num_se_reads++;
   }
@@ -471,7 +504,8 @@ void seq_parse_pe(const char *path1, const char *path2, uint8_t ascii_fq_offset,
   seq_file_t *sf1, *sf2;
   if((sf1 = seq_open(path1)) == NULL) die("Cannot open: %s", path1);
   if((sf2 = seq_open(path2)) == NULL) die("Cannot open: %s", path2);
-  seq_parse_pe_sf(sf1, sf2, ascii_fq_offset, r1, r2, read_func, reader_ptr);
+  seq_parse_pe_sf(sf1, sf2, ascii_fq_offset, r1, r2, read_func, reader_ptr,
+                  NULL);
   seq_close(sf1);
   seq_close(sf2);
 }
@@ -485,7 +519,7 @@ void seq_parse_se(const char *path, uint8_t ascii_fq_offset,
 {
   seq_file_t *sf;
   if((sf = seq_open(path)) == NULL) die("Cannot open: %s", path);
-  seq_parse_se_sf(sf, ascii_fq_offset, r1, read_func, reader_ptr);
+  seq_parse_se_sf(sf, ascii_fq_offset, r1, read_func, reader_ptr, NULL);
   seq_close(sf);
 }
 
@@ -44,19 +44,36 @@ size_t seq_contig_end(const read_t *r, size_t contig_start, size_t kmer_size,
                       uint8_t qual_cutoff, uint8_t hp_cutoff,
                       size_t *search_start);
 
+// Quality score range of an input file and which warnings have been printed,
+// for checking reads on a thread other than the one parsing them
+typedef struct
+{
+  uint8_t qmin, qmax;
+  volatile uint8_t warn_flags;
+  const char *path;
+} SeqReadCheck;
+
+// Warn about invalid bases and quality scores, at most once per file.
+// Can be called by many threads.
+void seq_read_check(const read_t *r, SeqReadCheck *chk);
+
+// If the SeqReadCheck argument is NULL, reads are checked before they are
+// passed to `read_func`. Otherwise it is set up (one per file) and the caller
+// should check reads with seq_read_check().
+
 void seq_parse_pe_sf(seq_file_t *sf1, seq_file_t *sf2, uint8_t ascii_fq_offset,
                      read_t *r1, read_t *r2,
                      void (*read_func)(read_t *_r1, read_t *_r2,
                                        uint8_t _qoffset1, uint8_t _qoffset2,
                                        void *_ptr),
-                     void *reader_ptr);
+                     void *reader_ptr, SeqReadCheck chks[2]);
 
 void seq_parse_se_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
                      read_t *r1,
                      void (*read_func)(read_t *_r1, read_t *_r2,
                                        uint8_t _qoffset1, uint8_t _qoffset2,
                                        void *_ptr),
-                     void *reader_ptr);
+                     void *reader_ptr, SeqReadCheck *chk);
 
 void seq_parse_interleaved_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
                               read_t *r1, read_t *r2,
@@ -64,7 +81,7 @@ void seq_parse_interleaved_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
                                                 uint8_t _qoffset1,
                                                 uint8_t _qoffset2,
                                                 void *_ptr),
-                              void *reader_ptr);
+                              void *reader_ptr, SeqReadCheck *chk);
 
 void seq_parse_pe(const char *path1, const char *path2, uint8_t ascii_fq_offset,
                   read_t *r1, read_t *r2,
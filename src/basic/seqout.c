@@ -18,11 +18,11 @@ static char* _seqout_alloc_path(char *out_base, int pe, const char *suffix)
   return path;
 }
 
-// Returns gzFile or NULL if file already exists and !futil_get_force()
+// Returns BgzfWriter or NULL if file already exists and !futil_get_force()
 // Creates directories as required
-static gzFile _seqout_open(const char *path)
+static BgzfWriter* _seqout_open(const char *path, size_t nthreads)
 {
-  gzFile gzout;
+  FILE *fout;
 
   int fd = futil_create_file(path, O_CREAT | O_EXCL | O_WRONLY);
   if(fd == -1) {
@@ -31,24 +31,20 @@ static gzFile _seqout_open(const char *path)
     return NULL;
   }
 
-  if((gzout = gzdopen(fd, "w")) == NULL) {
+  if((fout = fdopen(fd, "w")) == NULL) {
     warn("Cannot open %s", path);
     close(fd);
     return NULL;
   }
 
-  // Set buffer size
-  #if ZLIB_VERNUM >= 0x1240
-    gzbuffer(gzout, DEFAULT_IO_BUFSIZE);
-  #endif
-
-  return gzout;
+  return bgzf_writer_new(fout, path, nthreads);
 }
 
 // Returns true on success, false on failure
 // fmt may be: SEQ_FMT_FASTQ, SEQ_FMT_FASTA, SEQ_FMT_PLAIN
 // file extensions are: <O>.fq.gz, <O>.fa.gz, <O>.txt.gz
-bool seqout_open(SeqOutput *seqout, char *out_base, seq_format fmt, bool is_pe)
+bool seqout_open(SeqOutput *seqout, char *out_base, seq_format fmt, bool is_pe,
+                 size_t nthreads)
 {
   memset(seqout, 0, sizeof(SeqOutput));
 
@@ -63,19 +59,29 @@ bool seqout_open(SeqOutput *seqout, char *out_base, seq_format fmt, bool is_pe)
     default: die("Invalid format: %i", (int)fmt);
   }
 
+  if(pthread_mutex_init(&seqout->lock_se, NULL) != 0) die("Mutex init failed");
+  if(pthread_mutex_init(&seqout->lock_pe, NULL) != 0) die("Mutex init failed");
+  if(pthread_mutex_init(&seqout->lock_order, NULL) != 0) die("Mutex init failed");
+
+  strbuf_alloc(&seqout->buf_se, 1024);
+  strbuf_alloc(&seqout->buf_pe[0], 1024);
+  strbuf_alloc(&seqout->buf_pe[1], 1024);
+
+  // Share compression threads between output files, left over threads go to
+  // the single ended file
+  size_t pe_threads = is_pe ? MAX2(nthreads/3, 1) : 0;
+  size_t se_threads = MAX2(nthreads - MIN2(2*pe_threads, nthreads), 1);
+
   seqout->path_se = _seqout_alloc_path(out_base, 0, ext);
-  if((seqout->gzout_se = _seqout_open(seqout->path_se)) == NULL) return false;
+  if((seqout->out_se = _seqout_open(seqout->path_se, se_threads)) == NULL) return false;
 
   if(is_pe) {
     seqout->path_pe[0] = _seqout_alloc_path(out_base, 1, ext);
     seqout->path_pe[1] = _seqout_alloc_path(out_base, 2, ext);
-    if((seqout->gzout_pe[0] = _seqout_open(seqout->path_pe[0])) == NULL) return false;
-    if((seqout->gzout_pe[1] = _seqout_open(seqout->path_pe[1])) == NULL) return false;
+    if((seqout->out_pe[0] = _seqout_open(seqout->path_pe[0], pe_threads)) == NULL) return false;
+    if((seqout->out_pe[1] = _seqout_open(seqout->path_pe[1], pe_threads)) == NULL) return false;
   }
 
-  if(pthread_mutex_init(&seqout->lock_se, NULL) != 0) die("Mutex init failed");
-  if(pthread_mutex_init(&seqout->lock_pe, NULL) != 0) die("Mutex init failed");
-
   return true;
 }
 
@@ -83,23 +89,36 @@ bool seqout_open(SeqOutput *seqout, char *out_base, seq_format fmt, bool is_pe)
 // @rm if true, delete files as well
 void seqout_close(SeqOutput *seqout, bool rm)
 {
+  size_t i;
+
   // Clean up seqout
-  if(seqout->gzout_se != NULL) { gzclose(seqout->gzout_se); }
-  if(seqout->gzout_pe[0] != NULL) { gzclose(seqout->gzout_pe[0]); }
-  if(seqout->gzout_pe[1] != NULL) { gzclose(seqout->gzout_pe[1]); }
+  if(seqout->out_se != NULL) { bgzf_writer_close(seqout->out_se); }
+  if(seqout->out_pe[0] != NULL) { bgzf_writer_close(seqout->out_pe[0]); }
+  if(seqout->out_pe[1] != NULL) { bgzf_writer_close(seqout->out_pe[1]); }
   if(rm) {
-    if(seqout->gzout_se != NULL && unlink(seqout->path_se) != 0)
+    if(seqout->out_se != NULL && unlink(seqout->path_se) != 0)
       warn("Cannot delete file %s", seqout->path_se);
-    if(seqout->gzout_pe[0] != NULL && unlink(seqout->path_pe[0]) != 0)
+    if(seqout->out_pe[0] != NULL && unlink(seqout->path_pe[0]) != 0)
       warn("Cannot delete file %s", seqout->path_pe[0]);
-    if(seqout->gzout_pe[1] != NULL && unlink(seqout->path_pe[1]) != 0)
+    if(seqout->out_pe[1] != NULL && unlink(seqout->path_pe[1]) != 0)
       warn("Cannot delete file %s", seqout->path_pe[1]);
   }
   ctx_free(seqout->path_se);
   ctx_free(seqout->path_pe[0]);
   ctx_free(seqout->path_pe[1]);
+  strbuf_dealloc(&seqout->buf_se);
+  strbuf_dealloc(&seqout->buf_pe[0]);
+  strbuf_dealloc(&seqout->buf_pe[1]);
+  for(i = 0; i < seqout->npending; i++) {
+    ctx_assert2(!seqout->pending[i].ready, "Read %zu never written",
+                seqout->next_idx);
+    strbuf_dealloc(&seqout->pending[i].buf1);
+    strbuf_dealloc(&seqout->pending[i].buf2);
+  }
+  ctx_free(seqout->pending);
   pthread_mutex_destroy(&seqout->lock_se);
   pthread_mutex_destroy(&seqout->lock_pe);
+  pthread_mutex_destroy(&seqout->lock_order);
   memset(seqout, 0, sizeof(SeqOutput));
 }
 
@@ -107,12 +126,99 @@ void seqout_print(SeqOutput *seqout, const read_t *r1, const read_t *r2)
 {
   if(r2 == NULL) {
     pthread_mutex_lock(&seqout->lock_se);
-    seqout_gzprint_read(r1, seqout->fmt, seqout->gzout_se);
+    strbuf_reset(&seqout->buf_se);
+    seqout_sbuf_read(r1, seqout->fmt, &seqout->buf_se);
+    bgzf_writer_write(seqout->out_se, seqout->buf_se.b, seqout->buf_se.end);
     pthread_mutex_unlock(&seqout->lock_se);
   } else {
     pthread_mutex_lock(&seqout->lock_pe);
-    seqout_gzprint_read(r1, seqout->fmt, seqout->gzout_pe[0]);
-    seqout_gzprint_read(r2, seqout->fmt, seqout->gzout_pe[1]);
+    strbuf_reset(&seqout->buf_pe[0]);
+    strbuf_reset(&seqout->buf_pe[1]);
+    seqout_sbuf_read(r1, seqout->fmt, &seqout->buf_pe[0]);
+    seqout_sbuf_read(r2, seqout->fmt, &seqout->buf_pe[1]);
+    bgzf_writer_write(seqout->out_pe[0], seqout->buf_pe[0].b, seqout->buf_pe[0].end);
+    bgzf_writer_write(seqout->out_pe[1], seqout->buf_pe[1].b, seqout->buf_pe[1].end);
     pthread_mutex_unlock(&seqout->lock_pe);
   }
 }
+
+static void _seqout_write(SeqOutput *seqout,
+                          const StrBuf *sbuf1, const StrBuf *sbuf2)
+{
+  if(sbuf2 == NULL) {
+    bgzf_writer_write(seqout->out_se, sbuf1->b, sbuf1->end);
+  } else {
+    bgzf_writer_write(seqout->out_pe[0], sbuf1->b, sbuf1->end);
+    bgzf_writer_write(seqout->out_pe[1], sbuf2->b, sbuf2->end);
+  }
+}
+
+// Grow ring buffer of pending reads to hold at least `n` reads
+static void _seqout_pending_grow(SeqOutput *seqout, size_t n)
+{
+  size_t i, oldn = seqout->npending, newn = MAX2(oldn*2, 64);
+  while(newn < n) newn *= 2;
+
+  SeqOutPending *old = seqout->pending, *p;
+  seqout->pending = ctx_calloc(newn, sizeof(SeqOutPending));
+  seqout->npending = newn;
+
+  for(i = 0; i < oldn; i++) {
+    if(old[i].ready) {
+      p = &seqout->pending[old[i].idx % newn];
+      memcpy(p, &old[i], sizeof(SeqOutPending));
+    } else {
+      strbuf_dealloc(&old[i].buf1);
+      strbuf_dealloc(&old[i].buf2);
+    }
+  }
+
+  ctx_free(old);
+}
+
+void seqout_print_ordered(SeqOutput *seqout, size_t idx,
+                          const StrBuf *sbuf1, const StrBuf *sbuf2)
+{
+  SeqOutPending *p;
+
+  pthread_mutex_lock(&seqout->lock_order);
+
+  ctx_assert2(idx >= seqout->next_idx, "Read written twice: %zu", idx);
+
+  if(idx == seqout->next_idx)
+  {
+    _seqout_write(seqout, sbuf1, sbuf2);
+    seqout->next_idx++;
+
+    // Write reads that were waiting for this one
+    while(seqout->npending > 0 &&
+          (p = &seqout->pending[seqout->next_idx % seqout->npending])->ready)
+    {
+      _seqout_write(seqout, &p->buf1, p->is_pe ? &p->buf2 : NULL);
+      p->ready = false;
+      seqout->next_idx++;
+    }
+  }
+  else
+  {
+    // Copy read until earlier reads have been written
+    if(idx - seqout->next_idx >= seqout->npending)
+      _seqout_pending_grow(seqout, idx - seqout->next_idx + 1);
+
+    p = &seqout->pending[idx % seqout->npending];
+    ctx_assert(!p->ready);
+    p->idx = idx;
+    p->ready = true;
+    p->is_pe = (sbuf2 != NULL);
+    if(p->buf1.b == NULL) strbuf_alloc(&p->buf1, sbuf1->end+1);
+    if(p->buf2.b == NULL) strbuf_alloc(&p->buf2, sbuf2 ? sbuf2->end+1 : 64);
+    strbuf_reset(&p->buf1);
+    strbuf_append_strn(&p->buf1, sbuf1->b, sbuf1->end);
+    if(sbuf2 != NULL) {
+      strbuf_reset(&p->buf2);
+      strbuf_append_strn(&p->buf2, sbuf2->b, sbuf2->end);
+    }
+  }
+
+  pthread_mutex_unlock(&seqout->lock_order);
+}
@@ -9,41 +9,86 @@
 //   <out>.1.fa.gz
 //   <out>.2.fa.gz
 //
+// Output is written with a BgzfWriter, so files are compressed with multiple
+// threads and can be read as normal gzip files.
+//
 
 #include "seq_file/seq_file.h"
+#include "bgzf_writer.h"
+
+// A formatted read (pair) waiting for earlier reads to be written
+typedef struct {
+  size_t idx;
+  bool ready, is_pe;
+  StrBuf buf1, buf2;
+} SeqOutPending;
 
 typedef struct {
   char *path_se, *path_pe[2];
-  gzFile gzout_se, gzout_pe[2];
+  BgzfWriter *out_se, *out_pe[2];
   pthread_mutex_t lock_se, lock_pe;
+  StrBuf buf_se, buf_pe[2]; // used by seqout_print()
   bool is_pe; // if we have X.{1,2}.fq.gz as well as X.fq.gz
   seq_format fmt; // output format
+
+  // For seqout_print_ordered()
+  pthread_mutex_t lock_order;
+  size_t next_idx; // next read (pair) to be written
+  SeqOutPending *pending; // ring buffer, pending[i % npending]
+  size_t npending;
 } SeqOutput;
 
 // Returns true on success, false on failure
 // fmt may be: SEQ_FMT_FASTQ, SEQ_FMT_FASTA, SEQ_FMT_PLAIN
 // file extensions are: <O>.fq.gz, <O>.fa.gz, <O>.txt.gz
-bool seqout_open(SeqOutput *seqout, char *out_base, seq_format fmt, bool is_pe);
+// `nthreads` compression threads are shared between the output files
+bool seqout_open(SeqOutput *seqout, char *out_base, seq_format fmt, bool is_pe,
+                 size_t nthreads);
 
 // Free memory
 // @rm if true, delete files as well
 void seqout_close(SeqOutput *output, bool rm);
 
+// Thread safe, reads are written in the order this is called
 void seqout_print(SeqOutput *output, const read_t *r1, const read_t *r2);
 
-static inline void seqout_gzprint_read(const read_t *r, seq_format fmt, gzFile gzout)
+// Write formatted read (pair) number `idx`. Reads are written in order of
+// `idx`, every idx from zero must be passed exactly once. Threads never wait for
+// earlier reads, instead the read is copied until they arrive.
+// `sbuf2` is NULL for a single ended read.
+void seqout_print_ordered(SeqOutput *output, size_t idx,
+                          const StrBuf *sbuf1, const StrBuf *sbuf2);
+
+// Append a read to a string buffer in the given format
+static inline void seqout_sbuf_read(const read_t *r, seq_format fmt,
+                                    StrBuf *sbuf)
 {
-  int ret = 0;
+  size_t qlen;
   switch(fmt) {
     case SEQ_FMT_PLAIN:
-      if(gzwrite(gzout, (r)->seq.b, (r)->seq.end) != (int)(r)->seq.end ||
-         gzputc(gzout, '\n') != '\n') ret = -1;
+      strbuf_append_strn(sbuf, r->seq.b, r->seq.end);
+      strbuf_append_char(sbuf, '\n');
+      break;
+    case SEQ_FMT_FASTA:
+      strbuf_append_char(sbuf, '>');
+      strbuf_append_strn(sbuf, r->name.b, r->name.end);
+      strbuf_append_char(sbuf, '\n');
+      strbuf_append_strn(sbuf, r->seq.b, r->seq.end);
+      strbuf_append_char(sbuf, '\n');
+      break;
+    case SEQ_FMT_FASTQ:
+      strbuf_append_char(sbuf, '@');
+      strbuf_append_strn(sbuf, r->name.b, r->name.end);
+      strbuf_append_char(sbuf, '\n');
+      strbuf_append_strn(sbuf, r->seq.b, r->seq.end);
+      strbuf_append_str(sbuf, "\n+\n");
+      qlen = MIN2(r->qual.end, r->seq.end);
+      strbuf_append_strn(sbuf, r->qual.b, qlen);
+      strbuf_append_charn(sbuf, '.', r->seq.end - qlen);
+      strbuf_append_char(sbuf, '\n');
       break;
-    case SEQ_FMT_FASTA: ret = seq_gzprint_fasta(r, gzout, 0); break;
-    case SEQ_FMT_FASTQ: ret = seq_gzprint_fastq(r, gzout, 0); break;
     default: die("Invalid output format: %i", fmt);
   }
-  if(ret == -1) die("Cannot write sequence");
 }
 
 static inline void seqout_print_read(const read_t *r, seq_format fmt, FILE *fout)
@@ -0,0 +1,140 @@
+#include "global.h"
+#include "work_steal.h"
+#include "util.h"
+
+#define ws_pack(first,end) (((uint64_t)(first) << 32) | (uint64_t)(end))
+#define ws_first(run) ((size_t)((run) >> 32))
+#define ws_end(run) ((size_t)((run) & 0xffffffff))
+
+void work_steal_alloc_chunks(WorkSteal *ws, size_t nitems, size_t nthreads,
+                             size_t chunksize)
+{
+  ctx_assert(nthreads > 0);
+  ctx_assert(chunksize > 0);
+  size_t i, nchunks = (nitems + chunksize - 1) / chunksize;
+  ctx_assert2(nchunks < (1UL<<32), "Too many chunks: %zu", nchunks);
+
+  WorkSteal tmp = {.nitems = nitems, .nthreads = nthreads,
+                   .chunksize = chunksize, .nchunks = nchunks,
+                   .runs = ctx_calloc(nthreads, sizeof(WorkStealRun))};
+  memcpy(ws, &tmp, sizeof(tmp));
+
+  // Start with the same slices as a static split
+  for(i = 0; i < nthreads; i++)
+    ws->runs[i].run = ws_pack((nchunks*i)/nthreads, (nchunks*(i+1))/nthreads);
+
+  gettimeofday(&ws->start, NULL);
+}
+
+void work_steal_alloc(WorkSteal *ws, size_t nitems, size_t nthreads,
+                      size_t chunks_per_thread)
+{
+  ctx_assert(nthreads > 0);
+  size_t chunksize = nitems / (nthreads * MAX2(chunks_per_thread, 1));
+  chunksize = MAX2(chunksize, WORK_STEAL_MIN_CHUNK);
+  work_steal_alloc_chunks(ws, nitems, nthreads, chunksize);
+}
+
+void work_steal_dealloc(WorkSteal *ws)
+{
+  ctx_free(ws->runs);
+  memset(ws, 0, sizeof(*ws));
+}
+
+// Take the first chunk from a thread's own run
+static inline bool ws_take_own(WorkStealRun *r, size_t *chunk)
+{
+  uint64_t run;
+  while(1) {
+    run = r->run;
+    if(ws_first(run) >= ws_end(run)) return false;
+    if(__sync_bool_compare_and_swap(&r->run, run,
+                                    ws_pack(ws_first(run)+1, ws_end(run)))) {
+      *chunk = ws_first(run);
+      return true;
+    }
+  }
+}
+
+// Steal the back half of the largest run left. Keep the first chunk stolen
+// and put the rest in our own (empty) run.
+static inline bool ws_steal(WorkSteal *ws, size_t threadid, size_t *chunk)
+{
+  size_t i, n, best, bestn, first, end, nsteal;
+  uint64_t run;
+
+  while(1)
+  {
+    for(i = best = bestn = 0; i < ws->nthreads; i++) {
+      run = ws->runs[i].run;
+      first = ws_first(run); end = ws_end(run);
+      n = first < end ? end - first : 0;
+      if(n > bestn) { best = i; bestn = n; }
+    }
+
+    if(bestn == 0) return false; // no work left
+
+    run = ws->runs[best].run;
+    first = ws_first(run); end = ws_end(run);
+    if(first >= end) continue;
+    nsteal = (end - first + 1) / 2;
+
+    if(__sync_bool_compare_and_swap(&ws->runs[best].run, run,
+                                    ws_pack(first, end-nsteal))) {
+      *chunk = end-nsteal;
+      __sync_lock_test_and_set(&ws->runs[threadid].run,
+                               ws_pack(end-nsteal+1, end));
+      ws->runs[threadid].nstolen += nsteal;
+      return true;
+    }
+  }
+}
+
+bool work_steal_next(WorkSteal *ws, size_t threadid,
+                     size_t *start, size_t *end)
+{
+  size_t chunk;
+  WorkStealRun *r = &ws->runs[threadid];
+  if(!ws_take_own(r, &chunk) && !ws_steal(ws, threadid, &chunk)) return false;
+  r->nchunks++;
+  *start = chunk * ws->chunksize;
+  *end = MIN2(*start + ws->chunksize, ws->nitems);
+  return true;
+}
+
+void work_steal_thread_done(WorkSteal *ws, size_t threadid)
+{
+  gettimeofday(&ws->runs[threadid].finish, NULL);
+}
+
+static inline double ws_secs(struct timeval a, struct timeval b)
+{
+  return (b.tv_sec - a.tv_sec) + (b.tv_usec - a.tv_usec) / 1000000.0;
+}
+
+void work_steal_print_stats(const WorkSteal *ws, const char *name)
+{
+  size_t i, nstolen = 0;
+  double busy, idle, max_idle = 0, total;
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  total = ws_secs(ws->start, now);
+
+  StrBuf sbuf;
+  strbuf_alloc(&sbuf, 256);
+
+  for(i = 0; i < ws->nthreads; i++) {
+    busy = ws_secs(ws->start, ws->runs[i].finish);
+    idle = MAX2(total - busy, 0);
+    max_idle = MAX2(max_idle, idle);
+    nstolen += ws->runs[i].nstolen;
+    strbuf_sprintf(&sbuf, " %.2f/%.2f", busy, idle);
+  }
+
+  status("[%s] %zu thread%s, %zu chunks of %zu, %zu stolen, %.2f secs "
+         "(max idle %.2f)", name, ws->nthreads, util_plural_str(ws->nthreads),
+         ws->nchunks, ws->chunksize, nstolen, total, max_idle);
+  status("[%s]   busy/idle secs per thread:%s", name, sbuf.b);
+
+  strbuf_dealloc(&sbuf);
+}
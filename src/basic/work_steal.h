@@ -0,0 +1,73 @@
+#ifndef WORK_STEAL_H_
+#define WORK_STEAL_H_
+
+#include <sys/time.h> // struct timeval
+
+//
+// Work-stealing scheduler for splitting a range [0,nitems) between threads
+//
+// The range is split into small chunks. Each thread starts with a contiguous
+// run of chunks (the same slice a static split would give it) and takes
+// chunks from the front of its own run. A thread that runs out steals the
+// back half of the largest remaining run from another thread. Each run is a
+// single 64 bit word [first,end) updated with compare-and-swap, so there are
+// no locks.
+//
+// Usage:
+//   WorkSteal ws;
+//   work_steal_alloc(&ws, nitems, nthreads, WORK_STEAL_CHUNKS_PER_THREAD);
+//   // in each thread:
+//   size_t start, end;
+//   while(work_steal_next(&ws, threadid, &start, &end)) { ... }
+//   work_steal_thread_done(&ws, threadid);
+//   // after all threads have finished:
+//   work_steal_print_stats(&ws, "clean");
+//   work_steal_dealloc(&ws);
+//
+
+// Default number of chunks to split each thread's share into
+#define WORK_STEAL_CHUNKS_PER_THREAD 64
+
+// Don't use chunks smaller than this
+#define WORK_STEAL_MIN_CHUNK 1024
+
+typedef struct
+{
+  volatile uint64_t run; // chunks [run>>32, run&0xffffffff) left to do
+  size_t nchunks, nstolen; // chunks processed, chunks stolen from others
+  struct timeval finish; // time thread ran out of work
+  char pad[64]; // avoid false sharing between threads
+} WorkStealRun;
+
+typedef struct
+{
+  size_t nitems, nthreads, chunksize, nchunks;
+  WorkStealRun *runs; // one per thread
+  struct timeval start;
+} WorkSteal;
+
+// Split nitems into about nthreads*chunks_per_thread chunks, each at least
+// WORK_STEAL_MIN_CHUNK items
+void work_steal_alloc(WorkSteal *ws, size_t nitems, size_t nthreads,
+                      size_t chunks_per_thread);
+
+// Use chunks of `chunksize` items, for when each item is a lot of work
+void work_steal_alloc_chunks(WorkSteal *ws, size_t nitems, size_t nthreads,
+                             size_t chunksize);
+
+void work_steal_dealloc(WorkSteal *ws);
+
+// Get the next range [*start,*end) for thread `threadid` to process
+// Returns false once there is no work left anywhere
+bool work_steal_next(WorkSteal *ws, size_t threadid,
+                     size_t *start, size_t *end);
+
+// Record that a thread has finished (i.e. work_steal_next returned false or
+// the thread stopped early)
+void work_steal_thread_done(WorkSteal *ws, size_t threadid);
+
+// Print busy and idle time for each thread, call once all threads have
+// finished
+void work_steal_print_stats(const WorkSteal *ws, const char *name);
+
+#endif /* WORK_STEAL_H_ */
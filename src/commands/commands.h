@@ -13,6 +13,7 @@ int ctx_correct(int argc, char **argv);
 int ctx_coverage(int argc, char **argv);
 int ctx_rmsubstr(int argc, char **argv);
 int ctx_breakpoints(int argc, char **argv);
+int ctx_refindex(int argc, char **argv);
 int ctx_bubbles(int argc, char **argv);
 int ctx_view(int argc, char **argv);
 int ctx_pview(int argc, char **argv);
@@ -55,6 +56,7 @@ extern const char pjoin_usage[];
 extern const char bubbles_usage[];
 extern const char correct_usage[];
 extern const char breakpoints_usage[];
+extern const char refindex_usage[];
 extern const char coverage_usage[];
 extern const char rmsubstr_usage[];
 extern const char calls2vcf_usage[];
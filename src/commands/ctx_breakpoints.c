@@ -15,6 +15,7 @@ const char breakpoints_usage[] =
 "\n"
 "  Use trusted assembled genome to call large events.  Output is gzipped.\n"
 "  Memory (bytes) is roughly: num_kmers*(8+8+1) + num_ref_kmers*8 + links_mem\n"
+"  Reference kmers can be loaded from an index built with `"CMD" refindex`.\n"
 "\n"
 "  -h, --help              This help message\n"
 "  -q, --quiet             Silence status output normally printed to STDERR\n"
@@ -25,6 +26,7 @@ const char breakpoints_usage[] =
 "  -p, --paths <in.ctp>    Load link file (can specify multiple times)\n"
 "  -o, --out <out.txt.gz>  Save calls (gzipped output) [default: STDOUT]\n"
 "  -s, --seq <in>          Trusted input (can specify multiple times)\n"
+"  -I, --index <ref.idx>   Load trusted input from a reference index\n"
 "  -r, --minref <N>        Require <N> kmers at ref breakpoint [default: "QUOTE_VALUE(DEFAULT_MIN_REF_NKMERS)"]\n"
 "  -R, --maxref <N>        Stop after <N> kmers at ref breakpoint [default: "QUOTE_VALUE(DEFAULT_MAX_REF_NKMERS)"]\n"
 "  -E, --no-ref-edges      Don't load edges from the reference\n"
@@ -43,6 +45,7 @@ static struct option longopts[] =
 // command specific
   {"seq",          required_argument, NULL, '1'},
   {"seq",          required_argument, NULL, 's'},
+  {"index",        required_argument, NULL, 'I'},
   {"minref",       required_argument, NULL, 'r'},
   {"maxref",       required_argument, NULL, 'R'},
   {"no-ref-edges", no_argument,       NULL, 'E'},
@@ -53,7 +56,7 @@ int ctx_breakpoints(int argc, char **argv)
 {
   size_t nthreads = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
-  const char *output_file = NULL;
+  const char *output_file = NULL, *index_path = NULL;
   size_t min_ref_flank = 0, max_ref_flank = 0;
   bool load_ref_edges = true; // by default load kmers and edges
 
@@ -96,6 +99,7 @@ int ctx_breakpoints(int argc, char **argv)
           die("Cannot read --seq file %s", optarg);
         seq_file_ptr_buf_add(&sfilebuf, tmp_sfile);
         break;
+      case 'I': cmd_check(!index_path, cmd); index_path = optarg; break;
       case 'E': cmd_check(load_ref_edges,cmd); load_ref_edges = false; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
@@ -110,7 +114,10 @@ int ctx_breakpoints(int argc, char **argv)
   if(min_ref_flank == 0) min_ref_flank = DEFAULT_MIN_REF_NKMERS;
   if(max_ref_flank == 0) max_ref_flank = DEFAULT_MAX_REF_NKMERS;
 
-  if(sfilebuf.len == 0) cmd_print_usage("Require at least one --seq file");
+  if(sfilebuf.len == 0 && !index_path)
+    cmd_print_usage("Require at least one --seq file or an --index");
+  if(sfilebuf.len > 0 && index_path)
+    cmd_print_usage("Cannot use both --seq and --index");
   if(optind == argc) cmd_print_usage("Require input graph files (.ctx)");
 
   //
@@ -129,13 +136,26 @@ int ctx_breakpoints(int argc, char **argv)
   graphs_gpaths_compatible(gfiles, num_gfiles, gpfiles.b, gpfiles.len, -1);
 
   //
-  // Get file sizes of sequence files
+  // Get file sizes of sequence files, or number of kmers in the index
   //
-  // set to -1 if we cannot calc
-  int64_t est_num_bases = seq_est_seq_bases(sfilebuf.b, sfilebuf.len);
-  if(est_num_bases < 0) {
-    warn("Cannot get file sizes, using pipes");
-    est_num_bases = memargs.num_kmers;
+  int64_t est_num_bases;
+  KOGraphIndexHdr idxhdr;
+
+  if(index_path) {
+    kograph_index_read_hdr(index_path, &idxhdr);
+    if(idxhdr.kmer_size != gfiles[0].hdr.kmer_size) {
+      cmd_print_usage("Reference index kmer_size doesn't match [%u vs %u]: %s",
+                      idxhdr.kmer_size, gfiles[0].hdr.kmer_size, index_path);
+    }
+    est_num_bases = idxhdr.nkmers;
+  }
+  else {
+    // set to -1 if we cannot calc
+    est_num_bases = seq_est_seq_bases(sfilebuf.b, sfilebuf.len);
+    if(est_num_bases < 0) {
+      warn("Cannot get file sizes, using pipes");
+      est_num_bases = memargs.num_kmers;
+    }
   }
 
   //
@@ -149,11 +169,14 @@ int ctx_breakpoints(int argc, char **argv)
   // TODO: use threads in memory calculation
 
   // kmer memory = Edges + paths + 1 bit per colour for in-colour
+  // Occurrences loaded from an index are memory mapped rather than allocated
   bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(Edges)*8 +
                   (gpfiles.len > 0 ? sizeof(GPath*)*8 : 0) +
                   ncols +
-                  sizeof(KONodeList) + sizeof(KOccur) + // see kmer_occur.h
-                  8; // 1 byte per kmer for each base to load sequence files
+                  sizeof(KONodeList) + // see kmer_occur.h
+                  (index_path ? 0
+                              : sizeof(KOccur) +
+                                8); // 1 byte per kmer for each base to load sequence files
 
   // For k=31, 8+1+12+8+1=30 bytes per kmer, could be 8+1+8+8=26
   // for human ~3 billion kmers, hash table load factor of 0.75
@@ -186,7 +209,8 @@ int ctx_breakpoints(int argc, char **argv)
   //
   // Open output file
   //
-  gzFile gzout = futil_gzopen_create(output_file != NULL ? output_file : "-", "w");
+  BgzfWriter *out = bgzf_writer_open(output_file != NULL ? output_file : "-",
+                                     nthreads);
 
   //
   // Set up memory
@@ -205,6 +229,7 @@ int ctx_breakpoints(int argc, char **argv)
   // Load graphs
   //
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
   gprefs.empty_colours = true;
 
   for(i = 0; i < num_gfiles; i++) {
@@ -221,28 +246,43 @@ int ctx_breakpoints(int argc, char **argv)
 
   // Load link files
   for(i = 0; i < gpfiles.len; i++)
-    gpath_reader_load(&gpfiles.b[i], true, &db_graph);
+    gpath_reader_load_mt(&gpfiles.b[i], true, nthreads, &db_graph);
 
   // Get array of sequence file paths
-  size_t num_seq_paths = sfilebuf.len;
+  size_t num_seq_paths = index_path ? 1 : sfilebuf.len;
   char **seq_paths = ctx_calloc(num_seq_paths, sizeof(char*));
-  for(i = 0; i < num_seq_paths; i++)
+  for(i = 0; i < sfilebuf.len; i++)
     seq_paths[i] = strdup(sfilebuf.b[i]->path);
+  if(index_path) seq_paths[0] = strdup(index_path);
 
   //
-  // Load reference sequence into a read buffer
+  // Load reference kmers into the last colour
   //
-  ReadBuffer rbuf;
-  read_buf_alloc(&rbuf, 1024);
-  seq_load_all_reads(sfilebuf.b, sfilebuf.len, &rbuf);
-
-  // Remove commas and colons from read names so we can print:
-  //   chr1:start1-end1,chr2:start2-end2...
-  for(i = 0; i < rbuf.len; i++) {
-    read_t *r = &rbuf.b[i];
-    seq_read_truncate_name(r); // strip fast[aq] comments (after whitespace)
-    string_char_replace(r->name.b, ',', '.'); // change , -> . in read name
-    string_char_replace(r->name.b, ':', ';'); // change : -> ; in read name
+  KOGraph kograph;
+
+  if(index_path) {
+    kograph = kograph_load(index_path, load_ref_edges, ncols-1,
+                           nthreads, &db_graph);
+  }
+  else {
+    // Load reference sequence into a read buffer
+    ReadBuffer rbuf;
+    read_buf_alloc(&rbuf, 1024);
+    seq_load_all_reads(sfilebuf.b, sfilebuf.len, &rbuf);
+    kograph_clean_read_names(rbuf.b, rbuf.len);
+
+    // Temporarily hide edges from kograph_create if we don't want to load edges
+    Edges *tmp_edges = db_graph.col_edges;
+    if(!load_ref_edges) db_graph.col_edges = NULL;
+
+    kograph = kograph_create(rbuf.b, rbuf.len, true, ncols-1,
+                             nthreads, &db_graph);
+
+    // Restore graph edges
+    db_graph.col_edges = tmp_edges;
+
+    for(i = 0; i < rbuf.len; i++) seq_read_dealloc(&rbuf.b[i]);
+    read_buf_dealloc(&rbuf);
   }
 
   // Create array of cJSON** from input files
@@ -251,15 +291,17 @@ int ctx_breakpoints(int argc, char **argv)
 
   // Call breakpoints. Put reference in last colour
   breakpoints_call(nthreads, ncols-1,
-                   gzout, output_file,
-                   rbuf.b, rbuf.len,
+                   out, output_file,
+                   &kograph,
                    seq_paths, num_seq_paths,
                    load_ref_edges, min_ref_flank, max_ref_flank,
                    hdrs, gpfiles.len,
                    &db_graph);
 
+  kograph_dealloc(&kograph);
+
   // Finished: do clean up
-  gzclose(gzout);
+  bgzf_writer_close(out);
   ctx_free(hdrs);
 
   // Close input files
@@ -267,9 +309,6 @@ int ctx_breakpoints(int argc, char **argv)
     gpath_reader_close(&gpfiles.b[i]);
   gpfile_buf_dealloc(&gpfiles);
 
-  for(i = 0; i < rbuf.len; i++) seq_read_dealloc(&rbuf.b[i]);
-  read_buf_dealloc(&rbuf);
-
   seq_file_ptr_buf_dealloc(&sfilebuf);
 
   for(i = 0; i < num_seq_paths; i++) free(seq_paths[i]);
@@ -8,6 +8,7 @@
 #include "gpath_reader.h"
 #include "gpath_checks.h"
 #include "bubble_caller.h"
+#include "compact_graph.h"
 
 // Long flanks help us map calls
 // increasing allele length can be costly
@@ -34,6 +35,7 @@ const char bubbles_usage[] =
 "  -A, --max-allele <len>  Max bubble branch length in kmers [default: "QUOTE_VALUE(DEFAULT_MAX_ALLELE)"]\n"
 "  -F, --max-flank <len>   Max flank length in kmers [default: "QUOTE_VALUE(DEFAULT_MAX_FLANK)"]\n"
 "  -S, --keep-serial       Keep serial bubbles. Use if mapping is hard. Higher FP.\n"
+"  -U, --unitigs <in.ctu>  Load compacted unitigs saved by `"CMD" unitigs --compact`\n"
 "\n"
 "  When loading link files with -p, use offset (e.g. 2:in.ctp) to specify\n"
 "  which colour to load the data into.\n"
@@ -54,6 +56,7 @@ static struct option longopts[] =
   {"max-allele",   required_argument, NULL, 'A'},
   {"max-flank",    required_argument, NULL, 'F'},
   {"keep-serial",  required_argument, NULL, 'S'},
+  {"unitigs",      required_argument, NULL, 'U'},
   {NULL, 0, NULL, 0}
 };
 
@@ -61,7 +64,7 @@ int ctx_bubbles(int argc, char **argv)
 {
   size_t nthreads = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
-  const char *out_path = NULL;
+  const char *out_path = NULL, *unitigs_path = NULL;
   size_t max_allele_len = 0, max_flank_len = 0;
   bool remove_serial_bubbles = true;
 
@@ -102,6 +105,7 @@ int ctx_bubbles(int argc, char **argv)
       case 'A': cmd_check(!max_allele_len, cmd); max_allele_len = cmd_uint32_nonzero(cmd, optarg); break;
       case 'F': cmd_check(!max_flank_len, cmd); max_flank_len = cmd_uint32_nonzero(cmd, optarg); break;
       case 'S': cmd_check(remove_serial_bubbles,cmd); remove_serial_bubbles = false; break;
+      case 'U': cmd_check(!unitigs_path, cmd); unitigs_path = optarg; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -150,13 +154,19 @@ int ctx_bubbles(int argc, char **argv)
   // Decide on memory
   //
   size_t bits_per_kmer, kmers_in_hash, graph_mem, path_mem, thread_mem;
+  size_t cgraph_bits, cgraph_mem;
   char thread_mem_str[100];
 
+  // Compacted unitigs, assuming the worst case of one unitig per kmer
+  cgraph_bits = unitigs_path ?
+                compact_graph_bits_per_kmer(gfiles[0].hdr.kmer_size, false) : 0;
+
   // edges(1bytes) + kmer_paths(8bytes) + in_colour(1bit/col) +
-  // visitedfw/rv(2bits/thread)
+  // visitedfw/rv(2bits/thread) + unitigs
 
   bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(Edges)*8 +
                   (gpfiles.len > 0 ? sizeof(GPath*)*8 : 0) +
+                  cgraph_bits +
                   ncols + 2*nthreads;
 
   kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
@@ -183,13 +193,18 @@ int ctx_bubbles(int argc, char **argv)
   path_mem  += sizeof(GPath*)*kmers_in_hash;
   cmd_print_mem(path_mem, "paths");
 
-  size_t total_mem = graph_mem + thread_mem + path_mem;
+  // Shift unitig memory from graph->unitigs
+  cgraph_mem = (kmers_in_hash * cgraph_bits) / 8;
+  graph_mem -= cgraph_mem;
+  if(unitigs_path) cmd_print_mem(cgraph_mem, "unitigs");
+
+  size_t total_mem = graph_mem + thread_mem + path_mem + cgraph_mem;
   cmd_check_mem_limit(memargs.mem_to_use, total_mem);
 
   //
   // Open output file
   //
-  gzFile gzout = futil_gzopen_create(out_path, "w");
+  BgzfWriter *out = bgzf_writer_open(out_path, nthreads);
 
   // Allocate memory
   dBGraph db_graph;
@@ -203,6 +218,7 @@ int ctx_bubbles(int argc, char **argv)
   // Load graphs
   //
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
   gprefs.empty_colours = true;
 
   for(i = 0; i < num_gfiles; i++) {
@@ -216,7 +232,15 @@ int ctx_bubbles(int argc, char **argv)
 
   // Load link files
   for(i = 0; i < gpfiles.len; i++)
-    gpath_reader_load(&gpfiles.b[i], GPATH_DIE_MISSING_KMERS, &db_graph);
+    gpath_reader_load_mt(&gpfiles.b[i], GPATH_DIE_MISSING_KMERS,
+                         nthreads, &db_graph);
+
+  // Compacted unitigs
+  CompactGraph cgraph;
+  if(unitigs_path) {
+    compact_graph_alloc(&cgraph, &db_graph);
+    compact_graph_load(&cgraph, unitigs_path);
+  }
 
   // Create array of cJSON** from input files
   cJSON **hdrs = ctx_malloc(gpfiles.len * sizeof(cJSON*));
@@ -230,12 +254,15 @@ int ctx_bubbles(int argc, char **argv)
                                    .remove_serial_bubbles = remove_serial_bubbles};
 
   invoke_bubble_caller(nthreads, &call_prefs,
-                       gzout, out_path,
+                       out, out_path,
                        hdrs, gpfiles.len,
+                       unitigs_path ? &cgraph : NULL,
                        &db_graph);
 
+  if(unitigs_path) compact_graph_dealloc(&cgraph);
+
   status("  saved to: %s\n", out_path);
-  gzclose(gzout);
+  bgzf_writer_close(out);
   ctx_free(hdrs);
 
   // Close input link files
@@ -21,6 +21,7 @@ const char build_usage[] =
 "  -m, --memory <mem>       Memory to use\n"
 "  -n, --nkmers <kmers>     Number of hash table entries (e.g. 1G ~ 1 billion)\n"
 "  -t, --threads <T>        Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
+"  -b, --batch <N>          Pass reads between threads in batches of <N> [default: "QUOTE_VALUE(ASYNCIO_DEFAULT_BATCH)"]\n"
 //
 "  -k, --kmer <kmer>        Kmer size must be odd ("QUOTE_VALUE(MAX_KMER_SIZE)" >= k >= "QUOTE_VALUE(MIN_KMER_SIZE)")\n"
 "  -s, --sample <name>      Sample name (required before any seq args)\n"
@@ -39,6 +40,9 @@ const char build_usage[] =
 "                           graphs will be merged, not intersected. Treated as\n"
 "                           single colour graphs.\n"
 "  -S, --sort               Output a graph file ordered by kmer\n"
+"  -A, --append <in.ctx>    Merge new sequence into sorted graph in.ctx, only\n"
+"                           holding new kmers in memory. Output is sorted.\n"
+"  -C, --colmajor           Write a column-major graph (format version 8)\n"
 "\n"
 "  Note: Argument must come before input file\n"
 "  PCR duplicate removal works by ignoring read (pairs) if (both) reads\n"
@@ -47,6 +51,9 @@ const char build_usage[] =
 "  Consecutive sequence options are loaded into the same colour.\n"
 "  --graph argument can have colours specifed e.g. in.ctx:0,6-8 will load\n"
 "  samples 0,6,7,8.  Graphs are loaded into new colours.\n"
+"  --append keeps the colours of in.ctx (which can be filtered as with --graph)\n"
+"  and adds sequence for the n-th --sample to colour n. Sample names must match\n"
+"  those already in in.ctx. Use `"CMD" sort` to sort in.ctx first.\n"
 "  See `"CMD" join` to combine .ctx files\n"
 "\n";
 
@@ -57,6 +64,7 @@ static struct option longopts[] =
   {"memory",       required_argument, NULL, 'm'},
   {"nkmers",       required_argument, NULL, 'n'},
   {"threads",      required_argument, NULL, 't'},
+  {"batch",        required_argument, NULL, 'b'},
   {"force",        no_argument,       NULL, 'f'},
 // command specific
   {"kmer",         required_argument, NULL, 'k'},
@@ -73,6 +81,8 @@ static struct option longopts[] =
   {"keep-pcr",     no_argument,       NULL, 'P'},
   {"graph",        required_argument, NULL, 'g'},
   {"intersect",    required_argument, NULL, 'I'},
+  {"append",       required_argument, NULL, 'A'},
+  {"colmajor",     no_argument,       NULL, 'C'},
   {NULL, 0, NULL, 0}
 };
 
@@ -94,7 +104,14 @@ static struct MemArgs memargs = MEM_ARGS_INIT;
 static char *out_path = NULL;
 static size_t output_colours = 0, kmer_size = 0;
 
-static bool sort_kmers = false;
+static bool sort_kmers = false, colmajor = false;
+
+// Sorted graph to merge new kmers into (--append)
+static const char *append_path = NULL;
+static GraphFileReader append_gfile;
+
+// Number of kmers to check when testing the --append graph is sorted
+#define APPEND_SORTED_SAMPLES 1024
 
 static void add_task(BuildGraphTask *task)
 {
@@ -152,6 +169,7 @@ static void parse_args(int argc, char **argv)
       case 0: /* flag set */ break;
       case 'h': cmd_print_usage(NULL); break;
       case 't': cmd_check(!nthreads,cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
+      case 'b': asyncio_set_batch_size(cmd_size_nonzero(cmd, optarg)); break;
       case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
       case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
@@ -164,6 +182,7 @@ static void parse_args(int argc, char **argv)
         sample_named = true;
         break;
       case 'S': cmd_check(!sort_kmers,cmd); sort_kmers = true; break;
+      case 'C': cmd_check(!colmajor,cmd); colmajor = true; break;
       case '1':
       case '2':
       case 'i':
@@ -202,6 +221,12 @@ static void parse_args(int argc, char **argv)
         file_filter_flatten(&tmp_gfile.fltr, 0);
         gfile_buf_push(&gisecbuf, &tmp_gfile, 1);
         break;
+      case 'A':
+        cmd_check(!append_path, cmd);
+        append_path = optarg;
+        graph_file_reset(&append_gfile);
+        graph_file_open(&append_gfile, optarg);
+        break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -239,6 +264,48 @@ static void parse_args(int argc, char **argv)
   }
 
   output_colours = intocolour + (sample_named ? 1 : 0);
+
+  if(append_path)
+  {
+    if(gfilebuf.len > 0 || gisecbuf.len > 0)
+      cmd_print_usage("Cannot use --append with --graph or --intersect");
+
+    if(colmajor)
+      cmd_print_usage("Cannot use --append with --colmajor");
+
+    if(strcmp(file_filter_path(&append_gfile.fltr), out_path) == 0)
+      cmd_print_usage("--append graph cannot also be the output: %s", out_path);
+
+    if(append_gfile.hdr.kmer_size != kmer_size) {
+      cmd_print_usage("Input graph kmer_size doesn't match [%u vs %zu]: %s",
+                      append_gfile.hdr.kmer_size, kmer_size,
+                      file_filter_input(&append_gfile.fltr));
+    }
+  }
+}
+
+// Check sample names given with --append match those in the graph, then
+// unset them so that they are not repeated when headers are merged
+static void append_check_sample_names(dBGraph *db_graph)
+{
+  GraphFileHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  graph_file_merge_header(&hdr, &append_gfile);
+
+  size_t i, ncols = MIN2(hdr.num_of_cols, db_graph->num_of_cols);
+  const char *name;
+  for(i = 0; i < ncols; i++) {
+    name = hdr.ginfo[i].sample_name.b;
+    if(strcmp(name, "undefined") == 0) continue;
+    if(strcmp(db_graph->ginfo[i].sample_name.b, name) != 0 &&
+       strcmp(db_graph->ginfo[i].sample_name.b, "undefined") != 0) {
+      die("Sample name '%s' doesn't match colour %zu of --append graph: '%s'",
+          db_graph->ginfo[i].sample_name.b, i, name);
+    }
+    strbuf_set(&db_graph->ginfo[i].sample_name, "undefined");
+  }
+
+  graph_header_dealloc(&hdr);
 }
 
 
@@ -265,6 +332,14 @@ int ctx_build(int argc, char **argv)
   //
   size_t max_kmers = 0;
 
+  // Only new kmers are held in memory when appending
+  if(append_path) {
+    file_filter_status(&append_gfile.fltr, false);
+    if(!file_filter_isstdin(&append_gfile.fltr) &&
+       !graph_file_sample_sorted(&append_gfile, APPEND_SORTED_SAMPLES))
+      die("--append graph is not sorted (see `"CMD" sort`): %s", append_path);
+  }
+
   // Print graphs to be loaded
   for(i = 0; i < gfilebuf.len; i++) {
     file_filter_status(&gfilebuf.b[i].fltr, false);
@@ -312,7 +387,7 @@ int ctx_build(int argc, char **argv)
                   (sizeof(Covg) + sizeof(Edges)) * 8 * output_colours +
                   (gisecbuf.len > 0 ? sizeof(Edges)*8 : 0) +
                   (remove_pcr_used ? 2 : 0) +
-                  (sort_kmers ? sizeof(hkey_t)*8 : 0);
+                  (sort_kmers || append_path ? sizeof(hkey_t)*8 : 0);
 
   kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
                                         memargs.mem_to_use_set,
@@ -332,8 +407,10 @@ int ctx_build(int argc, char **argv)
 
   // Create db_graph
   dBGraph db_graph;
-  int alloc_flags = DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS |
-                    (remove_pcr_used ? DBG_ALLOC_READSTRT : 0);
+  // No bucket locks: kmers are added with lock-free inserts
+  int alloc_flags = DBG_ALLOC_EDGES | DBG_ALLOC_COVGS |
+                    (remove_pcr_used ? DBG_ALLOC_READSTRT : 0) |
+                    (colmajor ? DBG_ALLOC_COLMAJOR : 0);
 
   db_graph_alloc(&db_graph, kmer_size, output_colours, output_colours,
                  kmers_in_hash, alloc_flags);
@@ -348,6 +425,7 @@ int ctx_build(int argc, char **argv)
   if(gisecbuf.len > 0)
   {
     GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+    gprefs.nthreads = nthreads;
     Covg *tmp_covgs = NULL;
     SWAP(db_graph.col_covgs, tmp_covgs);
     SWAP(db_graph.col_edges, isec_edges); db_graph.num_edge_cols = 1;
@@ -366,6 +444,7 @@ int ctx_build(int argc, char **argv)
   if(gfilebuf.len > 0)
   {
     GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+    gprefs.nthreads = nthreads;
     gprefs.must_exist_in_graph = (gisecbuf.len > 0);
     gprefs.must_exist_in_edges = isec_edges;
 
@@ -381,6 +460,8 @@ int ctx_build(int argc, char **argv)
     strbuf_set(&db_graph.ginfo[samples[i].colour].sample_name, samples[i].name);
   }
 
+  if(append_path) append_check_sample_names(&db_graph);
+
   size_t start, end, num_load, colour, prev_colour = 0;
 
   // If we are using PCR duplicate removal,
@@ -421,8 +502,17 @@ int ctx_build(int argc, char **argv)
     build_graph_task_destroy(&tasks[i]);
   }
 
-  status("Dumping graph...\n");
-  graph_writer_save_mkhdr(out_path, &db_graph, sort_kmers, output_colours);
+  if(append_path) {
+    // Graph is merged in one pass reading in.ctx through a 1MB buffer
+    graph_writer_merge_sorted_graph_mkhdr(out_path, &append_gfile, &db_graph,
+                                          nthreads, ONE_MEGABYTE);
+    graph_file_close(&append_gfile);
+  }
+  else {
+    status("Dumping graph...\n");
+    graph_writer_save_mkhdr(out_path, &db_graph, sort_kmers, nthreads,
+                            output_colours);
+  }
 
   build_graph_task_buf_dealloc(&gtaskbuf);
   gfile_buf_dealloc(&gfilebuf);
@@ -347,6 +347,7 @@ int ctx_clean(int argc, char **argv)
 
   // Load graph into a single colour
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
 
   // Construct cleaned graph header
   GraphFileHeader outhdr;
@@ -455,7 +456,7 @@ int ctx_clean(int argc, char **argv)
     graph_writer_merge(out_ctx_path, gfiles, num_gfiles,
                        true, all_colours_loaded,
                        edges_union, &outhdr,
-                       sort_kmers, &db_graph);
+                       sort_kmers, nthreads, &db_graph);
   }
 
   ctx_check(hash_table_nkmers(&db_graph.ht) == hash_table_count_kmers(&db_graph.ht));
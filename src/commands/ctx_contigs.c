@@ -265,6 +265,7 @@ int ctx_contigs(int argc, char **argv)
 
   // Load graph
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
   gprefs.empty_colours = true;
 
   for(i = 0; i < num_gfiles; i++) {
@@ -278,7 +279,8 @@ int ctx_contigs(int argc, char **argv)
 
   // Load link files
   for(i = 0; i < gpfiles.len; i++) {
-    gpath_reader_load(&gpfiles.b[i], GPATH_DIE_MISSING_KMERS, &db_graph);
+    gpath_reader_load_mt(&gpfiles.b[i], GPATH_DIE_MISSING_KMERS,
+                         nthreads, &db_graph);
     gpath_reader_close(&gpfiles.b[i]);
   }
   gpfile_buf_dealloc(&gpfiles);
@@ -21,6 +21,7 @@ const char correct_usage[] =
 "  -m, --memory <mem>       Memory to use (e.g. 1M, 20GB)\n"
 "  -n, --nkmers <N>         Number of hash table entries (e.g. 1G ~ 1 billion)\n"
 "  -t, --threads <T>        Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
+"  -b, --batch <N>          Pass reads between threads in batches of <N> [default: "QUOTE_VALUE(ASYNCIO_DEFAULT_BATCH)"]\n"
 "  -p, --paths <in.ctp>     Load link file (can specify multiple times)\n"
 "\n"
 "  Input:\n"
@@ -53,7 +54,7 @@ const char correct_usage[] =
 "\n"
 "  Output is <O>.fq.gz for FASTQ, <O>.fa.gz for FASTA, <O>.txt.gz for plain\n"
 "  --seq outputs <out>.fa.gz, --seq2 outputs <out>.1.fa.gz, <out>.2.fa.gz\n"
-"  --seq must come AFTER two/oneway options. Output may be slightly shuffled.\n"
+"  --seq must come AFTER two/oneway options. Reads are output in input order.\n"
 "\n";
 
 static struct option longopts[] =
@@ -63,6 +64,7 @@ static struct option longopts[] =
   {"memory",        required_argument, NULL, 'm'},
   {"nkmers",        required_argument, NULL, 'n'},
   {"threads",       required_argument, NULL, 't'},
+  {"batch",         required_argument, NULL, 'b'},
   {"paths",         required_argument, NULL, 'p'},
   {"force",         no_argument,       NULL, 'f'},
 // command specific
@@ -168,7 +170,8 @@ int ctx_correct(int argc, char **argv)
     // We loaded target colour into colour zero
     input->crt_params.ctxcol = input->crt_params.ctpcol = 0;
     bool is_pe = asyncio_task_is_pe(&input->files);
-    err_occurred = !seqout_open(&outputs[i], input->out_base, args.fmt, is_pe);
+    err_occurred = !seqout_open(&outputs[i], input->out_base, args.fmt, is_pe,
+                                args.nthreads);
     input->output = &outputs[i];
   }
 
@@ -194,6 +197,7 @@ int ctx_correct(int argc, char **argv)
   // Load Graph and link files
   //
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = args.nthreads;
   gprefs.empty_colours = true;
 
   // Load graph, print stats, close file
@@ -203,7 +207,8 @@ int ctx_correct(int argc, char **argv)
 
   // Load link files
   for(i = 0; i < gpfiles->len; i++) {
-    gpath_reader_load(&gpfiles->b[i], GPATH_DIE_MISSING_KMERS, &db_graph);
+    gpath_reader_load_mt(&gpfiles->b[i], GPATH_DIE_MISSING_KMERS,
+                         args.nthreads, &db_graph);
     gpath_reader_close(&gpfiles->b[i]);
   }
 
@@ -50,8 +50,8 @@ static inline void fetch_node_edges(const dBGraph *db_graph, dBNode node,
                                     Edges *dst)
 {
   size_t i, ncols = db_graph->num_edge_cols;
-  const Edges *edges = &db_node_edges(db_graph, node.key, 0);
-  memcpy(dst, edges, ncols * sizeof(Edges));
+  // Colours are not contiguous in column-major graphs
+  for(i = 0; i < ncols; i++) dst[i] = db_node_edges(db_graph, node.key, i);
   if(node.orient == REVERSE) {
     for(i = 0; i < ncols; i++) {
       // dst[i] = rev_nibble_lookup(dst[i]>>4) | (rev_nibble_lookup(dst[i]&0xf)<<4);
@@ -134,8 +134,9 @@ static inline void print_read_covg(const dBGraph *db_graph, const read_t *r,
       bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
       node = db_graph_find(db_graph, bkmer);
       if(node.key != HASH_NOT_FOUND) {
-        covgs = &db_node_covg(db_graph, node.key, 0);
-        memcpy(covgbuf->b+i*ncols, covgs, ncols * sizeof(Covg));
+        covgs = covgbuf->b+i*ncols;
+        for(col = 0; col < ncols; col++)
+          covgs[col] = db_node_get_covg(db_graph, node.key, col);
         if(db_graph->col_edges) {
           fetch_node_edges(db_graph, node, edgebuf->b+i*ncols);
         }
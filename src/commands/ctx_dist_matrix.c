@@ -6,6 +6,7 @@
 #include "db_node.h"
 #include "graphs_load.h"
 #include "gpath_checks.h"
+#include "dist_matrix.h"
 
 const char dist_matrix_usage[] =
 "usage: "CMD" dist [options] <in.ctx> [in2.ctx ...]\n"
@@ -19,6 +20,8 @@ const char dist_matrix_usage[] =
 "  -n, --nkmers <kmers>  Number of hash table entries (e.g. 1G ~ 1 billion)\n"
 "  -t, --threads <T>     Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "  -o, --out <out.csv>   Ouput matrix, tab separated [defaults to STDOUT]\n"
+"  -J, --jaccard         Print Jaccard index instead of number of shared kmers\n"
+"  -M, --mash            Print Mash distance instead of number of shared kmers\n"
 "\n";
 
 static struct option longopts[] =
@@ -30,41 +33,18 @@ static struct option longopts[] =
   {"threads",      required_argument, NULL, 't'},
   {"force",        no_argument,       NULL, 'f'},
   {"out",          required_argument, NULL, 'o'},
+  {"jaccard",      no_argument,       NULL, 'J'},
+  {"mash",         no_argument,       NULL, 'M'},
   {NULL, 0, NULL, 0}
 };
 
-typedef struct {
-  const dBGraph *db_graph;
-  uint64_t **matrices;
-} DistMatrixThreads;
-
-static bool dist_matrix_thread(hkey_t hkey, size_t threadid, void *arg)
-{
-  DistMatrixThreads *workers = (DistMatrixThreads*)arg;
-  const dBGraph *db_graph = workers->db_graph;
-  const size_t ncols = db_graph->num_of_cols;
-  uint64_t *matrix = workers->matrices[threadid];
-  size_t i, j;
-  for(i = 0; i < ncols; i++) {
-    if(db_node_has_col(db_graph, hkey, i)) {
-      matrix[ncols*i+i]++; // colour with self
-      for(j = i+1; j < ncols; j++) {
-        if(db_node_has_col(db_graph, hkey, j)) {
-          matrix[ncols*i+j]++;
-        }
-      }
-    }
-  }
-
-  return false; // keep iterating
-}
-
 int ctx_dist_matrix(int argc, char **argv)
 {
   size_t nthreads = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
 
   char *out_path = NULL;
+  bool print_jaccard = false, print_mash = false;
 
   // Arg parsing
   char cmd[100];
@@ -85,6 +65,8 @@ int ctx_dist_matrix(int argc, char **argv)
       case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
       case 'o': cmd_check(!out_path, cmd); out_path = optarg; break;
+      case 'J': cmd_check(!print_jaccard, cmd); print_jaccard = true; break;
+      case 'M': cmd_check(!print_mash, cmd); print_mash = true; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -97,6 +79,8 @@ int ctx_dist_matrix(int argc, char **argv)
   if(!nthreads) nthreads = DEFAULT_NTHREADS;
 
   if(optind >= argc) cmd_print_usage("Require input graph files (.ctx)");
+  if(print_jaccard && print_mash)
+    cmd_print_usage("Cannot use --jaccard and --mash together");
 
   //
   // Open graph files
@@ -106,7 +90,7 @@ int ctx_dist_matrix(int argc, char **argv)
   ctx_assert(num_gfiles > 0);
 
   GraphFileReader *gfiles = ctx_calloc(num_gfiles, sizeof(GraphFileReader));
-  size_t i, j, ncols, ctx_max_kmers = 0, ctx_sum_kmers = 0;
+  size_t i, ncols, ctx_max_kmers = 0, ctx_sum_kmers = 0;
 
   ncols = graph_files_open(graph_paths, gfiles, num_gfiles,
                            &ctx_max_kmers, &ctx_sum_kmers);
@@ -131,7 +115,7 @@ int ctx_dist_matrix(int argc, char **argv)
                                         ctx_max_kmers, ctx_sum_kmers,
                                         true, &graph_mem);
 
-  size_t total_mem = graph_mem;
+  size_t total_mem = graph_mem + nthreads * dist_matrix_thread_mem(ncols);
   cmd_check_mem_limit(memargs.mem_to_use, total_mem);
 
 
@@ -140,11 +124,7 @@ int ctx_dist_matrix(int argc, char **argv)
   db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size, ncols, 0, kmers_in_hash,
                  DBG_ALLOC_NODE_IN_COL);
 
-  // Allocate thread memory
-  uint64_t **matrices = ctx_calloc(nthreads, sizeof(DistMatrixThreads));
-  DistMatrixThreads workers = {.db_graph = &db_graph, .matrices = matrices};
-  for(i = 0; i < nthreads; i++)
-    workers.matrices[i] = ctx_calloc(ncols*ncols, sizeof(uint64_t));
+  uint64_t *mat = ctx_calloc(ncols*ncols, sizeof(uint64_t));
 
   // Open output file
   // Print to stdout unless --out <out> is specified
@@ -155,6 +135,7 @@ int ctx_dist_matrix(int argc, char **argv)
   // Load graphs
   //
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
   gprefs.empty_colours = true;
 
   for(i = 0; i < num_gfiles; i++) {
@@ -169,15 +150,10 @@ int ctx_dist_matrix(int argc, char **argv)
   // Generate matrix
   status("[dist_matrix] Generating matrix between %zu colours with %zu thread%s",
          ncols, nthreads, util_plural_str(nthreads));
-  hash_table_iterate(&db_graph.ht, nthreads, dist_matrix_thread, &workers);
-
-  // Merge matrices
-  for(i = 1; i < nthreads; i++)
-    for(j = 0; j < ncols*ncols; j++)
-      matrices[0][j] += matrices[i][j];
+  dist_matrix_count(&db_graph, nthreads, mat);
 
   size_t row, col;
-  uint64_t *mat = matrices[0];
+  double dist;
 
   // Print matrix
   fprintf(fout, ".");// top left column empty
@@ -186,8 +162,15 @@ int ctx_dist_matrix(int argc, char **argv)
   for(row = 0; row < ncols; row++) {
     fprintf(fout, "col%zu", row);
     for(col = 0; col < ncols; col++) {
-      if(col < row) fprintf(fout, "\t.");
-      else fprintf(fout, "\t%zu", (size_t)mat[ncols*row+col]);
+      if(col < row) { fprintf(fout, "\t."); continue; }
+      if(!print_jaccard && !print_mash) {
+        fprintf(fout, "\t%zu", (size_t)mat[ncols*row+col]);
+        continue;
+      }
+      dist = dist_jaccard(mat[ncols*row+col], mat[ncols*row+row],
+                          mat[ncols*col+col]);
+      if(print_mash) dist = dist_mash(dist, db_graph.kmer_size);
+      fprintf(fout, "\t%.6f", dist);
     }
     fprintf(fout, "\n");
   }
@@ -195,9 +178,7 @@ int ctx_dist_matrix(int argc, char **argv)
   status("[dist_matrix]   written to %s", futil_outpath_str(out_path));
   fclose(fout);
 
-  for(i = 0; i < nthreads; i++)
-    ctx_free(workers.matrices[i]);
-  ctx_free(workers.matrices);
+  ctx_free(mat);
 
   db_graph_dealloc(&db_graph);
 
@@ -435,6 +435,7 @@ int ctx_exp_abc(int argc, char **argv)
 
   // Load the graph
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
   gprefs.empty_colours = true;
 
   graph_load(&gfile, gprefs, NULL);
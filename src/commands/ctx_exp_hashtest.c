@@ -4,10 +4,14 @@
 #include "db_graph.h"
 #include "binary_kmer.h"
 
+#include <sys/time.h> // gettimeofday()
+
 const char exp_hashtest_usage[] =
 "usage: "CMD" hashtest [options] <num_ops>\n"
 "\n"
 "  Test hash table speed. If threads is set to 0, use single-threaded code.\n"
+"  Inserts <num_ops> kmers then looks each one up again, reporting the time\n"
+"  taken for each.\n"
 "\n"
 "  -h, --help        This help message\n"
 "  -m, --memory <M>  Memory to use\n"
@@ -15,6 +19,12 @@ const char exp_hashtest_usage[] =
 "  -t, --threads <T> Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "  -k, --kmer <K>    Kmer size must be odd ("QUOTE_VALUE(MAX_KMER_SIZE)" >= k >= "QUOTE_VALUE(MIN_KMER_SIZE)")\n"
 "  -F, --func-only   Only use the hash function, do not store kmers\n"
+"  -b, --batch       Use batched lookups that prefetch buckets\n"
+"  -L, --lock-free   Use lock-free find / insert instead of bucket locks\n"
+"  -s, --scale       Run with 1,2,4,...,64 threads (or up to --threads), using\n"
+"                    bucket locks then lock-free, and print a table of results\n"
+"  -S, --sort        Insert kmers then time sorting them with 1,2,4,...,64\n"
+"                    threads (or up to --threads), print speedup over 1 thread\n"
 "\n";
 
 static struct option longopts[] =
@@ -27,16 +37,50 @@ static struct option longopts[] =
 // command specific
   {"kmer",         required_argument, NULL, 'k'},
   {"func-only",    no_argument,       NULL, 'F'},
+  {"batch",        no_argument,       NULL, 'b'},
+  {"lock-free",    no_argument,       NULL, 'L'},
+  {"scale",        no_argument,       NULL, 's'},
+  {"sort",         no_argument,       NULL, 'S'},
   {NULL, 0, NULL, 0}
 };
 
+// Number of kmers passed to each batch call
+#define HASHTEST_BATCH 64
+
+// Max number of threads to use with --scale
+#define HASHTEST_SCALE_MAX_THREADS 64
+
 struct HashLoopJob {
   dBGraph *db_graph;
-  bool single_threaded;
+  volatile uint8_t *bktlocks; // NULL => lock-free
+  bool single_threaded, batch, find;
   size_t start, end;
   size_t hash; // return value
 };
 
+static inline void hash_loop_batch(struct HashLoopJob j)
+{
+  BinaryKmer bkmers[HASHTEST_BATCH];
+  hkey_t hkeys[HASHTEST_BATCH];
+  bool found[HASHTEST_BATCH];
+  size_t i, k, n;
+
+  memset(bkmers, 0, sizeof(bkmers));
+
+  for(i = j.start; i < j.end; i += n) {
+    n = MIN2(j.end - i, HASHTEST_BATCH);
+    for(k = 0; k < n; k++) bkmers[k].b[0] = i+k;
+    if(j.find) {
+      hash_table_find_batch(&j.db_graph->ht, bkmers, n, hkeys);
+      for(k = 0; k < n; k++)
+        if(hkeys[k] == HASH_NOT_FOUND) die("Lost kmer: %zu", i+k);
+    } else {
+      hash_table_find_or_insert_mt_batch(&j.db_graph->ht, bkmers, n,
+                                         hkeys, found, j.bktlocks);
+    }
+  }
+}
+
 static inline void hash_loop(void *arg, size_t threadid)
 {
   (void)threadid;
@@ -47,7 +91,21 @@ static inline void hash_loop(void *arg, size_t threadid)
   bool found;
   uint32_t hash = 0;
 
-  if(j.db_graph && j.single_threaded) {
+  if(j.db_graph && j.batch) {
+    hash_loop_batch(j);
+  } else if(j.db_graph && j.find && j.single_threaded) {
+    for(i = j.start; i < j.end; i++) {
+      bkmer.b[0] = i;
+      if(hash_table_find(&j.db_graph->ht, bkmer) == HASH_NOT_FOUND)
+        die("Lost kmer: %zu", i);
+    }
+  } else if(j.db_graph && j.find) {
+    for(i = j.start; i < j.end; i++) {
+      bkmer.b[0] = i;
+      if(hash_table_find_mt(&j.db_graph->ht, bkmer, j.bktlocks) == HASH_NOT_FOUND)
+        die("Lost kmer: %zu", i);
+    }
+  } else if(j.db_graph && j.single_threaded) {
     for(i = j.start; i < j.end; i++) {
       bkmer.b[0] = i;
       hash_table_find_or_insert(&j.db_graph->ht, bkmer, &found);
@@ -56,7 +114,7 @@ static inline void hash_loop(void *arg, size_t threadid)
     for(i = j.start; i < j.end; i++) {
       bkmer.b[0] = i;
       hash_table_find_or_insert_mt(&j.db_graph->ht, bkmer, &found,
-                                   j.db_graph->bktlocks);
+                                   j.bktlocks);
     }
   } else {
     for(i = j.start; i < j.end; i++) {
@@ -68,11 +126,124 @@ static inline void hash_loop(void *arg, size_t threadid)
   jptr->hash = hash;
 }
 
+// Split `num_ops` between `nthreads` jobs
+static void hashtest_jobs_init(struct HashLoopJob *jobs, size_t nthreads,
+                               size_t num_ops, struct HashLoopJob tmpl)
+{
+  size_t i, start, end;
+  for(i = 0; i < nthreads; i++) {
+    start = i * (num_ops / nthreads);
+    end = (i+1 == nthreads ? num_ops : start + (num_ops / nthreads));
+    jobs[i] = tmpl;
+    jobs[i].start = start;
+    jobs[i].end = end;
+    jobs[i].hash = 0;
+  }
+}
+
+// Returns millions of operations per second
+static double hashtest_run(struct HashLoopJob *jobs, size_t nthreads,
+                           size_t num_ops, const char *name)
+{
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+  util_run_threads(jobs, nthreads, sizeof(jobs[0]), nthreads, hash_loop);
+  gettimeofday(&end, NULL);
+
+  double secs = (end.tv_sec - start.tv_sec) +
+                (end.tv_usec - start.tv_usec) / 1000000.0;
+  double mops = secs > 0 ? num_ops / secs / 1e6 : 0.0;
+
+  if(name != NULL) {
+    char num_ops_str[50];
+    ulong_to_str(num_ops, num_ops_str);
+    status("[hashtest] %s: %s ops in %.3f secs (%.1f Mops/sec)",
+           name, num_ops_str, secs, mops);
+  }
+
+  return mops;
+}
+
+// Insert then find `num_ops` kmers with 1,2,4,...,max_threads threads, using
+// bucket locks and then lock-free
+static void hashtest_scale(dBGraph *db_graph, size_t max_threads,
+                           size_t num_ops, bool batch)
+{
+  struct HashLoopJob tmpl = {.db_graph = db_graph, .single_threaded = false,
+                             .batch = batch};
+  struct HashLoopJob jobs[max_threads];
+  double mops[4];
+  size_t t, m;
+
+  status("[hashtest] scaling (Mops/sec):");
+  status("[hashtest]  threads  locked-insert  locked-find"
+         "  lockfree-insert  lockfree-find");
+
+  for(t = 1; ; t = MIN2(t*2, max_threads))
+  {
+    for(m = 0; m < 2; m++) {
+      hash_table_empty(&db_graph->ht);
+      tmpl.bktlocks = m == 0 ? db_graph->bktlocks : NULL;
+      tmpl.find = false;
+      hashtest_jobs_init(jobs, t, num_ops, tmpl);
+      mops[m*2] = hashtest_run(jobs, t, num_ops, NULL);
+      tmpl.find = true;
+      hashtest_jobs_init(jobs, t, num_ops, tmpl);
+      mops[m*2+1] = hashtest_run(jobs, t, num_ops, NULL);
+    }
+    status("[hashtest]  %7zu  %13.1f  %11.1f  %15.1f  %13.1f",
+           t, mops[0], mops[1], mops[2], mops[3]);
+    if(t == max_threads) break;
+  }
+}
+
+// Insert `num_ops` kmers then sort them with 1,2,4,...,max_threads threads
+static void hashtest_sort(dBGraph *db_graph, size_t max_threads,
+                          size_t num_ops)
+{
+  struct HashLoopJob tmpl = {.db_graph = db_graph, .single_threaded = false,
+                             .bktlocks = db_graph->bktlocks, .find = false};
+  struct HashLoopJob jobs[max_threads];
+  struct timeval start, end;
+  double secs, secs1 = 0;
+  hkey_t *hkeys;
+  size_t i, t, nkmers;
+
+  hash_table_empty(&db_graph->ht);
+  hashtest_jobs_init(jobs, max_threads, num_ops, tmpl);
+  hashtest_run(jobs, max_threads, num_ops, "insert");
+  nkmers = hash_table_nkmers(&db_graph->ht);
+
+  status("[hashtest] sorting %zu kmers:", nkmers);
+  status("[hashtest]  threads     secs  speedup");
+
+  for(t = 1; ; t = MIN2(t*2, max_threads))
+  {
+    gettimeofday(&start, NULL);
+    hkeys = hash_table_sorted(&db_graph->ht, t);
+    gettimeofday(&end, NULL);
+
+    for(i = 1; i < nkmers; i++) {
+      if(!binary_kmer_lt(db_graph->ht.table[hkeys[i-1]],
+                         db_graph->ht.table[hkeys[i]]))
+        die("Kmers not sorted with %zu threads", t);
+    }
+    ctx_free(hkeys);
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    if(t == 1) secs1 = secs;
+    status("[hashtest]  %7zu  %7.3f  %6.2fx", t, secs,
+           secs > 0 ? secs1 / secs : 0.0);
+    if(t == max_threads) break;
+  }
+}
+
 int ctx_exp_hashtest(int argc, char **argv)
 {
   size_t nthreads = 0, kmer_size = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
-  bool store_kmers = true;
+  bool store_kmers = true, batch = false, lock_free = false, scale = false;
+  bool sort = false;
 
   // Arg parsing
   char cmd[100], shortopts[100];
@@ -89,6 +260,10 @@ int ctx_exp_hashtest(int argc, char **argv)
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
       case 'k': cmd_check(!kmer_size,cmd); kmer_size = cmd_uint32_nonzero(cmd, optarg); break;
       case 'F': cmd_check(store_kmers,cmd); store_kmers = false; break;
+      case 'b': cmd_check(!batch,cmd); batch = true; break;
+      case 'L': cmd_check(!lock_free,cmd); lock_free = true; break;
+      case 's': cmd_check(!scale,cmd); scale = true; break;
+      case 'S': cmd_check(!sort,cmd); sort = true; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -97,6 +272,10 @@ int ctx_exp_hashtest(int argc, char **argv)
     }
   }
 
+  if((scale || sort) && !nthreads) nthreads = HASHTEST_SCALE_MAX_THREADS;
+  if((scale || sort) && nthreads > HASHTEST_SCALE_MAX_THREADS)
+    die("--scale/--sort use at most %i threads", HASHTEST_SCALE_MAX_THREADS);
+
   bool single_threaded = false;
   if(nthreads == 0) { single_threaded = true; nthreads = 1; }
 
@@ -109,6 +288,13 @@ int ctx_exp_hashtest(int argc, char **argv)
   }
 
   if(optind+1 != argc) cmd_print_usage(NULL);
+  if(batch && !store_kmers) cmd_print_usage("Cannot use --batch with --func-only");
+  if(scale && !store_kmers) cmd_print_usage("Cannot use --scale with --func-only");
+  if(scale && lock_free) cmd_print_usage("--scale runs with and without --lock-free");
+  if(sort && !store_kmers) cmd_print_usage("Cannot use --sort with --func-only");
+  if(sort && scale) cmd_print_usage("Cannot use --sort with --scale");
+  if(lock_free && single_threaded)
+    cmd_print_usage("--lock-free requires --threads <T> with T > 0");
 
   size_t i, num_ops;
   if(!parse_entire_size(argv[optind], &num_ops))
@@ -136,25 +322,47 @@ int ctx_exp_hashtest(int argc, char **argv)
     hash_table_print_stats(&db_graph.ht);
   }
 
-  status("[threads] using %zu thread%s (%s-threaded code)",
+  #ifdef HASH_TAGS
+    status("[hashtest] hash table with fingerprint tags (HASH_TAGS)");
+  #endif
+
+  if(scale) {
+    hashtest_scale(&db_graph, nthreads, num_ops, batch);
+    hash_table_print_stats(&db_graph.ht);
+    db_graph_dealloc(&db_graph);
+    return EXIT_SUCCESS;
+  }
+
+  if(sort) {
+    hashtest_sort(&db_graph, nthreads, num_ops);
+    db_graph_dealloc(&db_graph);
+    return EXIT_SUCCESS;
+  }
+
+  status("[threads] using %zu thread%s (%s-threaded%s%s code)",
          nthreads, util_plural_str(nthreads),
-         single_threaded ? "single" : "multi");
+         single_threaded ? "single" : "multi", batch ? " batched" : "",
+         lock_free ? " lock-free" : "");
 
   struct HashLoopJob jobs[nthreads];
   size_t hash = 0;
 
-  for(i = 0; i < nthreads; i++) {
-    size_t start = i * (num_ops / nthreads);
-    size_t end = (i+1 == nthreads ? num_ops : start + (num_ops / nthreads));
-    jobs[i] = (struct HashLoopJob){.db_graph = store_kmers ? &db_graph : NULL,
-                                   .single_threaded = single_threaded,
-                                   .start = start, .end = end, .hash = 0};
-  }
+  struct HashLoopJob tmpl = {.db_graph = store_kmers ? &db_graph : NULL,
+                             .bktlocks = store_kmers && !lock_free ?
+                                         db_graph.bktlocks : NULL,
+                             .single_threaded = single_threaded,
+                             .batch = batch, .find = false};
+  hashtest_jobs_init(jobs, nthreads, num_ops, tmpl);
 
-  util_run_threads(jobs, nthreads, sizeof(jobs[0]), nthreads, hash_loop);
+  hashtest_run(jobs, nthreads, num_ops, store_kmers ? "insert" : "hash");
 
   for(i = 0; i < nthreads; i++) hash += jobs[i].hash;
 
+  if(store_kmers) {
+    for(i = 0; i < nthreads; i++) jobs[i].find = true;
+    hashtest_run(jobs, nthreads, num_ops, "find");
+  }
+
   if(store_kmers) {
     hash_table_print_stats(&db_graph.ht);
     db_graph_dealloc(&db_graph);
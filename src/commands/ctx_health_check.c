@@ -144,13 +144,15 @@ int ctx_health_check(int argc, char **argv)
   gpath_reader_alloc_gpstore(gpfiles.b, gpfiles.len, path_mem, false, &db_graph);
 
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
   gprefs.empty_colours = true;
 
   graph_load(&gfile, gprefs, NULL);
 
   // Load link files
   for(i = 0; i < gpfiles.len; i++) {
-    gpath_reader_load(&gpfiles.b[i], GPATH_DIE_MISSING_KMERS, &db_graph);
+    gpath_reader_load_mt(&gpfiles.b[i], GPATH_DIE_MISSING_KMERS,
+                         nthreads, &db_graph);
     gpath_reader_close(&gpfiles.b[i]);
   }
 
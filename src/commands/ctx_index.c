@@ -5,6 +5,7 @@
 #include "file_util.h"
 #include "graphs_load.h"
 #include "binary_kmer.h"
+#include "graph_index.h"
 
 // TODO: add .ctp.gz indexing
 
@@ -85,6 +86,9 @@ int ctx_index(int argc, char **argv)
   if(!file_filter_from_direct(&gfile.fltr))
     die("Cannot open graph file with a filter ('in.ctx:blah' syntax)");
 
+  if(graph_file_is_colmajor(&gfile))
+    die("Cannot index a column-major graph: %s", file_filter_path(&gfile.fltr));
+
   // Open output file
   FILE *fout = out_path ? futil_fopen_create(out_path, "w") : stdout;
 
@@ -111,8 +115,12 @@ int ctx_index(int argc, char **argv)
 
   if(block_kmers == 0) die("Cannot set block_kmers to zero");
 
+  const GraphIndexLayout layout = {.kmer_size = kmer_size,
+                                   .hdr_size = gfile.hdr_size,
+                                   .entrysize = kmer_mem};
+
   // Print header
-  fputs("#block_start\tnext_block\tfirst_kmer\tkmer_idx\tnext_kmer_idx\n", fout);
+  fputs(GRAPH_INDEX_HDR, fout);
 
   BinaryKmer bkmer = BINARY_KMER_ZERO_MACRO;
   BinaryKmer prev_bkmer = BINARY_KMER_ZERO_MACRO;
@@ -126,7 +134,7 @@ int ctx_index(int argc, char **argv)
   // Read in file, print index
   size_t nblocks = 0;
   size_t bl_bytes = 0, bl_kmers = 0;
-  size_t bl_byte_offset = gfile.hdr_size, bl_kmer_offset = 0;
+  size_t bl_kmer_offset = 0;
 
   while(1)
   {
@@ -137,11 +145,9 @@ int ctx_index(int argc, char **argv)
       die("File is not sorted: %s [%s]", bkmerstr, path);
     // We've already read one kmer entry, read rest of block
     bl_bytes = kmer_mem + graph_file_fread(&gfile, tmp_mem, rem_block);
-    bl_kmers = 1 + bl_bytes / kmer_mem;
-    fprintf(fout, "%zu\t%zu\t%s\t%zu\t%zu\n",
-            bl_byte_offset, bl_byte_offset+bl_bytes, bkmerstr,
-            bl_kmer_offset, bl_kmer_offset+bl_kmers);
-    bl_byte_offset += bl_bytes;
+    bl_kmers = bl_bytes / kmer_mem;
+    graph_index_print_block(fout, &layout, bkmerstr,
+                            bl_kmer_offset, bl_kmer_offset+bl_kmers);
     bl_kmer_offset += bl_kmers;
     nblocks++;
     if(bl_kmers < block_kmers) {
@@ -222,11 +222,19 @@ int ctx_infer_edges(int argc, char **argv)
   if(!file_filter_from_direct(&file.fltr))
     cmd_print_usage("Inferedges with filter not implemented - sorry");
 
+  if(editing_file && graph_file_is_bgzf(&file))
+    cmd_print_usage("Cannot edit a compressed graph in place, use -o <out.ctx>");
+  if(editing_file && graph_file_is_colmajor(&file))
+    cmd_print_usage("Cannot edit a column-major graph in place, use -o <out.ctx>");
+
   FILE *fout = NULL;
 
   // Editing input file or writing a new file
-  if(!editing_file)
-    fout = futil_fopen_create(out_ctx_path ? out_ctx_path : "-", "w");
+  if(!editing_file) {
+    const char *out_path = out_ctx_path ? out_ctx_path : "-";
+    fout = graph_writer_compress(futil_fopen_create(out_path, "w"), out_path,
+                                 num_of_threads);
+  }
 
   // Print output status
   if(fout == stdout) status("Writing to STDOUT");
@@ -289,7 +297,7 @@ int ctx_infer_edges(int argc, char **argv)
     ctx_assert(fout != NULL);
     num_kmers_edited = infer_edges(num_of_threads, add_all_edges, &db_graph);
     graph_write_header(fout, &file.hdr);
-    graph_write_all_kmers_direct(fout, &db_graph, false, &file.hdr);
+    graph_write_all_kmers_direct(fout, &db_graph, false, 1, &file.hdr);
   }
   else if(fout == NULL) {
     // Reading from file, writing to same file
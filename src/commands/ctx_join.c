@@ -28,12 +28,23 @@ const char join_usage[] =
 "  -o, --out <out.ctx>     Output file [required]\n"
 "  -m, --memory <mem>      Memory to use\n"
 "  -n, --nkmers <kmers>    Number of hash table entries (e.g. 1G ~ 1 billion)\n"
+"  -t, --threads <T>       Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 //
 "  -N, --ncols <c>         How many colours to load at once [default: 1]\n"
 "  -i, --intersect <a.ctx> Only load the kmers that are in graph A.ctx. Can be\n"
 "                          specified multiple times. <a.ctx> is NOT merged into\n"
 "                          the output file.\n"
 "  -S, --sort              Output sorted graph file\n"
+"  -s, --sorted            Input graphs are sorted: merge in a single streaming\n"
+"                          pass without a hash table. Used automatically when\n"
+"                          all input files appear to be sorted.\n"
+"  -C, --colmajor          Write a column-major graph (format version 8), which\n"
+"                          stores each colour separately\n"
+"  -8, --covg8             Hold coverage in 8 bit counters, with an overflow table\n"
+"                          for larger values. Uses less memory with many colours\n"
+"  -A, --append            Add the colours of the input graphs to the existing\n"
+"                          column-major graph <out.ctx>. Only kmers already in\n"
+"                          <out.ctx> are kept.\n"
 "\n"
 "  Files can be specified with specific colours: samples.ctx:2,3\n"
 "  Offset specifies where to load the first colour: 3:samples.ctx\n"
@@ -47,26 +58,56 @@ static struct option longopts[] =
   {"force",        no_argument,       NULL, 'f'},
   {"memory",       required_argument, NULL, 'm'},
   {"nkmers",       required_argument, NULL, 'n'},
+  {"threads",      required_argument, NULL, 't'},
 // command specific
   {"ncols",        required_argument, NULL, 'N'},
   {"intersect",    required_argument, NULL, 'i'},
   {"sort",         no_argument,       NULL, 'S'},
+  {"sorted",       no_argument,       NULL, 's'},
+  {"colmajor",     no_argument,       NULL, 'C'},
+  {"append",       no_argument,       NULL, 'A'},
+  {"covg8",        no_argument,       NULL, '8'},
   {NULL, 0, NULL, 0}
 };
 
-static inline void remove_non_intersect_nodes(hkey_t node, Covg *covgs,
-                                              Covg num, HashTable *ht)
+// Number of kmers to check when detecting sorted input files
+#define JOIN_SORTED_SAMPLES 1024
+
+// Read buffer size per input file when merging sorted files
+#define JOIN_SORTED_MAX_BUFSIZE ONE_MEGABYTE
+#define JOIN_SORTED_MIN_BUFSIZE (64*1024)
+
+static inline void remove_non_intersect_nodes(hkey_t node, dBGraph *db_graph,
+                                              Covg num)
+{
+  if(db_node_get_covg(db_graph, node, 0) != num)
+    hash_table_delete(&db_graph->ht, node);
+}
+
+// Report how much of the estimated overflow table was used
+static void join_print_covg_ovf(dBGraph *db_graph)
 {
-  if(covgs[node] != num)
-    hash_table_delete(ht, node);
+  size_t nentries = covg_ovf_size(db_graph->covg_ovf);
+  size_t ncounters = db_graph->ht.capacity * db_graph->num_of_cols;
+  size_t est = ncounters * COVG_OVF_EST_FRAC;
+  char nstr[50], memstr[50], eststr[50];
+  ulong_to_str(nentries, nstr);
+  bytes_to_str(covg_ovf_mem(db_graph->covg_ovf), 1, memstr);
+  bytes_to_str(est * COVG_OVF_ENTRY_BYTES, 1, eststr);
+  status("[memory] coverage overflow table: %s entries, %s (estimated %s)",
+         nstr, memstr, eststr);
+  if(nentries > est)
+    warn("More coverages over %i than expected, memory use was underestimated",
+         COVG8_MAX);
 }
 
 int ctx_join(int argc, char **argv)
 {
   struct MemArgs memargs = MEM_ARGS_INIT;
   const char *out_path = NULL;
-  size_t use_ncols = 0;
-  bool sort_kmers = false;
+  size_t nthreads = 0, use_ncols = 0;
+  bool sort_kmers = false, merge_sorted = false;
+  bool colmajor = false, append = false, covg8 = false;
 
   GraphFileReader tmp_gfile;
   GraphFileBuffer isec_gfiles_buf;
@@ -86,6 +127,7 @@ int ctx_join(int argc, char **argv)
       case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
       case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case 'N': cmd_check(!use_ncols, cmd); use_ncols = cmd_uint32_nonzero(cmd, optarg); break;
       case 'i':
         graph_file_reset(&tmp_gfile);
@@ -96,6 +138,10 @@ int ctx_join(int argc, char **argv)
         gfile_buf_push(&isec_gfiles_buf, &tmp_gfile, 1);
         break;
       case 'S': cmd_check(!sort_kmers,cmd); sort_kmers = true; break;
+      case 's': cmd_check(!merge_sorted,cmd); merge_sorted = true; break;
+      case 'C': cmd_check(!colmajor,cmd); colmajor = true; break;
+      case 'A': cmd_check(!append,cmd); append = true; break;
+      case '8': cmd_check(!covg8,cmd); covg8 = true; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -109,13 +155,31 @@ int ctx_join(int argc, char **argv)
 
   if(!out_path) cmd_print_usage("--out <out.ctx> required");
 
+  // Coverage is held in 8 bit counters with --covg8, the memory estimate
+  // includes room in the overflow table for larger coverages
+  size_t covg_bits = covg8 ? COVG8_EST_BITS : sizeof(Covg)*8;
+  int covg_flag = covg8 ? DBG_ALLOC_COVGS8 : DBG_ALLOC_COVGS;
+  if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
+
   if(optind >= argc)
     cmd_print_usage("Please specify at least one input graph file");
 
+  if(merge_sorted && num_igfiles > 0)
+    cmd_print_usage("Cannot use --sorted with --intersect");
+
+  if(colmajor && merge_sorted)
+    cmd_print_usage("Cannot use --sorted with --colmajor");
+
+  if(append && (num_igfiles > 0 || sort_kmers || merge_sorted))
+    cmd_print_usage("Cannot use --append with --intersect, --sort or --sorted");
+
   // optind .. argend-1 are graphs to load
   size_t num_gfiles = (size_t)(argc - optind);
   char **gfile_paths = argv + optind;
 
+  // We may be merging thousands of files, keep them all open
+  futil_raise_open_files_limit(num_gfiles + num_igfiles + 16);
+
   GraphFileReader *gfiles = ctx_calloc(num_gfiles, sizeof(GraphFileReader));
 
   status("Probing %zu graph files and %zu intersect files", num_gfiles, num_igfiles);
@@ -165,6 +229,52 @@ int ctx_join(int argc, char **argv)
   if(take_intersect)
     ctx_max_kmers = ctx_sum_kmers = min_intersect_num_kmers;
 
+  if(append)
+  {
+    // Kmers come from the existing graph, all new colours are held in memory
+    GraphFileReader outfile;
+    memset(&outfile, 0, sizeof(outfile));
+    graph_file_open(&outfile, out_path);
+    if(!graph_file_is_colmajor(&outfile))
+      die("--append requires a column-major graph: %s", out_path);
+    if(outfile.hdr.kmer_size != gfiles[0].hdr.kmer_size) {
+      cmd_print_usage("Kmer sizes don't match [%u vs %u]",
+                      outfile.hdr.kmer_size, gfiles[0].hdr.kmer_size);
+    }
+    ctx_max_kmers = ctx_sum_kmers = graph_file_nkmers(&outfile);
+    graph_file_close(&outfile);
+
+    size_t bits_per_kmer, kmers_in_hash, graph_mem;
+    bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(hkey_t)*8 +
+                    (covg_bits + sizeof(Edges)*8) * ctx_max_cols;
+
+    kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
+                                          memargs.mem_to_use_set,
+                                          memargs.num_kmers,
+                                          memargs.num_kmers_set,
+                                          bits_per_kmer,
+                                          ctx_max_kmers, ctx_sum_kmers,
+                                          true, &graph_mem);
+
+    cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
+
+    dBGraph db_graph;
+    db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size,
+                   ctx_max_cols, ctx_max_cols, kmers_in_hash,
+                   covg_flag | DBG_ALLOC_EDGES | DBG_ALLOC_COLMAJOR);
+
+    graph_writer_append_colmajor(out_path, gfiles, num_gfiles, nthreads,
+                                 &db_graph);
+    if(covg8) join_print_covg_ovf(&db_graph);
+
+    for(i = 0; i < num_gfiles; i++) graph_file_close(&gfiles[i]);
+    gfile_buf_dealloc(&isec_gfiles_buf);
+    ctx_free(gfiles);
+    db_graph_dealloc(&db_graph);
+
+    return EXIT_SUCCESS;
+  }
+
   bool use_ncols_set = (use_ncols > 0);
   bool output_to_stdout = (strcmp(out_path,"-") == 0);
 
@@ -188,7 +298,7 @@ int ctx_join(int argc, char **argv)
   status("Output %zu cols; from %zu files; intersecting %zu graphs; ",
          ctx_max_cols, num_gfiles, num_igfiles);
 
-  if(num_gfiles == 1 && num_igfiles == 0)
+  if(num_gfiles == 1 && num_igfiles == 0 && !colmajor)
   {
     // Loading only one file with no intersection files
     // Don't need to store a graph in memory, can filter as stream
@@ -208,13 +318,40 @@ int ctx_join(int argc, char **argv)
     return EXIT_SUCCESS;
   }
 
+  // Sorted files can be merged in a single pass without a hash table
+  if(!take_intersect && !merge_sorted && !colmajor) {
+    for(i = 0; i < num_gfiles; i++)
+      if(!graph_file_sample_sorted(&gfiles[i], JOIN_SORTED_SAMPLES)) break;
+    merge_sorted = (i == num_gfiles);
+  }
+
+  if(merge_sorted)
+  {
+    size_t bufsize = memargs.mem_to_use / num_gfiles;
+    bufsize = MIN2(bufsize, JOIN_SORTED_MAX_BUFSIZE);
+    bufsize = MAX2(bufsize, JOIN_SORTED_MIN_BUFSIZE);
+
+    char mem_str[50];
+    bytes_to_str(bufsize * num_gfiles, 1, mem_str);
+    status("[memory] Sorted input graphs, merging with %s of read buffers",
+           mem_str);
+
+    graph_writer_merge_sorted_mkhdr(out_path, gfiles, num_gfiles, bufsize);
+
+    for(i = 0; i < num_gfiles; i++) graph_file_close(&gfiles[i]);
+    gfile_buf_dealloc(&isec_gfiles_buf);
+    ctx_free(gfiles);
+
+    return EXIT_SUCCESS;
+  }
+
   //
   // Decide on memory
   //
   size_t bits_per_kmer, kmers_in_hash, graph_mem;
 
   bits_per_kmer = sizeof(BinaryKmer)*8 +
-                  (sizeof(Covg) + sizeof(Edges)) * 8 * use_ncols +
+                  (covg_bits + sizeof(Edges)*8) * use_ncols +
                   (sort_kmers ? sizeof(hkey_t)*8 : 0);
 
   kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
@@ -232,7 +369,7 @@ int ctx_join(int argc, char **argv)
 
     use_ncols = MIN2(max_usencols, ctx_max_cols);
     bits_per_kmer = sizeof(BinaryKmer)*8 +
-                    (sizeof(Covg) + sizeof(Edges)) * 8 * use_ncols;
+                    (covg_bits + sizeof(Edges)*8) * use_ncols;
 
     // Re-check memory used
     kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
@@ -254,7 +391,8 @@ int ctx_join(int argc, char **argv)
   size_t edge_cols = (use_ncols + take_intersect);
 
   db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size, use_ncols, use_ncols,
-                 kmers_in_hash, DBG_ALLOC_COVGS);
+                 kmers_in_hash,
+                 covg_flag | (colmajor ? DBG_ALLOC_COLMAJOR : 0));
 
   // We allocate edges ourself since it's a special case
   db_graph.col_edges = ctx_calloc(db_graph.ht.capacity*edge_cols, sizeof(Edges));
@@ -268,6 +406,7 @@ int ctx_join(int argc, char **argv)
   {
     GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
     gprefs.boolean_covgs = true; // covg++ only
+    gprefs.nthreads = nthreads;
 
     for(i = 0; i < num_igfiles; i++)
     {
@@ -285,7 +424,7 @@ int ctx_join(int argc, char **argv)
     {
       // Remove nodes where covg != num_igfiles
       HASH_ITERATE_SAFE(&db_graph.ht, remove_non_intersect_nodes,
-                        db_graph.col_covgs, (Covg)num_igfiles, &db_graph.ht);
+                        &db_graph, (Covg)num_igfiles);
     }
 
     status("Loaded intersection set\n");
@@ -298,7 +437,7 @@ int ctx_join(int argc, char **argv)
       graph_info_init(&db_graph.ginfo[i]);
 
     // Zero covgs
-    memset(db_graph.col_covgs, 0, db_graph.ht.capacity * sizeof(Covg));
+    db_graph_zero_covgs(&db_graph);
 
     // Use union edges we loaded to intersect new edges
     intersect_edges = db_graph.col_edges;
@@ -309,11 +448,14 @@ int ctx_join(int argc, char **argv)
 
   graph_writer_merge_mkhdr(out_path, gfiles, num_gfiles,
                           kmers_loaded, colours_loaded, intersect_edges,
-                          intsct_gname_ptr, sort_kmers, &db_graph);
+                          intsct_gname_ptr, sort_kmers, nthreads,
+                          &db_graph);
 
   if(take_intersect)
     db_graph.col_edges -= db_graph.ht.capacity;
 
+  if(covg8) join_print_covg_ovf(&db_graph);
+
   for(i = 0; i < num_gfiles; i++) graph_file_close(&gfiles[i]);
 
   strbuf_dealloc(&intersect_gname);
@@ -55,30 +55,6 @@ static struct option longopts[] =
   {NULL, 0, NULL, 0}
 };
 
-// Creates <base>.tmp.<rand>
-static FILE* create_tmp_file(StrBuf *path, const char *base)
-{
-  size_t i;
-  const size_t attempt_limit = 100;
-  FILE *fh;
-
-  for(i = 0; i < attempt_limit; i++) {
-    size_t r = rand() % 9999;
-    strbuf_reset(path);
-    strbuf_sprintf(path, "%s.tmp.%04zu", base, r);
-    if(!futil_file_exists(path->b)) break;
-  }
-  if(i == attempt_limit)
-    die("Temporary files already exist (%zu tries): %s", attempt_limit, path->b);
-
-  if((fh = futil_fopen_create(path->b, "r+")) == NULL) {
-    die("Cannot write temporary file: %s [%s]", path->b, strerror(errno));
-  }
-
-  unlink(path->b); // Immediately unlink to hide temp file
-  return fh;
-}
-
 static void print_suggest_cutoff(size_t hist_distsize, size_t hist_covgsize,
                                  uint64_t (*hists)[hist_covgsize],
                                  FILE *fh)
@@ -240,7 +216,7 @@ int ctx_links(int argc, char **argv)
       die("Cannot find required header entries");
 
     // Create a random temporary file
-    link_tmp_fh = create_tmp_file(&link_tmp_path, link_out_path);
+    link_tmp_fh = futil_create_tmp_file(&link_tmp_path, link_out_path);
 
     status("Saving output to: %s", link_out_path);
     status("Temporary output: %s", link_tmp_path.b);
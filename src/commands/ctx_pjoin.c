@@ -17,6 +17,7 @@ const char pjoin_usage[] =
 "  -q, --quiet            Silence status output normally printed to STDERR\n"
 "  -f, --force            Overwrite output files\n"
 "  -o, --out <out.ctp.gz> Output file [required]\n"
+"  -B, --binary           Save a binary indexed link file (<out.ctpb>)\n"
 "  -m, --memory <mem>     Memory to use (required) recommend 80G for human\n"
 "  -n, --nkmers <nkmers>  Number of hash table entries (e.g. 1G ~ 1 billion)\n"
 "  -t, --threads <T>      Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
@@ -24,7 +25,12 @@ const char pjoin_usage[] =
 "  -g, --graph <in.ctx>   Get number of hash table entries from graph file\n"
 "  -c, --outcols <C>      How many 'colours' should the output file have\n"
 "  -r, --noredundant      Remove redundant paths\n"
+"  -R, --range <K1-K2>    Only load links for kmer keys K1 <= key <= K2\n"
+"                         (binary input link files only)\n"
 "\n"
+"  Input files may be text (.ctp.gz) or binary (.ctpb) link files.\n"
+"  --range only decompresses the blocks of binary link files that overlap the\n"
+"  range, e.g. to split a link file: --range AAAAAAA-CTTTTTT\n"
 "  Files can be specified with specific colours: samples.ctp:2,3\n"
 "  Offset specifies where to load the first colour: 3:samples.ctp\n"
 "\n";
@@ -35,6 +41,7 @@ static struct option longopts[] =
   {"help",         no_argument,       NULL, 'h'},
   {"out",          required_argument, NULL, 'o'},
   {"force",        no_argument,       NULL, 'f'},
+  {"binary",       no_argument,       NULL, 'B'},
   {"memory",       required_argument, NULL, 'm'},
   {"nkmers",       required_argument, NULL, 'n'},
   {"threads",      required_argument, NULL, 't'},
@@ -42,6 +49,7 @@ static struct option longopts[] =
   {"graph",        required_argument, NULL, 'g'},
   {"outcols",      required_argument, NULL, 'c'},
   {"noredundant",  required_argument, NULL, 'r'},
+  {"range",        required_argument, NULL, 'R'},
   {NULL, 0, NULL, 0}
 };
 
@@ -49,10 +57,10 @@ int ctx_pjoin(int argc, char **argv)
 {
   size_t nthreads = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
-  bool noredundant = false;
+  bool noredundant = false, binary_out = false;
   size_t output_ncols = 0;
   char *graph_file = NULL;
-  const char *out_ctp_path = NULL;
+  const char *out_ctp_path = NULL, *range_str = NULL;
 
   // Arg parsing
   char cmd[100];
@@ -70,12 +78,14 @@ int ctx_pjoin(int argc, char **argv)
       case 'h': cmd_print_usage(NULL); break;
       case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
       case 'o': cmd_check(!out_ctp_path, cmd); out_ctp_path = optarg; break;
+      case 'B': cmd_check(!binary_out, cmd); binary_out = true; break;
       case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
       case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case 'g': cmd_check(!graph_file,cmd); graph_file = optarg; break;
       case 'c': cmd_check(!output_ncols, cmd); output_ncols = cmd_uint32_nonzero(cmd, optarg); break;
       case 'r': cmd_check(!noredundant,cmd); noredundant = true; break;
+      case 'R': cmd_check(!range_str,cmd); range_str = optarg; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -116,6 +126,31 @@ int ctx_pjoin(int argc, char **argv)
   }
 
 
+  // Parse kmer range
+  size_t kmer_size = gpath_reader_get_kmer_size(&pfiles[0]);
+  BinaryKmer range_first = BINARY_KMER_ZERO_MACRO;
+  BinaryKmer range_last = BINARY_KMER_ZERO_MACRO;
+
+  if(range_str != NULL)
+  {
+    const char *sep = strchr(range_str, '-');
+    if(sep == NULL || (size_t)(sep - range_str) != kmer_size ||
+       strlen(sep+1) != kmer_size ||
+       strspn(range_str, "ACGT") != kmer_size || strspn(sep+1, "ACGT") != kmer_size)
+      cmd_print_usage("--range expects <K1-K2> with two %zu-mers: %s",
+                      kmer_size, range_str);
+
+    range_first = binary_kmer_from_str(range_str, kmer_size);
+    range_last = binary_kmer_from_str(sep+1, kmer_size);
+
+    if(binary_kmer_lt(range_last, range_first))
+      cmd_print_usage("--range first kmer is after last kmer: %s", range_str);
+
+    for(i = 0; i < num_pfiles; i++)
+      if(!gpath_reader_is_binary(&pfiles[i]))
+        cmd_print_usage("--range needs binary link files: %s", paths[i]);
+  }
+
   if(output_ncols == 0) output_ncols = ctp_max_cols;
   else if(ctp_max_cols > output_ncols) {
     cmd_print_usage("You specified --outcols %zu but inputs need at %zu colours",
@@ -185,10 +220,12 @@ int ctx_pjoin(int argc, char **argv)
   cmd_check_mem_limit(memargs.mem_to_use, total_mem);
 
   // Open output file
-  gzFile gzout = futil_gzopen_create(out_ctp_path, "w");
+  gzFile gzout = NULL;
+  FILE *fout = NULL;
+  if(binary_out) fout = futil_fopen_create(out_ctp_path, "w");
+  else gzout = futil_gzopen_create(out_ctp_path, "w");
 
   // Set up graph and PathStore
-  size_t kmer_size = gpath_reader_get_kmer_size(&pfiles[0]);
   dBGraph db_graph;
   db_graph_alloc(&db_graph, kmer_size, output_ncols, 0, kmers_in_hash, 0);
 
@@ -216,8 +253,15 @@ int ctx_pjoin(int argc, char **argv)
   }
 
   // Load link files
-  for(i = 0; i < num_pfiles; i++)
-    gpath_reader_load(&pfiles[i], GPATH_ADD_MISSING_KMERS, &db_graph);
+  for(i = 0; i < num_pfiles; i++) {
+    if(range_str != NULL) {
+      gpath_reader_load_range(&pfiles[i], GPATH_ADD_MISSING_KMERS,
+                              range_first, range_last, &db_graph);
+    } else {
+      gpath_reader_load_mt(&pfiles[i], GPATH_ADD_MISSING_KMERS,
+                           nthreads, &db_graph);
+    }
+  }
 
   status("Got %zu path bytes", (size_t)db_graph.gpstore.path_bytes);
 
@@ -227,17 +271,25 @@ int ctx_pjoin(int argc, char **argv)
   for(i = 0; i < num_pfiles; i++) hdrs[i] = pfiles[i].json;
 
   // Write output file
-  gpath_save(gzout, out_ctp_path, output_threads, false,
-             NULL, NULL, hdrs, num_pfiles,
-             contig_histgrms, output_ncols,
-             &db_graph);
+  if(binary_out) {
+    gpath_save_bin(fout, out_ctp_path, output_threads,
+                   NULL, NULL, hdrs, num_pfiles,
+                   contig_histgrms, output_ncols,
+                   &db_graph);
+  } else {
+    gpath_save(gzout, out_ctp_path, output_threads, false,
+               NULL, NULL, hdrs, num_pfiles,
+               contig_histgrms, output_ncols,
+               &db_graph);
+  }
 
   for(i = 0; i < output_ncols; i++)
     zsize_buf_dealloc(&contig_histgrms[i]);
 
   ctx_free(contig_histgrms);
 
-  gzclose(gzout);
+  if(binary_out) fclose(fout);
+  else gzclose(gzout);
   ctx_free(hdrs);
 
   // Close ctp files
@@ -26,6 +26,7 @@ const char pop_bubbles_usage[] =
 "  -C, --max-covg <C>    Only remove branches whose mean coverage is less than <C>\n"
 "  -L, --max-len <L>     Only remove branches whose lengths are less than <L> kmers\n"
 "  -D, --max-diff <D>    Only pop bubbles whose branch lengths are within <D> kmers\n"
+"  -U, --unitigs <in>    Load compacted unitigs saved by `"CMD" unitigs --compact`\n"
 "\n";
 
 static struct option longopts[] =
@@ -40,6 +41,7 @@ static struct option longopts[] =
   {"max-covg",     required_argument, NULL, 'C'},
   {"max-len",      required_argument, NULL, 'L'},
   {"max-diff",     required_argument, NULL, 'D'},
+  {"unitigs",      required_argument, NULL, 'U'},
   {NULL, 0, NULL, 0}
 };
 
@@ -47,7 +49,7 @@ int ctx_pop_bubbles(int argc, char **argv)
 {
   size_t nthreads = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
-  const char *out_path = NULL;
+  const char *out_path = NULL, *unitigs_path = NULL;
   int32_t max_covg  = -1; // max mean coverage to remove <=0 => ignore
   int32_t max_klen  = -1; // max length (kmers) to remove <=0 => ignore
   int32_t max_kdiff = -1; // max diff between bubble branch lengths <0 => ignore
@@ -74,6 +76,7 @@ int ctx_pop_bubbles(int argc, char **argv)
       case 'C': cmd_check(max_covg<0,  cmd); max_covg  = cmd_uint32(cmd, optarg); break;
       case 'L': cmd_check(max_klen<0,  cmd); max_klen  = cmd_uint32(cmd, optarg); break;
       case 'D': cmd_check(max_kdiff<0, cmd); max_kdiff = cmd_uint32(cmd, optarg); break;
+      case 'U': cmd_check(!unitigs_path, cmd); unitigs_path = optarg; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -115,12 +118,17 @@ int ctx_pop_bubbles(int argc, char **argv)
   //
   // Decide on memory
   //
-  size_t bits_per_kmer, kmers_in_hash, graph_mem;
+  size_t bits_per_kmer, cgraph_bits, kmers_in_hash, graph_mem, cgraph_mem;
+
+  // Compacted unitigs, assuming the worst case of one unitig per kmer
+  cgraph_bits = compact_graph_bits_per_kmer(gfiles[0].hdr.kmer_size,
+                                            unitigs_path == NULL);
 
   bits_per_kmer = sizeof(BinaryKmer)*8 +
                   sizeof(Covg)*8*ncols +
                   sizeof(Edges)*8*ncols +
-                  2; // 1 bit for visited, 1 for removed
+                  cgraph_bits +
+                  1; // 1 bit for removed
 
   kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
                                         memargs.mem_to_use_set,
@@ -130,7 +138,12 @@ int ctx_pop_bubbles(int argc, char **argv)
                                         ctx_max_kmers, ctx_sum_kmers,
                                         false, &graph_mem);
 
-  cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
+  // Shift unitig memory from graph->unitigs
+  cgraph_mem = (kmers_in_hash * cgraph_bits) / 8;
+  graph_mem -= cgraph_mem;
+  cmd_print_mem(cgraph_mem, "unitigs");
+
+  cmd_check_mem_limit(memargs.mem_to_use, graph_mem + cgraph_mem);
 
   // Check out_path is writable
   futil_create_output(out_path);
@@ -141,13 +154,13 @@ int ctx_pop_bubbles(int argc, char **argv)
                  kmers_in_hash,  DBG_ALLOC_EDGES | DBG_ALLOC_COVGS);
 
   size_t nkwords = roundup_bits2bytes(db_graph.ht.capacity);
-  uint8_t *visited = ctx_calloc(1, nkwords);
   uint8_t *rmvbits  = ctx_calloc(1, nkwords);
 
   //
   // Load graphs
   //
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
   gprefs.empty_colours = true;
 
   for(i = 0; i < num_gfiles; i++) {
@@ -165,8 +178,14 @@ int ctx_pop_bubbles(int argc, char **argv)
   size_t npopped = 0;
   char npopped_str[50];
 
+  CompactGraph cgraph;
+  compact_graph_alloc(&cgraph, &db_graph);
+  if(unitigs_path) compact_graph_load(&cgraph, unitigs_path);
+  else compact_graph_build(&cgraph, nthreads);
+
   status("Popping bubbles...");
-  npopped = pop_bubbles(&db_graph, nthreads, prefs, visited, rmvbits);
+  npopped = pop_bubbles(&cgraph, nthreads, prefs, rmvbits);
+  compact_graph_dealloc(&cgraph);
   ulong_to_str(npopped, npopped_str);
   status("Popped %s bubbles", npopped_str);
 
@@ -196,10 +215,9 @@ int ctx_pop_bubbles(int argc, char **argv)
   else
   {
     status("Saving to: %s\n", out_path);
-    graph_writer_save_mkhdr(out_path, &db_graph, false, ncols);
+    graph_writer_save_mkhdr(out_path, &db_graph, false, nthreads, ncols);
   }
 
-  ctx_free(visited);
   ctx_free(rmvbits);
 
   db_graph_dealloc(&db_graph);
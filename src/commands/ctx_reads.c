@@ -9,6 +9,8 @@
 #include "graphs_load.h"
 #include "seqout.h"
 #include "async_read_io.h"
+#include "graph_search.h"
+#include "graph_stream.h"
 
 const char reads_usage[] =
 "usage: "CMD" reads [options] <in.ctx>[:cols] [in2.ctx ...]\n"
@@ -27,6 +29,8 @@ const char reads_usage[] =
 "  -1, --seq  <in>:<O>         Writes output to <O>.fq.gz\n"
 "  -2, --seq2 <in1>:<in2>:<O>  Writes output to <O>.{1,2}.fq.gz\n"
 "  -i, --seqi <in>:<O>         Writes output to <O>.{1,2}.fq.gz\n"
+"  -D, --disk                  Search sorted graphs on disk instead of loading them\n"
+"  -S, --stream                Stream sorted graphs past sorted batches of read kmers\n"
 "\n"
 "  Output is <O>.fq.gz for FASTQ, <O>.fa.gz for FASTA, <O>.txt.gz for plain\n"
 "  Paired reads are saved to e.g. <O>.1.fq.gz, <O>.2.fq.gz, and unpaired reads\n"
@@ -34,6 +38,15 @@ const char reads_usage[] =
 "\n"
 "  User can specify --seq/--seq2/--seqi multiple times. If either read of a\n"
 "  pair touches the graph, both are printed.\n"
+"\n"
+"  With --disk, graphs must be sorted (`"CMD" sort`) and are searched using the\n"
+"  block index <in.ctx>.idx (see `"CMD" index`), which is built and saved if it\n"
+"  does not exist. No hash table is allocated, so --memory is not needed.\n"
+"\n"
+"  With --stream, kmers from the reads are collected in batches that fit in\n"
+"  --memory, sorted and merged against each sorted graph, reading the graphs\n"
+"  once per batch. Sequence files are then read a second time to print reads,\n"
+"  so they cannot be pipes. Memory use does not depend on the size of the graph.\n"
 "\n";
 
 static struct option longopts[] =
@@ -50,6 +63,8 @@ static struct option longopts[] =
   {"seq",          required_argument, NULL, '1'},
   {"seq2",         required_argument, NULL, '2'},
   {"seqi",         required_argument, NULL, 'i'},
+  {"disk",         no_argument,       NULL, 'D'},
+  {"stream",       no_argument,       NULL, 'S'},
   {NULL, 0, NULL, 0}
 };
 
@@ -65,7 +80,12 @@ typedef struct
   size_t num_of_reads_printed;
 
   // Global settings
-  dBGraph *db_graph;
+  dBGraph *db_graph; // NULL if searching on disk
+  GraphFileSearch **disk; // sorted graphs on disk
+  size_t num_disk, kmer_size;
+  // --stream: bitset of read (pair) numbers that touch the graph
+  uint8_t *hits;
+  size_t hits_nbits;
   volatile size_t *rcounter;
   SeqLoadingStats *stats;
   bool invert;
@@ -80,6 +100,7 @@ madcrow_buffer(asyncio_buf,   AsyncIOInputBuffer, AsyncIOInput);
 static AsyncIOInputBuffer files;
 static AlignReadsBuffer inputs;
 static size_t nthreads = 0;
+static bool use_disk = false, use_stream = false;
 static struct MemArgs memargs = MEM_ARGS_INIT;
 
 static size_t num_gfiles = 0;
@@ -116,6 +137,8 @@ static void parse_args(int argc, char **argv)
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
       case 'F': cmd_check(fmt==SEQ_FMT_FASTQ, cmd); fmt = cmd_parse_format(cmd, optarg); break;
       case 'v': cmd_check(!invert,cmd); invert = true; break;
+      case 'D': cmd_check(!use_disk,cmd); use_disk = true; break;
+      case 'S': cmd_check(!use_stream,cmd); use_stream = true; break;
       case '1':
       case '2':
       case 'i':
@@ -144,6 +167,9 @@ static void parse_args(int argc, char **argv)
   if(optind >= argc)
     cmd_print_usage("Please specify input graph file(s)");
 
+  if(use_disk && use_stream)
+    cmd_print_usage("Cannot use --disk and --stream together");
+
   num_gfiles = (size_t)(argc - optind);
   gfile_paths = argv + optind;
 
@@ -163,7 +189,7 @@ static void inputs_attempt_open()
     AlignReadsData *input = &inputs.b[i];
     err_occurred = !seqout_open(&input->seqout, input->out_base, input->fmt,
                                 // input->use_fq ? SEQ_FMT_FASTQ : SEQ_FMT_FASTQ,
-                                asyncio_task_is_pe(&files.b[i]));
+                                asyncio_task_is_pe(&files.b[i]), nthreads);
   }
 
   if(err_occurred) {
@@ -173,12 +199,29 @@ static void inputs_attempt_open()
   }
 }
 
-static bool read_touches_graph(const read_t *r, const dBGraph *db_graph,
-                               SeqLoadingStats *stats)
+// `caches` has one BgzfCache per graph on disk for the calling thread
+static inline bool kmer_in_graph(const AlignReadsData *input, BinaryKmer bkmer,
+                                 BgzfCache *caches)
+{
+  if(input->db_graph != NULL)
+    return db_graph_find(input->db_graph, bkmer).key != HASH_NOT_FOUND;
+
+  // Graph filters have been flattened to a single colour
+  BinaryKmer bkey = binary_kmer_get_key(bkmer, input->kmer_size);
+  Covg covg; Edges edges;
+  size_t i;
+  for(i = 0; i < input->num_disk; i++)
+    if(graph_search_find(input->disk[i], bkey, &covg, &edges, &caches[i]))
+      return true;
+  return false;
+}
+
+static bool read_touches_graph(const read_t *r, const AlignReadsData *input,
+                               SeqLoadingStats *stats, BgzfCache *caches)
 {
   bool found = false;
-  BinaryKmer bkmer; Nucleotide nuc; dBNode node;
-  const size_t kmer_size = db_graph->kmer_size;
+  BinaryKmer bkmer; Nucleotide nuc;
+  const size_t kmer_size = input->kmer_size;
   size_t i, num_contigs = 0, num_kmers_loaded = 0;
   size_t search_pos = 0, start, end = 0, contig_len;
 
@@ -195,16 +238,14 @@ static bool read_touches_graph(const read_t *r, const dBGraph *db_graph,
 
       bkmer = binary_kmer_from_str(r->seq.b + start, kmer_size);
       num_kmers_loaded++;
-      node = db_graph_find(db_graph, bkmer);
-      if(node.key != HASH_NOT_FOUND) { found = true; break; }
+      if(kmer_in_graph(input, bkmer, caches)) { found = true; break; }
 
       for(i = start+kmer_size; i < end; i++)
       {
         nuc = dna_char_to_nuc(r->seq.b[i]);
         bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
         num_kmers_loaded++;
-        node = db_graph_find(db_graph, bkmer);
-        if(node.key != HASH_NOT_FOUND) { found = true; break; }
+        if(kmer_in_graph(input, bkmer, caches)) { found = true; break; }
       }
     }
   }
@@ -219,19 +260,25 @@ static bool read_touches_graph(const read_t *r, const dBGraph *db_graph,
   return found;
 }
 
+// `arg` is an array of nthreads * num_disk BgzfCaches, or NULL
 void filter_reads(AsyncIOData *data, size_t threadid, void *arg)
 {
-  (void)arg; (void)threadid;
   read_t *r1 = (read_t*)&data->r1, *r2 = data->r2.seq.end ? (read_t*)&data->r2 : NULL;
   AlignReadsData *input = (AlignReadsData*)data->ptr;
-  const dBGraph *db_graph = input->db_graph;
   SeqLoadingStats *stats = input->stats;
+  BgzfCache *caches = arg ? (BgzfCache*)arg + threadid*input->num_disk : NULL;
 
   ctx_assert2(r2 == NULL || input->seqout.is_pe,
               "Were not expecting r2: %p %i", r2, (int)input->seqout.is_pe);
 
-  bool touches_graph = read_touches_graph(r1, db_graph, stats) ||
-                       (r2 != NULL && read_touches_graph(r2, db_graph, stats));
+  bool touches_graph;
+
+  if(use_stream)
+    touches_graph = data->idx < input->hits_nbits &&
+                    bitset_get(input->hits, data->idx);
+  else
+    touches_graph = read_touches_graph(r1, input, stats, caches) ||
+                    (r2 != NULL && read_touches_graph(r2, input, stats, caches));
 
   if(touches_graph != input->invert)
   {
@@ -246,21 +293,11 @@ void filter_reads(AsyncIOData *data, size_t threadid, void *arg)
   ctx_update("FilterReads", n);
 }
 
-int ctx_reads(int argc, char **argv)
+// Load graphs into a hash table, closes graph files
+static void reads_load_graphs(dBGraph *db_graph, GraphFileReader *gfiles,
+                              size_t ctx_max_kmers, size_t ctx_sum_kmers)
 {
-  parse_args(argc, argv);
-
-  //
-  // Open input graphs
-  //
-  GraphFileReader *gfiles = ctx_calloc(num_gfiles, sizeof(GraphFileReader));
-  size_t i, ctx_max_kmers = 0, ctx_sum_kmers = 0;
-
-  graph_files_open(gfile_paths, gfiles, num_gfiles,
-                   &ctx_max_kmers, &ctx_sum_kmers);
-
-  // Will exit and remove output files on error
-  inputs_attempt_open();
+  size_t i;
 
   //
   // Calculate memory use
@@ -280,11 +317,11 @@ int ctx_reads(int argc, char **argv)
   //
   // Set up graph
   //
-  dBGraph db_graph;
-  db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size, 1, 0, kmers_in_hash, 0);
+  db_graph_alloc(db_graph, gfiles[0].hdr.kmer_size, 1, 0, kmers_in_hash, 0);
 
   // Load graphs
-  GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  GraphLoadingPrefs gprefs = graph_loading_prefs(db_graph);
+  gprefs.nthreads = nthreads;
   gprefs.empty_colours = true;
 
   for(i = 0; i < num_gfiles; i++) {
@@ -293,20 +330,179 @@ int ctx_reads(int argc, char **argv)
     graph_file_close(&gfiles[i]);
     gprefs.empty_colours = false;
   }
-  ctx_free(gfiles);
+}
 
-  status("Printing reads that do %stouch the graph\n",
-         inputs.b[0].invert ? "not " : "");
+// Open sorted graphs for searching on disk, graph files must stay open
+static GraphFileSearch** reads_open_disk_graphs(GraphFileReader *gfiles)
+{
+  GraphFileSearch **disk = ctx_calloc(num_gfiles, sizeof(GraphFileSearch*));
+  size_t i;
+  for(i = 0; i < num_gfiles; i++) {
+    file_filter_flatten(&gfiles[i].fltr, 0);
+    disk[i] = graph_search_new(&gfiles[i], NULL);
+    if(disk[i] == NULL)
+      die("Cannot search graph on disk: %s", file_filter_path(&gfiles[i].fltr));
+  }
+  return disk;
+}
+
+//
+// --stream: collect read kmers in batches, sort them and merge them against
+// each sorted graph, marking read (pair) numbers that touch the graph. Reads
+// are then printed from a second pass over the sequence files.
+//
+
+typedef struct
+{
+  KmerQueryBuffer queries;
+  size_t max_queries, kmer_size;
+  GraphFileReader *gfiles;
+  SeqLoadingStats *stats;
+  GraphStreamStats strm_stats;
+} ReadsStream;
+
+// Query ids encode the input and the read (pair) number in that input
+#define stream_query_id(input_idx,read_idx) ((read_idx)*inputs.len + (input_idx))
+
+static void stream_hit(const KmerQuery *q, const Covg *covgs,
+                       const Edges *edges, void *arg)
+{
+  (void)covgs; (void)edges; (void)arg;
+  AlignReadsData *input = &inputs.b[q->id % inputs.len];
+  bitset_set(input->hits, q->id / inputs.len);
+}
+
+static void stream_flush(ReadsStream *rs)
+{
+  size_t i;
+  if(rs->queries.len == 0) return;
+  graph_stream_sort(&rs->queries, nthreads);
+  for(i = 0; i < num_gfiles; i++)
+    graph_stream_join(&rs->gfiles[i], &rs->queries, stream_hit, NULL,
+                      &rs->strm_stats);
+  rs->strm_stats.nqueries += rs->queries.len;
+  rs->strm_stats.nbatches++;
+  kmer_query_buf_reset(&rs->queries);
+}
+
+static inline void stream_add_kmer(BinaryKmer bkmer, ReadsStream *rs,
+                                   uint64_t id)
+{
+  KmerQuery q = {.bkey = binary_kmer_get_key(bkmer, rs->kmer_size), .id = id};
+  kmer_query_buf_add(&rs->queries, q);
+  if(rs->queries.len == rs->max_queries) stream_flush(rs);
+}
+
+// Make room in the hit bitset for read (pair) number `idx`
+static void stream_hits_capacity(AlignReadsData *input, size_t idx)
+{
+  if(idx < input->hits_nbits) return;
+  size_t old_bytes = roundup_bits2bytes(input->hits_nbits);
+  size_t new_bytes = roundup_bits2bytes(MAX2(idx+1, input->hits_nbits*2));
+  input->hits = ctx_recallocarray(input->hits, old_bytes, new_bytes, 1);
+  input->hits_nbits = new_bytes * 8;
+}
+
+// Called by a single thread
+static void stream_collect_kmers(AsyncIOData *data, size_t threadid, void *arg)
+{
+  (void)threadid;
+  ReadsStream *rs = (ReadsStream*)arg;
+  read_t *r1 = &data->r1, *r2 = data->r2.seq.end ? &data->r2 : NULL;
+  AlignReadsData *input = (AlignReadsData*)data->ptr;
+  uint64_t id = stream_query_id(input - inputs.b, data->idx);
+
+  stream_hits_capacity(input, data->idx);
+
+  READ_TO_BKMERS(r1, rs->kmer_size, 0, 0, rs->stats, stream_add_kmer, rs, id);
+  if(r2 != NULL)
+    READ_TO_BKMERS(r2, rs->kmer_size, 0, 0, rs->stats, stream_add_kmer, rs, id);
+}
+
+static void reads_stream_graphs(GraphFileReader *gfiles, size_t kmer_size,
+                                SeqLoadingStats *seq_stats)
+{
+  size_t i, start, end;
+
+  for(i = 0; i < num_gfiles; i++) {
+    if(file_filter_isstdin(&gfiles[i].fltr))
+      die("Cannot use --stream with graph from STDIN");
+    file_filter_flatten(&gfiles[i].fltr, 0);
+  }
+
+  ReadsStream rs = {.max_queries = graph_stream_max_queries(memargs.mem_to_use),
+                    .kmer_size = kmer_size, .gfiles = gfiles,
+                    .stats = seq_stats};
+
+  char max_queries_str[50];
+  ulong_to_str(rs.max_queries, max_queries_str);
+  status("[stream] Up to %s read kmers per batch", max_queries_str);
+
+  kmer_query_buf_alloc(&rs.queries, rs.max_queries);
+  graph_stream_stats_init(&rs.strm_stats);
+
+  for(start = 0; start < inputs.len; start += MAX_IO_THREADS) {
+    end = MIN2(inputs.len, start+MAX_IO_THREADS);
+    asyncio_run_pool(files.b+start, end-start, stream_collect_kmers, &rs, 1, 0);
+  }
+
+  stream_flush(&rs);
+  graph_stream_print_stats(&rs.strm_stats);
+  kmer_query_buf_dealloc(&rs.queries);
+
+  // Read sequence again to print reads
+  for(i = 0; i < inputs.len; i++)
+    asyncio_task_reopen(&files.b[i]);
+}
+
+int ctx_reads(int argc, char **argv)
+{
+  parse_args(argc, argv);
 
   //
-  // Filter reads using async io
+  // Open input graphs
   //
+  GraphFileReader *gfiles = ctx_calloc(num_gfiles, sizeof(GraphFileReader));
+  size_t i, ctx_max_kmers = 0, ctx_sum_kmers = 0;
+
+  graph_files_open(gfile_paths, gfiles, num_gfiles,
+                   &ctx_max_kmers, &ctx_sum_kmers);
+
+  const size_t kmer_size = gfiles[0].hdr.kmer_size;
+
+  // Will exit and remove output files on error
+  inputs_attempt_open();
+
+  dBGraph db_graph;
+  GraphFileSearch **disk = NULL;
+
   SeqLoadingStats seq_stats;
   memset(&seq_stats, 0, sizeof(seq_stats));
 
+  if(use_disk) disk = reads_open_disk_graphs(gfiles);
+  else if(use_stream) reads_stream_graphs(gfiles, kmer_size, &seq_stats);
+  else reads_load_graphs(&db_graph, gfiles, ctx_max_kmers, ctx_sum_kmers);
+
+  status("Printing reads that do %stouch the graph\n",
+         inputs.b[0].invert ? "not " : "");
+
+  //
+  // Filter reads using async io
+  //
   for(i = 0; i < inputs.len; i++) {
     inputs.b[i].stats = &seq_stats;
-    inputs.b[i].db_graph = &db_graph;
+    inputs.b[i].db_graph = use_disk || use_stream ? NULL : &db_graph;
+    inputs.b[i].disk = disk;
+    inputs.b[i].num_disk = use_disk ? num_gfiles : 0;
+    inputs.b[i].kmer_size = kmer_size;
+  }
+
+  // Each thread keeps one block cache per compressed graph on disk
+  BgzfCache *caches = NULL;
+  if(use_disk) {
+    caches = ctx_malloc(nthreads * num_gfiles * sizeof(BgzfCache));
+    for(i = 0; i < nthreads * num_gfiles; i++)
+      caches[i] = (BgzfCache)BGZF_CACHE_INIT;
   }
 
   // Deal with a set of files at once
@@ -315,7 +511,12 @@ int ctx_reads(int argc, char **argv)
   {
     // Can have different numbers of inputs vs threads
     end = MIN2(inputs.len, start+MAX_IO_THREADS);
-    asyncio_run_pool(files.b+start, end-start, filter_reads, NULL, nthreads, 0);
+    asyncio_run_pool(files.b+start, end-start, filter_reads, caches, nthreads, 0);
+  }
+
+  if(use_disk) {
+    for(i = 0; i < nthreads * num_gfiles; i++) bgzf_cache_dealloc(&caches[i]);
+    ctx_free(caches);
   }
 
   size_t total_reads_printed = 0;
@@ -327,6 +528,7 @@ int ctx_reads(int argc, char **argv)
   for(i = 0; i < inputs.len; i++) {
     seqout_close(&inputs.b[i].seqout, false);
     asyncio_task_close(&files.b[i]);
+    ctx_free(inputs.b[i].hits);
   }
 
   aln_reads_buf_dealloc(&inputs);
@@ -336,7 +538,19 @@ int ctx_reads(int argc, char **argv)
          total_reads_printed, total_reads,
          total_reads ? (100.0 * total_reads_printed) / total_reads : 0.0);
 
-  db_graph_dealloc(&db_graph);
+  if(use_disk) {
+    for(i = 0; i < num_gfiles; i++) {
+      graph_search_destroy(disk[i]);
+      graph_file_close(&gfiles[i]);
+    }
+    ctx_free(disk);
+  }
+  else if(use_stream) {
+    for(i = 0; i < num_gfiles; i++) graph_file_close(&gfiles[i]);
+  }
+  else db_graph_dealloc(&db_graph);
+
+  ctx_free(gfiles);
 
   return EXIT_SUCCESS;
 }
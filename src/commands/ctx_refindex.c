@@ -0,0 +1,165 @@
+#include "global.h"
+#include "commands.h"
+#include "util.h"
+#include "file_util.h"
+#include "seq_reader.h"
+#include "kmer_occur.h"
+
+const char refindex_usage[] =
+"usage: "CMD" refindex [options] -k <K> -o <out.idx> <ref.fa> [ref2.fa ...]\n"
+"\n"
+"  Index where each kmer occurs in a reference genome, so that commands such\n"
+"  as `"CMD" breakpoints --index` can load it without re-indexing the\n"
+"  reference each time. The index is memory mapped when loaded.\n"
+"\n"
+"  -h, --help            This help message\n"
+"  -q, --quiet           Silence status output normally printed to STDERR\n"
+"  -f, --force           Overwrite output files\n"
+"  -o, --out <out.idx>   Save index to file [required]\n"
+"  -m, --memory <mem>    Memory to use\n"
+"  -n, --nkmers <kmers>  Number of hash table entries (e.g. 1G ~ 1 billion)\n"
+"  -t, --threads <T>     Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
+"  -k, --kmer <kmer>     Kmer size must be odd ("QUOTE_VALUE(MAX_KMER_SIZE)" >= k >= "QUOTE_VALUE(MIN_KMER_SIZE)")\n"
+"\n";
+
+static struct option longopts[] =
+{
+// General options
+  {"help",         no_argument,       NULL, 'h'},
+  {"out",          required_argument, NULL, 'o'},
+  {"force",        no_argument,       NULL, 'f'},
+  {"memory",       required_argument, NULL, 'm'},
+  {"nkmers",       required_argument, NULL, 'n'},
+  {"threads",      required_argument, NULL, 't'},
+// command specific
+  {"kmer",         required_argument, NULL, 'k'},
+  {NULL, 0, NULL, 0}
+};
+
+int ctx_refindex(int argc, char **argv)
+{
+  struct MemArgs memargs = MEM_ARGS_INIT;
+  size_t kmer_size = 0, nthreads = 0;
+  const char *output_file = NULL;
+
+  // Arg parsing
+  char cmd[100], shortopts[100];
+  cmd_long_opts_to_short(longopts, shortopts, sizeof(shortopts));
+  int c;
+
+  while((c = getopt_long_only(argc, argv, shortopts, longopts, NULL)) != -1) {
+    cmd_get_longopt_str(longopts, c, cmd, sizeof(cmd));
+    switch(c) {
+      case 0: /* flag set */ break;
+      case 'h': cmd_print_usage(NULL); break;
+      case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
+      case 'o': cmd_check(!output_file, cmd); output_file = optarg; break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
+      case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
+      case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
+      case 'k': cmd_check(!kmer_size,cmd); kmer_size = cmd_kmer_size(cmd, optarg); break;
+      case ':': /* BADARG */
+      case '?': /* BADCH getopt_long has already printed error */
+        // cmd_print_usage(NULL);
+        cmd_print_usage("`"CMD" refindex -h` for help. Bad option: %s", argv[optind-1]);
+      default: abort();
+    }
+  }
+
+  // Defaults
+  if(!nthreads) nthreads = DEFAULT_NTHREADS;
+
+  if(!kmer_size) cmd_print_usage("kmer size not set with -k <K>");
+  if(!output_file) cmd_print_usage("Please specify an output file with -o <out.idx>");
+
+  if(optind >= argc)
+    cmd_print_usage("Please specify at least one reference file (.fa, .fa.gz etc.)");
+
+  size_t i, num_seq_files = argc - optind;
+  char **seq_paths = argv + optind;
+  seq_file_t **seq_files = ctx_calloc(num_seq_files, sizeof(seq_file_t*));
+
+  for(i = 0; i < num_seq_files; i++)
+    if((seq_files[i] = seq_open(seq_paths[i])) == NULL)
+      die("Cannot read sequence file %s", seq_paths[i]);
+
+  // Estimate number of bases
+  // set to -1 if we cannot calc
+  int64_t est_num_bases = seq_est_seq_bases(seq_files, num_seq_files);
+  if(est_num_bases < 0) {
+    warn("Cannot get file sizes, using pipes");
+    est_num_bases = memargs.num_kmers * IDEAL_OCCUPANCY;
+  }
+
+  status("[memory] Estimated number of bases: %li", (long)est_num_bases);
+
+  //
+  // Decide on memory
+  //
+  size_t bits_per_kmer, kmers_in_hash, graph_mem;
+  size_t mem_to_use = memargs.mem_to_use;
+
+  // kmer memory = kmer + Edges + occurrence list + hkey when sorting on save
+  bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(Edges)*8 +
+                  (sizeof(KONodeList) + sizeof(KOccur))*8 + // see kmer_occur.h
+                  sizeof(hkey_t)*8;
+
+  if(mem_to_use < (size_t)est_num_bases) {
+    warn("You probably need at least %zu bytes (> %zu)",
+         (size_t)est_num_bases, memargs.mem_to_use);
+  }
+  else {
+    mem_to_use -= est_num_bases;
+  }
+
+  kmers_in_hash = cmd_get_kmers_in_hash(mem_to_use,
+                                        memargs.mem_to_use_set,
+                                        memargs.num_kmers,
+                                        memargs.num_kmers_set,
+                                        bits_per_kmer,
+                                        0, est_num_bases,
+                                        true, &graph_mem);
+
+  // 1 byte per kmer for each base to load sequence files
+  size_t total_mem = kmers_in_hash*bits_per_kmer/8 + est_num_bases;
+
+  char memstr[50];
+  bytes_to_str(total_mem, 1, memstr);
+  status("[memory] total mem with input: %s\n", memstr);
+
+  cmd_check_mem_limit(memargs.mem_to_use, total_mem);
+
+  futil_create_output(output_file);
+
+  //
+  // Set up memory
+  //
+  dBGraph db_graph;
+  db_graph_alloc(&db_graph, kmer_size, 1, 1, kmers_in_hash,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_BKTLOCKS);
+
+  //
+  // Load reference sequence into a read buffer
+  //
+  ReadBuffer rbuf;
+  read_buf_alloc(&rbuf, 1024);
+  seq_load_all_reads(seq_files, num_seq_files, &rbuf);
+  kograph_clean_read_names(rbuf.b, rbuf.len);
+
+  KOGraph kograph = kograph_create(rbuf.b, rbuf.len, true, 0,
+                                   nthreads, &db_graph);
+
+  // Free sequence memory before sorting kmers
+  for(i = 0; i < rbuf.len; i++) seq_read_dealloc(&rbuf.b[i]);
+  read_buf_dealloc(&rbuf);
+  ctx_free(seq_files);
+
+  hash_table_print_stats(&db_graph.ht);
+
+  kograph_save(&kograph, output_file, nthreads, &db_graph);
+
+  kograph_dealloc(&kograph);
+  db_graph_dealloc(&db_graph);
+
+  return EXIT_SUCCESS;
+}
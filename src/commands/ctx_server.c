@@ -27,6 +27,10 @@ const char server_usage[] =
 "  -C, --coverages       Load coverages for kmers+links\n"
 "  -E, --edges           Load per sample edges\n"
 "  -D, --disk            Read from disk (one graph only, must be sorted)\n"
+"  -I, --index <in.idx>  Index for --disk from `"CMD" index` [default: <in.ctx>.idx]\n"
+"\n"
+"  With --disk, links in binary link files (see `"CMD" pjoin --binary`) are\n"
+"  fetched from disk for each query rather than loaded into memory.\n"
 "\n";
 
 static struct option longopts[] =
@@ -40,6 +44,7 @@ static struct option longopts[] =
   {"coverages",    no_argument,       NULL, 'C'},
   {"edges",        no_argument,       NULL, 'E'},
   {"disk",         no_argument,       NULL, 'D'},
+  {"index",        required_argument, NULL, 'I'},
   {NULL, 0, NULL, 0}
 };
 
@@ -52,8 +57,17 @@ typedef struct {
   Edges *edges;
   size_t ncols, nedges;
   bool binary_covgs;
+  const GPath *links; // linked list of links for this kmer
+  BgzfCache *cache; // last block read from a compressed graph on disk
 } ServerQuery;
 
+// Binary link files that we fetch links from for each query
+typedef struct {
+  GPathReader *files;
+  size_t nfiles;
+  GPathSet gpset; // links for the current query
+} DiskLinks;
+
 static void query_alloc(ServerQuery *q, size_t ncols,
                         bool binary_covgs, bool flatten_edges)
 {
@@ -70,6 +84,7 @@ static void query_dealloc(ServerQuery *q) {
 }
 
 static inline void kmer_response(StrBuf *resp, ServerQuery q, bool pretty,
+                                 const GPathSet *gpset,
                                  const dBGraph *db_graph)
 {
   size_t i;
@@ -119,8 +134,7 @@ static inline void kmer_response(StrBuf *resp, ServerQuery q, bool pretty,
   // Links
   // {"forward": true, "juncs": "ACAA", "colours": [0,0,1]}
   size_t nlinks;
-  const GPath *gpath = gpath_store_safe_fetch(&db_graph->gpstore, q.node.key);
-  const GPathSet *gpset = &db_graph->gpstore.gpset;
+  const GPath *gpath = q.links;
   for(nlinks = 0; gpath != NULL; gpath = gpath->next, nlinks++)
   {
     if(nlinks) strbuf_append_str(resp, pretty ? ",\n            " : ", ");
@@ -134,7 +148,7 @@ static inline void kmer_response(StrBuf *resp, ServerQuery q, bool pretty,
 
     // Print link colours
     // counts may be null if user did not specify -C,--coverages
-    uint8_t *counts = gpath_set_get_nseen(gpset, gpath);
+    uint8_t *counts = q.binary_covgs ? NULL : gpath_set_get_nseen(gpset, gpath);
     strbuf_append_str(resp, "\", \"colours\": [");
     for(i = 0; i < db_graph->num_of_cols; i++) {
       if(i) strbuf_append_char(resp, ',');
@@ -152,12 +166,46 @@ static inline void query_fetch_from_graph(ServerQuery *q, const dBGraph *db_grap
 {
   size_t i;
   for(i = 0; i < q->ncols; i++)
-    q->covgs[i] = db_graph->col_covgs ? db_node_get_covg(db_graph, q->node.key, i)
+    q->covgs[i] = db_graph_has_covgs(db_graph) ? db_node_get_covg(db_graph, q->node.key, i)
                                       : db_node_has_col(db_graph, q->node.key, i);
   for(i = 0; i < q->nedges; i++)
     q->edges[i] = db_node_get_edges(db_graph, q->node.key, i);
 }
 
+// Fetch links for q->bkey from binary link files on disk. Links seen in
+// more than one file are merged.
+static inline void query_fetch_links_from_disk(ServerQuery *q, DiskLinks *dl)
+{
+  GPathSet *gpset = &dl->gpset;
+  GPath *gpath, *dup, *prev = NULL;
+  uint8_t *nseen, *dupnseen;
+  size_t i, j, c;
+
+  gpath_set_reset(gpset);
+  for(i = 0; i < dl->nfiles; i++)
+    gpath_reader_fetch(&dl->files[i], q->bkey, gpset);
+
+  q->links = NULL;
+  for(i = 0; i < gpset->entries.len; i++) {
+    gpath = &gpset->entries.b[i];
+    for(dup = (GPath*)q->links; dup && gpath_cmp(dup, gpath); dup = dup->next) {}
+    if(dup == NULL) {
+      gpath->next = NULL;
+      if(prev) prev->next = gpath;
+      else q->links = gpath;
+      prev = gpath;
+    } else {
+      gpath_colset_or_mt(dup, gpath, gpset->ncols);
+      nseen = gpath_set_get_nseen(gpset, gpath);
+      dupnseen = gpath_set_get_nseen(gpset, dup);
+      for(c = 0; c < gpset->ncols; c++) {
+        j = (size_t)dupnseen[c] + nseen[c];
+        dupnseen[c] = MIN2(j, (size_t)UINT8_MAX);
+      }
+    }
+  }
+}
+
 static inline void query_fetch_from_disk(ServerQuery *q)
 {
   size_t i;
@@ -171,6 +219,22 @@ static inline void query_fetch_from_disk(ServerQuery *q)
       q->edges[0] |= q->edges[i];
 }
 
+// Set q->links, q->node must be set unless we are reading from disk
+static inline void query_fetch_links(ServerQuery *q,
+                                     const GraphFileSearch *disk,
+                                     DiskLinks *dl, const dBGraph *db_graph)
+{
+  const GPathStore *gpstore = &db_graph->gpstore;
+  if(dl != NULL) { query_fetch_links_from_disk(q, dl); return; }
+  if(disk != NULL) {
+    // Links were loaded into the hash table, graph is on disk
+    q->node.key = gpstore->paths_all ? hash_table_find(&db_graph->ht, q->bkey)
+                                     : HASH_NOT_FOUND;
+    if(q->node.key == HASH_NOT_FOUND) { q->links = NULL; return; }
+  }
+  q->links = gpath_store_safe_fetch(gpstore, q->node.key);
+}
+
 /*
 // Query: ACACCAA
 {
@@ -193,7 +257,9 @@ static inline void query_fetch_from_disk(ServerQuery *q)
  */
 static inline bool query_response(const char *qstr, ServerQuery q,
                                   StrBuf *resp, bool pretty,
-                                  GraphFileSearch *disk, const dBGraph *db_graph)
+                                  const GraphFileSearch *disk,
+                                  DiskLinks *dl,
+                                  const dBGraph *db_graph)
 {
   size_t qlen;
   strbuf_reset(resp);
@@ -227,20 +293,24 @@ static inline bool query_response(const char *qstr, ServerQuery q,
     query_fetch_from_graph(&q, db_graph);
   }
   else {
-    if(!graph_search_find(disk, q.bkey, q.covgs, q.edges)) {
+    if(!graph_search_find(disk, q.bkey, q.covgs, q.edges, q.cache)) {
       strbuf_set(resp, "{}\n");
       return true;
     }
     query_fetch_from_disk(&q);
   }
 
-  kmer_response(resp, q, pretty, db_graph);
+  query_fetch_links(&q, disk, dl, db_graph);
+  kmer_response(resp, q, pretty, dl ? &dl->gpset : &db_graph->gpstore.gpset,
+                db_graph);
   return true;
 }
 
 // Reply with a random kmer
 static inline void request_random(ServerQuery q, StrBuf *resp, bool pretty,
-                                  GraphFileSearch *disk, const dBGraph *db_graph)
+                                  const GraphFileSearch *disk,
+                                  DiskLinks *dl,
+                                  const dBGraph *db_graph)
 {
   strbuf_reset(resp);
   if(disk == NULL) {
@@ -251,10 +321,12 @@ static inline void request_random(ServerQuery q, StrBuf *resp, bool pretty,
     query_fetch_from_graph(&q, db_graph);
   }
   else {
-    graph_search_rand(disk, &q.bkey, q.covgs, q.edges);
+    graph_search_rand(disk, &q.bkey, q.covgs, q.edges, q.cache);
     query_fetch_from_disk(&q);
   }
-  kmer_response(resp, q, pretty, db_graph);
+  query_fetch_links(&q, disk, dl, db_graph);
+  kmer_response(resp, q, pretty, dl ? &dl->gpset : &db_graph->gpstore.gpset,
+                db_graph);
 }
 
 static char* make_info_json_str(cJSON **hdrs, size_t nhdrs,
@@ -291,6 +363,7 @@ int ctx_server(int argc, char **argv)
   bool binary_covgs = true; // Binary coverage instead of full coverage
   bool per_col_edges = false; // Load per sample or pooled edges
   bool use_disk = false;
+  const char *idx_path = NULL;
 
   // Arg parsing
   char cmd[100];
@@ -317,6 +390,7 @@ int ctx_server(int argc, char **argv)
       case 'C': cmd_check(binary_covgs, cmd); binary_covgs = false; break;
       case 'E': cmd_check(!per_col_edges, cmd); per_col_edges = true; break;
       case 'D': cmd_check(!use_disk, cmd); use_disk = true; break;
+      case 'I': cmd_check(!idx_path, cmd); idx_path = optarg; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -351,6 +425,14 @@ int ctx_server(int argc, char **argv)
   if(use_disk && num_gfiles > 1)
     cmd_print_usage("Can only use --disk with one sorted graph file");
 
+  if(idx_path && !use_disk)
+    cmd_print_usage("--index <in.idx> requires --disk");
+
+  // With --disk and only binary link files, fetch links for each query
+  bool fetch_links = use_disk && gpfiles.len > 0;
+  for(i = 0; i < gpfiles.len; i++)
+    fetch_links &= gpath_reader_is_binary(&gpfiles.b[i]);
+
   //
   // Decide on memory
   //
@@ -358,7 +440,7 @@ int ctx_server(int argc, char **argv)
 
   // edges(1bytes) + kmer_paths(8bytes) + in_colour(1bit/col) +
 
-  if(use_disk && gpfiles.len == 0)
+  if(use_disk && (gpfiles.len == 0 || fetch_links))
   {
     kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
                                           memargs.mem_to_use_set,
@@ -412,9 +494,11 @@ int ctx_server(int argc, char **argv)
                  allocflags);
 
   // Paths - allocates nothing if gpfiles.len == 0
-  gpath_reader_alloc_gpstore(gpfiles.b, gpfiles.len,
-                             path_mem, !binary_covgs,
-                             &db_graph);
+  if(!fetch_links) {
+    gpath_reader_alloc_gpstore(gpfiles.b, gpfiles.len,
+                               path_mem, !binary_covgs,
+                               &db_graph);
+  }
 
   //
   // Load graphs
@@ -424,7 +508,8 @@ int ctx_server(int argc, char **argv)
   if(use_disk) {
     // Only load graph info
     graph_load_ginfo(&db_graph, &gfiles[0]);
-    disk = graph_search_new(&gfiles[0]);
+    disk = graph_search_new(&gfiles[0], idx_path);
+    if(disk == NULL) die("Cannot search graph on disk: %s", gfiles[0].fltr.path.b);
   }
   else {
     GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
@@ -437,9 +522,21 @@ int ctx_server(int argc, char **argv)
   }
 
   // Load link files
-  int link_flags = use_disk ? GPATH_ADD_MISSING_KMERS : GPATH_DIE_MISSING_KMERS;
-  for(i = 0; i < gpfiles.len; i++)
-    gpath_reader_load(&gpfiles.b[i], link_flags, &db_graph);
+  DiskLinks dlinks, *dl = NULL;
+
+  if(fetch_links) {
+    status("Fetching links from %zu binary link file(s) on disk", gpfiles.len);
+    dlinks.files = gpfiles.b;
+    dlinks.nfiles = gpfiles.len;
+    gpath_set_alloc(&dlinks.gpset, db_graph.num_of_cols, ONE_MEGABYTE,
+                    true, true);
+    dl = &dlinks;
+  }
+  else {
+    int link_flags = use_disk ? GPATH_ADD_MISSING_KMERS : GPATH_DIE_MISSING_KMERS;
+    for(i = 0; i < gpfiles.len; i++)
+      gpath_reader_load(&gpfiles.b[i], link_flags, &db_graph);
+  }
 
   hash_table_print_stats(&db_graph.ht);
 
@@ -453,10 +550,12 @@ int ctx_server(int argc, char **argv)
                                       nkmers_in_graph, &db_graph);
   ctx_free(hdrs);
 
-  // Close input link files
-  for(i = 0; i < gpfiles.len; i++)
-    gpath_reader_close(&gpfiles.b[i]);
-  gpfile_buf_dealloc(&gpfiles);
+  // Close input link files, unless we are fetching links from them
+  if(!fetch_links) {
+    for(i = 0; i < gpfiles.len; i++)
+      gpath_reader_close(&gpfiles.b[i]);
+    gpfile_buf_dealloc(&gpfiles);
+  }
 
   // Answer queries
   StrBuf line, response;
@@ -466,7 +565,9 @@ int ctx_server(int argc, char **argv)
   bool success;
 
   ServerQuery q;
+  BgzfCache disk_cache = BGZF_CACHE_INIT;
   query_alloc(&q, db_graph.num_of_cols, binary_covgs, !per_col_edges);
+  q.cache = &disk_cache;
 
   // Read from input
   while(1)
@@ -484,12 +585,13 @@ int ctx_server(int argc, char **argv)
       fflush(stdout);
     }
     else if(strcasecmp(line.b,"random") == 0) {
-      request_random(q, &response, pretty, disk, &db_graph);
+      request_random(q, &response, pretty, disk, dl, &db_graph);
       fputs(response.b, stdout);
       fflush(stdout);
     }
     else {
-      success = query_response(line.b, q, &response, pretty, disk, &db_graph);
+      success = query_response(line.b, q, &response, pretty, disk, dl,
+                               &db_graph);
       if(response.end) {
         fputs(response.b, stdout);
         fflush(stdout);
@@ -505,6 +607,14 @@ int ctx_server(int argc, char **argv)
   status("Answered %s queries, %s bad queries", nstr, badstr);
 
   query_dealloc(&q);
+  bgzf_cache_dealloc(&disk_cache);
+
+  if(fetch_links) {
+    gpath_set_dealloc(&dlinks.gpset);
+    for(i = 0; i < gpfiles.len; i++)
+      gpath_reader_close(&gpfiles.b[i]);
+    gpfile_buf_dealloc(&gpfiles);
+  }
 
   if(disk) {
     graph_search_destroy(disk);
@@ -5,19 +5,22 @@
 #include "graphs_load.h"
 #include "graph_writer.h"
 #include "binary_kmer.h"
+#include "binary_kmer_sort.h"
 
 // TODO: add .ctp.gz sorting
 
 const char sort_usage[] =
 "usage: "CMD" sort [options] <in.ctx>\n"
 "\n"
-"  Sort a cortex graph file. Loads entire graph into memory then sorts.\n"
+"  Sort a cortex graph file. If the graph does not fit in memory (-m), sorted\n"
+"  runs are written to a temporary file then merged.\n"
 "\n"
 "  -h, --help              This help message\n"
 "  -q, --quiet             Silence status output normally printed to STDERR\n"
 "  -f, --force             Overwrite output files\n"
 "  -m, --memory <mem>      Memory to use\n"
 "  -n, --nkmers <kmers>    Number of hash table entries (e.g. 1G ~ 1 billion)\n"
+"  -t, --threads <T>       Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "  -o, --out <out.ctx>     Output file [default: overwrite input]\n"
 "\n";
 
@@ -27,19 +30,109 @@ static struct option longopts[] =
   {"force",        no_argument,       NULL, 'f'},
   {"memory",       required_argument, NULL, 'm'},
   {"nkmers",       required_argument, NULL, 'n'},
+  {"threads",      required_argument, NULL, 't'},
   {"out",          required_argument, NULL, 'o'},
   {NULL, 0, NULL, 0}
 };
 
-// Sort graph file entries. Pointers must point to binary kmer
-static inline void sort_block(char **entries, size_t num)
+//
+// A sorted run of graph file entries, either in memory or in a temporary file.
+// Runs are merged with a heap.
+//
+typedef struct
 {
-  qsort(entries, num, sizeof(char*), binary_kmers_qcmp_unaligned_ptrs);
+  const char *curr; // current entry, NULL once run is finished
+  // In memory
+  char **next, **end;
+  // In a temporary file
+  int fd;
+  off_t offset; // offset of next entry to read into buf
+  size_t nrem; // entries not yet read into buf
+  char *buf;
+  size_t buf_cap, buf_len, buf_idx; // in entries
+  size_t kmer_mem;
+} SortRun;
+
+static void sort_run_next(SortRun *run)
+{
+  if(run->buf == NULL) {
+    run->curr = (run->next < run->end ? *(run->next++) : NULL);
+    return;
+  }
+
+  if(run->buf_idx == run->buf_len) {
+    if(run->nrem == 0) { run->curr = NULL; return; }
+    size_t n = MIN2(run->nrem, run->buf_cap), nbytes = n * run->kmer_mem;
+    if(pread(run->fd, run->buf, nbytes, run->offset) != (ssize_t)nbytes)
+      die("Cannot read temporary file [%s]", strerror(errno));
+    run->offset += nbytes;
+    run->nrem -= n;
+    run->buf_len = n;
+    run->buf_idx = 0;
+  }
+
+  run->curr = run->buf + run->kmer_mem * run->buf_idx++;
+}
+
+static inline bool sort_run_lt(const SortRun *a, const SortRun *b)
+{
+  return binary_kmers_qcmp_unaligned_ptrs(&a->curr, &b->curr) < 0;
+}
+
+static void sort_heap_down(SortRun **heap, size_t n, size_t i)
+{
+  size_t l, r, m;
+  while(1) {
+    l = 2*i+1; r = l+1; m = i;
+    if(l < n && sort_run_lt(heap[l], heap[m])) m = l;
+    if(r < n && sort_run_lt(heap[r], heap[m])) m = r;
+    if(m == i) break;
+    SWAP(heap[i], heap[m]);
+    i = m;
+  }
+}
+
+// Merge sorted runs into fout. Returns number of entries written.
+static size_t sort_runs_merge(SortRun *runs, size_t nruns,
+                              FILE *fout, size_t kmer_mem)
+{
+  SortRun **heap = ctx_calloc(nruns, sizeof(SortRun*));
+  size_t i, n = 0, nwritten = 0;
+
+  for(i = 0; i < nruns; i++) {
+    sort_run_next(&runs[i]);
+    if(runs[i].curr != NULL) heap[n++] = &runs[i];
+  }
+
+  for(i = n/2; i-- > 0; ) sort_heap_down(heap, n, i);
+
+  while(n > 0) {
+    if(fwrite(heap[0]->curr, 1, kmer_mem, fout) != kmer_mem)
+      die("Cannot write to file");
+    nwritten++;
+    sort_run_next(heap[0]);
+    if(heap[0]->curr == NULL) heap[0] = heap[--n];
+    sort_heap_down(heap, n, 0);
+  }
+
+  ctx_free(heap);
+  return nwritten;
+}
+
+// Read up to `max_kmers` entries from the graph file. Returns number read.
+static size_t sort_read_kmers(GraphFileReader *gfile, char *mem,
+                              size_t max_kmers, size_t kmer_mem)
+{
+  size_t nbytes = graph_file_fread(gfile, mem, max_kmers*kmer_mem);
+  if(nbytes % kmer_mem != 0)
+    die("Partial kmer entry at end of file: %s", file_filter_path(&gfile->fltr));
+  return nbytes / kmer_mem;
 }
 
 int ctx_sort(int argc, char **argv)
 {
   const char *out_path = NULL;
+  size_t nthreads = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
 
   // Arg parsing
@@ -59,6 +152,7 @@ int ctx_sort(int argc, char **argv)
       case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
       case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case 'o': cmd_check(!out_path, cmd); out_path = optarg; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
@@ -68,6 +162,8 @@ int ctx_sort(int argc, char **argv)
     }
   }
 
+  if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
+
   if(optind+1 != argc)
     cmd_print_usage("Require exactly one input graph file (.ctx)");
 
@@ -83,58 +179,94 @@ int ctx_sort(int argc, char **argv)
   if(!file_filter_from_direct(&gfile.fltr))
     die("Cannot open graph file with a filter ('in.ctx:blah' syntax)");
 
-  size_t num_kmers, memory;
+  if(out_path == NULL && graph_file_is_bgzf(&gfile))
+    die("Cannot sort a compressed graph in place, use -o <out.ctx>");
+  if(graph_file_is_colmajor(&gfile))
+    die("Cannot sort a column-major graph, use `"CMD" join --sort`");
 
-  // Reading from a stream
-  if(gfile.num_of_kmers < 0) {
-    if(!memargs.num_kmers_set)
-      die("If reading from a stream, must give -n <num_kmers>");
-    num_kmers = memargs.num_kmers;
-  }
-  else num_kmers = gfile.num_of_kmers;
+  graph_file_set_threads(&gfile, nthreads);
+
+  // Reading from a stream - number of kmers is unknown unless given
+  bool nkmers_known = (gfile.num_of_kmers >= 0 || memargs.num_kmers_set);
+  size_t num_kmers = gfile.num_of_kmers >= 0 ? (size_t)gfile.num_of_kmers
+                                             : memargs.num_kmers;
 
   // Open output path (if given)
-  FILE *fout = out_path ? futil_fopen_create(out_path, "w") : NULL;
+  FILE *fout = NULL;
+  if(out_path) {
+    fout = graph_writer_compress(futil_fopen_create(out_path, "w"), out_path,
+                                 nthreads);
+  }
 
   size_t i;
   size_t ncols = gfile.hdr.num_of_cols;
   size_t kmer_mem = sizeof(BinaryKmer) + (sizeof(Edges)+sizeof(Covg))*ncols;
+  // pointer + 16 bit radix sort digit per entry
+  size_t entry_mem = sizeof(char*) + sizeof(uint16_t) + kmer_mem;
 
-  memory = (sizeof(char*) + kmer_mem) * num_kmers;
-
-  char mem_str[50];
-  bytes_to_str(memory, 1, mem_str);
+  // Number of entries we can sort in memory at once
+  size_t max_kmers = memargs.mem_to_use / entry_mem;
+  bool in_memory = nkmers_known && num_kmers <= max_kmers;
 
-  if(memory > memargs.mem_to_use)
-    die("Require at least %s memory", mem_str);
+  if(max_kmers == 0) die("Not enough memory to sort (-m)");
 
+  char mem_str[50];
+  bytes_to_str(in_memory ? num_kmers*entry_mem : max_kmers*entry_mem, 1, mem_str);
   status("[memory] Total: %s", mem_str);
+  status("[sort] %s sort with %zu threads",
+         in_memory ? "In memory" : "External", nthreads);
+
+  size_t chunk_kmers = in_memory ? MAX2(num_kmers,1) : max_kmers;
+  char *mem = ctx_malloc(kmer_mem * chunk_kmers);
+  char **kmers = ctx_malloc(chunk_kmers * sizeof(char*));
+  SortRun run = {.fd = -1}, *runs = &run;
+  size_t nkread, total_kmers = 0;
+
+  // Temporary file for external sort
+  StrBuf tmp_path;
+  strbuf_alloc(&tmp_path, 1024);
+  FILE *tmp_fh = NULL;
+  SizeBuffer run_starts; // offset of each run in tmp file, in entries
+  size_buf_alloc(&run_starts, 64);
+
+  while((nkread = sort_read_kmers(&gfile, mem, chunk_kmers, kmer_mem)) > 0)
+  {
+    total_kmers += nkread;
+    for(i = 0; i < nkread; i++) kmers[i] = mem + kmer_mem*i;
+    binary_kmer_sort_ptrs((void**)kmers, nkread, nthreads);
+    run = (SortRun){.next = kmers, .end = kmers+nkread, .fd = -1};
+
+    if(in_memory) {
+      // check we are at the end of the file
+      char tmpc;
+      if(graph_file_fread(&gfile, &tmpc, 1) != 0) {
+        die("More kmers in file than believed (kmers: %zu ncols: %zu).",
+            num_kmers, ncols);
+      }
+      break;
+    }
 
-  char *mem = ctx_malloc(kmer_mem * num_kmers);
-  char **kmers = ctx_malloc(num_kmers*sizeof(char*));
+    // Write sorted run to the temporary file
+    if(tmp_fh == NULL) {
+      tmp_fh = futil_create_tmp_file(&tmp_path, out_path ? out_path : ctx_path);
+      status("[sort] Temporary file: %s", tmp_path.b);
+    }
 
-  // Read in whole file
-  // if(graph_file_fseek(gfile, gfile.hdr_size, SEEK_SET) != 0) die("fseek failed");
-  size_t nkread = graph_file_fread(&gfile, mem, num_kmers*kmer_mem);
+    size_buf_push(&run_starts, &total_kmers, 1); // end of this run
+    sort_runs_merge(&run, 1, tmp_fh, kmer_mem);
 
-  if(nkread != num_kmers*kmer_mem)
-    die("Could only read %zu bytes [<%zu]", nkread, num_kmers*kmer_mem);
+    status("[sort] Written %zu sorted runs (%zu kmers)",
+           run_starts.len, total_kmers);
+  }
 
-  // check we are at the end of the file
-  char tmpc;
-  if(graph_file_fread(&gfile, &tmpc, 1) != 0) {
-    die("More kmers in file than believed (kmers: %zu ncols: %zu).",
-        num_kmers, ncols);
+  if(nkmers_known && total_kmers != num_kmers) {
+    die("Number of kmers in file doesn't match (read: %zu expected: %zu)",
+        total_kmers, num_kmers);
   }
 
-  status("Read %zu kmers with %zu colour%s", num_kmers,
+  status("Read %zu kmers with %zu colour%s", total_kmers,
          ncols, util_plural_str(ncols));
 
-  for(i = 0; i < num_kmers; i++)
-    kmers[i] = mem + kmer_mem*i;
-
-  sort_block(kmers, num_kmers);
-
   // Print
   if(out_path != NULL) {
     // saving to a different destination - write header
@@ -147,12 +279,48 @@ int ctx_sort(int argc, char **argv)
     fout = gfile.fh;
   }
 
-  for(i = 0; i < num_kmers; i++)
-    if(fwrite(kmers[i], 1, kmer_mem, fout) != kmer_mem)
-      die("Cannot write to file");
+  size_t nruns = in_memory ? 1 : run_starts.len;
+
+  if(!in_memory && nruns > 0)
+  {
+    // Free sorting memory, then split it between the runs to read back in
+    ctx_free(kmers);
+    ctx_free(mem);
+    kmers = NULL;
+
+    size_t buf_kmers = (max_kmers * entry_mem) / (nruns * kmer_mem);
+    if(buf_kmers == 0)
+      die("Not enough memory to merge %zu sorted runs (-m)", nruns);
+
+    mem = ctx_malloc(buf_kmers * kmer_mem * nruns);
+    runs = ctx_calloc(nruns, sizeof(SortRun));
+
+    if(fflush(tmp_fh) != 0)
+      die("Cannot write temporary file: %s [%s]", tmp_path.b, strerror(errno));
+
+    size_t start = 0;
+    for(i = 0; i < nruns; i++) {
+      runs[i] = (SortRun){.fd = fileno(tmp_fh),
+                          .offset = (off_t)(start * kmer_mem),
+                          .nrem = run_starts.b[i] - start,
+                          .buf = mem + buf_kmers * kmer_mem * i,
+                          .buf_cap = buf_kmers, .kmer_mem = kmer_mem};
+      start = run_starts.b[i];
+    }
+
+    status("[sort] Merging %zu sorted runs", nruns);
+  }
+
+  if(total_kmers > 0 && sort_runs_merge(runs, nruns, fout, kmer_mem) != total_kmers)
+    die("Merging lost kmers");
+
+  if(runs != &run) ctx_free(runs);
 
   if(out_path) fclose(fout);
+  if(tmp_fh) fclose(tmp_fh);
 
+  strbuf_dealloc(&tmp_path);
+  size_buf_dealloc(&run_starts);
   graph_file_close(&gfile);
   ctx_free(kmers);
   ctx_free(mem);
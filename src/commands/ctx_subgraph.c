@@ -11,6 +11,7 @@
 #include "graphs_load.h"
 #include "graph_writer.h"
 #include "subgraph.h"
+#include "graph_search.h"
 #include "hash_mem.h" // for calculating mem usage
 
 const char subgraph_usage[] =
@@ -35,6 +36,18 @@ const char subgraph_usage[] =
 // "  -D, --udist <N>       Number of unitigs to extend by [default: 0]\n"
 "  -v, --invert          Dump kmers not in subgraph\n"
 "  -U, --unitigs         Grab entire runs of kmers that are touched by a read\n"
+"  -D, --disk            Search sorted graphs on disk, only load the subgraph\n"
+"  -S, --stream          Stream sorted graphs past sorted batches of kmers\n"
+"\n"
+"  With --disk, graphs must be sorted (`"CMD" sort`) and are searched using the\n"
+"  block index <in.ctx>.idx (see `"CMD" index`), which is built and saved if it\n"
+"  does not exist. Memory is only needed for the subgraph. All colours are\n"
+"  loaded; --invert and --unitigs are not supported.\n"
+"\n"
+"  With --stream, seed kmers are sorted in batches and merged against each\n"
+"  sorted graph, reading the graphs once per batch and once per step of --dist.\n"
+"  A quarter of --memory is used for batches, the rest holds the subgraph. The\n"
+"  same restrictions as --disk apply.\n"
 "\n";
 
 static struct option longopts[] =
@@ -54,6 +67,8 @@ static struct option longopts[] =
   // {"sdist",        required_argument, NULL, 'D'},
   {"invert",       no_argument,       NULL, 'v'},
   {"unitigs",      no_argument,       NULL, 'U'},
+  {"disk",         no_argument,       NULL, 'D'},
+  {"stream",       no_argument,       NULL, 'S'},
   {NULL, 0, NULL, 0}
 };
 
@@ -63,7 +78,7 @@ int ctx_subgraph(int argc, char **argv)
   struct MemArgs memargs = MEM_ARGS_INIT;
   const char *out_path = NULL;
   size_t i, j, use_ncols = 0, dist = 0;
-  bool invert = false, grab_unitigs = false;
+  bool invert = false, grab_unitigs = false, use_disk = false, use_stream = false;
 
   seq_file_t *tmp_sfile;
   SeqFilePtrBuffer sfilebuf;
@@ -93,8 +108,9 @@ int ctx_subgraph(int argc, char **argv)
         break;
       case 'd': cmd_check(!dist,cmd); dist = cmd_uint32(cmd, optarg); break;
       case 'v': cmd_check(!invert,cmd); invert = true; break;
-      case 'S':
       case 'U': cmd_check(!grab_unitigs,cmd); grab_unitigs = true; break;
+      case 'D': cmd_check(!use_disk,cmd); use_disk = true; break;
+      case 'S': cmd_check(!use_stream,cmd); use_stream = true; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -109,6 +125,11 @@ int ctx_subgraph(int argc, char **argv)
 
   if(sfilebuf.len == 0) cmd_print_usage("Require at least one --seq file");
   if(optind >= argc) cmd_print_usage("Require input graph files (.ctx)");
+  if(use_disk && use_stream) cmd_print_usage("Cannot use --disk and --stream together");
+  if((use_disk || use_stream) && invert)
+    cmd_print_usage("Cannot use --invert with --disk or --stream");
+  if((use_disk || use_stream) && grab_unitigs)
+    cmd_print_usage("Cannot use --unitigs with --disk or --stream");
 
   size_t num_gfiles = argc - optind;
   char **gfile_paths = argv + optind;
@@ -122,6 +143,9 @@ int ctx_subgraph(int argc, char **argv)
   total_cols = graph_files_open(gfile_paths, gfiles, num_gfiles,
                                 &ctx_max_kmers, &ctx_sum_kmers);
 
+  // Only the subgraph is loaded, so we can hold all colours
+  if(use_disk || use_stream) use_ncols = total_cols;
+
   if(use_ncols < total_cols && (out_path == NULL || strcmp(out_path,"-")==0))
     cmd_print_usage("Need to use --ncols %zu if output is stdout", total_cols);
 
@@ -130,40 +154,59 @@ int ctx_subgraph(int argc, char **argv)
   //
   use_ncols = MIN2(use_ncols, total_cols);
   size_t bits_per_kmer, kmers_in_hash, graph_mem;
-  size_t num_of_fringe_nodes, fringe_mem, total_mem;
+  size_t num_of_fringe_nodes, fringe_mem = 0, query_mem = 0, total_mem;
   char graph_mem_str[100], fringe_mem_str[100], num_fringe_nodes_str[100];
 
   bits_per_kmer = sizeof(BinaryKmer)*8 +
                   ((sizeof(Edges) + sizeof(Covg))*use_ncols*8 + 1);
 
-  kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
-                                        memargs.mem_to_use_set,
-                                        memargs.num_kmers,
-                                        memargs.num_kmers_set,
-                                        bits_per_kmer,
-                                        ctx_max_kmers, ctx_sum_kmers,
-                                        false, &graph_mem);
-
-  graph_mem = hash_table_mem(kmers_in_hash, bits_per_kmer, NULL);
-  bytes_to_str(graph_mem, 1, graph_mem_str);
-
-  if(graph_mem >= memargs.mem_to_use)
-    die("Not enough memory for graph (requires %s)", graph_mem_str);
-
-  // Fringe nodes
-  fringe_mem = memargs.mem_to_use - graph_mem;
-  num_of_fringe_nodes = fringe_mem / (sizeof(dBNode) * 2);
-  ulong_to_str(num_of_fringe_nodes, num_fringe_nodes_str);
-  bytes_to_str(fringe_mem, 1, fringe_mem_str);
-
-  status("[memory] fringe nodes: %s (%s)\n", fringe_mem_str, num_fringe_nodes_str);
-
-  if(dist > 0 && fringe_mem < 1024)
-    die("Not enough memory for the graph search (set -m <mem> higher)");
-
-  // Don't need to check, but it prints out memory
-  total_mem = graph_mem + fringe_mem;
-  cmd_check_mem_limit(memargs.mem_to_use, total_mem);
+  if(use_disk || use_stream)
+  {
+    // Hash table only holds the subgraph, the search fringe grows as needed
+    // With --stream keep a quarter of memory for batches of queries
+    if(use_stream) query_mem = memargs.mem_to_use / 4;
+
+    kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use - query_mem,
+                                          memargs.mem_to_use_set,
+                                          memargs.num_kmers,
+                                          memargs.num_kmers_set,
+                                          bits_per_kmer,
+                                          0, ctx_sum_kmers,
+                                          true, &graph_mem);
+
+    cmd_check_mem_limit(memargs.mem_to_use, graph_mem + query_mem);
+  }
+  else
+  {
+    kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
+                                          memargs.mem_to_use_set,
+                                          memargs.num_kmers,
+                                          memargs.num_kmers_set,
+                                          bits_per_kmer,
+                                          ctx_max_kmers, ctx_sum_kmers,
+                                          false, &graph_mem);
+
+    graph_mem = hash_table_mem(kmers_in_hash, bits_per_kmer, NULL);
+    bytes_to_str(graph_mem, 1, graph_mem_str);
+
+    if(graph_mem >= memargs.mem_to_use)
+      die("Not enough memory for graph (requires %s)", graph_mem_str);
+
+    // Fringe nodes
+    fringe_mem = memargs.mem_to_use - graph_mem;
+    num_of_fringe_nodes = fringe_mem / (sizeof(dBNode) * 2);
+    ulong_to_str(num_of_fringe_nodes, num_fringe_nodes_str);
+    bytes_to_str(fringe_mem, 1, fringe_mem_str);
+
+    status("[memory] fringe nodes: %s (%s)\n", fringe_mem_str, num_fringe_nodes_str);
+
+    if(dist > 0 && fringe_mem < 1024)
+      die("Not enough memory for the graph search (set -m <mem> higher)");
+
+    // Don't need to check, but it prints out memory
+    total_mem = graph_mem + fringe_mem;
+    cmd_check_mem_limit(memargs.mem_to_use, total_mem);
+  }
 
   //
   // Open output file
@@ -179,17 +222,36 @@ int ctx_subgraph(int argc, char **argv)
   db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size, use_ncols, use_ncols,
                  kmers_in_hash, DBG_ALLOC_EDGES | DBG_ALLOC_COVGS);
 
-  uint8_t *kmer_mask = ctx_calloc(roundup_bits2bytes(db_graph.ht.capacity), 1);
+  uint8_t *kmer_mask = NULL;
+  GraphFileSearch **disk = NULL;
 
   //
   // Load graphs
   //
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
 
   StrBuf intersect_gname;
   strbuf_alloc(&intersect_gname, 1024);
 
-  if(total_cols > db_graph.num_of_cols) {
+  if(use_stream) {
+    for(i = 0; i < num_gfiles; i++) {
+      if(file_filter_isstdin(&gfiles[i].fltr))
+        die("Cannot use --stream with graph from STDIN");
+      graph_load_ginfo(&db_graph, &gfiles[i]);
+    }
+  }
+  else if(use_disk) {
+    // Only load graph info, kmers are fetched from disk
+    disk = ctx_calloc(num_gfiles, sizeof(GraphFileSearch*));
+    for(i = 0; i < num_gfiles; i++) {
+      graph_load_ginfo(&db_graph, &gfiles[i]);
+      disk[i] = graph_search_new(&gfiles[i], NULL);
+      if(disk[i] == NULL)
+        die("Cannot search graph on disk: %s", file_filter_path(&gfiles[i].fltr));
+    }
+  }
+  else if(total_cols > db_graph.num_of_cols) {
     graphs_load_files_flat(gfiles, num_gfiles, gprefs, NULL);
   }
   else {
@@ -211,11 +273,29 @@ int ctx_subgraph(int argc, char **argv)
   strbuf_insert(&intersect_gname, 0, subgraphstr, strlen(subgraphstr));
   strbuf_append_char(&intersect_gname, '}');
 
-  // Load sequence and mark in first pass
-  subgraph_from_reads(&db_graph, nthreads, dist,
-                      invert, grab_unitigs,
-                      fringe_mem, kmer_mask,
-                      sfilebuf.b, sfilebuf.len);
+  if(use_stream)
+  {
+    subgraph_from_stream(&db_graph, nthreads, dist, query_mem,
+                         gfiles, num_gfiles, sfilebuf.b, sfilebuf.len);
+  }
+  else if(use_disk)
+  {
+    subgraph_from_disk(&db_graph, dist, disk, num_gfiles,
+                       sfilebuf.b, sfilebuf.len);
+
+    for(i = 0; i < num_gfiles; i++) graph_search_destroy(disk[i]);
+    ctx_free(disk);
+  }
+  else
+  {
+    kmer_mask = ctx_calloc(roundup_bits2bytes(db_graph.ht.capacity), 1);
+
+    // Load sequence and mark in first pass
+    subgraph_from_reads(&db_graph, nthreads, dist,
+                        invert, grab_unitigs,
+                        fringe_mem, kmer_mask,
+                        sfilebuf.b, sfilebuf.len);
+  }
 
   for(i = 0; i < sfilebuf.len; i++) seq_close(sfilebuf.b[i]);
   seq_file_ptr_buf_dealloc(&sfilebuf);
@@ -239,7 +319,7 @@ int ctx_subgraph(int argc, char **argv)
   graph_writer_merge_mkhdr(out_path, gfiles, num_gfiles,
                           kmers_loaded, colours_loaded,
                           intersect_edges, intersect_gname.b,
-                          false, &db_graph);
+                          false, nthreads, &db_graph);
 
   ctx_free(intersect_edges);
   strbuf_dealloc(&intersect_gname);
@@ -20,10 +20,12 @@ const char thread_usage[] =
 "  -q, --quiet              Silence status output normally printed to STDERR\n"
 "  -f, --force              Overwrite output files\n"
 "  -o, --out <out.ctp.gz>   Save output file [required]\n"
+"  -B, --binary             Save a binary indexed link file (<out.ctpb>)\n"
 "  -m, --memory <mem>       Memory to use (e.g. 1M, 20GB)\n"
 "  -n, --nkmers <N>         Number of hash table entries (e.g. 1G ~ 1 billion)\n"
 "  -t, --threads <T>        Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
-"  -p, --paths <in.ctp>     Load link file (can specify multiple times)\n"
+"  -b, --batch <N>          Pass reads between threads in batches of <N> [default: "QUOTE_VALUE(ASYNCIO_DEFAULT_BATCH)"]\n"
+"  -p, --paths <in.ctp>     Load link file, text or binary (can specify multiple times)\n"
 "  -0, --zero-paths         Zero counts on initially loaded links. Use if existing\n"
 "                           links were built from sequence being re-used by this run\n"
 "\n"
@@ -67,8 +69,10 @@ static struct option longopts[] =
   {"memory",        required_argument, NULL, 'm'},
   {"nkmers",        required_argument, NULL, 'n'},
   {"threads",       required_argument, NULL, 't'},
+  {"batch",         required_argument, NULL, 'b'},
   {"paths",         required_argument, NULL, 'p'},
   {"zero-paths",    no_argument,       NULL, '0'},
+  {"binary",        no_argument,       NULL, 'B'},
 // command specific
   {"seq",           required_argument, NULL, '1'},
   {"seq2",          required_argument, NULL, '2'},
@@ -166,7 +170,10 @@ int ctx_thread(int argc, char **argv)
   //
   // Open output file
   //
-  gzFile gzout = futil_gzopen_create(args.out_ctp_path, "w");
+  gzFile gzout = NULL;
+  FILE *fout = NULL;
+  if(args.binary_out) fout = futil_fopen_create(args.out_ctp_path, "w");
+  else gzout = futil_gzopen_create(args.out_ctp_path, "w");
 
   status("Creating paths file: %s", futil_outpath_str(args.out_ctp_path));
 
@@ -214,6 +221,7 @@ int ctx_thread(int argc, char **argv)
   // Setup for loading graphs graph
   // Don't set gprefs.empty_colours => we've already loaded paths
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = args.nthreads;
 
   // Load graph, print stats, close file
   graph_load(gfile, gprefs, NULL);
@@ -222,7 +230,8 @@ int ctx_thread(int argc, char **argv)
 
   // Load existing paths
   for(i = 0; i < gpfiles->len; i++)
-    gpath_reader_load(&gpfiles->b[i], GPATH_DIE_MISSING_KMERS, &db_graph);
+    gpath_reader_load_mt(&gpfiles->b[i], GPATH_DIE_MISSING_KMERS,
+                         args.nthreads, &db_graph);
 
   // zero link counts of already loaded links
   if(args.zero_link_counts) {
@@ -267,12 +276,19 @@ int ctx_thread(int argc, char **argv)
     cJSON_AddItemToArray(inputs_hdr, correct_aln_input_json_hdr(&inputs->b[i]));
 
   // Write output file
-  gpath_save(gzout, args.out_ctp_path, output_threads, true,
-             "thread", thread_hdr, hdrs, gpfiles->len,
-             &aln_stats->contig_histgrm, 1,
-             &db_graph);
-
-  gzclose(gzout);
+  if(args.binary_out) {
+    gpath_save_bin(fout, args.out_ctp_path, output_threads,
+                   "thread", thread_hdr, hdrs, gpfiles->len,
+                   &aln_stats->contig_histgrm, 1,
+                   &db_graph);
+    fclose(fout);
+  } else {
+    gpath_save(gzout, args.out_ctp_path, output_threads, true,
+               "thread", thread_hdr, hdrs, gpfiles->len,
+               &aln_stats->contig_histgrm, 1,
+               &db_graph);
+    gzclose(gzout);
+  }
   ctx_free(hdrs);
 
   // Optionally run path checks for debugging
@@ -9,6 +9,7 @@
 #include "graphs_load.h"
 #include "gpath_checks.h"
 #include "unitig_graph.h"
+#include "compact_graph.h"
 
 const char unitigs_usage[] =
 "usage: "CMD" unitigs [options] <in.ctx> [<in2.ctx> ...]\n"
@@ -27,6 +28,8 @@ const char unitigs_usage[] =
 "  -g, --gfa             Print in Graphical Fragment Assembly (GFA) format\n"
 "  -d, --dot             Print in graphviz (DOT) format\n"
 "  -P, --points          Used with --dot, print contigs as points\n"
+"  -c, --compact         Save compacted unitig graph for `"CMD" pop --unitigs`\n"
+"                        (binary, requires --out)\n"
 "\n"
 "  e.g. "CMD" unitigs --dot in.ctx | dot -Tpdf > in.pdf\n"
 "\n";
@@ -45,6 +48,7 @@ static struct option longopts[] =
   {"gfa",          no_argument,       NULL, 'g'},
   {"dot",          no_argument,       NULL, 'd'},
   {"points",       no_argument,       NULL, 'P'},
+  {"compact",      no_argument,       NULL, 'c'},
   {NULL, 0, NULL, 0}
 };
 
@@ -52,10 +56,12 @@ static struct option longopts[] =
 typedef enum {
   PRINT_FASTA = 0,
   PRINT_GFA = 1,
-  PRINT_DOT = 2
+  PRINT_DOT = 2,
+  PRINT_COMPACT = 3
 } UnitigSyntax;
 
-const char *syntax_strs[3] = {"FASTA", "GFA", "DOT (Graphviz)"};
+const char *syntax_strs[4] = {"FASTA", "GFA", "DOT (Graphviz)",
+                              "compacted unitig graph"};
 
 
 typedef struct
@@ -207,8 +213,9 @@ static void print_unitig_fasta(dBNodeBuffer nbuf, size_t threadid, void *arg)
 }
 
 static void print_unitig_dot(const dBNode *nodes, size_t num_nodes,
-                             size_t unitig_idx, void *arg)
+                             size_t unitig_idx, size_t threadid, void *arg)
 {
+  (void)threadid; // unused
   UnitigPrinter *p = (UnitigPrinter*)arg;
   pthread_mutex_lock(&p->outlock);
   fprintf(p->fout, "  node%zu [label=", unitig_idx);
@@ -231,14 +238,15 @@ static void print_dot_syntax(UnitigPrinter *p, bool dot_use_points)
 
   // Now print edges
   fputc('\n', p->fout);
-  hash_table_iterate(&p->db_graph->ht, p->nthreads, print_edges, p);
+  hash_table_iterate(&p->db_graph->ht, p->nthreads, NULL, print_edges, p);
   fputs("}\n", p->fout);
 }
 
 
 static void print_unitig_gfa(const dBNode *nodes, size_t num_nodes,
-                             size_t unitig_idx, void *arg)
+                             size_t unitig_idx, size_t threadid, void *arg)
 {
+  (void)threadid; // unused
   UnitigPrinter *p = (UnitigPrinter*)arg;
   pthread_mutex_lock(&p->outlock);
   fprintf(p->fout, "S\tnode%zu\t", unitig_idx);
@@ -256,7 +264,7 @@ static void print_gfa_syntax(UnitigPrinter *p)
 
   p->num_unitigs = p->ugraph.num_unitigs;
   // Now print edges
-  hash_table_iterate(&p->db_graph->ht, p->nthreads, print_edges, p);
+  hash_table_iterate(&p->db_graph->ht, p->nthreads, NULL, print_edges, p);
 }
 
 // Returns 0 on success, otherwise != 0
@@ -291,6 +299,7 @@ int ctx_unitigs(int argc, char **argv)
       case 'g': cmd_check(!syntax, cmd); syntax = PRINT_GFA; break;
       case 'd': cmd_check(!syntax, cmd); syntax = PRINT_DOT; break;
       case 'P': cmd_check(!dot_use_points, cmd); dot_use_points = true; break;
+      case 'c': cmd_check(!syntax, cmd); syntax = PRINT_COMPACT; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         die("`"CMD" unitigs -h` for help. Bad option: %s", argv[optind-1]);
@@ -301,6 +310,9 @@ int ctx_unitigs(int argc, char **argv)
   if(dot_use_points && syntax == PRINT_FASTA)
     cmd_print_usage("--point is only for use with --dot");
 
+  if(syntax == PRINT_COMPACT && out_path == NULL)
+    cmd_print_usage("--compact requires --out <out.ctu>");
+
   // Defaults for unset values
   if(out_path == NULL) out_path = "-";
   if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
@@ -328,7 +340,12 @@ int ctx_unitigs(int argc, char **argv)
   size_t bits_per_kmer, kmers_in_hash, graph_mem;
 
   bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(Edges)*8 + 1;
-  if(syntax != PRINT_FASTA) bits_per_kmer += sizeof(UnitigEnd) * 8;
+  if(syntax == PRINT_DOT || syntax == PRINT_GFA)
+    bits_per_kmer += sizeof(UnitigEnd) * 8;
+  if(syntax == PRINT_COMPACT) {
+    bits_per_kmer += sizeof(Covg) * 8 +
+                     compact_graph_bits_per_kmer(gfiles[0].hdr.kmer_size, true);
+  }
 
   kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
                                         memargs.mem_to_use_set,
@@ -348,14 +365,17 @@ int ctx_unitigs(int argc, char **argv)
   //
 
   // Print to stdout unless --out <out> is specified
-  FILE *fout = futil_fopen_create(out_path, "w");
+  FILE *fout = NULL;
+  if(syntax == PRINT_COMPACT) futil_create_output(out_path);
+  else fout = futil_fopen_create(out_path, "w");
 
   //
   // Allocate memory
   //
   dBGraph db_graph;
   db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size, 1, 1, kmers_in_hash,
-                 DBG_ALLOC_EDGES);
+                 DBG_ALLOC_EDGES |
+                 (syntax == PRINT_COMPACT ? DBG_ALLOC_COVGS : 0));
 
   UnitigPrinter printer;
   unitig_printer_init(&printer, &db_graph, nthreads, syntax, fout);
@@ -363,8 +383,11 @@ int ctx_unitigs(int argc, char **argv)
   if(syntax == PRINT_DOT || syntax == PRINT_GFA)
     unitig_graph_alloc(&printer.ugraph, &db_graph);
 
+  CompactGraph cgraph;
+
   // Load graphs
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
 
   for(i = 0; i < num_gfiles; i++) {
     file_filter_flatten(&gfiles[i].fltr, 0);
@@ -388,6 +411,13 @@ int ctx_unitigs(int argc, char **argv)
     case PRINT_DOT:
       print_dot_syntax(&printer, dot_use_points);
       break;
+    case PRINT_COMPACT:
+      compact_graph_alloc(&cgraph, &db_graph);
+      compact_graph_build(&cgraph, nthreads);
+      compact_graph_save(&cgraph, out_path);
+      printer.num_unitigs = cgraph.num_unitigs;
+      compact_graph_dealloc(&cgraph);
+      break;
     default:
       die("Invalid print syntax: %i", syntax);
   }
@@ -396,7 +426,7 @@ int ctx_unitigs(int argc, char **argv)
   ulong_to_str(printer.num_unitigs, num_unitigs_str);
   status("Dumped %s unitigs\n", num_unitigs_str);
 
-  fclose(fout);
+  if(fout != NULL) fclose(fout);
 
   unitig_printer_destroy(&printer);
   db_graph_dealloc(&db_graph);
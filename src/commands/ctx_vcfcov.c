@@ -26,6 +26,7 @@ const char vcfcov_usage[] =
 "  -f, --force            Overwrite output files\n"
 "  -m, --memory <mem>     Memory to use\n"
 "  -n, --nkmers <kmers>   Number of hash table entries (e.g. 1G ~ 1 billion)\n"
+"  -t, --threads <T>      Number of threads to use [default: 1]\n"
 "  -o, --out <out.vcf>    Output file [default: STDOUT]\n"
 "  -O, --out-fmt <f>      Format vcf|vcfgz|bcf|ubcf\n"
 "  -r, --ref <ref.fa>     Reference file [required]\n"
@@ -33,6 +34,10 @@ const char vcfcov_usage[] =
 "  -N, --max-nvars <N>    Limit haplotypes to <= N variants [default: "QUOTE_VALUE(DEFAULT_MAX_GT_VARS)"]\n"
 "  -M, --low-mem          Two-passes of VCF to only load needed kmers [default]\n"
 "  -H, --high-mem         One-pass of VCF, all kmers loaded (when streaming VCF)\n"
+"\n"
+"  With more than one thread, the VCF is split into shards between chromosomes\n"
+"  and gaps between variants. Shards are genotyped in parallel and printed in\n"
+"  input order.\n"
 "\n";
 
 static struct option longopts[] =
@@ -44,6 +49,7 @@ static struct option longopts[] =
   {"force",        no_argument,       NULL, 'f'},
   {"memory",       required_argument, NULL, 'm'},
   {"nkmers",       required_argument, NULL, 'n'},
+  {"threads",      required_argument, NULL, 't'},
   {"ref",          required_argument, NULL, 'r'},
   {"max-var-len",  required_argument, NULL, 'L'},
   {"max-nvars",    required_argument, NULL, 'N'},
@@ -60,6 +66,7 @@ int ctx_vcfcov(int argc, char **argv)
   const char *out_path = NULL, *out_type = NULL;
 
   uint32_t max_allele_len = 0, max_gt_vars = 0;
+  size_t nthreads = 0;
   char *ref_path = NULL;
   bool use_lowmem = false, use_himem = false;
 
@@ -83,6 +90,7 @@ int ctx_vcfcov(int argc, char **argv)
       case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
       case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case 'r': cmd_check(!ref_path, cmd); ref_path = optarg; break;
       case 'L': cmd_check(!max_allele_len,cmd); max_allele_len = cmd_uint32(cmd,optarg); break;
       case 'N': cmd_check(!max_gt_vars,cmd); max_gt_vars = cmd_uint32(cmd,optarg); break;
@@ -113,9 +121,11 @@ int ctx_vcfcov(int argc, char **argv)
 
   if(!max_allele_len) max_allele_len = DEFAULT_MAX_ALLELE_LEN;
   if(!max_gt_vars) max_gt_vars = DEFAULT_MAX_GT_VARS;
+  if(!nthreads) nthreads = 1;
 
   status("[vcfcov] max allele length: %u; max number of variants: %u",
          max_allele_len, max_gt_vars);
+  status("[vcfcov] Using %zu thread%s", nthreads, util_plural_str(nthreads));
 
   // open ref
   // index fasta with: samtools faidx ref.fa
@@ -218,7 +228,8 @@ int ctx_vcfcov(int argc, char **argv)
                        .kcov_alt_tag = kcov_alt_tag,
                        .max_allele_len = max_allele_len,
                        .max_gt_vars = max_gt_vars,
-                       .load_kmers_only = false};
+                       .load_kmers_only = false,
+                       .nthreads = nthreads};
 
   if(low_mem)
   {
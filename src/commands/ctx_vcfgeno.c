@@ -7,6 +7,7 @@
 
 #include <math.h> // log()
 #include <float.h> // DBL_MAX
+#include <pthread.h>
 #include "htslib/vcf.h"
 
 // TODO:
@@ -42,6 +43,7 @@ const char vcfgeno_usage[] =
 "  -f, --force          Overwrite output files\n"
 "  -o, --out <out.vcf>  Output file [default: STDOUT]\n"
 "  -O, --out-fmt <f>    Format vcf|vcfgz|bcf|ubcf\n"
+"  -t, --threads <T>    Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "  -E, --err <E>        List of sample error rates (per bp) ["DEFAULT_ERR_RATE"]\n"
 "  -D, --cov <C>        List of genome coverage per colour\n"
 "  -C, --kcov <C>       List of kmer coverage per colour\n"
@@ -74,6 +76,7 @@ static struct option longopts[] =
   {"out",          required_argument, NULL, 'o'},
   {"out-fmt",      required_argument, NULL, 'O'},
   {"force",        no_argument,       NULL, 'f'},
+  {"threads",      required_argument, NULL, 't'},
   {"err",          required_argument, NULL, 'E'},
   {"cov",          required_argument, NULL, 'D'},
   {"kcov",         required_argument, NULL, 'C'},
@@ -88,12 +91,45 @@ static struct option longopts[] =
 // Tags to use
 char kcovgs_ref_tag[10] = {0}, kcovgs_alt_tag[10] = {0};
 
-// Statistics
-uint64_t num_lines_read = 0, num_ALTs_read = 0;
-uint64_t num_missing_tags = 0; // no GT fields
-uint64_t num_missing_covgs = 0, num_non_biallelic = 0;
-uint64_t ploidy_seen[3] = {0,0,0}, num_genotypes_printed = 0;
+typedef struct
+{
+  uint64_t nlines, nalts;
+  uint64_t nmissing_tags; // no GT fields
+  uint64_t nmissing_covgs, nnon_biallelic;
+  uint64_t ploidy_seen[3], ngenotyped;
+} VcfGenoStats;
 
+static void vcfgeno_stats_merge(VcfGenoStats *dst, const VcfGenoStats *src)
+{
+  dst->nlines += src->nlines;
+  dst->nalts += src->nalts;
+  dst->nmissing_tags += src->nmissing_tags;
+  dst->nmissing_covgs += src->nmissing_covgs;
+  dst->nnon_biallelic += src->nnon_biallelic;
+  dst->ploidy_seen[0] += src->ploidy_seen[0];
+  dst->ploidy_seen[1] += src->ploidy_seen[1];
+  dst->ploidy_seen[2] += src->ploidy_seen[2];
+  dst->ngenotyped += src->ngenotyped;
+}
+
+// Per-sample model parameters
+typedef struct
+{
+  size_t nsamples, kmer_size, max_ploidy, max_gts;
+  const double *kcovgs, *log_errs;
+  const double *log_rates; // ln(kcovgs[s] / readlensk[s])
+  const size_t *readlensk;
+  const uint8_t *const* ploidy_mat; // [chrom][sample]
+  bool add_gllks, rm_vcfcov_tags;
+} VcfGenoModel;
+
+// Expected number of kmers on the ref and alt allele of a biallelic record,
+// the same for all samples
+typedef struct
+{
+  uint64_t rlenk, alenk;
+  double log_rlenk, log_alenk;
+} AlleleKmers;
 
 #define N_LFAC 1024
 double *lnfac_table = NULL; // log natural of x factorial: ln(x!)
@@ -113,17 +149,32 @@ static void math_calcs_destroy() {
 
 #define lnfac(x) ((x) < N_LFAC ? lnfac_table[x] : lgamma((x)+1))
 
-// logerr = log(seq_err)
-static double llk_hom(uint64_t covg1, uint64_t covg2, double theta1, double logerr)
+// logerr = log(seq_err), logtheta1 = log(theta1)
+static inline double llk_hom(uint64_t covg1, uint64_t covg2,
+                             double theta1, double logtheta1, double logerr)
 {
-  double logtheta1 = log(theta1); // log(err*theta) = log(err)+log(theta)
+  // log(err*theta) = log(err)+log(theta)
   return covg1 * logtheta1 - theta1 - lnfac(covg1) + covg2 * (logerr + logtheta1);
 }
 
-static double llk_het(uint64_t covg1, uint64_t covg2, double theta1, double theta2)
+// log(theta/2) = log(theta)-ln(2)
+static inline double llk_het(uint64_t covg1, uint64_t covg2,
+                             double theta1, double logtheta1,
+                             double theta2, double logtheta2)
 {
-  return covg1 * log(theta1/2) - theta1/2 - lnfac(covg1) +
-         covg2 * log(theta2/2) - theta2/2 - lnfac(covg2);
+  return covg1 * (logtheta1 - M_LN2) - theta1/2 - lnfac(covg1) +
+         covg2 * (logtheta2 - M_LN2) - theta2/2 - lnfac(covg2);
+}
+
+static void allele_kmers_init(AlleleKmers *ak, bcf1_t *v, size_t ksize)
+{
+  // Get rlen, alen in kmers
+  size_t rlen = 0, alen = 0, rshift;
+  rshift = trimmed_alt_lengths(v, 1, &rlen, &alen);
+  ak->rlenk = hap_num_exp_kmers(v->pos+rshift, rlen, ksize);
+  ak->alenk = hap_num_exp_kmers(v->pos+rshift, alen, ksize);
+  ak->log_rlenk = log(ak->rlenk);
+  ak->log_alenk = log(ak->alenk);
 }
 
 // TODO: update for ploidy > 2, nalts > 2
@@ -154,27 +205,28 @@ static inline void set_gts_missing(size_t ploidy, size_t nalts,
 /**
  * Genotype a single sample
  * param gts sample genotype goes into: gts[0..(ploidy-1)]
- * param rcovgs,acovgs are of length num_alts (fixed to 1 currently)
+ * param rcovg,acovg are the sample's ref and alt kmer coverage
+ * param ak is the number of kmers expected on each allele
  * param ploidy is this samples ploidy on the current chromosome
  * param logerr is ln(sample_err_rate)
  * param readlenk is read length in kmers
+ * param log_rate is ln(kcovg / readlenk)
  **/
-static void genotype_sample_biallelic(bcf1_t *v, size_t sampleid,
+static void genotype_sample_biallelic(size_t sampleid,
                                       int32_t *gts, size_t ngts,
                                       float *gllks, size_t ngllks,
                                       int32_t *gt_qual,
-                                      const int32_t *rcovgs,
-                                      const int32_t *acovgs,
+                                      int32_t rcovg, int32_t acovg,
+                                      const AlleleKmers *ak,
                                       double kcovg, uint8_t ploidy,
-                                      size_t ksize, double logerr,
-                                      size_t readlenk)
+                                      double logerr, size_t readlenk,
+                                      double log_rate, VcfGenoStats *stats)
 {
   ctx_assert(ploidy <= ngts);
-  ctx_assert(v->n_allele == 2);
 
-  if(rcovgs[0] == bcf_int32_missing || acovgs[0] == bcf_int32_missing)
+  if(rcovg == bcf_int32_missing || acovg == bcf_int32_missing)
   {
-    num_missing_covgs++;
+    stats->nmissing_covgs++;
     set_gts_missing(ploidy, 2, gts, ngts, gllks, ngllks, gt_qual);
   }
   else if(ploidy == 0)
@@ -186,32 +238,30 @@ static void genotype_sample_biallelic(bcf1_t *v, size_t sampleid,
     if(!readlenk)
       die("Read length is zero for sample: %zu", sampleid);
 
-    // Get rlen, alen in kmers
-    size_t rlen = 0, alen = 0, rshift;
-    rshift = trimmed_alt_lengths(v, 1, &rlen, &alen);
-
-    uint64_t rlenk = hap_num_exp_kmers(v->pos+rshift, rlen, ksize);
-    uint64_t alenk = hap_num_exp_kmers(v->pos+rshift, alen, ksize);
-
     // theta1 is expected number of reads arriving on ref allele
     // theta2 is expected number of reads arriving on alt allele
-    double theta1, theta2;
+    double theta1, theta2, logtheta1, logtheta2;
     uint64_t rkcov, akcov;
     double llk[3]; // hom1, het, hom2
     int order[3] = {0,1,2};
 
     // convert kmer coverage to num. of reads arriving, est. read arrival rate
-    theta1 = kcovg * rlenk / readlenk;
-    theta2 = kcovg * alenk / readlenk;
-    rkcov = rcovgs[0] * rlenk / readlenk;
-    akcov = acovgs[0] * alenk / readlenk;
+    theta1 = kcovg * ak->rlenk / readlenk;
+    theta2 = kcovg * ak->alenk / readlenk;
+    rkcov = rcovg * ak->rlenk / readlenk;
+    akcov = acovg * ak->alenk / readlenk;
+
+    // log(theta) from per-sample and per-record logs, no log() per sample
+    logtheta1 = log_rate + ak->log_rlenk;
+    logtheta2 = log_rate + ak->log_alenk;
 
     // given: loc_b(x) = log_a(x) / log_a(b)
     // llk_*() return natural log, divide by ln(10)=M_LN10 to get in log10
     // log10 is required by the VCFv4.2 standard for the GL tag
-    llk[0] = llk_hom(rkcov, akcov, theta1, logerr) / M_LN10;
-    llk[1] = ploidy == 2 ? llk_het(rkcov, akcov, theta1, theta2) / M_LN10 : -DBL_MAX;
-    llk[2] = llk_hom(akcov, rkcov, theta2, logerr) / M_LN10;
+    llk[0] = llk_hom(rkcov, akcov, theta1, logtheta1, logerr) / M_LN10;
+    llk[1] = ploidy == 2 ? llk_het(rkcov, akcov, theta1, logtheta1,
+                                   theta2, logtheta2) / M_LN10 : -DBL_MAX;
+    llk[2] = llk_hom(akcov, rkcov, theta2, logtheta2, logerr) / M_LN10;
 
     if(llk[order[0]] > llk[order[1]]) SWAP(order[0], order[1]);
     if(llk[order[1]] > llk[order[2]]) SWAP(order[1], order[2]);
@@ -241,86 +291,339 @@ static void genotype_sample_biallelic(bcf1_t *v, size_t sampleid,
       }
     }
 
-    num_genotypes_printed++; // non-missing genotype printed
+    stats->ngenotyped++; // non-missing genotype printed
   }
 }
 
-static void genotype_vcf(htsFile *vcffh, bcf_hdr_t *vcfhdr, htsFile *outfh,
-                         const double *kcovgs, const double *log_errs,
-                         const uint8_t *const* ploidy_mat,
-                         size_t *readlensk,
-                         size_t max_ploidy, size_t kmer_size,
-                         bool add_gllks, bool rm_vcfcov_tags)
-{
-  size_t nalts, s, nsamples = bcf_hdr_nsamples(vcfhdr);
-  bcf1_t *v = bcf_init();
-  int a, b;
+//
+// Records are decoded in batches on the reading thread, genotyped on worker
+// threads and printed in order by the worker that completes the oldest batch
+//
 
-  // ref / alt kmer coverage, one per ALT allele
-  int nkcovr = 0, nkcova = 0;
-  int32_t *kcovr = NULL, *kcova = NULL;
+// Number of record x sample genotypes per batch, with at most
+// GENO_BATCH_MAX_RECS records so that small VCFs still use every thread
+#define GENO_BATCH_GENOTYPES (1<<16)
+#define GENO_BATCH_MAX_RECS 1024
+// Number of batches per worker thread that can be read ahead of printing
+#define GENO_BATCHES_PER_THREAD 4
 
-  size_t max_gts = num_gts(max_ploidy, 2);
-  size_t ngllks = nsamples * max_gts;
+typedef struct
+{
+  bcf1_t **recs; // biallelic records with coverage, decoded by the reader
+  size_t nrecs;
+  // ref / alt kmer coverage, GTs, GQs and GLs of sample s in record r are at
+  // [r*nsamples+s] (times max_ploidy for GTs, max_gts for GLs)
+  int32_t *rcovgs, *acovgs, *gts, *gtquals;
+  float *gllks;
+  VcfGenoStats stats;
+  bool done; // has been genotyped
+} VcfGenoBatch;
+
+typedef struct
+{
+  htsFile *vcffh, *outfh;
+  bcf_hdr_t *vcfhdr;
+  const VcfGenoModel *model;
+  size_t batch_nrecs;
+
+  // Used by the reading thread to fetch coverage
+  int nkcovr, nkcova;
+  int32_t *kcovr, *kcova;
+
+  // Batches [nprinted, nread) have been read. Batches from nqueued have not
+  // been picked up by a worker. Batch i is batches[i % nbatches].
+  // Only the reading thread changes nread.
+  VcfGenoBatch *batches;
+  size_t nbatches, nread, nqueued, nprinted;
+  bool eof, printing;
+  VcfGenoStats stats; // merged when printing
+
+  pthread_mutex_t lock;
+  pthread_mutex_t hdr_lock; // held whilst reading input or printing
+  pthread_cond_t batch_read, batch_printed;
+} VcfGenoEngine;
+
+static void vcfgeno_batch_alloc(VcfGenoBatch *batch, const VcfGenoModel *model,
+                                size_t nrecs)
+{
+  size_t i, n = nrecs * model->nsamples;
+  memset(batch, 0, sizeof(*batch));
+  batch->recs = ctx_calloc(nrecs, sizeof(batch->recs[0]));
+  for(i = 0; i < nrecs; i++) batch->recs[i] = bcf_init();
+  batch->rcovgs = ctx_calloc(n, sizeof(batch->rcovgs[0]));
+  batch->acovgs = ctx_calloc(n, sizeof(batch->acovgs[0]));
+  batch->gts = ctx_calloc(n * model->max_ploidy, sizeof(batch->gts[0]));
+  batch->gtquals = ctx_calloc(n, sizeof(batch->gtquals[0]));
+  if(model->add_gllks)
+    batch->gllks = ctx_calloc(n * model->max_gts, sizeof(batch->gllks[0]));
+}
 
-  int ngts = nsamples * max_ploidy;
-  int32_t *gts = ctx_calloc(ngts, sizeof(gts[0]));
-  int32_t *gtquals = ctx_calloc(nsamples, sizeof(gtquals[0]));
-  float *gllks = add_gllks ? ctx_calloc(ngllks, sizeof(gllks[0])) : NULL;
+static void vcfgeno_batch_dealloc(VcfGenoBatch *batch, size_t nrecs)
+{
+  size_t i;
+  for(i = 0; i < nrecs; i++) bcf_destroy(batch->recs[i]);
+  ctx_free(batch->recs);
+  ctx_free(batch->rcovgs);
+  ctx_free(batch->acovgs);
+  ctx_free(batch->gts);
+  ctx_free(batch->gtquals);
+  ctx_free(batch->gllks);
+}
 
-  // Initialise lookup tables
-  math_calcs_init();
+// Read up to batch_nrecs biallelic records that have coverage into `batch`.
+// Returns false at the end of the input.
+static bool vcfgeno_batch_read(VcfGenoEngine *eng, VcfGenoBatch *batch)
+{
+  const size_t nsamples = eng->model->nsamples;
+  bcf1_t *v;
+  int a, b, rc;
 
-  // read and print
-  while(bcf_read(vcffh, vcfhdr, v) == 0)
+  batch->nrecs = 0;
+  memset(&batch->stats, 0, sizeof(batch->stats));
+
+  while(batch->nrecs < eng->batch_nrecs)
   {
+    v = batch->recs[batch->nrecs];
+
+    pthread_mutex_lock(&eng->hdr_lock);
+    rc = bcf_read(eng->vcffh, eng->vcfhdr, v);
+    pthread_mutex_unlock(&eng->hdr_lock);
+    if(rc != 0) return false;
+
     bcf_unpack(v, BCF_UN_ALL);
-    num_lines_read++;
-    num_ALTs_read += v->n_allele-1;
+    batch->stats.nlines++;
+    batch->stats.nalts += v->n_allele-1;
 
-    if(v->n_allele != 2) { num_non_biallelic++; continue; }
-    nalts = v->n_allele-1;
+    if(v->n_allele != 2) { batch->stats.nnon_biallelic++; continue; }
 
     // TODO: if add_gllks and nalts > 1, may need to resize gllks
 
-    a = bcf_get_format_int32(vcfhdr, v, kcovgs_ref_tag, &kcovr, &nkcovr);
-    b = bcf_get_format_int32(vcfhdr, v, kcovgs_alt_tag, &kcova, &nkcova);
-    if(a < 0 || b < 0) { num_missing_tags++; continue; }
+    a = bcf_get_format_int32(eng->vcfhdr, v, kcovgs_ref_tag, &eng->kcovr, &eng->nkcovr);
+    b = bcf_get_format_int32(eng->vcfhdr, v, kcovgs_alt_tag, &eng->kcova, &eng->nkcova);
+    if(a < 0 || b < 0) { batch->stats.nmissing_tags++; continue; }
+
+    // one value per sample, since there is one ALT
+    memcpy(batch->rcovgs + batch->nrecs*nsamples, eng->kcovr, nsamples*sizeof(int32_t));
+    memcpy(batch->acovgs + batch->nrecs*nsamples, eng->kcova, nsamples*sizeof(int32_t));
+    batch->nrecs++;
+  }
+
+  return true;
+}
+
+static void vcfgeno_batch_genotype(VcfGenoBatch *batch, const VcfGenoModel *m)
+{
+  const size_t nsamples = m->nsamples, max_ploidy = m->max_ploidy;
+  const size_t max_gts = m->max_gts;
+  size_t r, s, i;
+  const uint8_t *ploidies;
+  AlleleKmers ak;
+  bcf1_t *v;
+
+  for(r = 0; r < batch->nrecs; r++)
+  {
+    v = batch->recs[r];
+    allele_kmers_init(&ak, v, m->kmer_size);
+    ploidies = m->ploidy_mat[v->rid];
 
     // loop over samples
     for(s = 0; s < nsamples; s++) {
-      uint8_t ploidy = ploidy_mat[v->rid][s];
-      ploidy_seen[ploidy]++;
-      genotype_sample_biallelic(v, s,
-                                gts+max_ploidy*s, max_ploidy,
-                                gllks ? gllks+max_gts*s : NULL, max_gts,
-                                gtquals+s,
-                                kcovr+nalts*s, kcova+nalts*s,
-                                kcovgs[s], ploidy, kmer_size, log_errs[s],
-                                readlensk[s]);
+      i = r*nsamples + s;
+      batch->stats.ploidy_seen[ploidies[s]]++;
+      genotype_sample_biallelic(s, batch->gts + max_ploidy*i, max_ploidy,
+                                batch->gllks ? batch->gllks + max_gts*i : NULL,
+                                max_gts, batch->gtquals + i,
+                                batch->rcovgs[i], batch->acovgs[i], &ak,
+                                m->kcovgs[s], ploidies[s], m->log_errs[s],
+                                m->readlensk[s], m->log_rates[s], &batch->stats);
     }
+  }
+}
+
+static void vcfgeno_batch_print(VcfGenoEngine *eng, VcfGenoBatch *batch)
+{
+  const VcfGenoModel *m = eng->model;
+  const size_t nsamples = m->nsamples;
+  bcf_hdr_t *hdr = eng->vcfhdr;
+  size_t r;
+  bcf1_t *v;
+
+  pthread_mutex_lock(&eng->hdr_lock);
+
+  for(r = 0; r < batch->nrecs; r++)
+  {
+    v = batch->recs[r];
 
     // Update GTs and write out
-    if(rm_vcfcov_tags) {
+    if(m->rm_vcfcov_tags) {
       // remove coverage tags added by vcfcov
-      a = bcf_update_format_int32(vcfhdr, v, kcovgs_ref_tag, NULL, 0);
-      b = bcf_update_format_int32(vcfhdr, v, kcovgs_alt_tag, NULL, 0);
+      bcf_update_format_int32(hdr, v, kcovgs_ref_tag, NULL, 0);
+      bcf_update_format_int32(hdr, v, kcovgs_alt_tag, NULL, 0);
     }
-    if(bcf_update_genotypes(vcfhdr, v, gts, ngts) < 0)
+    if(bcf_update_genotypes(hdr, v, batch->gts + r*nsamples*m->max_ploidy,
+                            nsamples*m->max_ploidy) < 0)
       die("Cannot update GTs");
-    if(bcf_update_format_int32(vcfhdr, v, "GQ", gtquals, nsamples) < 0)
+    if(bcf_update_format_int32(hdr, v, "GQ", batch->gtquals + r*nsamples,
+                               nsamples) < 0)
       die("Cannot update GQs");
-    if(gllks && bcf_update_format_float(vcfhdr, v, "GL", gllks, ngllks) < 0)
+    if(batch->gllks &&
+       bcf_update_format_float(hdr, v, "GL", batch->gllks + r*nsamples*m->max_gts,
+                               nsamples*m->max_gts) < 0)
       die("Cannot update GLs");
-    if(bcf_write(outfh, vcfhdr, v) != 0) die("Cannot write record");
+    if(bcf_write(eng->outfh, hdr, v) != 0) die("Cannot write record");
   }
 
-  free(kcovr);
-  free(kcova);
-  ctx_free(gts);
-  ctx_free(gtquals);
-  ctx_free(gllks);
-  bcf_destroy(v);
+  pthread_mutex_unlock(&eng->hdr_lock);
+
+  vcfgeno_stats_merge(&eng->stats, &batch->stats);
+}
+
+// Print genotyped batches in input order until we reach one that has not been
+// genotyped. Called and returns with eng->lock held.
+static void vcfgeno_print_batches(VcfGenoEngine *eng)
+{
+  VcfGenoBatch *batch;
+  eng->printing = true;
+
+  while(eng->nprinted < eng->nread &&
+        (batch = &eng->batches[eng->nprinted % eng->nbatches])->done)
+  {
+    pthread_mutex_unlock(&eng->lock);
+    vcfgeno_batch_print(eng, batch);
+    batch->done = false;
+    pthread_mutex_lock(&eng->lock);
+    eng->nprinted++;
+    pthread_cond_signal(&eng->batch_printed);
+  }
+
+  eng->printing = false;
+}
+
+static void* vcfgeno_worker(void *arg)
+{
+  VcfGenoEngine *eng = (VcfGenoEngine*)arg;
+  VcfGenoBatch *batch;
+
+  pthread_mutex_lock(&eng->lock);
+  while(1)
+  {
+    while(eng->nqueued == eng->nread && !eng->eof)
+      pthread_cond_wait(&eng->batch_read, &eng->lock);
+
+    if(eng->nqueued == eng->nread) break; // end of input
+
+    batch = &eng->batches[eng->nqueued++ % eng->nbatches];
+    pthread_mutex_unlock(&eng->lock);
+
+    vcfgeno_batch_genotype(batch, eng->model);
+
+    pthread_mutex_lock(&eng->lock);
+    batch->done = true;
+    // If another thread is printing, it will print this batch when it gets
+    // to it
+    if(!eng->printing) vcfgeno_print_batches(eng);
+  }
+  pthread_mutex_unlock(&eng->lock);
+
+  return NULL;
+}
+
+static void vcfgeno_read_batches(VcfGenoEngine *eng)
+{
+  VcfGenoBatch *batch;
+  bool more = true;
+
+  while(more)
+  {
+    // Wait for a free batch
+    pthread_mutex_lock(&eng->lock);
+    while(eng->nread - eng->nprinted == eng->nbatches)
+      pthread_cond_wait(&eng->batch_printed, &eng->lock);
+    pthread_mutex_unlock(&eng->lock);
+
+    batch = &eng->batches[eng->nread % eng->nbatches];
+    more = vcfgeno_batch_read(eng, batch);
+
+    // Pass to the worker threads
+    pthread_mutex_lock(&eng->lock);
+    eng->nread++;
+    pthread_cond_signal(&eng->batch_read);
+    pthread_mutex_unlock(&eng->lock);
+  }
+
+  pthread_mutex_lock(&eng->lock);
+  eng->eof = true;
+  pthread_cond_broadcast(&eng->batch_read);
+  pthread_mutex_unlock(&eng->lock);
+}
+
+static void genotype_vcf(htsFile *vcffh, bcf_hdr_t *vcfhdr, htsFile *outfh,
+                         const VcfGenoModel *model, size_t nthreads,
+                         VcfGenoStats *stats)
+{
+  size_t i;
+  int rc;
+
+  VcfGenoEngine eng;
+  memset(&eng, 0, sizeof(eng));
+  eng.vcffh = vcffh;
+  eng.vcfhdr = vcfhdr;
+  eng.outfh = outfh;
+  eng.model = model;
+  eng.batch_nrecs = MIN2(GENO_BATCH_GENOTYPES / model->nsamples,
+                         GENO_BATCH_MAX_RECS);
+  eng.batch_nrecs = MAX2(eng.batch_nrecs, 1);
+  eng.nbatches = nthreads * GENO_BATCHES_PER_THREAD;
+  eng.batches = ctx_calloc(eng.nbatches, sizeof(VcfGenoBatch));
+
+  for(i = 0; i < eng.nbatches; i++)
+    vcfgeno_batch_alloc(&eng.batches[i], model, eng.batch_nrecs);
+
+  if(pthread_mutex_init(&eng.lock, NULL) != 0 ||
+     pthread_mutex_init(&eng.hdr_lock, NULL) != 0)
+    die("Mutex init failed");
+  if(pthread_cond_init(&eng.batch_read, NULL) != 0 ||
+     pthread_cond_init(&eng.batch_printed, NULL) != 0)
+    die("Condition variable init failed");
+
+  // Initialise lookup tables
+  math_calcs_init();
+
+  status("[vcfgeno] Genotyping %zu records per batch with %zu thread%s",
+         eng.batch_nrecs, nthreads, util_plural_str(nthreads));
+
+  pthread_t *threads = ctx_calloc(nthreads, sizeof(pthread_t));
+
+  for(i = 0; i < nthreads; i++) {
+    rc = pthread_create(&threads[i], NULL, vcfgeno_worker, &eng);
+    if(rc != 0) die("Creating thread failed: %s", strerror(rc));
+  }
+
+  // read and print
+  vcfgeno_read_batches(&eng);
+
+  for(i = 0; i < nthreads; i++) {
+    rc = pthread_join(threads[i], NULL);
+    if(rc != 0) die("Joining thread failed: %s", strerror(rc));
+  }
+
+  ctx_assert(eng.nprinted == eng.nread);
+  memcpy(stats, &eng.stats, sizeof(*stats));
+
+  for(i = 0; i < eng.nbatches; i++)
+    vcfgeno_batch_dealloc(&eng.batches[i], eng.batch_nrecs);
+
+  ctx_free(threads);
+  ctx_free(eng.batches);
+  free(eng.kcovr);
+  free(eng.kcova);
+
+  math_calcs_destroy();
+
+  pthread_mutex_destroy(&eng.lock);
+  pthread_mutex_destroy(&eng.hdr_lock);
+  pthread_cond_destroy(&eng.batch_read);
+  pthread_cond_destroy(&eng.batch_printed);
 }
 
 static int match_list(const char *s, char const*const* list, size_t n)
@@ -468,6 +771,7 @@ int ctx_vcfgeno(int argc, char **argv)
   char *pl_args[argc];
   size_t npl_args = 0;
   bool add_gllks = false, rm_vcfcov_tags = false;
+  size_t nthreads = 0;
 
   // These are set after we have initially looped over args
   size_t *read_lens = NULL;
@@ -493,6 +797,7 @@ int ctx_vcfgeno(int argc, char **argv)
       case 'o': cmd_check(!out_path, cmd); out_path = optarg; break;
       case 'O': cmd_check(!out_type, cmd); out_type = optarg; break;
       case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case 'E': cmd_check(!err_arg, cmd); err_arg = optarg; break;
       case 'C': cmd_check(!kcov_arg, cmd); kcov_arg = optarg; break;
       case 'D': cmd_check(!cov_arg, cmd); cov_arg = optarg; break;
@@ -512,6 +817,7 @@ int ctx_vcfgeno(int argc, char **argv)
 
   // if(!err_arg) cmd_print_usage("Require '--err 0.01,0.005,...' argument");
   if(!err_arg) err_arg = default_err;
+  if(!nthreads) nthreads = DEFAULT_NTHREADS;
   if(!npl_args) cmd_print_usage("Require '--ploidy sample:chr:ploidy' argment");
   if(!kcov_arg && !cov_arg) cmd_print_usage("Require --kcov or --cov argument");
   if(optind+1 != argc) cmd_print_usage("Need to pass a single VCF");
@@ -638,6 +944,13 @@ int ctx_vcfgeno(int argc, char **argv)
     if(read_lens[i])
       read_lens[i] = readklen(read_lens[i],kmer_size);
 
+  // ln(expected reads per kmer of allele), so that genotyping only needs to
+  // add ln(allele length in kmers)
+  double *log_rates = ctx_calloc(nsamples, sizeof(log_rates[0]));
+  for(i = 0; i < nsamples; i++)
+    if(read_lens[i])
+      log_rates[i] = log(kcovgs[i] / read_lens[i]);
+
   // Reconstruct tags from kmersize
   sprintf(kcovgs_ref_tag, "K%zuR", kmer_size);
   sprintf(kcovgs_alt_tag, "K%zuA", kmer_size);
@@ -711,56 +1024,63 @@ int ctx_vcfgeno(int argc, char **argv)
   if(bcf_hdr_write(outfh, vcfhdr) != 0)
     die("Cannot write header to: %s", futil_outpath_str(out_path));
 
+  VcfGenoModel model = {.nsamples = nsamples, .kmer_size = kmer_size,
+                        .max_ploidy = max_ploidy,
+                        .max_gts = num_gts(max_ploidy, 2),
+                        .kcovgs = kcovgs, .log_errs = log_errs,
+                        .log_rates = log_rates, .readlensk = read_lens,
+                        .ploidy_mat = (const uint8_t *const*)ploidy_mat,
+                        .add_gllks = add_gllks,
+                        .rm_vcfcov_tags = rm_vcfcov_tags};
+
   // Ready to go
-  genotype_vcf(vcffh, vcfhdr, outfh,
-               kcovgs, log_errs, (const uint8_t *const*)ploidy_mat, read_lens,
-               max_ploidy, kmer_size, add_gllks, rm_vcfcov_tags);
+  VcfGenoStats st;
+  genotype_vcf(vcffh, vcfhdr, outfh, &model, nthreads, &st);
 
-  uint64_t n_sample_alts = nsamples * num_ALTs_read;
+  uint64_t n_sample_alts = nsamples * st.nalts;
 
   // Print statistics
   char n0[50], n1[50];
-  status("[vcfgeno] Read %s VCF lines", ulong_to_str(num_lines_read, n0));
-  status("[vcfgeno] Read %s ALT alleles", ulong_to_str(num_ALTs_read, n0));
+  status("[vcfgeno] Read %s VCF lines", ulong_to_str(st.nlines, n0));
+  status("[vcfgeno] Read %s ALT alleles", ulong_to_str(st.nalts, n0));
   status("[vcfgeno] Lines skipped non-biallelic: %s / %s (%.2f%%)",
-         ulong_to_str(num_non_biallelic, n0),
-         ulong_to_str(num_lines_read, n1),
-         safe_percent(num_non_biallelic, num_lines_read));
+         ulong_to_str(st.nnon_biallelic, n0),
+         ulong_to_str(st.nlines, n1),
+         safe_percent(st.nnon_biallelic, st.nlines));
   status("[vcfgeno] Lines skipped no K..R/K..A fields: %s / %s (%.2f%%)",
-         ulong_to_str(num_missing_tags, n0),
-         ulong_to_str(num_lines_read, n1),
-         safe_percent(num_missing_tags, num_lines_read));
+         ulong_to_str(st.nmissing_tags, n0),
+         ulong_to_str(st.nlines, n1),
+         safe_percent(st.nmissing_tags, st.nlines));
   status("[vcfgeno] # missing kcov: %s / %s (%.2f%%)",
-         ulong_to_str(num_missing_covgs, n0),
+         ulong_to_str(st.nmissing_covgs, n0),
          ulong_to_str(n_sample_alts, n1),
-         safe_percent(num_missing_covgs, n_sample_alts));
+         safe_percent(st.nmissing_covgs, n_sample_alts));
   status("[vcfgeno] # ploidy zero: %s / %s (%.2f%%)",
-         ulong_to_str(ploidy_seen[0], n0),
+         ulong_to_str(st.ploidy_seen[0], n0),
          ulong_to_str(n_sample_alts, n1),
-         safe_percent(ploidy_seen[0], n_sample_alts));
+         safe_percent(st.ploidy_seen[0], n_sample_alts));
   status("[vcfgeno] # ploidy one: %s / %s (%.2f%%)",
-         ulong_to_str(ploidy_seen[1], n0),
+         ulong_to_str(st.ploidy_seen[1], n0),
          ulong_to_str(n_sample_alts, n1),
-         safe_percent(ploidy_seen[1], n_sample_alts));
+         safe_percent(st.ploidy_seen[1], n_sample_alts));
   status("[vcfgeno] # ploidy two: %s / %s (%.2f%%)",
-         ulong_to_str(ploidy_seen[2], n0),
+         ulong_to_str(st.ploidy_seen[2], n0),
          ulong_to_str(n_sample_alts, n1),
-         safe_percent(ploidy_seen[2], n_sample_alts));
+         safe_percent(st.ploidy_seen[2], n_sample_alts));
   status("[vcfgeno] # genotyped %s / %s (%.2f%%)",
-         ulong_to_str(num_genotypes_printed, n0),
+         ulong_to_str(st.ngenotyped, n0),
          ulong_to_str(n_sample_alts, n1),
-         safe_percent(num_genotypes_printed, n_sample_alts));
+         safe_percent(st.ngenotyped, n_sample_alts));
 
   strbuf_dealloc(&tmpstr);
   ctx_free(read_lens);
   ctx_free(err_rates);
   ctx_free(log_errs);
+  ctx_free(log_rates);
   ctx_free(kcovgs);
   for(r = 0; r < nseqs; r++) ctx_free(ploidy_mat[r]);
   ctx_free(ploidy_mat);
 
-  math_calcs_destroy();
-
   free(seqnames);
   bcf_hdr_destroy(vcfhdr);
   hts_close(vcffh);
@@ -66,10 +66,16 @@ void read_thread_args_parse(struct ReadThreadCmdArgs *args,
         cmd_check(!args->zero_link_counts, cmd);
         args->zero_link_counts = true;
         break;
+      case 'B':
+        if(correct_cmd) cmd_print_usage("Invalid binary option: %s", cmd);
+        cmd_check(!args->binary_out, cmd);
+        args->binary_out = true;
+        break;
       case 't':
         cmd_check(!args->nthreads, cmd);
         args->nthreads = cmd_uint32_nonzero(cmd, optarg);
         break;
+      case 'b': asyncio_set_batch_size(cmd_size_nonzero(cmd, optarg)); break;
       case 'm': cmd_mem_args_set_memory(&args->memargs, optarg); break;
       case 'n': cmd_mem_args_set_nkmers(&args->memargs, optarg); break;
       case 'c': args->colour = cmd_uint32(cmd, optarg); break;
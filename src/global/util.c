@@ -2,6 +2,8 @@
 #include "util.h"
 
 #include <math.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
 #include "sort_r/sort_r.h"
 
@@ -537,6 +539,28 @@ size_t seconds_to_str(unsigned long seconds, char *str)
   return (size_t)(ptr - str);
 }
 
+double util_wall_time()
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return now.tv_sec + now.tv_usec / 1000000.0;
+}
+
+//
+// Memory
+//
+
+size_t util_peak_rss()
+{
+  struct rusage usage;
+  if(getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  #if defined(__APPLE__)
+    return usage.ru_maxrss; // bytes
+  #else
+    return usage.ru_maxrss * 1024UL; // kilobytes on linux
+  #endif
+}
+
 //
 // Multi-threading
 //
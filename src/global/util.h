@@ -170,6 +170,16 @@ size_t calc_N50(const size_t *sorted_arr, size_t n, size_t total);
 // returns number of bytes written
 size_t seconds_to_str(unsigned long seconds, char *str);
 
+// Wall clock time in seconds, for measuring elapsed time
+double util_wall_time();
+
+//
+// Memory
+//
+
+// Peak resident set size of this process in bytes
+size_t util_peak_rss();
+
 //
 // Multi-threading
 //
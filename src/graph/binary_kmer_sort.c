@@ -0,0 +1,212 @@
+#include "global.h"
+#include "binary_kmer_sort.h"
+#include "util.h"
+
+//
+// In-place MSD radix sort (American flag sort) of pointers to BinaryKmers.
+//
+// Large arrays are first split on a 16 bit digit: we find the first byte that
+// differs between kmers, then count the 16 bit digit starting at that byte with
+// all threads. Pointers are permuted into 2^16 buckets by one thread, using a
+// cached copy of each digit so kmers are not dereferenced again. Buckets are
+// then sorted in parallel, largest first, with the single threaded 8 bit radix
+// sort. Dereferencing kmer pointers dominates the run time, so the cached
+// digits also speed up sorting with a single thread.
+//
+
+#define BKSORT_NBYTES (NUM_BKMER_WORDS*8)
+#define BKSORT_TOP_BITS 16
+#define BKSORT_TOP_BUCKETS (1UL<<BKSORT_TOP_BITS)
+
+// Use the 16 bit top level split when sorting at least this many pointers
+#define BKSORT_TOP_MIN (1UL<<14)
+
+// Use at most one thread per this many pointers
+#define BKSORT_MT_MIN (1UL<<16)
+
+// Get byte `d` of a kmer, where byte 0 is the most significant byte of b[0]
+static inline size_t bksort_byte(const void *ptr, size_t d)
+{
+  uint64_t w;
+  memcpy(&w, (const char*)ptr + (d/8)*sizeof(uint64_t), sizeof(uint64_t));
+  return (w >> (56 - 8*(d%8))) & 0xff;
+}
+
+// Bytes `d` and `d+1` of a kmer as a 16 bit digit
+static inline size_t bksort_digit16(const void *ptr, size_t d)
+{
+  size_t lo = d+1 < BKSORT_NBYTES ? bksort_byte(ptr, d+1) : 0;
+  return (bksort_byte(ptr, d) << 8) | lo;
+}
+
+// Single threaded sort, all kmers are equal in bytes 0..d-1
+static void bksort_msd(void **ptrs, size_t n, size_t d)
+{
+  size_t counts[256], next[256], b, c, i, start, end;
+  void *p;
+
+  for(; d < BKSORT_NBYTES && n > BKMER_SORT_SMALL; d++)
+  {
+    memset(counts, 0, sizeof(counts));
+    for(i = 0; i < n; i++) counts[bksort_byte(ptrs[i], d)]++;
+
+    // All kmers share this byte, move on to the next one
+    if(counts[bksort_byte(ptrs[0], d)] == n) continue;
+
+    for(b = i = 0; b < 256; b++) { next[b] = i; i += counts[b]; }
+
+    // Permute pointers into buckets
+    for(b = start = 0; b < 256; start += counts[b], b++) {
+      end = start + counts[b];
+      while(next[b] < end) {
+        p = ptrs[next[b]];
+        while((c = bksort_byte(p, d)) != b) { SWAP(p, ptrs[next[c]]); next[c]++; }
+        ptrs[next[b]++] = p;
+      }
+    }
+
+    for(b = start = 0; b < 256; start += counts[b], b++)
+      if(counts[b] > 1) bksort_msd(ptrs+start, counts[b], d+1);
+
+    return;
+  }
+
+  if(d < BKSORT_NBYTES && n > 1)
+    qsort(ptrs, n, sizeof(void*), binary_kmers_qcmp_unaligned_ptrs);
+}
+
+typedef struct {
+  size_t start, n;
+} BKSortBucket;
+
+typedef struct
+{
+  void **ptrs;
+  uint16_t *digits; // cached top digit of each kmer
+  size_t n, nthreads, d; // d is the first byte that differs between kmers
+  uint64_t *diffs; // nthreads x NUM_BKMER_WORDS
+  size_t *counts; // nthreads x BKSORT_TOP_BUCKETS
+  BKSortBucket *buckets;
+  size_t nbuckets;
+  volatile size_t next_bucket;
+} BKSortJob;
+
+#define bksort_thread_start(j,t) (((j)->n * (t)) / (j)->nthreads)
+
+// Find bits that differ from the first kmer
+static void bksort_diff_thread(void *arg, size_t threadid)
+{
+  BKSortJob *job = (BKSortJob*)arg;
+  size_t i, w, start, end;
+  uint64_t *diff = job->diffs + threadid*NUM_BKMER_WORDS;
+  BinaryKmer first, bkmer;
+  start = bksort_thread_start(job, threadid);
+  end = bksort_thread_start(job, threadid+1);
+  memcpy(first.b, job->ptrs[0], sizeof(BinaryKmer));
+  for(i = start; i < end; i++) {
+    memcpy(bkmer.b, job->ptrs[i], sizeof(BinaryKmer));
+    for(w = 0; w < NUM_BKMER_WORDS; w++) diff[w] |= bkmer.b[w] ^ first.b[w];
+  }
+}
+
+static void bksort_count_thread(void *arg, size_t threadid)
+{
+  BKSortJob *job = (BKSortJob*)arg;
+  size_t i, start, end;
+  size_t *counts = job->counts + threadid*BKSORT_TOP_BUCKETS;
+  start = bksort_thread_start(job, threadid);
+  end = bksort_thread_start(job, threadid+1);
+  for(i = start; i < end; i++) {
+    job->digits[i] = bksort_digit16(job->ptrs[i], job->d);
+    counts[job->digits[i]]++;
+  }
+}
+
+static void bksort_bucket_thread(void *arg, size_t threadid)
+{
+  (void)threadid;
+  BKSortJob *job = (BKSortJob*)arg;
+  size_t i;
+  while((i = __sync_fetch_and_add(&job->next_bucket, 1)) < job->nbuckets) {
+    bksort_msd(job->ptrs + job->buckets[i].start, job->buckets[i].n,
+               job->d + 2);
+  }
+}
+
+// Sort buckets largest first
+static int bksort_bucket_cmp(const void *aa, const void *bb)
+{
+  const BKSortBucket *a = (const BKSortBucket*)aa, *b = (const BKSortBucket*)bb;
+  return a->n < b->n ? 1 : (a->n > b->n ? -1 : 0);
+}
+
+/**
+ * Sort pointers to kmers in place using an MSD radix sort
+ * @param ptrs pointers to BinaryKmers, need not be aligned
+ */
+void binary_kmer_sort_ptrs(void **ptrs, size_t n, size_t nthreads)
+{
+  if(n < BKSORT_TOP_MIN) { bksort_msd(ptrs, n, 0); return; }
+  nthreads = MAX2(1, MIN2(nthreads, n / BKSORT_MT_MIN));
+
+  size_t b, i, j, t, w, start, end;
+  BKSortJob job = {.ptrs = ptrs, .n = n, .nthreads = nthreads};
+
+  // Find first byte that differs
+  job.diffs = ctx_calloc(nthreads * NUM_BKMER_WORDS, sizeof(uint64_t));
+  util_multi_thread(&job, nthreads, bksort_diff_thread);
+  for(t = 1; t < nthreads; t++)
+    for(w = 0; w < NUM_BKMER_WORDS; w++)
+      job.diffs[w] |= job.diffs[t*NUM_BKMER_WORDS+w];
+  for(w = 0; w < NUM_BKMER_WORDS && !job.diffs[w]; w++) {}
+  if(w < NUM_BKMER_WORDS) job.d = w*8 + __builtin_clzll(job.diffs[w])/8;
+  ctx_free(job.diffs);
+  if(w == NUM_BKMER_WORDS) return; // all kmers are equal
+
+  // Count top digits
+  job.digits = ctx_malloc(n * sizeof(uint16_t));
+  job.counts = ctx_calloc(nthreads * BKSORT_TOP_BUCKETS, sizeof(size_t));
+  util_multi_thread(&job, nthreads, bksort_count_thread);
+
+  size_t *counts = job.counts;
+  size_t *next = ctx_malloc(BKSORT_TOP_BUCKETS * sizeof(size_t));
+  for(t = 1; t < nthreads; t++)
+    for(b = 0; b < BKSORT_TOP_BUCKETS; b++)
+      counts[b] += counts[t*BKSORT_TOP_BUCKETS+b];
+
+  for(b = i = 0; b < BKSORT_TOP_BUCKETS; b++) { next[b] = i; i += counts[b]; }
+
+  // Permute pointers into buckets, using cached digits
+  void *p;
+  uint16_t digit;
+  for(b = start = 0; b < BKSORT_TOP_BUCKETS; start += counts[b], b++) {
+    end = start + counts[b];
+    while(next[b] < end) {
+      p = ptrs[next[b]];
+      digit = job.digits[next[b]];
+      while(digit != b) {
+        j = next[digit]++;
+        SWAP(p, ptrs[j]);
+        SWAP(digit, job.digits[j]);
+      }
+      ptrs[next[b]++] = p;
+    }
+  }
+
+  ctx_free(job.digits);
+  ctx_free(next);
+
+  // Sort buckets in parallel
+  job.buckets = ctx_malloc(BKSORT_TOP_BUCKETS * sizeof(BKSortBucket));
+  for(b = start = 0; b < BKSORT_TOP_BUCKETS; start += counts[b], b++) {
+    if(counts[b] > 1)
+      job.buckets[job.nbuckets++] = (BKSortBucket){.start = start,
+                                                   .n = counts[b]};
+  }
+
+  qsort(job.buckets, job.nbuckets, sizeof(BKSortBucket), bksort_bucket_cmp);
+  util_multi_thread(&job, nthreads, bksort_bucket_thread);
+
+  ctx_free(job.buckets);
+  ctx_free(job.counts);
+}
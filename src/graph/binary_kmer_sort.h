@@ -0,0 +1,23 @@
+#ifndef BINARY_KMER_SORT_H_
+#define BINARY_KMER_SORT_H_
+
+#include "binary_kmer.h"
+
+//
+// Sort pointers to BinaryKmers with an in-place MSD radix sort
+//
+// Kmers are compared one byte at a time from the most significant byte of
+// b[0] to the least significant byte of b[NUM_BKMER_WORDS-1], giving the same
+// order as binary_kmer_cmp(). Pointers do not need to be aligned, so they can
+// point to kmer entries in a graph file buffer. Sorting small arrays uses no
+// extra memory, large arrays also need two bytes per pointer and a 2^16 entry
+// histogram per thread.
+//
+
+// Use comparison sort below this many pointers
+#define BKMER_SORT_SMALL 64
+
+// Sort `ptrs` with `nthreads`. Each element of `ptrs` points to a BinaryKmer.
+void binary_kmer_sort_ptrs(void **ptrs, size_t n, size_t nthreads);
+
+#endif /* BINARY_KMER_SORT_H_ */
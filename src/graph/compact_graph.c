@@ -0,0 +1,497 @@
+#include "global.h"
+#include "compact_graph.h"
+#include "db_unitig.h"
+#include "binary_seq.h"
+#include "file_util.h"
+#include "util.h"
+#include "work_steal.h"
+#include "common_buffers.h"
+
+// File format (see docs/file_formats/unitig_graph_format.txt):
+//   "CTXCMP" | uint32 version | uint32 kmer_size | uint32 flags |
+//   uint64 total_covg | uint64 num_unitigs | uint64 seq_nbases |
+//   unitig records | packed sequence | "CTXCMP"
+#define CGRAPH_MAGIC "CTXCMP"
+#define CGRAPH_VERSION 2
+
+// Set in the file flags if unitig coverages were saved
+#define CGRAPH_FLAG_COVGS 1
+
+void compact_graph_alloc(CompactGraph *cgraph, const dBGraph *db_graph)
+{
+  memset(cgraph, 0, sizeof(*cgraph));
+  cgraph->kmer_size = db_graph->kmer_size;
+  cgraph->db_graph = db_graph;
+  cgraph->capacity = 1024;
+  cgraph->unitigs = ctx_calloc(cgraph->capacity, sizeof(CompactUnitig));
+  cgraph->seq_capacity = 1024*4;
+  cgraph->seq = ctx_calloc(binary_seq_mem(cgraph->seq_capacity), 1);
+  unitig_graph_alloc(&cgraph->ugraph, db_graph);
+}
+
+void compact_graph_dealloc(CompactGraph *cgraph)
+{
+  unitig_graph_dealloc(&cgraph->ugraph);
+  ctx_free(cgraph->unitigs);
+  ctx_free(cgraph->seq);
+  memset(cgraph, 0, sizeof(*cgraph));
+}
+
+static void cgraph_capacity(CompactGraph *cgraph, size_t nunitigs,
+                            size_t nbases)
+{
+  size_t cap;
+
+  if(nunitigs > cgraph->capacity) {
+    cap = MAX2(cgraph->capacity*2, nunitigs);
+    cgraph->unitigs = ctx_recallocarray(cgraph->unitigs, cgraph->capacity, cap,
+                                        sizeof(CompactUnitig));
+    cgraph->capacity = cap;
+  }
+
+  if(nbases > cgraph->seq_capacity) {
+    cap = MAX2(cgraph->seq_capacity*2, nbases);
+    cgraph->seq = ctx_recallocarray(cgraph->seq,
+                                    binary_seq_mem(cgraph->seq_capacity),
+                                    binary_seq_mem(cap), 1);
+    cgraph->seq_capacity = cap;
+  }
+}
+
+BinaryKmer compact_graph_unitig_bkmer(const CompactGraph *cgraph, size_t uid,
+                                      size_t pos)
+{
+  const size_t kmer_size = cgraph->kmer_size;
+  const uint8_t *seq = cgraph->seq + cgraph->unitigs[uid].seqpos/4;
+  BinaryKmer bkmer = BINARY_KMER_ZERO_MACRO;
+  size_t i;
+
+  ctx_assert(pos < cgraph->unitigs[uid].nkmers);
+
+  for(i = 0; i < kmer_size; i++)
+    bkmer = binary_kmer_left_shift_add(bkmer, kmer_size,
+                                       binary_seq_get(seq, pos+i));
+  return bkmer;
+}
+
+void compact_graph_unitig_nodes(const CompactGraph *cgraph, size_t uid,
+                                dBNodeBuffer *nbuf)
+{
+  const CompactUnitig *u = &cgraph->unitigs[uid];
+  const size_t kmer_size = cgraph->kmer_size;
+  const uint8_t *seq = cgraph->seq + u->seqpos/4;
+  BinaryKmer bkmer = compact_graph_unitig_bkmer(cgraph, uid, 0);
+  dBNode node;
+  size_t i;
+
+  db_node_buf_capacity(nbuf, nbuf->len + u->nkmers);
+
+  for(i = 0; i < u->nkmers; i++) {
+    if(i > 0) {
+      bkmer = binary_kmer_left_shift_add(bkmer, kmer_size,
+                                         binary_seq_get(seq, i+kmer_size-1));
+    }
+    node = db_graph_find(cgraph->db_graph, bkmer);
+    ctx_assert(node.key != HASH_NOT_FOUND);
+    nbuf->b[nbuf->len++] = node;
+  }
+}
+
+//
+// Build
+//
+
+// Unitigs compacted by one thread. Sequence is packed into a buffer per thread
+// and copied into the CompactGraph once all unitigs have been found.
+typedef struct
+{
+  size_t uidx;
+  CompactUnitig u; // u.seqpos is an offset into the thread's sequence
+} CompactThreadUnitig;
+
+madcrow_buffer(cthread_unitig_buf, CompactThreadUnitigBuffer,
+               CompactThreadUnitig);
+
+typedef struct
+{
+  CompactThreadUnitigBuffer unitigs;
+  ByteBuffer seq;
+  size_t seq_nbases;
+  StrBuf sbuf;
+} CompactThread;
+
+typedef struct
+{
+  CompactGraph *cgraph;
+  CompactThread *threads;
+} CompactBuilder;
+
+size_t compact_graph_bits_per_kmer(size_t kmer_size, bool build)
+{
+  // Each unitig's sequence starts on a byte boundary
+  size_t seq_bytes = binary_seq_mem((kmer_size+3) & ~(size_t)3);
+  size_t bytes = sizeof(UnitigEnd) + sizeof(CompactUnitig) + seq_bytes;
+
+  // Thread buffers grow by doubling, so may be up to twice what they hold.
+  // Build also needs a visited bit per kmer.
+  if(build) return bytes*8 + 2*(sizeof(CompactThreadUnitig) + seq_bytes)*8 + 1;
+  return bytes*8;
+}
+
+static void cgraph_add_unitig(const dBNode *nodes, size_t n, size_t uidx,
+                              size_t threadid, void *arg)
+{
+  CompactBuilder *builder = (CompactBuilder*)arg;
+  CompactThread *thread = &builder->threads[threadid];
+  const dBGraph *db_graph = builder->cgraph->db_graph;
+  const size_t nbases = n + db_graph->kmer_size - 1;
+  size_t i, seqpos;
+  Covg covg;
+
+  CompactUnitig u = {.nkmers = n, .covg_min = COVG_MAX, .covg_max = 0,
+                     .covg_sum = 0};
+
+  if(!db_graph_has_covgs(db_graph)) u.covg_min = 0;
+  else {
+    for(i = 0; i < n; i++) {
+      covg = db_node_sum_covg(db_graph, nodes[i].key);
+      u.covg_min = MIN2(u.covg_min, covg);
+      u.covg_max = MAX2(u.covg_max, covg);
+      u.covg_sum += covg;
+    }
+  }
+
+  strbuf_ensure_capacity(&thread->sbuf, nbases);
+  db_nodes_to_str(nodes, n, db_graph, thread->sbuf.b);
+
+  // Each unitig starts on a byte boundary
+  seqpos = (thread->seq_nbases+3) & ~(size_t)3;
+  byte_buf_capacity(&thread->seq, binary_seq_mem(seqpos+nbases));
+  binary_seq_from_str(thread->sbuf.b, nbases, thread->seq.b + seqpos/4);
+  thread->seq_nbases = seqpos+nbases;
+  thread->seq.len = binary_seq_mem(thread->seq_nbases);
+
+  u.seqpos = seqpos;
+  CompactThreadUnitig tu = {.uidx = uidx, .u = u};
+  cthread_unitig_buf_add(&thread->unitigs, tu);
+}
+
+// Copy each thread's unitigs and sequence into the graph
+static void cgraph_merge_threads(CompactGraph *cgraph, CompactThread *threads,
+                                 size_t nthreads)
+{
+  size_t t, i, offset = 0, nbases = 0;
+  ctx_assert(cgraph->seq_nbases == 0);
+
+  for(t = 0; t < nthreads; t++)
+    nbases += (threads[t].seq_nbases+3) & ~(size_t)3;
+
+  cgraph_capacity(cgraph, cgraph->ugraph.num_unitigs, nbases);
+
+  // Each thread's sequence starts on a byte boundary
+  for(t = 0; t < nthreads; t++) {
+    const CompactThread *thread = &threads[t];
+    memcpy(cgraph->seq + offset/4, thread->seq.b, thread->seq.len);
+    for(i = 0; i < thread->unitigs.len; i++) {
+      const CompactThreadUnitig *tu = &thread->unitigs.b[i];
+      cgraph->unitigs[tu->uidx] = tu->u;
+      cgraph->unitigs[tu->uidx].seqpos += offset;
+    }
+    cgraph->seq_nbases = offset + thread->seq_nbases;
+    offset = (cgraph->seq_nbases+3) & ~(size_t)3;
+  }
+}
+
+// Requires ends of all unitigs to be labelled
+static void cgraph_link_unitig(CompactGraph *cgraph, size_t uid)
+{
+  const dBGraph *db_graph = cgraph->db_graph;
+  CompactUnitig *u = &cgraph->unitigs[uid];
+  dBNode ends[2], next_nodes[4];
+  Nucleotide next_nucs[4];
+  size_t side, i, n;
+  uint64_t e;
+
+  // Walk backwards off the first kmer, forwards off the last
+  ends[0] = db_graph_find(db_graph, compact_graph_unitig_bkmer(cgraph, uid, 0));
+  ends[0] = db_node_reverse(ends[0]);
+  ends[1] = db_graph_find(db_graph,
+                          compact_graph_unitig_bkmer(cgraph, uid, u->nkmers-1));
+
+  for(side = 0; side < 2; side++) {
+    u->nnext[side] = 0;
+    n = db_graph_next_nodes_union(db_graph, ends[side], next_nodes, next_nucs);
+    for(i = 0; i < n; i++) {
+      e = compact_graph_node_end(cgraph, next_nodes[i]);
+      ctx_assert(e != CGRAPH_NO_END);
+      if(e != CGRAPH_NO_END) u->next[side][u->nnext[side]++] = e;
+    }
+  }
+}
+
+typedef struct {
+  CompactGraph *cgraph;
+  WorkSteal *ws;
+} CompactLinker;
+
+static void cgraph_link_thread(void *arg, size_t threadid)
+{
+  CompactLinker *linker = (CompactLinker*)arg;
+  size_t uid, start, end;
+
+  while(work_steal_next(linker->ws, threadid, &start, &end))
+    for(uid = start; uid < end; uid++)
+      cgraph_link_unitig(linker->cgraph, uid);
+
+  work_steal_thread_done(linker->ws, threadid);
+}
+
+static void cgraph_link(CompactGraph *cgraph, size_t nthreads)
+{
+  WorkSteal ws;
+  work_steal_alloc(&ws, cgraph->num_unitigs, nthreads,
+                   WORK_STEAL_CHUNKS_PER_THREAD);
+  CompactLinker linker = {.cgraph = cgraph, .ws = &ws};
+  util_multi_thread(&linker, nthreads, cgraph_link_thread);
+  work_steal_dealloc(&ws);
+}
+
+static void cgraph_print_stats(const CompactGraph *cgraph)
+{
+  char nunitigs_str[50], nbases_str[50], mem_str[50];
+  size_t mem = cgraph->num_unitigs * sizeof(CompactUnitig) +
+               binary_seq_mem(cgraph->seq_nbases);
+  ulong_to_str(cgraph->num_unitigs, nunitigs_str);
+  ulong_to_str(cgraph->seq_nbases, nbases_str);
+  bytes_to_str(mem, 1, mem_str);
+  status("[compact] %s unitigs, %s bases, %s", nunitigs_str, nbases_str,
+         mem_str);
+}
+
+void compact_graph_build(CompactGraph *cgraph, size_t nthreads)
+{
+  const dBGraph *db_graph = cgraph->db_graph;
+  uint8_t *visited = ctx_calloc(roundup_bits2bytes(db_graph->ht.capacity), 1);
+  CompactThread *threads = ctx_calloc(nthreads, sizeof(CompactThread));
+  CompactBuilder builder = {.cgraph = cgraph, .threads = threads};
+  size_t i;
+
+  for(i = 0; i < nthreads; i++) {
+    cthread_unitig_buf_alloc(&threads[i].unitigs, 1024);
+    byte_buf_alloc(&threads[i].seq, 1024);
+    strbuf_alloc(&threads[i].sbuf, 1024);
+  }
+
+  status("[compact] Compacting unitigs with %zu threads", nthreads);
+  unitig_graph_create(&cgraph->ugraph, nthreads, visited,
+                      cgraph_add_unitig, &builder);
+  ctx_free(visited);
+
+  cgraph_merge_threads(cgraph, threads, nthreads);
+
+  for(i = 0; i < nthreads; i++) {
+    cthread_unitig_buf_dealloc(&threads[i].unitigs);
+    byte_buf_dealloc(&threads[i].seq);
+    strbuf_dealloc(&threads[i].sbuf);
+  }
+  ctx_free(threads);
+
+  cgraph->num_unitigs = cgraph->ugraph.num_unitigs;
+  cgraph_link(cgraph, nthreads);
+  cgraph_print_stats(cgraph);
+}
+
+//
+// Save / load
+//
+
+static void cgraph_fwrite(const void *ptr, size_t len, FILE *fh,
+                          const char *path)
+{
+  if(fwrite(ptr, 1, len, fh) != len)
+    die("Cannot write: %s [%s]", path, strerror(errno));
+}
+
+static void cgraph_fread(void *ptr, size_t len, FILE *fh, const char *path)
+{
+  if(fread(ptr, 1, len, fh) != len) {
+    if(ferror(fh)) die("Cannot read: %s [%s]", path, strerror(errno));
+    die("Truncated unitig graph: %s", path);
+  }
+}
+
+// Sum of coverage over all colours and kmers
+static uint64_t cgraph_total_covg(const CompactGraph *cgraph)
+{
+  uint64_t total = 0;
+  size_t uid;
+  for(uid = 0; uid < cgraph->num_unitigs; uid++)
+    total += cgraph->unitigs[uid].covg_sum;
+  return total;
+}
+
+static inline void _graph_add_covg(hkey_t hkey, const dBGraph *db_graph,
+                                   uint64_t *total)
+{
+  *total += db_node_sum_covg(db_graph, hkey);
+}
+
+static uint64_t db_graph_total_covg(const dBGraph *db_graph)
+{
+  uint64_t total = 0;
+  HASH_ITERATE(&db_graph->ht, _graph_add_covg, db_graph, &total);
+  return total;
+}
+
+// Unitig records are written field by field so the file does not depend on
+// struct padding
+static void cgraph_write_unitig(const CompactUnitig *u, FILE *fh,
+                                const char *path)
+{
+  cgraph_fwrite(&u->seqpos, sizeof(u->seqpos), fh, path);
+  cgraph_fwrite(&u->nkmers, sizeof(u->nkmers), fh, path);
+  cgraph_fwrite(u->nnext, sizeof(u->nnext), fh, path);
+  cgraph_fwrite(&u->covg_min, sizeof(u->covg_min), fh, path);
+  cgraph_fwrite(&u->covg_max, sizeof(u->covg_max), fh, path);
+  cgraph_fwrite(&u->covg_sum, sizeof(u->covg_sum), fh, path);
+  cgraph_fwrite(u->next, sizeof(u->next), fh, path);
+}
+
+static void cgraph_read_unitig(CompactUnitig *u, FILE *fh, const char *path)
+{
+  memset(u, 0, sizeof(*u));
+  cgraph_fread(&u->seqpos, sizeof(u->seqpos), fh, path);
+  cgraph_fread(&u->nkmers, sizeof(u->nkmers), fh, path);
+  cgraph_fread(u->nnext, sizeof(u->nnext), fh, path);
+  cgraph_fread(&u->covg_min, sizeof(u->covg_min), fh, path);
+  cgraph_fread(&u->covg_max, sizeof(u->covg_max), fh, path);
+  cgraph_fread(&u->covg_sum, sizeof(u->covg_sum), fh, path);
+  cgraph_fread(u->next, sizeof(u->next), fh, path);
+
+  if(u->nkmers == 0 || u->nnext[0] > 4 || u->nnext[1] > 4)
+    die("Unitig graph file is corrupt: %s", path);
+}
+
+void compact_graph_save(const CompactGraph *cgraph, const char *path)
+{
+  uint32_t version = CGRAPH_VERSION, kmer_size = cgraph->kmer_size;
+  uint32_t flags = db_graph_has_covgs(cgraph->db_graph) ? CGRAPH_FLAG_COVGS : 0;
+  uint64_t total_covg = cgraph_total_covg(cgraph);
+  uint64_t num_unitigs = cgraph->num_unitigs, nbases = cgraph->seq_nbases;
+  size_t i;
+
+  FILE *fout = futil_fopen_create(path, "w");
+
+  cgraph_fwrite(CGRAPH_MAGIC, strlen(CGRAPH_MAGIC), fout, path);
+  cgraph_fwrite(&version, sizeof(version), fout, path);
+  cgraph_fwrite(&kmer_size, sizeof(kmer_size), fout, path);
+  cgraph_fwrite(&flags, sizeof(flags), fout, path);
+  cgraph_fwrite(&total_covg, sizeof(total_covg), fout, path);
+  cgraph_fwrite(&num_unitigs, sizeof(num_unitigs), fout, path);
+  cgraph_fwrite(&nbases, sizeof(nbases), fout, path);
+  for(i = 0; i < num_unitigs; i++)
+    cgraph_write_unitig(&cgraph->unitigs[i], fout, path);
+  cgraph_fwrite(cgraph->seq, binary_seq_mem(nbases), fout, path);
+  cgraph_fwrite(CGRAPH_MAGIC, strlen(CGRAPH_MAGIC), fout, path);
+
+  futil_fclose(fout);
+
+  char nunitigs_str[50];
+  ulong_to_str(num_unitigs, nunitigs_str);
+  status("[compact] Saved %s unitigs to %s", nunitigs_str,
+         futil_outpath_str(path));
+}
+
+// Label first and last kmer of each unitig in order of unitig id
+static void cgraph_label(CompactGraph *cgraph, const char *path)
+{
+  const dBGraph *db_graph = cgraph->db_graph;
+  size_t uid, nkmers = 0, n;
+  dBNode nodes[2];
+
+  for(uid = 0; uid < cgraph->num_unitigs; uid++)
+  {
+    const CompactUnitig *u = &cgraph->unitigs[uid];
+    n = (u->nkmers == 1 ? 1 : 2);
+    nodes[0] = db_graph_find(db_graph, compact_graph_unitig_bkmer(cgraph, uid, 0));
+    nodes[n-1] = db_graph_find(db_graph,
+                               compact_graph_unitig_bkmer(cgraph, uid,
+                                                          u->nkmers-1));
+
+    if(nodes[0].key == HASH_NOT_FOUND || nodes[n-1].key == HASH_NOT_FOUND ||
+       cgraph->ugraph.unitig_ends[nodes[0].key].assigned ||
+       cgraph->ugraph.unitig_ends[nodes[n-1].key].assigned)
+      die("Unitig graph doesn't match the graph: %s", path);
+
+    unitig_graph_store_end_mt(nodes, n, &cgraph->ugraph);
+    nkmers += u->nkmers;
+  }
+
+  if(nkmers != hash_table_nkmers(&db_graph->ht))
+    die("Unitig graph has %zu kmers, graph has %zu: %s",
+        nkmers, (size_t)hash_table_nkmers(&db_graph->ht), path);
+}
+
+void compact_graph_load(CompactGraph *cgraph, const char *path)
+{
+  const dBGraph *db_graph = cgraph->db_graph;
+  char magic[strlen(CGRAPH_MAGIC)];
+  uint32_t version, kmer_size, flags;
+  uint64_t total_covg, graph_covg, num_unitigs, nbases, i;
+
+  ctx_assert(cgraph->num_unitigs == 0);
+
+  FILE *fh = futil_fopen(path, "r");
+
+  cgraph_fread(magic, sizeof(magic), fh, path);
+  if(memcmp(magic, CGRAPH_MAGIC, sizeof(magic)) != 0)
+    die("Not a unitig graph file: %s", path);
+
+  cgraph_fread(&version, sizeof(version), fh, path);
+  if(version != CGRAPH_VERSION)
+    die("Unitig graph version %u not supported: %s", version, path);
+
+  cgraph_fread(&kmer_size, sizeof(kmer_size), fh, path);
+  cgraph_fread(&flags, sizeof(flags), fh, path);
+  cgraph_fread(&total_covg, sizeof(total_covg), fh, path);
+  cgraph_fread(&num_unitigs, sizeof(num_unitigs), fh, path);
+  cgraph_fread(&nbases, sizeof(nbases), fh, path);
+
+  if(kmer_size != cgraph->kmer_size)
+    die("Unitig graph kmer size %u doesn't match graph (%zu): %s",
+        kmer_size, cgraph->kmer_size, path);
+
+  // Stored coverages must come from the same coverage as the loaded graph
+  if(db_graph_has_covgs(db_graph)) {
+    if(!(flags & CGRAPH_FLAG_COVGS))
+      die("Unitig graph was saved without coverage: %s", path);
+    graph_covg = db_graph_total_covg(db_graph);
+    if(graph_covg != total_covg) {
+      die("Unitig graph coverage (%"PRIu64") doesn't match graph (%"PRIu64"): %s",
+          total_covg, graph_covg, path);
+    }
+  }
+
+  cgraph_capacity(cgraph, num_unitigs, nbases);
+  for(i = 0; i < num_unitigs; i++) {
+    cgraph_read_unitig(&cgraph->unitigs[i], fh, path);
+    if(cgraph->unitigs[i].seqpos + cgraph->unitigs[i].nkmers + kmer_size - 1 > nbases)
+      die("Unitig graph file is corrupt: %s", path);
+  }
+  cgraph_fread(cgraph->seq, binary_seq_mem(nbases), fh, path);
+  cgraph_fread(magic, sizeof(magic), fh, path);
+  if(memcmp(magic, CGRAPH_MAGIC, sizeof(magic)) != 0)
+    die("Unitig graph file is corrupt: %s", path);
+
+  fclose(fh);
+
+  cgraph->num_unitigs = num_unitigs;
+  cgraph->seq_nbases = nbases;
+
+  // Unitig records must add up to the coverage in the header
+  if(db_graph_has_covgs(db_graph) && cgraph_total_covg(cgraph) != total_covg)
+    die("Unitig graph file is corrupt: %s", path);
+
+  cgraph_label(cgraph, path);
+  cgraph_print_stats(cgraph);
+}
@@ -0,0 +1,117 @@
+#ifndef COMPACT_GRAPH_H_
+#define COMPACT_GRAPH_H_
+
+#include "db_graph.h"
+#include "db_node.h"
+#include "unitig_graph.h"
+
+//
+// Compacted de Bruijn graph with one node per unitig
+//
+// Each unitig has an id, its sequence packed four bases per byte, a summary
+// of its coverage (summed over colours) and links from each of its two ends to
+// the ends of the unitigs they join. Traversals can step from unitig to
+// unitig instead of doing a hash table lookup per kmer.
+//
+// A unitig end is (unitig_id<<1 | side). Side 0 is the first kmer of the
+// unitig, side 1 the last kmer. Leaving from side 0 means walking backwards
+// off the first kmer; leaving from side 1 means walking forwards off the last
+// kmer. Links from an end list the ends we arrive at, so leaving an end we
+// arrived at walks back to where we came from.
+//
+// Unitigs are oriented as by db_unitig_normalise(). While linked to a graph,
+// the first and last kmer of every unitig are labelled in `ugraph`.
+//
+
+#define cgraph_end(uid,side) (((uint64_t)(uid) << 1) | (side))
+#define cgraph_end_unitig(e) ((e) >> 1)
+#define cgraph_end_side(e) ((int)((e) & 1))
+#define cgraph_end_other(e) ((e) ^ 1)
+
+#define CGRAPH_NO_END UINT64_MAX
+
+typedef struct
+{
+  uint64_t seqpos; // offset in CompactGraph.seq (bases), multiple of four
+  uint32_t nkmers;
+  uint8_t nnext[2]; // number of links from side 0 and 1
+  Covg covg_min, covg_max; // over the kmers of the unitig
+  uint64_t covg_sum;
+  uint64_t next[2][4]; // ends linked to from side 0 and 1
+} CompactUnitig;
+
+typedef struct
+{
+  size_t kmer_size, num_unitigs, capacity;
+  CompactUnitig *unitigs;
+  uint8_t *seq; // packed bases of all unitigs
+  size_t seq_nbases, seq_capacity; // bases
+  const dBGraph *db_graph; // graph labelled in `ugraph`
+  UnitigKmerGraph ugraph;
+} CompactGraph;
+
+// Bits of memory per kmer in the graph needed for a CompactGraph. The number
+// of unitigs is not known before the graph is loaded, so this is the worst
+// case of one unitig per kmer: unitig end labels, the unitig and its packed
+// sequence. If `build` is true, also counts the copies each thread keeps
+// until compact_graph_build() merges them, otherwise the graph is loaded with
+// compact_graph_load().
+size_t compact_graph_bits_per_kmer(size_t kmer_size, bool build);
+
+void compact_graph_alloc(CompactGraph *cgraph, const dBGraph *db_graph);
+void compact_graph_dealloc(CompactGraph *cgraph);
+
+// Compact all unitigs in the graph and link them, using `nthreads`. Each
+// thread packs its unitigs into its own buffer; buffers are merged at the end.
+void compact_graph_build(CompactGraph *cgraph, size_t nthreads);
+
+// Save unitigs, sequence and links. Kmers are stored by sequence, so a saved
+// graph can be loaded against any hash table holding the same kmers.
+void compact_graph_save(const CompactGraph *cgraph, const char *path);
+
+// Load a compact graph saved with compact_graph_save() and label the unitig
+// ends in the graph passed to compact_graph_alloc(). Dies if the file does not
+// match the graph: kmers must match, and if the graph has coverage it must
+// have the same total coverage as the graph the file was saved from.
+void compact_graph_load(CompactGraph *cgraph, const char *path);
+
+// Get the kmer at position `pos` of unitig `uid`, in the unitig's orientation
+BinaryKmer compact_graph_unitig_bkmer(const CompactGraph *cgraph, size_t uid,
+                                      size_t pos);
+
+// Look up all kmers of unitig `uid` in the graph, appending them to `nbuf`
+void compact_graph_unitig_nodes(const CompactGraph *cgraph, size_t uid,
+                                dBNodeBuffer *nbuf);
+
+// Returns the end of the unitig we arrive at by stepping onto `node`, or
+// CGRAPH_NO_END if `node` is not the first kmer of a unitig going forward or
+// the last kmer going backward
+static inline uint64_t compact_graph_node_end(const CompactGraph *cgraph,
+                                              dBNode node)
+{
+  UnitigEnd uend = cgraph->ugraph.unitig_ends[node.key];
+  if(!uend.assigned) return CGRAPH_NO_END;
+  if(uend.left && node.orient == uend.lorient)
+    return cgraph_end(uend.unitigid, 0);
+  if(uend.right && node.orient != uend.rorient)
+    return cgraph_end(uend.unitigid, 1);
+  return CGRAPH_NO_END;
+}
+
+// Get the ends linked to from end `e`. Returns number of links (0-4)
+static inline size_t compact_graph_next(const CompactGraph *cgraph, uint64_t e,
+                                        const uint64_t **next)
+{
+  const CompactUnitig *u = &cgraph->unitigs[cgraph_end_unitig(e)];
+  *next = u->next[cgraph_end_side(e)];
+  return u->nnext[cgraph_end_side(e)];
+}
+
+static inline size_t compact_graph_covg_mean(const CompactGraph *cgraph,
+                                             size_t uid)
+{
+  const CompactUnitig *u = &cgraph->unitigs[uid];
+  return u->covg_sum / u->nkmers;
+}
+
+#endif /* COMPACT_GRAPH_H_ */
@@ -0,0 +1,129 @@
+#include "global.h"
+#include "covg_overflow.h"
+
+// Fibonacci hashing, so neighbouring kmers and colours use different locks
+static inline CovgOvfStripe* covg_ovf_stripe(CovgOverflow *ovf, uint64_t idx)
+{
+  size_t s = (idx * 0x9E3779B97F4A7C15ULL) >> (64 - COVG_OVF_NSTRIPES_BITS);
+  return &ovf->stripes[s];
+}
+
+CovgOverflow* covg_ovf_new()
+{
+  size_t i;
+  CovgOverflow *ovf = ctx_calloc(1, sizeof(CovgOverflow));
+  for(i = 0; i < COVG_OVF_NSTRIPES; i++) {
+    ovf->stripes[i].h = kh_init(kcovg_ovf);
+    if(pthread_mutex_init(&ovf->stripes[i].lock, NULL) != 0)
+      die("Mutex init failed");
+  }
+  return ovf;
+}
+
+void covg_ovf_free(CovgOverflow *ovf)
+{
+  size_t i;
+  if(ovf == NULL) return;
+  for(i = 0; i < COVG_OVF_NSTRIPES; i++) {
+    kh_destroy(kcovg_ovf, ovf->stripes[i].h);
+    pthread_mutex_destroy(&ovf->stripes[i].lock);
+  }
+  ctx_free(ovf);
+}
+
+void covg_ovf_reset(CovgOverflow *ovf)
+{
+  size_t i;
+  for(i = 0; i < COVG_OVF_NSTRIPES; i++) {
+    pthread_mutex_lock(&ovf->stripes[i].lock);
+    kh_clear(kcovg_ovf, ovf->stripes[i].h);
+    pthread_mutex_unlock(&ovf->stripes[i].lock);
+  }
+}
+
+Covg covg_ovf_get(CovgOverflow *ovf, uint64_t idx)
+{
+  CovgOvfStripe *st = covg_ovf_stripe(ovf, idx);
+  Covg covg = COVG8_MAX;
+  pthread_mutex_lock(&st->lock);
+  khiter_t k = kh_get(kcovg_ovf, st->h, idx);
+  if(k != kh_end(st->h)) covg = kh_value(st->h, k);
+  pthread_mutex_unlock(&st->lock);
+  return covg;
+}
+
+// Get entry, adding one set to COVG8_MAX if missing. Call with lock held
+static inline Covg* covg_ovf_getptr(CovgOvfStripe *st, uint64_t idx)
+{
+  int ret;
+  khiter_t k = kh_put(kcovg_ovf, st->h, idx, &ret);
+  if(ret < 0) die("Out of memory");
+  if(ret > 0) kh_value(st->h, k) = COVG8_MAX;
+  return &kh_value(st->h, k);
+}
+
+void covg_ovf_set(CovgOverflow *ovf, uint64_t idx, Covg covg)
+{
+  CovgOvfStripe *st = covg_ovf_stripe(ovf, idx);
+  pthread_mutex_lock(&st->lock);
+  *covg_ovf_getptr(st, idx) = covg;
+  pthread_mutex_unlock(&st->lock);
+}
+
+void covg_ovf_add(CovgOverflow *ovf, uint64_t idx, Covg update)
+{
+  CovgOvfStripe *st = covg_ovf_stripe(ovf, idx);
+  pthread_mutex_lock(&st->lock);
+  Covg *ptr = covg_ovf_getptr(st, idx);
+  SAFE_SUM_COVG(*ptr, update);
+  pthread_mutex_unlock(&st->lock);
+}
+
+void covg_ovf_del(CovgOverflow *ovf, uint64_t idx)
+{
+  CovgOvfStripe *st = covg_ovf_stripe(ovf, idx);
+  pthread_mutex_lock(&st->lock);
+  khiter_t k = kh_get(kcovg_ovf, st->h, idx);
+  if(k != kh_end(st->h)) kh_del(kcovg_ovf, st->h, k);
+  pthread_mutex_unlock(&st->lock);
+}
+
+void covg_ovf_filter(CovgOverflow *ovf, bool (*keep)(uint64_t idx, void *arg),
+                     void *arg)
+{
+  CovgOvfStripe *st;
+  khiter_t k;
+  size_t i;
+  for(i = 0; i < COVG_OVF_NSTRIPES; i++) {
+    st = &ovf->stripes[i];
+    pthread_mutex_lock(&st->lock);
+    for(k = kh_begin(st->h); k != kh_end(st->h); k++)
+      if(kh_exist(st->h, k) && !keep(kh_key(st->h, k), arg))
+        kh_del(kcovg_ovf, st->h, k);
+    pthread_mutex_unlock(&st->lock);
+  }
+}
+
+size_t covg_ovf_size(CovgOverflow *ovf)
+{
+  size_t i, n = 0;
+  for(i = 0; i < COVG_OVF_NSTRIPES; i++) {
+    pthread_mutex_lock(&ovf->stripes[i].lock);
+    n += kh_size(ovf->stripes[i].h);
+    pthread_mutex_unlock(&ovf->stripes[i].lock);
+  }
+  return n;
+}
+
+size_t covg_ovf_mem(CovgOverflow *ovf)
+{
+  size_t i, nbuckets, mem = sizeof(CovgOverflow);
+  for(i = 0; i < COVG_OVF_NSTRIPES; i++) {
+    pthread_mutex_lock(&ovf->stripes[i].lock);
+    nbuckets = ovf->stripes[i].h->n_buckets;
+    pthread_mutex_unlock(&ovf->stripes[i].lock);
+    // key, value and 2 bits of flags per bucket
+    mem += nbuckets * (sizeof(uint64_t) + sizeof(Covg)) + nbuckets / 4;
+  }
+  return mem;
+}
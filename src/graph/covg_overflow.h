@@ -0,0 +1,67 @@
+#ifndef COVG_OVERFLOW_H_
+#define COVG_OVERFLOW_H_
+
+#include <inttypes.h>
+#include <pthread.h>
+#include "htslib/khash.h"
+
+#include "cortex_types.h"
+
+//
+// Side table for coverages that do not fit in 8 bit counters
+// (see DBG_ALLOC_COVGS8). A counter of COVG8_MAX means the coverage is stored
+// here, keyed by its index in the counter array. A missing entry reads as
+// COVG8_MAX. All functions are thread safe: entries are split between
+// COVG_OVF_NSTRIPES tables by a hash of their index, each with its own lock.
+//
+
+#define COVG8_MAX UINT8_MAX
+
+#define COVG_OVF_NSTRIPES_BITS 6
+#define COVG_OVF_NSTRIPES (1<<COVG_OVF_NSTRIPES_BITS)
+
+// For memory estimates: bytes per entry (key, value and khash flags at ~75%
+// occupancy) and the fraction of counters assumed to overflow
+#define COVG_OVF_ENTRY_BYTES 18
+#define COVG_OVF_EST_FRAC 0.05
+
+// Bits per 8 bit counter including its share of the overflow table
+#define COVG8_EST_BITS (8 + (size_t)(COVG_OVF_ENTRY_BYTES*8*COVG_OVF_EST_FRAC))
+
+KHASH_MAP_INIT_INT64(kcovg_ovf, Covg);
+
+typedef struct
+{
+  khash_t(kcovg_ovf) *h;
+  pthread_mutex_t lock;
+} CovgOvfStripe;
+
+typedef struct
+{
+  CovgOvfStripe stripes[COVG_OVF_NSTRIPES];
+} CovgOverflow;
+
+CovgOverflow* covg_ovf_new();
+void covg_ovf_free(CovgOverflow *ovf);
+
+// Remove all entries
+void covg_ovf_reset(CovgOverflow *ovf);
+
+Covg covg_ovf_get(CovgOverflow *ovf, uint64_t idx);
+void covg_ovf_set(CovgOverflow *ovf, uint64_t idx, Covg covg);
+void covg_ovf_del(CovgOverflow *ovf, uint64_t idx);
+
+// Add to a stored coverage, with COVG8_MAX as the starting value if there is
+// no entry. Does not overflow: coverage stops at COVG_MAX
+void covg_ovf_add(CovgOverflow *ovf, uint64_t idx, Covg update);
+
+// Remove entries where `keep(idx,arg)` returns false
+void covg_ovf_filter(CovgOverflow *ovf, bool (*keep)(uint64_t idx, void *arg),
+                     void *arg);
+
+size_t covg_ovf_size(CovgOverflow *ovf);
+
+// Bytes used by the tables
+size_t covg_ovf_mem(CovgOverflow *ovf);
+
+#endif /* COVG_OVERFLOW_H_ */
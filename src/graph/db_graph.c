@@ -9,8 +9,10 @@ static void db_graph_status(const dBGraph *db_graph)
 {
   char capacity_str[100];
   ulong_to_str(db_graph->ht.capacity, capacity_str);
-  status("[graph] kmer-size: %zu; colours: %zu; capacity: %s\n",
-         db_graph->kmer_size, db_graph->num_of_cols, capacity_str);
+  status("[graph] kmer-size: %zu; colours: %zu; capacity: %s%s%s\n",
+         db_graph->kmer_size, db_graph->num_of_cols, capacity_str,
+         db_graph->col_major ? "; colour-major" : "",
+         db_graph->col_covgs8 ? "; 8-bit coverage" : "");
 }
 
 const int DBG_ALLOC_EDGES       =  1;
@@ -18,6 +20,8 @@ const int DBG_ALLOC_COVGS       =  2;
 const int DBG_ALLOC_BKTLOCKS    =  4;
 const int DBG_ALLOC_READSTRT    =  8;
 const int DBG_ALLOC_NODE_IN_COL = 16;
+const int DBG_ALLOC_COLMAJOR    = 32;
+const int DBG_ALLOC_COVGS8      = 64;
 
 // alloc_flags specifies where fields to malloc. OR together DBG_ALLOC_* values
 void db_graph_alloc(dBGraph *db_graph, size_t kmer_size,
@@ -33,8 +37,11 @@ void db_graph_alloc(dBGraph *db_graph, size_t kmer_size,
                  .ginfo = NULL,
                  .col_edges = NULL,
                  .col_covgs = NULL,
+                 .col_covgs8 = NULL,
+                 .covg_ovf = NULL,
                  .node_in_cols = NULL,
-                 .readstrt = NULL};
+                 .readstrt = NULL,
+                 .col_major = (alloc_flags & DBG_ALLOC_COLMAJOR) != 0};
 
   ctx_assert(num_of_cols > 0);
   ctx_assert(num_edge_cols == 0 || num_edge_cols == 1 || num_edge_cols == num_of_cols);
@@ -52,9 +59,16 @@ void db_graph_alloc(dBGraph *db_graph, size_t kmer_size,
   if(alloc_flags & DBG_ALLOC_EDGES)
     tmp.col_edges = ctx_calloc(tmp.ht.capacity * num_edge_cols, sizeof(Edges));
 
+  ctx_assert(!(alloc_flags & DBG_ALLOC_COVGS) || !(alloc_flags & DBG_ALLOC_COVGS8));
+
   if(alloc_flags & DBG_ALLOC_COVGS)
     tmp.col_covgs = ctx_calloc(tmp.ht.capacity * num_of_cols, sizeof(Covg));
 
+  if(alloc_flags & DBG_ALLOC_COVGS8) {
+    tmp.col_covgs8 = ctx_calloc(tmp.ht.capacity * num_of_cols, sizeof(uint8_t));
+    tmp.covg_ovf = covg_ovf_new();
+  }
+
   if(alloc_flags & DBG_ALLOC_BKTLOCKS)
     tmp.bktlocks = ctx_calloc(roundup_bits2bytes(tmp.ht.num_of_buckets), 1);
 
@@ -84,6 +98,8 @@ void db_graph_dealloc(dBGraph *db_graph)
 
   ctx_free(db_graph->bktlocks);
   ctx_free(db_graph->col_covgs); // num_of_cols * capacity
+  ctx_free(db_graph->col_covgs8); // num_of_cols * capacity
+  covg_ovf_free(db_graph->covg_ovf);
   ctx_free(db_graph->col_edges); // num_col_edges * capacity
   ctx_free(db_graph->node_in_cols);
   ctx_free(db_graph->readstrt);
@@ -101,7 +117,7 @@ void db_graph_dealloc(dBGraph *db_graph)
 void db_graph_update_node_mt(dBGraph *db_graph, dBNode node, Colour col)
 {
   if(db_graph->node_in_cols != NULL) db_node_set_col_mt(db_graph, node.key, col);
-  if(db_graph->col_covgs != NULL) db_node_increment_coverage_mt(db_graph, node.key, col);
+  if(db_graph_has_covgs(db_graph)) db_node_increment_coverage_mt(db_graph, node.key, col);
 }
 
 // Not thread safe, use db_graph_find_or_add_node_mt for that
@@ -278,10 +294,10 @@ uint8_t db_graph_next_nodes_in_col(const dBGraph *db_graph,
               (db_graph->num_of_cols == 1 && colour == 0) ||
               db_graph->num_of_cols == db_graph->num_edge_cols ||
               (db_graph->num_of_cols > 1 && db_graph->num_edge_cols == 1 &&
-                (db_graph->node_in_cols || db_graph->col_covgs)),
+                (db_graph->node_in_cols || db_graph_has_covgs(db_graph))),
               "col: %i; cols: %zu edges: %zu node_in_cols: %i col_covgs: %i",
               colour, db_graph->num_of_cols, db_graph->num_edge_cols,
-              !!db_graph->node_in_cols, !!db_graph->col_covgs);
+              !!db_graph->node_in_cols, !!db_graph_has_covgs(db_graph));
 
   size_t i, j;
   Edges edges;
@@ -308,7 +324,7 @@ uint8_t db_graph_next_nodes_in_col(const dBGraph *db_graph,
   {
     for(i = j = 0; i < count; i++) {
       if(( db_graph->node_in_cols && db_node_has_col(db_graph, nodes[i].key, colour)) ||
-         (!db_graph->node_in_cols && db_node_covg(db_graph, nodes[i].key, colour) > 0))
+         (!db_graph->node_in_cols && db_node_get_covg(db_graph, nodes[i].key, colour) > 0))
       {
         nodes[j] = nodes[i];
         fw_nucs[j] = fw_nucs[i];
@@ -454,6 +470,18 @@ void db_graph_healthcheck(const dBGraph *db_graph)
 // Functions applying to whole graph
 //
 
+// Set coverage of all kmers in all colours to zero
+void db_graph_zero_covgs(dBGraph *db_graph)
+{
+  size_t n = db_graph->ht.capacity * db_graph->num_of_cols;
+  if(db_graph->col_covgs != NULL)
+    memset(db_graph->col_covgs, 0, n * sizeof(Covg));
+  if(db_graph->col_covgs8 != NULL) {
+    memset(db_graph->col_covgs8, 0, n * sizeof(uint8_t));
+    covg_ovf_reset(db_graph->covg_ovf);
+  }
+}
+
 void db_graph_reset(dBGraph *db_graph)
 {
   size_t col, capacity = db_graph->ht.capacity;
@@ -467,8 +495,7 @@ void db_graph_reset(dBGraph *db_graph)
 
   if(db_graph->col_edges != NULL)
     memset(db_graph->col_edges, 0, nedgecols * sizeof(Edges) * capacity);
-  if(db_graph->col_covgs != NULL)
-    memset(db_graph->col_covgs, 0, ncols * sizeof(Covg) * capacity);
+  db_graph_zero_covgs(db_graph);
   if(db_graph->node_in_cols != NULL)
     memset(db_graph->node_in_cols, 0, roundup_bits2bytes(capacity) * ncols);
   if(db_graph->readstrt != NULL)
@@ -483,7 +510,7 @@ void db_graph_reset(dBGraph *db_graph)
 
 typedef struct {
   const dBGraph *db_graph;
-  const size_t nthreads;
+  WorkSteal *ws;
   uint64_t *nkmers, *sumcov;
 } GetKmerCovg;
 
@@ -509,8 +536,8 @@ void get_kmer_covg_thread(void *arg, size_t threadid)
   uint64_t *nkmers = ctx_calloc(ncols, sizeof(uint64_t));
   uint64_t *sumcov = ctx_calloc(ncols, sizeof(uint64_t));
 
-  HASH_ITERATE_PART(&d->db_graph->ht, threadid, d->nthreads,
-                    get_kmer_covg, d->db_graph, nkmers, sumcov);
+  HASH_ITERATE_STEAL(&d->db_graph->ht, d->ws, threadid,
+                     get_kmer_covg, d->db_graph, nkmers, sumcov);
 
   // Add results to array shared with other threads
   for(col = 0; col < ncols; col++) {
@@ -525,18 +552,40 @@ void get_kmer_covg_thread(void *arg, size_t threadid)
 void db_graph_get_kmer_covg(const dBGraph *db_graph, size_t nthreads,
                             uint64_t *nkmers, uint64_t *sumcov)
 {
+  WorkSteal ws;
+  work_steal_alloc(&ws, hash_table_size(&db_graph->ht), nthreads,
+                   WORK_STEAL_CHUNKS_PER_THREAD);
+
   GetKmerCovg getcov = {.db_graph = db_graph,
-                        .nthreads = nthreads,
+                        .ws = &ws,
                         .nkmers = nkmers,
                         .sumcov = sumcov};
 
   util_multi_thread(&getcov, nthreads, get_kmer_covg_thread);
+
+  work_steal_print_stats(&ws, "kmer_covg");
+  work_steal_dealloc(&ws);
 }
 
 //
 // Wipe
 //
 
+typedef struct {
+  const dBGraph *db_graph;
+  Colour col;
+} WipeCovgOvf;
+
+// Returns true if counter index `idx` is not in colour w->col
+static bool ovf_idx_not_in_col(uint64_t idx, void *arg)
+{
+  const WipeCovgOvf *w = (const WipeCovgOvf*)arg;
+  const dBGraph *db_graph = w->db_graph;
+  Colour col = db_graph->col_major ? idx / db_graph->ht.capacity
+                                   : idx % db_graph->num_of_cols;
+  return col != w->col;
+}
+
 // BEWARE: if num_edge_cols == 1, edges in all colours will be effectively wiped
 void db_graph_wipe_colour(dBGraph *db_graph, Colour col)
 {
@@ -559,6 +608,24 @@ void db_graph_wipe_colour(dBGraph *db_graph, Colour col)
   col_edges = (Edges (*)[db_graph->num_edge_cols])db_graph->col_edges;
   col_covgs = (Covg (*)[db_graph->num_of_cols])db_graph->col_covgs;
 
+  if(db_graph->col_covgs8 != NULL) {
+    for(i = 0; i < capacity; i++)
+      db_graph->col_covgs8[db_graph_col_idx(db_graph, i, col, db_graph->num_of_cols)] = 0;
+    covg_ovf_filter(db_graph->covg_ovf, ovf_idx_not_in_col,
+                    &(WipeCovgOvf){.db_graph = db_graph, .col = col});
+  }
+
+  // Colour-major: each colour is a contiguous run of capacity entries
+  if(db_graph->col_major) {
+    if(db_graph->col_covgs != NULL)
+      memset(&db_node_covg(db_graph, 0, col), 0, capacity * sizeof(Covg));
+    if(db_graph->col_edges != NULL && db_graph->num_edge_cols == 1)
+      memset(db_graph->col_edges, 0, capacity * sizeof(Edges));
+    else if(db_graph->col_edges != NULL)
+      memset(&db_node_edges(db_graph, 0, col), 0, capacity * sizeof(Edges));
+    return;
+  }
+
   if(db_graph->col_covgs != NULL) {
     if(db_graph->num_of_cols == 1) {
       memset(db_graph->col_covgs, 0, capacity * sizeof(Covg));
@@ -586,11 +653,11 @@ static inline void add_all_edges(hkey_t node, dBGraph *db_graph)
   Orientation orient;
   Nucleotide nuc;
   hkey_t next;
-  Edges edge, *edges = &db_node_edges(db_graph,node,0), iedges = edges[0];
+  Edges edge, iedges = db_node_get_edges(db_graph, node, 0);
   bool node_has_col[edgencols];
 
   for(col = 0; col < edgencols; col++) {
-    iedges &= edges[col];
+    iedges &= db_node_get_edges(db_graph, node, col);
     node_has_col[col] = db_node_has_col(db_graph, node, col);
   }
 
@@ -615,7 +682,7 @@ static inline void add_all_edges(hkey_t node, dBGraph *db_graph)
         if(next != HASH_NOT_FOUND)
           for(col = 0; col < edgencols; col++)
             if(node_has_col[col] && db_node_has_col(db_graph, next, col))
-              edges[col] |= edge;
+              db_node_edges(db_graph, node, col) |= edge;
       }
     }
   }
@@ -641,7 +708,8 @@ static bool wipe_kmer_if_no_covg(hkey_t hkey, size_t threadid, void *arg)
 // remove kmers from the graph if they have no coverage
 void db_graph_remove_no_covg_kmers(dBGraph *db_graph, size_t nthreads)
 {
-  hash_table_iterate(&db_graph->ht, nthreads, wipe_kmer_if_no_covg, db_graph);
+  hash_table_iterate(&db_graph->ht, nthreads, NULL,
+                     wipe_kmer_if_no_covg, db_graph);
 }
 
 typedef struct {
@@ -659,9 +727,15 @@ static void intersect_edges(void *arg, size_t threadid)
   start = step * threadid;
   end = threadid+1 == job.nthreads ? job.db_graph->ht.capacity : start + step;
   ncols = job.db_graph->num_of_cols;
-  for(i = start, j = i*ncols; i < end; i++)
-    for(col = 0; col < ncols; col++, j++)
-      edges[j] &= job.isec_edges[i];
+  if(job.db_graph->col_major) {
+    for(col = 0; col < ncols; col++)
+      for(i = start, j = col*job.db_graph->ht.capacity+i; i < end; i++, j++)
+        edges[j] &= job.isec_edges[i];
+  } else {
+    for(i = start, j = i*ncols; i < end; i++)
+      for(col = 0; col < ncols; col++, j++)
+        edges[j] &= job.isec_edges[i];
+  }
 }
 
 void db_graph_intersect_edges(dBGraph *db_graph, size_t nthreads, Edges *edges)
@@ -720,8 +794,14 @@ void db_graph_print_kmer2(BinaryKmer bkmer, Covg *covgs, Edges *edges,
 void db_graph_print_kmer(hkey_t node, dBGraph *db_graph, FILE *fout)
 {
   BinaryKmer bkmer = db_node_get_bkey(db_graph, node);
-  Covg *covgs = &db_node_covg(db_graph, node, 0);
-  Edges *edges = &db_node_edges(db_graph, node, 0);
+  Covg covgs[db_graph->num_of_cols];
+  Edges edges[db_graph->num_of_cols];
+  size_t col;
+
+  for(col = 0; col < db_graph->num_of_cols; col++) {
+    covgs[col] = db_node_get_covg(db_graph, node, col);
+    edges[col] = db_node_get_edges(db_graph, node, col);
+  }
 
   db_graph_print_kmer2(bkmer, covgs, edges,
                        db_graph->num_of_cols, db_graph->kmer_size,
@@ -10,12 +10,15 @@
 #include "graph_info.h"
 #include "gpath_store.h"
 #include "gpath_hash.h"
+#include "covg_overflow.h"
 
 extern const int DBG_ALLOC_EDGES;
 extern const int DBG_ALLOC_COVGS;
 extern const int DBG_ALLOC_BKTLOCKS;
 extern const int DBG_ALLOC_READSTRT;
 extern const int DBG_ALLOC_NODE_IN_COL;
+extern const int DBG_ALLOC_COLMAJOR;
+extern const int DBG_ALLOC_COVGS8;
 
 //
 // Graph
@@ -39,6 +42,19 @@ typedef struct
   Edges *col_edges; // num_of_cols*ht.capacity size addr: [hkey*num_of_cols + col]
   Covg *col_covgs; // num_edge_cols*ht.capacity size addr: [hkey*num_edge_cols + col]
 
+  // If col_major, col_covgs and col_edges are stored one colour after another:
+  //   [col*ht.capacity + hkey]
+  // so that passes over a single colour only touch that colour's memory.
+  // Use db_node_covg() / db_node_edges() rather than indexing directly.
+  bool col_major;
+
+  // Compact coverage (DBG_ALLOC_COVGS8), used instead of col_covgs:
+  // 8 bit counters indexed like col_covgs. Counters saturate at COVG8_MAX,
+  // larger coverages are kept in covg_ovf. Use db_node_get_covg(),
+  // db_node_set_covg() and db_node_add_col_covg() to read and update.
+  uint8_t *col_covgs8;
+  CovgOverflow *covg_ovf;
+
   // This should be cast to volatile to read / write
   uint8_t *bktlocks;
 
@@ -55,10 +71,14 @@ typedef struct
   uint8_t *readstrt;
 } dBGraph;
 
+#define db_graph_has_covgs(graph) ((graph)->col_covgs != NULL || (graph)->col_covgs8 != NULL)
 #define db_graph_has_path_hash(graph) ((graph)->gphash.table != NULL)
 #define db_graph_node_assigned(graph,hkey) hash_table_assigned(&(graph)->ht, hkey)
 
 // alloc_flags specifies where fields to malloc. OR together DBG_ALLOC_* values
+// DBG_ALLOC_COLMAJOR stores coverage and edges colour-major (see col_major)
+// DBG_ALLOC_COVGS8 stores coverage in 8 bit counters plus an overflow table
+//   (see col_covgs8); use instead of DBG_ALLOC_COVGS
 void db_graph_alloc(dBGraph *db_graph, size_t kmer_size,
                     size_t num_of_cols, size_t num_edge_cols,
                     uint64_t capacity, int alloc_flags);
@@ -68,6 +88,9 @@ void db_graph_dealloc(dBGraph *db_graph);
 
 void db_graph_reset(dBGraph *db_graph);
 
+// Set coverage of all kmers in all colours to zero
+void db_graph_zero_covgs(dBGraph *db_graph);
+
 //
 // Add to the de bruijn graph
 //
@@ -19,7 +19,7 @@ Edges db_node_edges_in_col(dBNode node, size_t col, const dBGraph *db_graph)
 
   // Edges are merged into one colour
   ctx_assert(db_graph->num_edge_cols == 1);
-  ctx_assert(db_graph->node_in_cols != NULL || db_graph->col_covgs != NULL);
+  ctx_assert(db_graph->node_in_cols != NULL || db_graph_has_covgs(db_graph));
 
   // Check which next nodes are in the given colour
   dBNode nodes[4];
@@ -125,24 +125,67 @@ char* db_node_get_edges_str(Edges edges, char *kmer_col_edge_str)
 // Coverages
 //
 
+// Add to an 8 bit counter, moving coverage into the overflow table once the
+// counter saturates. Thread safe.
+static void db_node_add_covg8_mt(dBGraph *graph, hkey_t hkey, Colour col,
+                                 Covg update)
+{
+  size_t idx = db_node_covg8_idx(graph, hkey, col);
+  volatile uint8_t *ptr = graph->col_covgs8 + idx;
+  uint8_t v;
+
+  if(update == 0) return;
+
+  while((v = *ptr) < COVG8_MAX) {
+    if((uint64_t)v + update < COVG8_MAX) {
+      if(__sync_bool_compare_and_swap(ptr, v, v+update)) return;
+    }
+    else if(__sync_bool_compare_and_swap(ptr, v, COVG8_MAX)) {
+      // Entry starts at COVG8_MAX, add the remainder
+      covg_ovf_add(graph->covg_ovf, idx, update - (COVG8_MAX - v));
+      return;
+    }
+  }
+
+  covg_ovf_add(graph->covg_ovf, idx, update);
+}
+
 void db_node_add_col_covg(dBGraph *graph, hkey_t hkey, Colour col, Covg update)
 {
-  SAFE_SUM_COVG(db_node_covg(graph,hkey,col), update);
+  if(graph->col_covgs8 != NULL) db_node_add_covg8_mt(graph, hkey, col, update);
+  else SAFE_SUM_COVG(db_node_covg(graph,hkey,col), update);
 }
 
 void db_node_increment_coverage(dBGraph *graph, hkey_t hkey, Colour col)
 {
-  SAFE_SUM_COVG(db_node_covg(graph,hkey,col), 1);
+  db_node_add_col_covg(graph, hkey, col, 1);
 }
 
 // Thread safe, overflow safe, coverage increment
 void db_node_increment_coverage_mt(dBGraph *graph, hkey_t hkey, Colour col)
 {
+  if(graph->col_covgs8 != NULL) { db_node_add_covg8_mt(graph, hkey, col, 1); return; }
   Covg v;
   while((v = db_node_covg(graph,hkey,col)) < COVG_MAX &&
         !__sync_bool_compare_and_swap(&db_node_covg(graph,hkey,col), v, v+1));
 }
 
+void db_node_add_col_covg_mt(dBGraph *graph, hkey_t hkey, Colour col, Covg update)
+{
+  if(graph->col_covgs8 != NULL) {
+    db_node_add_covg8_mt(graph, hkey, col, update);
+    return;
+  }
+
+  volatile Covg *ptr = &db_node_covg(graph,hkey,col);
+  Covg v, newv;
+  do {
+    v = *ptr;
+    newv = SAFE_ADD_COVG(v, update);
+  }
+  while(v != newv && !__sync_bool_compare_and_swap(ptr, v, newv));
+}
+
 //
 // dBNode reversal and shifting
 //
@@ -264,34 +307,26 @@ void db_nodes_print(const dBNode *nodes, size_t num,
   }
 }
 
-void db_nodes_gzprint(const dBNode *nodes, size_t num,
-                      const dBGraph *db_graph, gzFile out)
+void db_nodes_strbuf(const dBNode *nodes, size_t num,
+                     const dBGraph *db_graph, StrBuf *sbuf)
 {
-  size_t i, kmer_size = db_graph->kmer_size;
-  Nucleotide nuc;
-  BinaryKmer bkmer;
-  char tmp[MAX_KMER_SIZE+1];
-
-  bkmer = db_node_oriented_bkmer(db_graph, nodes[0]);
-  binary_kmer_to_str(bkmer, kmer_size, tmp);
-  gzputs(out, tmp);
-
-  for(i = 1; i < num; i++) {
-    nuc = db_node_get_last_nuc(nodes[i], db_graph);
-    gzputc(out, dna_nuc_to_char(nuc));
-  }
+  if(num == 0) return;
+  strbuf_ensure_capacity(sbuf, sbuf->end + db_graph->kmer_size + num);
+  sbuf->end += db_nodes_to_str(nodes, num, db_graph, sbuf->b + sbuf->end);
 }
 
 // Do not print first k-1 bases => 3 nodes gives 3bp instead of 3+k-1
-void db_nodes_gzprint_cont(const dBNode *nodes, size_t num,
-                           const dBGraph *db_graph, gzFile out)
+void db_nodes_strbuf_cont(const dBNode *nodes, size_t num,
+                          const dBGraph *db_graph, StrBuf *sbuf)
 {
   size_t i;
   Nucleotide nuc;
+  strbuf_ensure_capacity(sbuf, sbuf->end + num);
   for(i = 0; i < num; i++) {
     nuc = db_node_get_last_nuc(nodes[i], db_graph);
-    gzputc(out, dna_nuc_to_char(nuc));
+    sbuf->b[sbuf->end++] = dna_nuc_to_char(nuc);
   }
+  sbuf->b[sbuf->end] = '\0';
 }
 
 // Print:
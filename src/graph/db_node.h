@@ -237,16 +237,28 @@ static inline char *edges_get_str(Edges fw_edges, char *str)
 // dBNode Edges
 //
 
+// Index of colour `col` of node `hkey` in an array with `ncols` per node
+#define db_graph_col_idx(graph,hkey,col,ncols) \
+        ((graph)->col_major ? (col)*(graph)->ht.capacity + (hkey) \
+                            : (hkey)*(ncols) + (col))
+
 #define db_node_edges(graph,hkey,col) \
-        ((graph)->col_edges[(hkey)*(graph)->num_edge_cols + (col)])
+        ((graph)->col_edges[db_graph_col_idx(graph,hkey,col,(graph)->num_edge_cols)])
 
 static inline Edges db_node_get_edges(const dBGraph *graph, hkey_t hkey, Colour col) {
   return db_node_edges(graph, hkey, col);
 }
 
 static inline Edges db_node_get_edges_union(const dBGraph *graph, hkey_t hkey) {
-  return edges_get_union(graph->col_edges + hkey * graph->num_edge_cols,
-                         graph->num_edge_cols);
+  if(!graph->col_major || graph->num_edge_cols == 1) {
+    return edges_get_union(graph->col_edges + hkey * graph->num_edge_cols,
+                           graph->num_edge_cols);
+  }
+  Edges edges = 0;
+  size_t col;
+  for(col = 0; col < graph->num_edge_cols; col++)
+    edges |= db_node_edges(graph, hkey, col);
+  return edges;
 }
 
 // Edges restricted to this colour, only in one direction (node.orient)
@@ -262,9 +274,16 @@ Edges db_node_both_edges_in_col(hkey_t hkey, size_t col, const dBGraph *db_graph
 #define db_node_indegree_in_col(node,col,graph) \
         db_node_outdegree_in_col(db_node_reverse(node),col,graph)
 
-#define db_node_zero_edges(graph,hkey) \
-        memset((graph)->col_edges + (hkey)*(graph)->num_edge_cols, 0, \
-               (graph)->num_edge_cols * sizeof(Edges))
+static inline void db_node_zero_edges(dBGraph *graph, hkey_t hkey) {
+  size_t col;
+  if(!graph->col_major) {
+    memset(graph->col_edges + hkey*graph->num_edge_cols, 0,
+           graph->num_edge_cols * sizeof(Edges));
+  } else {
+    for(col = 0; col < graph->num_edge_cols; col++)
+      db_node_edges(graph, hkey, col) = 0;
+  }
+}
 
 #define db_node_set_col_edge(graph,hkey,col,nuc,or) \
         (db_node_edges(graph,hkey,col) \
@@ -281,17 +300,42 @@ char* db_node_get_edges_str(Edges edges, char *kmer_col_edge_str);
 // Coverages
 //
 
+// Only for graphs allocated with DBG_ALLOC_COVGS, otherwise use
+// db_node_get_covg() and db_node_set_covg()
 #define db_node_covg(graph,hkey,col) \
-        ((graph)->col_covgs[(hkey)*(graph)->num_of_cols+(col)])
+        ((graph)->col_covgs[db_graph_col_idx(graph,hkey,col,(graph)->num_of_cols)])
+
+#define db_node_covg8_idx(graph,hkey,col) \
+        db_graph_col_idx(graph,hkey,col,(graph)->num_of_cols)
 
 static inline Covg db_node_get_covg(const dBGraph *db_graph,
                                     hkey_t hkey, Colour col) {
-  return db_node_covg(db_graph, hkey, col);
+  if(db_graph->col_covgs8 == NULL) return db_node_covg(db_graph, hkey, col);
+  size_t idx = db_node_covg8_idx(db_graph, hkey, col);
+  uint8_t covg = db_graph->col_covgs8[idx];
+  return covg < COVG8_MAX ? covg : covg_ovf_get(db_graph->covg_ovf, idx);
 }
 
-#define db_node_zero_covgs(graph,hkey) \
-        memset((graph)->col_covgs + (hkey)*(graph)->num_of_cols, 0, \
-               (graph)->num_of_cols * sizeof(Covg))
+// Not thread safe
+static inline void db_node_set_covg(dBGraph *graph, hkey_t hkey, Colour col,
+                                    Covg covg) {
+  if(graph->col_covgs8 == NULL) { db_node_covg(graph, hkey, col) = covg; return; }
+  size_t idx = db_node_covg8_idx(graph, hkey, col);
+  if(covg >= COVG8_MAX) covg_ovf_set(graph->covg_ovf, idx, covg);
+  else if(graph->col_covgs8[idx] == COVG8_MAX) covg_ovf_del(graph->covg_ovf, idx);
+  graph->col_covgs8[idx] = (uint8_t)MIN2(covg, COVG8_MAX);
+}
+
+static inline void db_node_zero_covgs(dBGraph *graph, hkey_t hkey) {
+  size_t col;
+  if(!graph->col_major && graph->col_covgs8 == NULL) {
+    memset(graph->col_covgs + hkey*graph->num_of_cols, 0,
+           graph->num_of_cols * sizeof(Covg));
+  } else {
+    for(col = 0; col < graph->num_of_cols; col++)
+      db_node_set_covg(graph, hkey, col, 0);
+  }
+}
 
 void db_node_add_col_covg(dBGraph *graph, hkey_t hkey, Colour col, Covg update);
 void db_node_increment_coverage(dBGraph *graph, hkey_t hkey, Colour col);
@@ -299,12 +343,14 @@ void db_node_increment_coverage(dBGraph *graph, hkey_t hkey, Colour col);
 // Thread safe, overflow safe, coverage increment
 void db_node_increment_coverage_mt(dBGraph *graph, hkey_t hkey, Colour col);
 
+// Thread safe, overflow safe, add to coverage
+void db_node_add_col_covg_mt(dBGraph *graph, hkey_t hkey, Colour col, Covg update);
+
 static inline Covg db_node_sum_covg(const dBGraph *graph, hkey_t hkey)
 {
-  const Covg *covgs = &db_node_covg(graph,hkey,0);
-  Covg sum_covg = covgs[0];
+  Covg sum_covg = db_node_get_covg(graph,hkey,0);
   size_t c, ncols = graph->num_of_cols;
-  for(c = 1; c < ncols; c++) SAFE_SUM_COVG(sum_covg, covgs[c]);
+  for(c = 1; c < ncols; c++) SAFE_SUM_COVG(sum_covg, db_node_get_covg(graph,hkey,c));
   return sum_covg;
 }
 
@@ -350,12 +396,13 @@ size_t db_nodes_to_str(const dBNode *nodes, size_t num,
 void db_nodes_print(const dBNode *nodes, size_t num,
                     const dBGraph *db_graph, FILE *out);
 
-void db_nodes_gzprint(const dBNode *nodes, size_t num,
-                      const dBGraph *db_graph, gzFile out);
+// Append sequence of nodes to a string buffer
+void db_nodes_strbuf(const dBNode *nodes, size_t num,
+                     const dBGraph *db_graph, StrBuf *sbuf);
 
 // Do not print first k-1 bases => 3 nodes gives 3bp instead of 3+k-1
-void db_nodes_gzprint_cont(const dBNode *nodes, size_t num,
-                           const dBGraph *db_graph, gzFile out);
+void db_nodes_strbuf_cont(const dBNode *nodes, size_t num,
+                          const dBGraph *db_graph, StrBuf *sbuf);
 
 // Print:
 // 0: AAACCCAAATGCAAACCCAAATGCAAACCCA:1 TGGGTTTGCATTTGGGTTTGCATTTGGGTTT
@@ -204,7 +204,7 @@ static inline int unitig_iterate_node(hkey_t hkey, size_t threadid,
 }
 
 typedef struct {
-  const size_t nthreads;
+  WorkSteal *const ws;
   uint8_t *const visited;
   const dBGraph *db_graph;
   void (*func)(dBNodeBuffer _nbuf, size_t threadid, void *_arg);
@@ -218,10 +218,10 @@ static void db_unitigs_iterate_thread(void *arg, size_t threadid)
   dBNodeBuffer nbuf;
   db_node_buf_alloc(&nbuf, 2048);
 
-  HASH_ITERATE_PART(&iter.db_graph->ht, threadid, iter.nthreads,
-                    unitig_iterate_node,
-                    threadid, &nbuf, iter.visited, iter.db_graph,
-                    iter.func, iter.arg);
+  HASH_ITERATE_STEAL(&iter.db_graph->ht, iter.ws, threadid,
+                     unitig_iterate_node,
+                     threadid, &nbuf, iter.visited, iter.db_graph,
+                     iter.func, iter.arg);
 
   db_node_buf_dealloc(&nbuf);
 }
@@ -234,11 +234,18 @@ void db_unitigs_iterate(size_t nthreads, uint8_t *visited,
                         void (*func)(dBNodeBuffer nbuf, size_t threadid, void *arg),
                         void *arg)
 {
-  UnitigIterating iter = {.nthreads = nthreads,
+  WorkSteal ws;
+  work_steal_alloc(&ws, hash_table_size(&db_graph->ht), nthreads,
+                   WORK_STEAL_CHUNKS_PER_THREAD);
+
+  UnitigIterating iter = {.ws = &ws,
                           .visited = visited,
                           .db_graph = db_graph,
                           .func = func,
                           .arg = arg};
 
   util_multi_thread(&iter, nthreads, db_unitigs_iterate_thread);
+
+  work_steal_print_stats(&ws, "unitigs");
+  work_steal_dealloc(&ws);
 }
@@ -21,6 +21,7 @@ void graph_cache_alloc(GraphCache *cache, const dBGraph *db_graph)
   cache_path_buf_alloc(&cache->path_buf, 1024);
   cache->node2unitig = kh_init(Node2Unitig);
   cache->db_graph = db_graph;
+  cache->cgraph = NULL;
 }
 
 void graph_cache_dealloc(GraphCache *cache)
@@ -59,12 +60,23 @@ static inline void gc_create_unitig(GraphCache *cache, dBNode node,
   ctx_assert(db_graph->num_edge_cols == 1);
 
   size_t first_node_id = cache->node_buf.len;
-  db_node_buf_add(&cache->node_buf, node);
-  db_unitig_extend(&cache->node_buf, 0, db_graph);
-  size_t num_nodes = cache->node_buf.len - first_node_id;
+  uint64_t end = CGRAPH_NO_END;
+  if(cache->cgraph != NULL) end = compact_graph_node_end(cache->cgraph, node);
+
+  if(end != CGRAPH_NO_END) {
+    // Compacted unitigs are already normalised
+    compact_graph_unitig_nodes(cache->cgraph, cgraph_end_unitig(end),
+                               &cache->node_buf);
+  }
+  else {
+    db_node_buf_add(&cache->node_buf, node);
+    db_unitig_extend(&cache->node_buf, 0, db_graph);
+    db_unitig_normalise(graph_cache_node(cache, first_node_id),
+                        cache->node_buf.len - first_node_id, db_graph);
+  }
 
+  size_t num_nodes = cache->node_buf.len - first_node_id;
   dBNode *nodes = graph_cache_node(cache, first_node_id);
-  db_unitig_normalise(nodes, num_nodes, db_graph);
 
   // printf("Loaded unitig:\n  ");
   // db_nodes_print(nodes, num_nodes, db_graph, stdout);
@@ -3,6 +3,7 @@
 
 #include "htslib/khash.h"
 #include "db_node.h"
+#include "compact_graph.h"
 
 // Build and store paths through the graph
 // Must build one path at a time
@@ -58,9 +59,14 @@ typedef struct
   khash_t(Node2Unitig) *node2unitig;
 
   const dBGraph *db_graph;
+  const CompactGraph *cgraph; // if set, unitigs are fetched from it
 } GraphCache;
 
 void graph_cache_alloc(GraphCache *cache, const dBGraph *db_graph);
+
+// Fetch unitigs from a compacted graph of `cache->db_graph` instead of
+// walking them a kmer at a time. `cgraph` may be NULL.
+#define graph_cache_set_compact(cache,cg) ((cache)->cgraph = (cg))
 void graph_cache_dealloc(GraphCache *cache);
 void graph_cache_reset(GraphCache *cache);
 
@@ -7,6 +7,8 @@
 // Buffer size `bufsize` is in bytes
 void graph_file_set_buffered(GraphFileReader *file, size_t bufsize)
 {
+  // compressed files are buffered by the BgzfReader
+  if(graph_file_is_bgzf(file)) return;
   if(graph_file_is_buffered(file) == (bufsize>0)) return;
   if(bufsize) strm_buf_alloc(&file->strm, bufsize);
   else {
@@ -16,18 +18,51 @@ void graph_file_set_buffered(GraphFileReader *file, size_t bufsize)
   }
 }
 
-int graph_file_fseek(GraphFileReader *file, off_t offset, int whence)
+static int graph_file_fseek_raw(GraphFileReader *file, off_t offset, int whence)
 {
   if(file_filter_isstdin(&file->fltr)) die("Cannot fseek on STDIN");
-  if(graph_file_is_buffered(file))
+  if(graph_file_is_bgzf(file)) {
+    if(whence == SEEK_CUR) offset += bgzf_reader_tell(file->bgzf);
+    else if(whence == SEEK_END) {
+      if(file->file_size < 0) return -1;
+      offset += file->file_size;
+    }
+    return offset < 0 ? -1 : bgzf_reader_seek(file->bgzf, offset);
+  }
+  else if(graph_file_is_buffered(file))
     return fseek_buf(file->fh, offset, whence, &file->strm);
   else
     return fseek(file->fh, offset, whence);
 }
 
+// Column-major files can only seek to a kmer in the kmer array, which sets the
+// next kmer to be returned by graph_file_read()
+int graph_file_fseek(GraphFileReader *file, off_t offset, int whence)
+{
+  if(!graph_file_is_colmajor(file))
+    return graph_file_fseek_raw(file, offset, whence);
+
+  if(whence != SEEK_SET || offset < file->hdr_size ||
+     (offset - file->hdr_size) % sizeof(BinaryKmer) != 0 ||
+     (uint64_t)(offset - file->hdr_size) / sizeof(BinaryKmer) >
+       (uint64_t)file->num_of_kmers) {
+    return -1;
+  }
+
+  file->colbuf.kmer_idx = (offset - file->hdr_size) / sizeof(BinaryKmer);
+  file->colbuf.len = file->colbuf.next = 0;
+  return 0;
+}
+
 off_t graph_file_ftell(GraphFileReader *file)
 {
-  if(graph_file_is_buffered(file))
+  if(graph_file_is_colmajor(file)) {
+    const GraphFileColBuf *cb = &file->colbuf;
+    return graph_file_kmer_offset(file, cb->kmer_idx - (cb->len - cb->next));
+  }
+  else if(graph_file_is_bgzf(file))
+    return bgzf_reader_tell(file->bgzf);
+  else if(graph_file_is_buffered(file))
     return ftell_buf(file->fh, &file->strm);
   else
     return ftell(file->fh);
@@ -37,7 +72,9 @@ off_t graph_file_ftell(GraphFileReader *file)
 size_t graph_file_fread(GraphFileReader *file, void *ptr, size_t n)
 {
   size_t nread;
-  if(graph_file_is_buffered(file))
+  if(graph_file_is_bgzf(file))
+    nread = bgzf_reader_read(file->bgzf, ptr, n);
+  else if(graph_file_is_buffered(file))
     nread = fread_buf(file->fh, ptr, n, &file->strm);
   else
     nread = fread2(file->fh, ptr, n);
@@ -74,70 +111,15 @@ void graph_file_merge_header(GraphFileHeader *hdr, const GraphFileReader *file)
   }
 }
 
-// Return number of bytes read or die() with error
-size_t graph_file_read_header(GraphFileReader *file)
+// Read per colour information: read lengths, sequence loaded, sample names,
+// error rates and cleaning. In version 8 files this follows the colour columns.
+// Returns number of bytes read
+static size_t graph_file_read_colinfo(GraphFileReader *file)
 {
-  size_t i;
-  int bytes_read = 0;
+  size_t i, bytes_read = 0;
   GraphFileHeader *h = &file->hdr;
   const char *path = file_filter_path(&file->fltr);
 
-  char magic_word[7];
-  magic_word[6] = '\0';
-
-  _gfread(file, magic_word, strlen("CORTEX"), "Magic word");
-  if(strcmp(magic_word, "CORTEX") != 0) {
-    die("Magic word doesn't match '%s' (start): %s", "CORTEX", path);
-  }
-  bytes_read += strlen("CORTEX");
-
-  // Read version number, kmer_size, num bitfields, num colours
-  _gfread(file, &h->version, sizeof(uint32_t), "graph version");
-  _gfread(file, &h->kmer_size, sizeof(uint32_t), "kmer size");
-  _gfread(file, &h->num_of_bitfields, sizeof(uint32_t), "num of bitfields");
-  _gfread(file, &h->num_of_cols, sizeof(uint32_t), "number of colours");
-  bytes_read += 4*sizeof(uint32_t);
-
-  // Checks
-  if(h->version > 7 || h->version < 4)
-  {
-    die("Sorry, we only support graph file versions 4, 5, 6 & 7 "
-        "[version: %u; path: %s]\n", h->version, path);
-  }
-
-  if(h->kmer_size % 2 == 0)
-  {
-    die("kmer size is not an odd number [kmer_size: %u; path: %s]\n",
-        h->kmer_size, path);
-  }
-
-  if(h->kmer_size < 3)
-  {
-    die("kmer size is less than three [kmer_size: %u; path: %s]\n",
-        h->kmer_size, path);
-  }
-
-  if(h->num_of_bitfields * 32 < h->kmer_size)
-  {
-    die("Not enough bitfields for kmer size "
-        "[kmer_size: %u; bitfields: %u; path: %s]\n",
-        h->kmer_size, h->num_of_bitfields, path);
-  }
-
-  if((h->num_of_bitfields-1)*32 >= h->kmer_size) {
-    die("using more than the minimum number of bitfields [path: %s]\n", path);
-  }
-
-  if(h->num_of_cols == 0)
-    die("number of colours is zero [path: %s]\n", path);
-  if(h->num_of_cols > 10000)
-    die("Very high number of colours: %zu [path: %s]", (size_t)h->num_of_cols, path);
-
-  // graph_header_capacity will only alloc or realloc if it needs to
-  graph_header_capacity(h, h->num_of_cols);
-
-  // Assume to be graph file now, any error is therefore fatal
-
   for(i = 0; i < h->num_of_cols; i++) {
     _gfread(file, &h->ginfo[i].mean_read_length, sizeof(uint32_t),
              "mean read length for each colour");
@@ -257,6 +239,123 @@ size_t graph_file_read_header(GraphFileReader *file)
     }
   }
 
+  return bytes_read;
+}
+
+// Column-major files have the number of kmers after the fixed header and their
+// colour information at the end of the file. Leaves the file at the first kmer.
+// Returns the header size
+static size_t graph_file_read_colmajor_header(GraphFileReader *file,
+                                              size_t bytes_read)
+{
+  const char *path = file_filter_path(&file->fltr);
+  char magic_word[7];
+  uint64_t nkmers;
+
+  magic_word[6] = '\0';
+
+  if(file_filter_isstdin(&file->fltr))
+    die("Cannot read a column-major graph from a stream: %s", path);
+  if(graph_file_is_bgzf(file) && file->bgzf_idx == NULL)
+    die("Column-major compressed graph needs an index [`bgzip -r`]: %s", path);
+
+  _gfread(file, &nkmers, sizeof(uint64_t), "number of kmers");
+  _gfread(file, magic_word, strlen("CORTEX"), "magic word (end)");
+  if(strcmp(magic_word, "CORTEX") != 0)
+    die("Magic word doesn't match '%s' (end): '%s' [path: %s]\n",
+        "CORTEX", magic_word, path);
+
+  bytes_read += sizeof(uint64_t) + strlen("CORTEX");
+  file->num_of_kmers = (int64_t)nkmers;
+  file->hdr_size = bytes_read;
+
+  if(graph_file_fseek_raw(file, graph_file_col_offset(file, file->hdr.num_of_cols),
+                          SEEK_SET) != 0) {
+    die("Cannot seek to colour information: %s", path);
+  }
+
+  graph_file_read_colinfo(file);
+
+  _gfread(file, magic_word, strlen("CORTEX"), "magic word (colours end)");
+  if(strcmp(magic_word, "CORTEX") != 0)
+    die("Magic word doesn't match '%s' (colours end): '%s' [path: %s]\n",
+        "CORTEX", magic_word, path);
+
+  if(graph_file_fseek_raw(file, bytes_read, SEEK_SET) != 0)
+    die("Cannot seek to first kmer: %s", path);
+
+  return bytes_read;
+}
+
+// Return number of bytes read or die() with error
+size_t graph_file_read_header(GraphFileReader *file)
+{
+  int bytes_read = 0;
+  GraphFileHeader *h = &file->hdr;
+  const char *path = file_filter_path(&file->fltr);
+
+  char magic_word[7];
+  magic_word[6] = '\0';
+
+  _gfread(file, magic_word, strlen("CORTEX"), "Magic word");
+  if(strcmp(magic_word, "CORTEX") != 0) {
+    die("Magic word doesn't match '%s' (start): %s", "CORTEX", path);
+  }
+  bytes_read += strlen("CORTEX");
+
+  // Read version number, kmer_size, num bitfields, num colours
+  _gfread(file, &h->version, sizeof(uint32_t), "graph version");
+  _gfread(file, &h->kmer_size, sizeof(uint32_t), "kmer size");
+  _gfread(file, &h->num_of_bitfields, sizeof(uint32_t), "num of bitfields");
+  _gfread(file, &h->num_of_cols, sizeof(uint32_t), "number of colours");
+  bytes_read += 4*sizeof(uint32_t);
+
+  // Checks
+  if((h->version > 7 || h->version < 4) &&
+     h->version != CTX_GRAPH_COLMAJOR_FILEFORMAT)
+  {
+    die("Sorry, we only support graph file versions 4, 5, 6, 7 & 8 "
+        "[version: %u; path: %s]\n", h->version, path);
+  }
+
+  if(h->kmer_size % 2 == 0)
+  {
+    die("kmer size is not an odd number [kmer_size: %u; path: %s]\n",
+        h->kmer_size, path);
+  }
+
+  if(h->kmer_size < 3)
+  {
+    die("kmer size is less than three [kmer_size: %u; path: %s]\n",
+        h->kmer_size, path);
+  }
+
+  if(h->num_of_bitfields * 32 < h->kmer_size)
+  {
+    die("Not enough bitfields for kmer size "
+        "[kmer_size: %u; bitfields: %u; path: %s]\n",
+        h->kmer_size, h->num_of_bitfields, path);
+  }
+
+  if((h->num_of_bitfields-1)*32 >= h->kmer_size) {
+    die("using more than the minimum number of bitfields [path: %s]\n", path);
+  }
+
+  if(h->num_of_cols == 0)
+    die("number of colours is zero [path: %s]\n", path);
+  if(h->num_of_cols > 10000)
+    die("Very high number of colours: %zu [path: %s]", (size_t)h->num_of_cols, path);
+
+  // graph_header_capacity will only alloc or realloc if it needs to
+  graph_header_capacity(h, h->num_of_cols);
+
+  // Assume to be graph file now, any error is therefore fatal
+
+  if(h->version == CTX_GRAPH_COLMAJOR_FILEFORMAT)
+    return graph_file_read_colmajor_header(file, bytes_read);
+
+  bytes_read += graph_file_read_colinfo(file);
+
   // Read magic word at the end of header 'CORTEX'
   _gfread(file, magic_word, strlen("CORTEX"), "magic word (end)");
   if(strcmp(magic_word, "CORTEX") != 0)
@@ -269,6 +368,47 @@ size_t graph_file_read_header(GraphFileReader *file)
   return bytes_read;
 }
 
+// Set up reading a BGZF compressed file. The file size is only known if we
+// have an index
+static void graph_file_open_bgzf(GraphFileReader *file)
+{
+  const char *path = file_filter_path(&file->fltr);
+  file->file_size = -1;
+
+  if(!file_filter_isstdin(&file->fltr))
+  {
+    StrBuf idx_path = {0,0,0};
+    strbuf_sprintf(&idx_path, "%s.gzi", path);
+
+    BgzfIndex *idx = ctx_calloc(1, sizeof(BgzfIndex));
+    bgzf_index_alloc(idx);
+
+    if(futil_file_exists(idx_path.b) && bgzf_index_load(idx, idx_path.b)) {
+      // index may not include the last few blocks
+      bgzf_index_scan(idx, fileno(file->fh), path);
+      file->bgzf_idx = idx;
+      file->file_size = bgzf_index_usize(idx);
+    }
+    else {
+      warn("No index for compressed graph, cannot get number of kmers: %s "
+           "[create with `bgzip -r`]", path);
+      bgzf_index_dealloc(idx);
+      ctx_free(idx);
+    }
+
+    strbuf_dealloc(&idx_path);
+  }
+
+  // Start with one inflate thread, callers that stream the whole file can ask
+  // for more with graph_file_set_threads()
+  file->bgzf = bgzf_reader_new(file->fh, path, 1, file->bgzf_idx);
+}
+
+void graph_file_set_threads(GraphFileReader *file, size_t nthreads)
+{
+  if(graph_file_is_bgzf(file)) bgzf_reader_set_threads(file->bgzf, nthreads);
+}
+
 int graph_file_open(GraphFileReader *file, const char *path)
 {
   return graph_file_open2(file, path, "r", true, 0);
@@ -302,8 +442,19 @@ int graph_file_open2(GraphFileReader *file, const char *input, const char *mode,
   }
 
   file->fh = futil_fopen(path, mode);
-  if(usebuf) strm_buf_alloc(&file->strm, ONE_MEGABYTE);
-  else memset(&file->strm, 0, sizeof(file->strm));
+  memset(&file->strm, 0, sizeof(file->strm));
+  file->bgzf = NULL;
+  file->bgzf_idx = NULL;
+  memset(&file->colbuf, 0, sizeof(file->colbuf));
+
+  // Graph files start with 'C', gzip files with 0x1f
+  int c = getc(file->fh);
+  if(c != EOF && ungetc(c, file->fh) == EOF)
+    die("Cannot read file: %s [%s]", futil_inpath_str(path), strerror(errno));
+
+  if(c == 0x1f) graph_file_open_bgzf(file);
+  else if(usebuf) strm_buf_alloc(&file->strm, ONE_MEGABYTE);
+
   file->hdr_size = graph_file_read_header(file);
 
   file_filter_set_cols(fltr, hdr->num_of_cols, into_offset);
@@ -313,8 +464,25 @@ int graph_file_open2(GraphFileReader *file, const char *input, const char *mode,
 
   size_t bytes_per_kmer, bytes_remaining;
 
+  if(graph_file_is_colmajor(file))
+  {
+    // Number of kmers is in the header
+    GraphFileColBuf *cb = &file->colbuf;
+    cb->bkmers = ctx_malloc(GRAPH_COLBUF_NKMERS * sizeof(BinaryKmer));
+    cb->covgs = ctx_malloc(hdr->num_of_cols * GRAPH_COLBUF_NKMERS * sizeof(Covg));
+    cb->edges = ctx_malloc(hdr->num_of_cols * GRAPH_COLBUF_NKMERS * sizeof(Edges));
+    cb->cols = ctx_malloc(hdr->num_of_cols * sizeof(size_t));
+    cb->cache = (BgzfCache)BGZF_CACHE_INIT;
+
+    if(file->file_size != -1 &&
+       file->file_size < graph_file_col_offset(file, hdr->num_of_cols)) {
+      warn("Truncated graph file: %s [fsize: %zu; nkmers: %zu; cols: %zu]",
+           path, (size_t)file->file_size, (size_t)file->num_of_kmers,
+           (size_t)hdr->num_of_cols);
+    }
+  }
   // If reading from STDIN we don't know file size
-  if(file->file_size != -1)
+  else if(file->file_size != -1)
   {
     // File header checks
     // Get number of kmers
@@ -339,12 +507,123 @@ int graph_file_open2(GraphFileReader *file, const char *input, const char *mode,
 void graph_file_close(GraphFileReader *file)
 {
   strm_buf_dealloc(&file->strm);
+  ctx_free(file->colbuf.bkmers);
+  ctx_free(file->colbuf.covgs);
+  ctx_free(file->colbuf.edges);
+  ctx_free(file->colbuf.cols);
+  bgzf_cache_dealloc(&file->colbuf.cache);
+  if(file->bgzf) bgzf_reader_close(file->bgzf);
+  if(file->bgzf_idx) {
+    bgzf_index_dealloc(file->bgzf_idx);
+    ctx_free(file->bgzf_idx);
+  }
   if(file->fh) fclose(file->fh);
   file_filter_close(&file->fltr);
   graph_header_dealloc(&file->hdr);
   memset(file, 0, sizeof(*file));
 }
 
+// Read `len` bytes from offset `offset` of a column-major file. Uses pread() so
+// that jumping between columns does not discard the stream buffer. Compressed
+// files without a block index fall back to seeking the BgzfReader.
+static void graph_file_colmajor_pread(GraphFileReader *file, void *ptr,
+                                      size_t len, off_t offset,
+                                      const char *desc)
+{
+  const char *path = file_filter_path(&file->fltr);
+  int fd = fileno(file->fh);
+  size_t n = 0;
+  ssize_t r = 0;
+
+  if(file_filter_isstdin(&file->fltr)) die("Cannot fseek on STDIN");
+
+  if(graph_file_is_bgzf(file) && file->bgzf_idx == NULL) {
+    if(graph_file_fseek_raw(file, offset, SEEK_SET) != 0)
+      die("Cannot seek to %s: %s", desc, path);
+    _gfread(file, ptr, len, desc);
+    return;
+  }
+
+  if(graph_file_is_bgzf(file)) {
+    n = bgzf_pread(fd, file->bgzf_idx, ptr, len, offset,
+                   &file->colbuf.cache, path);
+  }
+  else {
+    while(n < len && (r = pread(fd, (char*)ptr+n, len-n, offset+n)) > 0)
+      n += r;
+    if(n < len && r < 0) die("Cannot read %s: %s [%s]", desc, path, strerror(errno));
+  }
+
+  if(n != len) {
+    die("Couldn't read '%s': expected %zu; recieved: %zu; [file: %s]\n",
+        desc, len, n, path);
+  }
+}
+
+// Read the next block of kmers from a column-major file, along with the
+// colours used by the file filter. Returns the number of kmers read.
+static size_t graph_file_colmajor_fill(GraphFileReader *file)
+{
+  GraphFileColBuf *cb = &file->colbuf;
+  const FileFilter *fltr = &file->fltr;
+  const char *path = file_filter_path(fltr);
+  size_t i, j, col, n;
+  uint64_t nkmers = (uint64_t)file->num_of_kmers;
+
+  cb->next = cb->len = 0;
+  if(cb->kmer_idx >= nkmers) return 0;
+  n = MIN2(nkmers - cb->kmer_idx, GRAPH_COLBUF_NKMERS);
+
+  // Colours to read: filters may change between passes over the file
+  for(i = cb->ncols = 0; i < file_filter_num(fltr); i++) {
+    col = file_filter_fromcol(fltr, i);
+    for(j = 0; j < cb->ncols && cb->cols[j] != col; j++) {}
+    if(j == cb->ncols) cb->cols[cb->ncols++] = col;
+  }
+
+  graph_file_colmajor_pread(file, cb->bkmers, n * sizeof(BinaryKmer),
+                            graph_file_kmer_offset(file, cb->kmer_idx), "Kmers");
+
+  for(i = 0; i < cb->ncols; i++) {
+    off_t offset = graph_file_col_offset(file, cb->cols[i]);
+    graph_file_colmajor_pread(file, cb->covgs + i*GRAPH_COLBUF_NKMERS,
+                              n * sizeof(Covg),
+                              offset + cb->kmer_idx * sizeof(Covg),
+                              "Coverages");
+    graph_file_colmajor_pread(file, cb->edges + i*GRAPH_COLBUF_NKMERS,
+                              n * sizeof(Edges),
+                              offset + nkmers * sizeof(Covg) +
+                                cb->kmer_idx * sizeof(Edges),
+                              "Edges");
+  }
+
+  cb->kmer_idx += n;
+  cb->len = n;
+  return n;
+}
+
+// Colours not used by the file filter are returned with zero coverage
+static size_t graph_file_colmajor_read(GraphFileReader *file, BinaryKmer *bkmer,
+                                       Covg *covgs, Edges *edges)
+{
+  GraphFileColBuf *cb = &file->colbuf;
+  size_t i;
+
+  if(cb->next == cb->len && graph_file_colmajor_fill(file) == 0) return 0;
+
+  memset(covgs, 0, file->hdr.num_of_cols * sizeof(Covg));
+  memset(edges, 0, file->hdr.num_of_cols * sizeof(Edges));
+
+  *bkmer = cb->bkmers[cb->next];
+  for(i = 0; i < cb->ncols; i++) {
+    covgs[cb->cols[i]] = cb->covgs[i*GRAPH_COLBUF_NKMERS + cb->next];
+    edges[cb->cols[i]] = cb->edges[i*GRAPH_COLBUF_NKMERS + cb->next];
+  }
+  cb->next++;
+
+  return sizeof(BinaryKmer) + cb->ncols * (sizeof(Covg) + sizeof(Edges));
+}
+
 size_t graph_file_read_raw(GraphFileReader *file,
                            BinaryKmer *bkmer, Covg *covgs, Edges *edges)
 {
@@ -355,23 +634,32 @@ size_t graph_file_read_raw(GraphFileReader *file,
   int num_bytes_read;
   char kstr[MAX_KMER_SIZE+1];
 
-  num_bytes_read = graph_file_fread(file, bkmer->b, sizeof(BinaryKmer));
+  if(graph_file_is_colmajor(file))
+  {
+    num_bytes_read = graph_file_colmajor_read(file, bkmer, covgs, edges);
+    if(num_bytes_read == 0) return 0;
+  }
+  else
+  {
+    num_bytes_read = graph_file_fread(file, bkmer->b, sizeof(BinaryKmer));
 
-  if(num_bytes_read == 0) return 0;
-  if(num_bytes_read != (int)(sizeof(uint64_t)*h->num_of_bitfields))
-    die("Unexpected end of file: %s", path);
+    if(num_bytes_read == 0) return 0;
+    if(num_bytes_read != (int)(sizeof(uint64_t)*h->num_of_bitfields))
+      die("Unexpected end of file: %s", path);
 
-  _gfread(file, covgs, h->num_of_cols * sizeof(uint32_t), "Coverages");
-  _gfread(file, edges, h->num_of_cols * sizeof(uint8_t), "Edges");
-  num_bytes_read += h->num_of_cols * (sizeof(uint32_t) + sizeof(uint8_t));
+    _gfread(file, covgs, h->num_of_cols * sizeof(uint32_t), "Coverages");
+    _gfread(file, edges, h->num_of_cols * sizeof(uint8_t), "Edges");
+    num_bytes_read += h->num_of_cols * (sizeof(uint32_t) + sizeof(uint8_t));
+  }
 
   // Check top word of each kmer
   if(binary_kmer_oversized(*bkmer, h->kmer_size))
     die("Oversized kmer in path [kmer: %u]: %s", h->kmer_size, path);
 
-  // Check covg is not 0 for all colours
+  // Check covg is not 0 for all colours (if we read all colours)
   for(i = 0; i < h->num_of_cols && covgs[i] == 0; i++) {}
-  if(i == h->num_of_cols && !file->error_zero_covg) {
+  if(i == h->num_of_cols && !file->error_zero_covg &&
+     (!graph_file_is_colmajor(file) || file->colbuf.ncols == h->num_of_cols)) {
     binary_kmer_to_str(*bkmer, h->kmer_size, kstr);
     warn("Kmer has zero covg in all colours [kmer: %s; path: %s]", kstr, path);
     file->error_zero_covg = true;
@@ -398,19 +686,63 @@ bool graph_file_read(GraphFileReader *file,
   // status("Header colours: %u", file->hdr.num_of_cols);
   Covg kmercovgs[file->hdr.num_of_cols];
   Edges kmeredges[file->hdr.num_of_cols];
-  size_t i, from, into;
-  const FileFilter *fltr = &file->fltr;
 
   if(!graph_file_read_raw(file, bkmer, kmercovgs, kmeredges)) return false;
 
+  graph_file_filter_kmer(file, kmercovgs, kmeredges, covgs, edges);
+  return true;
+}
+
+// Add coverage and edges read with graph_file_read_raw() into the colours
+// given by the file filter
+void graph_file_filter_kmer(const GraphFileReader *file,
+                            const Covg *kmercovgs, const Edges *kmeredges,
+                            Covg *covgs, Edges *edges)
+{
+  size_t i, from, into;
+  const FileFilter *fltr = &file->fltr;
+
   for(i = 0; i < file_filter_num(fltr); i++) {
     from = file_filter_fromcol(fltr, i);
     into = file_filter_intocol(fltr, i);
     covgs[into] = SAFE_ADD_COVG(covgs[into], kmercovgs[from]);
     edges[into] |= kmeredges[from];
   }
+}
+
+// Check if a graph file appears to be sorted by reading `nsamples` kmers
+// spaced evenly through the file. Uses pread() so does not move the file
+// position. Returns false for streams.
+bool graph_file_sample_sorted(const GraphFileReader *file, size_t nsamples)
+{
+  if(file->num_of_kmers < 0 || file_filter_isstdin(&file->fltr)) return false;
+
+  size_t i, idx, n = file->num_of_kmers;
+  BinaryKmer prev = BINARY_KMER_ZERO_MACRO, bkmer;
+  int fd = fileno(file->fh);
+  const char *path = file_filter_path(&file->fltr);
+  BgzfCache cache = BGZF_CACHE_INIT;
+  ssize_t nread;
+  bool sorted = true;
+  nsamples = MIN2(nsamples, n);
+
+  for(i = 0; i < nsamples && sorted; i++) {
+    idx = nsamples > 1 ? (i * (n-1)) / (nsamples-1) : 0;
+    if(graph_file_is_bgzf(file)) {
+      nread = bgzf_pread(fd, file->bgzf_idx, bkmer.b, sizeof(BinaryKmer),
+                         graph_file_kmer_offset(file, idx), &cache, path);
+    } else {
+      nread = pread(fd, bkmer.b, sizeof(BinaryKmer),
+                    graph_file_kmer_offset(file, idx));
+    }
+    if(nread != (ssize_t)sizeof(BinaryKmer))
+      die("Cannot read kmer %zu: %s [%s]", idx, path, strerror(errno));
+    sorted = (i == 0 || binary_kmer_lt(prev, bkmer));
+    prev = bkmer;
+  }
 
-  return true;
+  bgzf_cache_dealloc(&cache);
+  return sorted;
 }
 
 // Read a kmer from the file
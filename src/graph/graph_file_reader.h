@@ -5,19 +5,49 @@
 #include "graph_format.h"
 #include "file_filter.h"
 #include "binary_kmer.h"
+#include "bgzf_reader.h"
+#include "file_util.h"
 
 //
 // Read graph files from disk
 //
+// Graph files may be BGZF compressed (e.g. written to a path ending .gz or
+// compressed with `bgzip -i`), which is detected when the file is opened.
+// Offsets and sizes are then in the uncompressed data. Seeking is fast if
+// there is a block index <file>.gzi, otherwise the file size is unknown and
+// seeking backwards re-reads the file from the start.
+//
+// Column-major (version 8) graph files are also read transparently: kmers are
+// read a block at a time and only the colours used by the file filter are read
+// from their columns with pread(), so each column is read without seeking the
+// stream buffer. They cannot be read from a stream.
+//
+
+// Number of kmers read at once from a column-major graph file
+#define GRAPH_COLBUF_NKMERS 4096
+
+typedef struct
+{
+  BinaryKmer *bkmers;
+  Covg *covgs; // [i*GRAPH_COLBUF_NKMERS + j] is kmer j in colour cols[i]
+  Edges *edges;
+  size_t *cols; // colours in the file that are being read
+  size_t ncols, len, next; // num colours being read, kmers in buffer, next kmer
+  uint64_t kmer_idx; // index in the file of the kmer after the buffer
+  BgzfCache cache; // last block decompressed when reading columns with pread
+} GraphFileColBuf;
 
 typedef struct
 {
   FILE *fh;
   StreamBuffer strm; // buffer input
+  BgzfReader *bgzf; // non-NULL if the file is BGZF compressed
+  BgzfIndex *bgzf_idx; // block index of compressed file, NULL if none
   FileFilter fltr;
   GraphFileHeader hdr;
   off_t hdr_size, file_size;
   int64_t num_of_kmers; // set if reading from file (i.e. not stream) else -1
+  GraphFileColBuf colbuf; // only used for column-major files
   bool error_zero_covg, error_missing_covg; // Whether we saw loading errors
 } GraphFileReader;
 
@@ -30,6 +60,9 @@ madcrow_buffer(gfile_buf, GraphFileBuffer, GraphFileReader);
 // Returns 0 if not set instead of -1
 #define graph_file_nkmers(rdr) ((uint64_t)MAX2((rdr)->num_of_kmers, 0))
 
+#define graph_file_is_colmajor(file) \
+        ((file)->hdr.version == CTX_GRAPH_COLMAJOR_FILEFORMAT)
+
 // Get file offset of a given kmer
 static inline off_t graph_file_offset(const GraphFileReader *gfr, size_t i)
 {
@@ -37,10 +70,36 @@ static inline off_t graph_file_offset(const GraphFileReader *gfr, size_t i)
   return gfr->hdr_size + s*i;
 }
 
+// Get file offset of the binary kmer of a given kmer entry
+static inline off_t graph_file_kmer_offset(const GraphFileReader *gfr, size_t i)
+{
+  return graph_file_is_colmajor(gfr) ? gfr->hdr_size + sizeof(BinaryKmer)*i
+                                     : graph_file_offset(gfr, i);
+}
+
+// Column-major files: file offset of the coverage column of colour `col`.
+// The edges column follows the coverage column. Passing `col` equal to the
+// number of colours gives the offset of the colour information at the end of
+// the file.
+static inline off_t graph_file_col_offset(const GraphFileReader *gfr,
+                                          size_t col)
+{
+  uint64_t nkmers = (uint64_t)gfr->num_of_kmers;
+  return gfr->hdr_size + nkmers * sizeof(BinaryKmer) +
+         nkmers * col * (sizeof(Covg) + sizeof(Edges));
+}
+
 #define graph_file_is_buffered(file) ((file)->strm.b != NULL)
+#define graph_file_is_bgzf(file) ((file)->bgzf != NULL)
+
+// Graph files with a .gz extension are written compressed
+#define graph_file_path_is_bgzf(path) futil_path_has_extension(path, ".gz")
 // Buffer size `bufsize` is in bytes
 void graph_file_set_buffered(GraphFileReader *file, size_t bufsize);
 
+// Number of threads used to decompress a BGZF file (default 1)
+void graph_file_set_threads(GraphFileReader *file, size_t nthreads);
+
 int graph_file_fseek(GraphFileReader *file, off_t offset, int whence);
 off_t graph_file_ftell(GraphFileReader *file);
 
@@ -77,12 +136,24 @@ size_t graph_file_read_raw(GraphFileReader *rdr,
 bool graph_file_read(GraphFileReader *file,
                      BinaryKmer *bkmer, Covg *covgs, Edges *edges);
 
+// Add coverage and edges read with graph_file_read_raw() into the colours
+// given by the file filter. Arrays passed to graph_file_read_raw() have
+// file->hdr.num_of_cols entries, covgs/edges are file_filter_into_ncols()
+void graph_file_filter_kmer(const GraphFileReader *file,
+                            const Covg *kmercovgs, const Edges *kmeredges,
+                            Covg *covgs, Edges *edges);
+
 // Read a kmer from the file
 // returns true on success, false otherwise
 // prints warnings if dirty kmers in file
 bool graph_file_read_reset(GraphFileReader *file,
                            BinaryKmer *bkmer, Covg *covgs, Edges *edges);
 
+// Returns true if kmers sampled evenly through the file are in sorted order.
+// Does not change the file position. Always false for streams and compressed
+// files without an index.
+bool graph_file_sample_sorted(const GraphFileReader *file, size_t nsamples);
+
 // Returns true if one or more files passed loads data into colour
 bool graph_file_is_colour_loaded(size_t colour, const GraphFileReader *files,
                                  size_t num_files);
@@ -4,6 +4,10 @@
 // graph file format version
 #define CTX_GRAPH_FILEFORMAT 6
 
+// column-major graph file format version: kmers are followed by one column of
+// coverages and edges per colour (see docs/file_formats/graph_file_format.txt)
+#define CTX_GRAPH_COLMAJOR_FILEFORMAT 8
+
 #include "graph_info.h"
 
 // Graph (.ctx)
@@ -0,0 +1,184 @@
+#include "global.h"
+#include "graph_index.h"
+#include "file_util.h"
+
+void graph_index_default_path(const char *ctx_path, StrBuf *idx_path)
+{
+  strbuf_reset(idx_path);
+  strbuf_sprintf(idx_path, "%s.idx", ctx_path);
+}
+
+void graph_index_print_block(FILE *fout, const GraphIndexLayout *layout,
+                             const char *kmerstr,
+                             size_t kmer_idx, size_t next_kmer_idx)
+{
+  fprintf(fout, "%zu\t%zu\t%s\t%zu\t%zu\n",
+          layout->hdr_size + kmer_idx*layout->entrysize,
+          layout->hdr_size + next_kmer_idx*layout->entrysize,
+          kmerstr, kmer_idx, next_kmer_idx);
+}
+
+static void graph_index_alloc(GraphFileIndex *gidx, size_t capacity)
+{
+  gidx->kmers = ctx_calloc(capacity+1, sizeof(BinaryKmer)); // sentinel
+  gidx->blocks = ctx_calloc(capacity+1, sizeof(size_t));
+  gidx->nblocks = gidx->nkmers = 0;
+}
+
+// Set sentinel block after last block
+static void graph_index_finish(GraphFileIndex *gidx, size_t nkmers)
+{
+  gidx->nkmers = nkmers;
+  gidx->blocks[gidx->nblocks] = nkmers;
+  memset(gidx->kmers[gidx->nblocks].b, 0xff, BKMER_BYTES);
+}
+
+void graph_index_dealloc(GraphFileIndex *gidx)
+{
+  ctx_free(gidx->kmers);
+  ctx_free(gidx->blocks);
+  memset(gidx, 0, sizeof(*gidx));
+}
+
+// Columns: block_start, next_block, first_kmer, kmer_idx, next_kmer_idx
+bool graph_index_load(GraphFileIndex *gidx, const char *path,
+                      const GraphIndexLayout *layout)
+{
+  const size_t kmer_size = layout->kmer_size;
+  size_t capacity = 1024, fields[4], i;
+  size_t next_byte = layout->hdr_size, next_kmer = 0;
+  char *ptr, *end, *kmerstr;
+  bool success = true;
+
+  FILE *fh = futil_fopen(path, "r");
+  StrBuf line;
+  strbuf_alloc(&line, 1024);
+
+  graph_index_alloc(gidx, capacity);
+
+  while(success && strbuf_reset_readline(&line, fh) > 0)
+  {
+    strbuf_chomp(&line);
+    if(line.end == 0 || line.b[0] == '#') continue;
+
+    // Parse line
+    ptr = line.b;
+    kmerstr = NULL;
+    for(i = 0; i < 5 && success; i++) {
+      if(i == 2) {
+        kmerstr = ptr;
+        if((end = strchr(ptr, '\t')) == NULL) { success = false; break; }
+        *end = '\0';
+        success = ((size_t)(end - kmerstr) == kmer_size);
+      } else {
+        fields[i < 2 ? i : i-1] = strtoull(ptr, &end, 10);
+        success = (end > ptr && (*end == '\t' || (i == 4 && *end == '\0')));
+      }
+      ptr = end+1;
+    }
+
+    // Check the index matches the graph file
+    if(!success ||
+       fields[0] != next_byte || fields[2] != next_kmer ||
+       fields[3] <= fields[2] || fields[3] > layout->nkmers ||
+       fields[1] != layout->hdr_size + fields[3]*layout->entrysize) {
+      success = false;
+      break;
+    }
+
+    if(gidx->nblocks == capacity) {
+      gidx->kmers = ctx_recallocarray(gidx->kmers, capacity+1, capacity*2+1,
+                                      sizeof(BinaryKmer));
+      gidx->blocks = ctx_recallocarray(gidx->blocks, capacity+1, capacity*2+1,
+                                       sizeof(size_t));
+      capacity *= 2;
+    }
+
+    gidx->kmers[gidx->nblocks] = binary_kmer_from_str(kmerstr, kmer_size);
+    gidx->blocks[gidx->nblocks] = fields[2];
+    next_byte = fields[1];
+    next_kmer = fields[3];
+    gidx->nblocks++;
+  }
+
+  strbuf_dealloc(&line);
+  fclose(fh);
+
+  if(!success || gidx->nblocks == 0 || next_kmer != layout->nkmers) {
+    warn("Index doesn't match graph file, ignoring: %s", path);
+    graph_index_dealloc(gidx);
+    return false;
+  }
+
+  graph_index_finish(gidx, layout->nkmers);
+  return true;
+}
+
+void graph_index_build(GraphFileIndex *gidx, size_t nkmers, size_t max_blocks,
+                       BinaryKmer (*get_kmer)(size_t idx, void *arg),
+                       void *arg)
+{
+  ctx_assert(nkmers > 0 && max_blocks > 0);
+  size_t i, nblocks, blocksize;
+  nblocks = MIN2(nkmers, max_blocks);
+  blocksize = nkmers / nblocks;
+  nblocks = (nkmers+blocksize-1) / blocksize;
+
+  graph_index_alloc(gidx, nblocks);
+  gidx->nblocks = nblocks;
+
+  for(i = 0; i < nblocks; i++) {
+    gidx->blocks[i] = i*blocksize;
+    gidx->kmers[i] = get_kmer(gidx->blocks[i], arg);
+  }
+
+  graph_index_finish(gidx, nkmers);
+}
+
+bool graph_index_save(const GraphFileIndex *gidx, const char *path,
+                      const GraphIndexLayout *layout)
+{
+  ctx_assert(gidx->nkmers == layout->nkmers);
+  char kmerstr[MAX_KMER_SIZE+1];
+  size_t i;
+  bool success;
+
+  StrBuf tmp_path;
+  strbuf_alloc(&tmp_path, 1024);
+  strbuf_sprintf(&tmp_path, "%s.%i.tmp", path, (int)getpid());
+
+  FILE *fout = fopen(tmp_path.b, "w");
+  if(fout == NULL) {
+    warn("Cannot write index %s [%s]", path, strerror(errno));
+    strbuf_dealloc(&tmp_path);
+    return false;
+  }
+
+  fputs(GRAPH_INDEX_HDR, fout);
+  for(i = 0; i < gidx->nblocks; i++) {
+    binary_kmer_to_str(gidx->kmers[i], layout->kmer_size, kmerstr);
+    graph_index_print_block(fout, layout, kmerstr,
+                            gidx->blocks[i], gidx->blocks[i+1]);
+  }
+
+  success = !ferror(fout);
+  success = (fclose(fout) == 0) && success;
+  success = success && rename(tmp_path.b, path) == 0;
+
+  if(!success) {
+    warn("Cannot write index %s [%s]", path, strerror(errno));
+    unlink(tmp_path.b);
+  }
+
+  strbuf_dealloc(&tmp_path);
+  return success;
+}
+
+bool graph_index_is_sorted(const GraphFileIndex *gidx)
+{
+  size_t i;
+  for(i = 0; i+1 < gidx->nblocks; i++)
+    if(!binary_kmer_lt(gidx->kmers[i], gidx->kmers[i+1]))
+      return false;
+  return true;
+}
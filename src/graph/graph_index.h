@@ -0,0 +1,79 @@
+#ifndef GRAPH_INDEX_H_
+#define GRAPH_INDEX_H_
+
+#include "binary_kmer.h"
+
+//
+// Block index of a sorted graph file, as written by `ctx index`
+//
+// Block i covers kmers blocks[i]..blocks[i+1]-1 of the file and starts with
+// kmer kmers[i]. kmers[nblocks] is a sentinel (all bits set), so a lookup
+// never needs to check bounds. Once loaded or built an index is read-only and
+// may be shared between threads.
+//
+// The text format has one line per block:
+//   block_start, next_block, first_kmer, kmer_idx, next_kmer_idx
+// where block_start/next_block are byte offsets into the (uncompressed) file.
+//
+
+typedef struct
+{
+  BinaryKmer *kmers;
+  size_t *blocks, nblocks, nkmers;
+} GraphFileIndex;
+
+// Layout of the graph file being indexed
+typedef struct
+{
+  size_t kmer_size, hdr_size, entrysize, nkmers;
+} GraphIndexLayout;
+
+#define GRAPH_INDEX_HDR "#block_start\tnext_block\tfirst_kmer\tkmer_idx\tnext_kmer_idx\n"
+
+// Get path of the default index file for a graph: <in.ctx>.idx
+void graph_index_default_path(const char *ctx_path, StrBuf *idx_path);
+
+// Print a block of kmers kmer_idx..next_kmer_idx-1 in the index text format
+void graph_index_print_block(FILE *fout, const GraphIndexLayout *layout,
+                             const char *kmerstr,
+                             size_t kmer_idx, size_t next_kmer_idx);
+
+// Load index produced by `ctx index` or graph_index_save()
+// Returns false (with a warning) if the index does not match the layout
+bool graph_index_load(GraphFileIndex *gidx, const char *path,
+                      const GraphIndexLayout *layout);
+
+// Build an index of at most `max_blocks` equal sized blocks.
+// `get_kmer(idx,arg)` returns kmer `idx` from the file
+void graph_index_build(GraphFileIndex *gidx, size_t nkmers, size_t max_blocks,
+                       BinaryKmer (*get_kmer)(size_t idx, void *arg),
+                       void *arg);
+
+// Write the index in the format of `ctx index`. Writes to a temporary file
+// that is renamed into place, so readers never see a partial index.
+// Returns false (with a warning) on failure
+bool graph_index_save(const GraphFileIndex *gidx, const char *path,
+                      const GraphIndexLayout *layout);
+
+void graph_index_dealloc(GraphFileIndex *gidx);
+
+// Returns true if the first kmers of the blocks are strictly increasing
+bool graph_index_is_sorted(const GraphFileIndex *gidx);
+
+// Returns the block that would contain `bkey` or -1 if bkey is before the
+// first kmer in the file
+static inline long graph_index_find(const GraphFileIndex *gidx, BinaryKmer bkey)
+{
+  size_t l = 0, r = gidx->nblocks, mid;
+  while(l < r) {
+    mid = (l+r)/2;
+    if(binary_kmer_le(gidx->kmers[mid],bkey)) {
+      if(binary_kmer_lt(bkey,gidx->kmers[mid+1])) return mid;
+      else l = mid+1;
+    }
+    else r = mid;
+  }
+  return -1;
+}
+
+#endif /* GRAPH_INDEX_H_ */
@@ -1,111 +1,230 @@
 #include "global.h"
 #include "graph_search.h"
+#include "graph_index.h"
+#include "file_util.h"
+
+// Memory mapped graph file
+#include <sys/mman.h>
+
+//
+// Search a sorted graph file that has been memory mapped. Nothing is copied
+// out of the file except the kmer being compared and the entry requested.
+// An index of the first kmer in each block of records is read from
+// <in.ctx>.idx if it exists (see `ctx index`), otherwise one is built by
+// sampling the mapped file and saved to <in.ctx>.idx for next time.
+//
+// BGZF compressed files cannot be mapped. Instead each lookup decompresses the
+// blocks it needs with bgzf_pread() into the BgzfCache passed by the caller.
+// Caches are not shared, so callers must pass one cache per thread (NULL uses
+// a temporary cache for the one lookup). The binary search on the index
+// narrows each search down to a block of kmers that usually lies in one or
+// two BGZF blocks.
+//
 
 struct GraphFileSearch {
-  GraphFileReader *file;
+  const GraphFileReader *file;
   size_t nkmers, ncols, entrysize; // nkmers in file, size of kmer entry in file
-  BinaryKmer *index;
-  size_t blocksize, nblocks;
-  void *block; // read file into block to linear search
+  void *mmap_ptr; // whole file, NULL if compressed
+  const char *kmers; // start of kmer entries (mmap_ptr + hdr_size)
+  // compressed files
+  int fd;
+  const BgzfIndex *bgzf_idx;
+  BgzfIndex bgzf_built_idx; // used if the file has no .gzi index
+  GraphFileIndex gidx; // first kmer of each block of entries
 };
 
+// Max number of blocks to index if we don't have an index file
 // #define INDEX_SIZE 4 /* debugging */
-#define INDEX_SIZE 4*1024*1024 /* 4M */
-#define MAX_LIN_SEARCH 512
+#define INDEX_SIZE 1024*1024 /* 1M */
+
+// Get pointer to the start of entry `idx`, reading `len` bytes of it into
+// `buf` if the file is compressed
+static inline const char* gs_entry(const GraphFileSearch *gs, size_t idx,
+                                   size_t len, char *buf, BgzfCache *cache)
+{
+  if(gs->mmap_ptr != NULL) return gs->kmers + gs->entrysize*idx;
+  const char *path = file_filter_path(&gs->file->fltr);
+  size_t offset = gs->file->hdr_size + gs->entrysize*idx;
+  if(bgzf_pread(gs->fd, gs->bgzf_idx, buf, len, offset, cache, path) != len)
+    die("Cannot read kmer %zu: %s", idx, path);
+  return buf;
+}
+
+static inline BinaryKmer gs_kmer(const GraphFileSearch *gs, size_t idx,
+                                 BgzfCache *cache)
+{
+  BinaryKmer bkmer;
+  const char *ptr = gs_entry(gs, idx, sizeof(BinaryKmer), (char*)bkmer.b, cache);
+  if(ptr != (char*)bkmer.b) memcpy(bkmer.b, ptr, sizeof(BinaryKmer));
+  return bkmer;
+}
 
-/* with MAX_LIN_SEARCH of 512, 1 MiB allows 227 colours to be loaded */
+typedef struct {
+  const GraphFileSearch *gs;
+  BgzfCache *cache;
+} GraphSearchKmerGetter;
 
-GraphFileSearch *graph_search_new(GraphFileReader *file)
+static BinaryKmer gs_index_get_kmer(size_t idx, void *arg)
 {
-  if(file->num_of_kmers < 0) {
+  GraphSearchKmerGetter *getter = (GraphSearchKmerGetter*)arg;
+  return gs_kmer(getter->gs, idx, getter->cache);
+}
+
+// Load index from `idx_path` or <in.ctx>.idx. If that fails build an index by
+// sampling the file and cache it at <in.ctx>.idx unless `idx_path` was given
+static void graph_search_load_index(GraphFileSearch *gs, const char *idx_path)
+{
+  const char *path = file_filter_path(&gs->file->fltr);
+  const GraphIndexLayout layout = {.kmer_size = gs->file->hdr.kmer_size,
+                                   .hdr_size = gs->file->hdr_size,
+                                   .entrysize = gs->entrysize,
+                                   .nkmers = gs->nkmers};
+  BgzfCache cache = BGZF_CACHE_INIT;
+  bool loaded = false;
+
+  StrBuf default_idx;
+  strbuf_alloc(&default_idx, 1024);
+  graph_index_default_path(path, &default_idx);
+  const char *load_path = idx_path ? idx_path : default_idx.b;
+
+  if(idx_path != NULL || futil_file_exists(default_idx.b))
+  {
+    loaded = graph_index_load(&gs->gidx, load_path, &layout);
+    if(loaded && !binary_kmer_eq(gs->gidx.kmers[0], gs_kmer(gs, 0, &cache))) {
+      warn("Index doesn't match graph file, ignoring: %s", load_path);
+      graph_index_dealloc(&gs->gidx);
+      loaded = false;
+    }
+    if(loaded) {
+      status("[graph_search] on-disk-graph %zu cols %zu blocks %zu kmers"
+             " loaded index: %s", gs->ncols, gs->gidx.nblocks, gs->nkmers,
+             load_path);
+    }
+  }
+
+  if(!loaded)
+  {
+    status("[graph_search] on-disk-graph %zu cols %zu kmers building index...",
+           gs->ncols, gs->nkmers);
+    GraphSearchKmerGetter getter = {.gs = gs, .cache = &cache};
+    graph_index_build(&gs->gidx, gs->nkmers, INDEX_SIZE,
+                      gs_index_get_kmer, &getter);
+
+    // Cache the index next to the graph, unless the user gave us a bad one
+    if(idx_path == NULL && graph_index_is_sorted(&gs->gidx) &&
+       graph_index_save(&gs->gidx, default_idx.b, &layout)) {
+      status("[graph_search] Saved index to: %s", default_idx.b);
+    }
+  }
+
+  strbuf_dealloc(&default_idx);
+  bgzf_cache_dealloc(&cache);
+}
+
+/**
+ * Memory map a sorted graph file for searching.
+ * @param idx_path index file from `ctx index`, if NULL we look for
+ *                 <in.ctx>.idx and build (and save) one if it doesn't exist
+ */
+GraphFileSearch *graph_search_new(const GraphFileReader *file,
+                                  const char *idx_path)
+{
+  if(file_filter_isstdin(&file->fltr) ||
+     (file->num_of_kmers < 0 && !graph_file_is_bgzf(file))) {
     warn("Cannot open GraphFileSearch with file stream");
     return NULL;
   }
-  size_t i;
+
+  const char *path = file_filter_path(&file->fltr);
+
+  if(graph_file_is_colmajor(file)) {
+    warn("Cannot open GraphFileSearch with column-major graph: %s", path);
+    return NULL;
+  }
+
   GraphFileSearch *gs = ctx_calloc(sizeof(GraphFileSearch), 1);
   gs->file = file;
-  gs->nkmers = file->num_of_kmers;
   gs->ncols = file->hdr.num_of_cols;
   gs->entrysize = sizeof(BinaryKmer) + gs->ncols * (sizeof(Covg)+sizeof(Edges));
-  gs->nblocks = MIN2(gs->nkmers, INDEX_SIZE);
-  gs->blocksize = gs->nkmers / gs->nblocks;
-  gs->nblocks = (gs->nkmers+gs->blocksize-1) / gs->blocksize;
-  gs->index = ctx_calloc(sizeof(BinaryKmer), gs->nblocks+1); // sentinel
-  gs->block = ctx_calloc(MAX_LIN_SEARCH * gs->entrysize, 1);
-  memset(gs->index[gs->nblocks].b,0xff,BKMER_BYTES); // sentinel kmer
-  status("[graph_search] on-disk-graph %zu cols %zu blocks %zu bsize %zu kmers"
-         " building...", gs->ncols, gs->nblocks, gs->blocksize, gs->nkmers);
-  graph_file_set_buffered(file, 0); // Turn OFF buffered input
-  for(i = 0; i < gs->nblocks; i++) {
-    if(graph_file_fseek(file, graph_file_offset(file, i*gs->blocksize), SEEK_SET) != 0)
-      die("fseek failed: %s", strerror(errno));
-    if(graph_file_fread(file, &gs->index[i], sizeof(BinaryKmer)) != sizeof(BinaryKmer))
-      die("Cannot index graph: %s", file_filter_path(&gs->file->fltr));
+  gs->fd = fileno(file->fh);
+
+  if(graph_file_is_bgzf(file))
+  {
+    gs->bgzf_idx = file->bgzf_idx;
+    if(gs->bgzf_idx == NULL) {
+      status("[graph_search] Building BGZF block index: %s", path);
+      bgzf_index_alloc(&gs->bgzf_built_idx);
+      bgzf_index_scan(&gs->bgzf_built_idx, gs->fd, path);
+      gs->bgzf_idx = &gs->bgzf_built_idx;
+    }
+    size_t usize = bgzf_index_usize(gs->bgzf_idx);
+    gs->nkmers = usize > (size_t)file->hdr_size
+                   ? (usize - file->hdr_size) / gs->entrysize : 0;
+  }
+  else
+  {
+    gs->nkmers = file->num_of_kmers;
+  }
+
+  if(gs->nkmers == 0) {
+    warn("Cannot open GraphFileSearch with empty graph: %s", path);
+    if(gs->bgzf_idx == &gs->bgzf_built_idx)
+      bgzf_index_dealloc(&gs->bgzf_built_idx);
+    ctx_free(gs);
+    return NULL;
+  }
+
+  if(!graph_file_is_bgzf(file))
+  {
+    gs->mmap_ptr = mmap(NULL, file->file_size, PROT_READ, MAP_SHARED,
+                        gs->fd, 0);
+
+    if(gs->mmap_ptr == MAP_FAILED)
+      die("Cannot memory map file: %s [%s]", path, strerror(errno));
+
+    // Access pattern is a series of binary searches
+    if(madvise(gs->mmap_ptr, file->file_size, MADV_RANDOM) != 0)
+      warn("madvise failed: %s [%s]", strerror(errno), path);
+
+    gs->kmers = (const char*)gs->mmap_ptr + file->hdr_size;
   }
-  // check file is sorted
-  for(i = 0; i+1 < gs->nblocks; i++)
-    if(!binary_kmer_lt(gs->index[i],gs->index[i+1]))
-      die("File is not sorted: %s", file_filter_path(&file->fltr));
-  status("[graph_search] Index built.");
+
+  graph_search_load_index(gs, idx_path);
+
+  if(!graph_index_is_sorted(&gs->gidx))
+    die("File is not sorted: %s", path);
+
   return gs;
 }
 
 // We don't close the file
 void graph_search_destroy(GraphFileSearch *gs)
 {
-  ctx_free(gs->index);
-  ctx_free(gs->block);
+  if(gs->mmap_ptr != NULL && munmap(gs->mmap_ptr, gs->file->file_size) == -1)
+    die("Cannot release mmap file: %s [%s]",
+        file_filter_path(&gs->file->fltr), strerror(errno));
+  if(gs->bgzf_idx == &gs->bgzf_built_idx)
+    bgzf_index_dealloc(&gs->bgzf_built_idx);
+  graph_index_dealloc(&gs->gidx);
   ctx_free(gs);
 }
 
-// bkmers[n] must be a sentinel kmer (i.e. MAX_KMER)
-static inline int binary_search_index(BinaryKmer bkey,
-                                      const BinaryKmer *bkmers, size_t n)
-{
-  int l = 0, r = n, mid;
-  while(l < r) {
-    mid = (l+r)/2;
-    if(binary_kmer_le(bkmers[mid],bkey)) {
-      if(binary_kmer_lt(bkey,bkmers[mid+1])) return mid;
-      else l = mid+1;
-    }
-    else r = mid;
-  }
-  return -1;
-}
-
-// Return pointer to block of Covgs+Edges
-static inline void* search_file_sec(GraphFileSearch *gs, BinaryKmer bkey,
-                                    size_t start, size_t end)
+// Return pointer to entry (kmer+Covgs+Edges) in the mapped file or in `buf`
+static inline const char* search_file_sec(const GraphFileSearch *gs,
+                                          BinaryKmer bkey,
+                                          size_t start, size_t end,
+                                          char *buf, BgzfCache *cache)
 {
-  const size_t hdrsize = gs->file->hdr_size;
   size_t mid;
   BinaryKmer bmid;
-  // Binary search
-  while(start + MAX_LIN_SEARCH < end) {
+  while(start < end) {
     mid = (start+end) / 2;
-    if(graph_file_fseek(gs->file, hdrsize+gs->entrysize*mid, SEEK_SET) != 0)
-      die("fseek failed: %s", strerror(errno));
-    if(graph_file_fread(gs->file, gs->block, gs->entrysize) != gs->entrysize)
-      die("Cannot search graph from disk: %s", file_filter_path(&gs->file->fltr));
-    memcpy(bmid.b, gs->block, sizeof(BinaryKmer)); // copy binary kmer
-    if(binary_kmer_eq(bkey,bmid)) return gs->block;
+    bmid = gs_kmer(gs, mid, cache);
+    if(binary_kmer_eq(bkey,bmid))
+      return gs_entry(gs, mid, gs->entrysize, buf, cache);
     if(binary_kmer_lt(bkey,bmid)) end = mid;
     else start = mid + 1;
   }
-  // Linear search
-  size_t blockmem = gs->entrysize*(end-start);
-  if(graph_file_fseek(gs->file, hdrsize+gs->entrysize*start, SEEK_SET) != 0)
-    die("fseek failed: %s", strerror(errno));
-  if(graph_file_fread(gs->file, gs->block, blockmem) != blockmem)
-    die("Cannot search graph from disk: %s", file_filter_path(&gs->file->fltr));
-  char *p, *endp = (char*)gs->block + blockmem;
-  for(p = gs->block; p < endp; p += gs->entrysize)
-  {
-    memcpy(bmid.b, p, sizeof(BinaryKmer));
-    if(binary_kmer_eq(bkey,bmid)) return p;
-    if(binary_kmer_lt(bkey,bmid)) return NULL;
-  }
   return NULL;
 }
 
@@ -135,35 +254,40 @@ static inline void filter_covgs_edges(const FileFilter *fltr,
   }
 }
 
-bool graph_search_find(GraphFileSearch *gs, BinaryKmer bkey,
-                       Covg *covgs, Edges *edges)
+bool graph_search_find(const GraphFileSearch *gs, BinaryKmer bkey,
+                       Covg *covgs, Edges *edges, BgzfCache *cache)
 {
-  char *ptr;
+  const char *ptr;
   // Binary search on the index
-  long x = binary_search_index(bkey,gs->index,gs->nblocks);
+  long x = graph_index_find(&gs->gidx, bkey);
   if(x < 0) return false;
-  size_t blockstart = x*gs->blocksize;
-  size_t blockend = (size_t)x+1 < gs->nblocks ? blockstart+gs->blocksize : gs->nkmers;
-  if((ptr = search_file_sec(gs, bkey, blockstart, blockend)) == NULL) return false;
-  filter_covgs_edges(&gs->file->fltr, covgs, edges, ptr);
-  return true;
+  char buf[gs->mmap_ptr ? 1 : gs->entrysize];
+  BgzfCache tmp_cache = BGZF_CACHE_INIT;
+  if(cache == NULL) cache = &tmp_cache;
+  ptr = search_file_sec(gs, bkey, gs->gidx.blocks[x], gs->gidx.blocks[x+1], buf, cache);
+  if(ptr != NULL) filter_covgs_edges(&gs->file->fltr, covgs, edges, ptr);
+  bgzf_cache_dealloc(&tmp_cache);
+  return (ptr != NULL);
 }
 
-void graph_search_fetch(GraphFileSearch *gs, size_t idx, BinaryKmer *bkey,
-                        Covg *covgs, Edges *edges)
+void graph_search_fetch(const GraphFileSearch *gs, size_t idx,
+                        BinaryKmer *bkey, Covg *covgs, Edges *edges,
+                        BgzfCache *cache)
 {
-  if(graph_file_fseek(gs->file, gs->file->hdr_size+gs->entrysize*idx, SEEK_SET) != 0)
-    die("fseek failed: %s", strerror(errno));
-  // read one entry
-  if(graph_file_fread(gs->file, gs->block, gs->entrysize) != gs->entrysize)
-    die("Cannot search graph from disk: %s", file_filter_path(&gs->file->fltr));
-  memcpy(bkey, gs->block, sizeof(BinaryKmer)); // copy binary kmer
-  filter_covgs_edges(&gs->file->fltr, covgs, edges, gs->block);
+  ctx_assert(idx < gs->nkmers);
+  char buf[gs->mmap_ptr ? 1 : gs->entrysize];
+  BgzfCache tmp_cache = BGZF_CACHE_INIT;
+  if(cache == NULL) cache = &tmp_cache;
+  const char *ptr = gs_entry(gs, idx, gs->entrysize, buf, cache);
+  memcpy(bkey, ptr, sizeof(BinaryKmer)); // copy binary kmer
+  filter_covgs_edges(&gs->file->fltr, covgs, edges, ptr);
+  bgzf_cache_dealloc(&tmp_cache);
 }
 
-void graph_search_rand(GraphFileSearch *gs,
-                       BinaryKmer *bkey, Covg *covgs, Edges *edges)
+void graph_search_rand(const GraphFileSearch *gs,
+                       BinaryKmer *bkey, Covg *covgs, Edges *edges,
+                       BgzfCache *cache)
 {
-  size_t idx = (rand() / (double)RAND_MAX) * gs->nkmers;
-  graph_search_fetch(gs, idx, bkey, covgs, edges);
+  size_t idx = (rand() / ((double)RAND_MAX+1)) * gs->nkmers;
+  graph_search_fetch(gs, idx, bkey, covgs, edges, cache);
 }
@@ -8,19 +8,36 @@
 //
 // Search a sorted graph file on disk
 //
+// The file is memory mapped and searched in place, or read through its block
+// index if it is BGZF compressed. Once created a
+// GraphFileSearch is read-only, so any number of threads may call
+// graph_search_find() / graph_search_fetch() on it concurrently.
+//
+// Compressed files are read through a BgzfCache holding the last block
+// decompressed. Each thread should keep one cache per GraphFileSearch
+// (initialised with BGZF_CACHE_INIT, freed with bgzf_cache_dealloc()) and pass
+// it to every query, so nearby lookups don't inflate the same block again.
+// Passing NULL uses a temporary cache for the one query.
+//
 
 typedef struct GraphFileSearch GraphFileSearch;
 
-GraphFileSearch *graph_search_new(GraphFileReader *file);
+// `idx_path` is an index from `ctx index` or NULL to use <in.ctx>.idx. If
+// there is no usable index one is built and, if `idx_path` is NULL, saved to
+// <in.ctx>.idx. Returns NULL if the file cannot be searched (e.g. is a stream)
+GraphFileSearch *graph_search_new(const GraphFileReader *file,
+                                  const char *idx_path);
 void graph_search_destroy(GraphFileSearch *gs);
 
-bool graph_search_find(GraphFileSearch *gs, BinaryKmer bkey,
-                       Covg *covgs, Edges *edges);
+bool graph_search_find(const GraphFileSearch *gs, BinaryKmer bkey,
+                       Covg *covgs, Edges *edges, BgzfCache *cache);
 
-void graph_search_fetch(GraphFileSearch *gs, size_t idx,
-                        BinaryKmer *bkey, Covg *covgs, Edges *edges);
+void graph_search_fetch(const GraphFileSearch *gs, size_t idx,
+                        BinaryKmer *bkey, Covg *covgs, Edges *edges,
+                        BgzfCache *cache);
 
-void graph_search_rand(GraphFileSearch *gs,
-                       BinaryKmer *bkey, Covg *covgs, Edges *edges);
+void graph_search_rand(const GraphFileSearch *gs,
+                       BinaryKmer *bkey, Covg *covgs, Edges *edges,
+                       BgzfCache *cache);
 
 #endif /* GRAPH_SEARCH_H_ */
@@ -0,0 +1,99 @@
+#include "global.h"
+#include "graph_stream.h"
+#include "binary_kmer_sort.h"
+#include "util.h"
+
+// Per query: the query, a copy while reordering, a pointer and two bytes of
+// radix sort memory
+#define QUERY_MEM (2*sizeof(KmerQuery) + sizeof(void*) + 2)
+
+size_t graph_stream_max_queries(size_t mem)
+{
+  return MAX2(mem / QUERY_MEM, 1024);
+}
+
+void graph_stream_stats_init(GraphStreamStats *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+  stats->start_time = util_wall_time();
+}
+
+void graph_stream_sort(KmerQueryBuffer *queries, size_t nthreads)
+{
+  size_t i, n = queries->len;
+  if(n < 2) return;
+
+  void **ptrs = ctx_malloc(n * sizeof(void*));
+  for(i = 0; i < n; i++) ptrs[i] = &queries->b[i];
+
+  binary_kmer_sort_ptrs(ptrs, n, nthreads);
+
+  KmerQuery *sorted = ctx_malloc(queries->size * sizeof(KmerQuery));
+  for(i = 0; i < n; i++) sorted[i] = *(KmerQuery*)ptrs[i];
+
+  ctx_free(ptrs);
+  ctx_free(queries->b);
+  queries->b = sorted;
+}
+
+void graph_stream_join(GraphFileReader *file, const KmerQueryBuffer *queries,
+                       graph_stream_hit_f hit, void *arg,
+                       GraphStreamStats *stats)
+{
+  const char *path = file_filter_path(&file->fltr);
+  const KmerQuery *q = queries->b, *end = queries->b + queries->len;
+  const size_t ncols = file_filter_into_ncols(&file->fltr);
+  BinaryKmer bkmer, prev = BINARY_KMER_ZERO_MACRO;
+  size_t nkmers_read = 0;
+
+  if(queries->len == 0) return;
+
+  if(file_filter_isstdin(&file->fltr))
+    die("Cannot stream a graph from STDIN more than once");
+
+  if(graph_file_fseek(file, file->hdr_size, SEEK_SET) != 0)
+    die("Cannot seek to start of graph: %s", path);
+
+  Covg *covgs = ctx_malloc(ncols * sizeof(Covg));
+  Edges *edges = ctx_malloc(ncols * sizeof(Edges));
+
+  while(q < end && graph_file_read_reset(file, &bkmer, covgs, edges))
+  {
+    if(nkmers_read++ > 0 && !binary_kmer_lt(prev, bkmer))
+      die("Graph is not sorted: %s", path);
+    prev = bkmer;
+
+    while(q < end && binary_kmer_lt(q->bkey, bkmer)) q++;
+    for(; q < end && binary_kmer_eq(q->bkey, bkmer); q++) {
+      hit(q, covgs, edges, arg);
+      stats->nhits++;
+    }
+  }
+
+  ctx_free(covgs);
+  ctx_free(edges);
+
+  stats->npasses++;
+  stats->nkmers_read += nkmers_read;
+}
+
+void graph_stream_print_stats(const GraphStreamStats *stats)
+{
+  double secs = util_wall_time() - stats->start_time;
+  char nqueries_str[50], nhits_str[50], nkmers_str[50], rate_str[50];
+  char rss_str[50];
+
+  ulong_to_str(stats->nqueries, nqueries_str);
+  ulong_to_str(stats->nhits, nhits_str);
+  ulong_to_str(stats->nkmers_read, nkmers_str);
+  num_to_str(secs > 0 ? stats->nqueries / secs : 0, 2, rate_str);
+  bytes_to_str(util_peak_rss(), 1, rss_str);
+
+  status("[stream] %s queries in %zu batch%s, %s hits; "
+         "read %s graph kmers in %zu pass%s",
+         nqueries_str, stats->nbatches, stats->nbatches == 1 ? "" : "es",
+         nhits_str, nkmers_str, stats->npasses,
+         stats->npasses == 1 ? "" : "es");
+  status("[stream] %.2f secs, %s queries/sec, peak RSS %s",
+         secs, rate_str, rss_str);
+}
@@ -0,0 +1,55 @@
+#ifndef GRAPH_STREAM_H_
+#define GRAPH_STREAM_H_
+
+#include "binary_kmer.h"
+#include "graph_file_reader.h"
+
+//
+// Look up a batch of kmers in a sorted graph file by sorting them and
+// streaming the file past them (a merge join). Memory is bounded by the batch
+// size rather than the size of the graph, at the cost of reading the graph
+// once per batch.
+//
+
+typedef struct
+{
+  BinaryKmer bkey; // must be first, queries are sorted as BinaryKmers
+  uint64_t id; // set by the caller e.g. read number
+} KmerQuery;
+
+#include "madcrowlib/madcrow_buffer.h"
+madcrow_buffer(kmer_query_buf, KmerQueryBuffer, KmerQuery);
+
+typedef struct
+{
+  size_t nbatches, npasses; // batches of queries, passes over a graph file
+  size_t nqueries, nhits, nkmers_read;
+  double start_time;
+} GraphStreamStats;
+
+// Called for each query found in the file. `covgs` and `edges` are the kmer's
+// coverages and edges in the colours given by the file's filter
+typedef void (*graph_stream_hit_f)(const KmerQuery *q,
+                                   const Covg *covgs, const Edges *edges,
+                                   void *arg);
+
+// Number of queries that fit in `mem` bytes, including sorting memory
+size_t graph_stream_max_queries(size_t mem);
+
+void graph_stream_stats_init(GraphStreamStats *stats);
+
+// Sort queries by kmer using `nthreads` (reorders `queries`)
+void graph_stream_sort(KmerQueryBuffer *queries, size_t nthreads);
+
+// Read sorted graph `file` from its first kmer, calling `hit(q,...)` for each
+// query in `queries` (sorted with graph_stream_sort) whose kmer is in the
+// file. Stops reading once all queries have been passed. Dies if the file is
+// not sorted, or is a stream that has already been read.
+void graph_stream_join(GraphFileReader *file, const KmerQueryBuffer *queries,
+                       graph_stream_hit_f hit, void *arg,
+                       GraphStreamStats *stats);
+
+// Print queries, passes, throughput and peak memory
+void graph_stream_print_stats(const GraphStreamStats *stats);
+
+#endif /* GRAPH_STREAM_H_ */
@@ -5,6 +5,9 @@
 #include "db_node.h"
 #include "util.h"
 #include "file_util.h"
+#include "cmd.h" // DEFAULT_NTHREADS
+
+#include <unistd.h> // ftruncate
 
 // Construct graph header
 // Free with graph_header_free(hdr)
@@ -14,7 +17,8 @@ GraphFileHeader* graph_writer_mkhdr(const dBGraph *db_graph,
 {
   size_t i, from, into;
   GraphFileHeader *hdr = ctx_calloc(1, sizeof(*hdr));
-  hdr->version = CTX_GRAPH_FILEFORMAT;
+  hdr->version = db_graph->col_major ? CTX_GRAPH_COLMAJOR_FILEFORMAT
+                                     : CTX_GRAPH_FILEFORMAT;
   hdr->kmer_size = (uint32_t)db_graph->kmer_size;
   hdr->num_of_bitfields = NUM_BKMER_WORDS;
   hdr->num_of_cols = (uint32_t)filencols;
@@ -58,19 +62,18 @@ static size_t write_error_cleaning_object(FILE *fh, const ErrorCleaning *cleanin
   return written;
 }
 
+FILE* graph_writer_compress(FILE *fh, const char *path, size_t nthreads)
+{
+  if(!graph_file_path_is_bgzf(path)) return fh;
+  return bgzf_writer_fopen(fh, path, nthreads);
+}
+
+// Write per colour information in the header
 // Returns number of bytes written
-size_t graph_write_header(FILE *fh, const GraphFileHeader *h)
+static size_t graph_write_colinfo(FILE *fh, const GraphFileHeader *h)
 {
   size_t i, b = 0, act = 0, tmp;
 
-  act += fwrite("CORTEX", 1, strlen("CORTEX"), fh);
-  act += fwrite(&h->version, 1, sizeof(uint32_t), fh);
-  act += fwrite(&h->kmer_size, 1, sizeof(uint32_t), fh);
-  act += fwrite(&h->num_of_bitfields, 1, sizeof(uint32_t), fh);
-  act += fwrite(&h->num_of_cols, 1, sizeof(uint32_t), fh);
-
-  b += strlen("CORTEX") + sizeof(uint32_t) * 4;
-
   for(i = 0; i < h->num_of_cols; i++)
     act += fwrite(&h->ginfo[i].mean_read_length, 1, sizeof(uint32_t), fh);
   for(i = 0; i < h->num_of_cols; i++)
@@ -101,14 +104,40 @@ size_t graph_write_header(FILE *fh, const GraphFileHeader *h)
     }
   }
 
+  if(act != b) die("Cannot write file");
+
+  return b;
+}
+
+// Write "CORTEX", version, kmer size, number of words per kmer and colours
+static size_t graph_write_header_start(FILE *fh, const GraphFileHeader *h)
+{
+  size_t b = strlen("CORTEX") + sizeof(uint32_t) * 4, act = 0;
+
   act += fwrite("CORTEX", 1, strlen("CORTEX"), fh);
-  b += strlen("CORTEX");
+  act += fwrite(&h->version, 1, sizeof(uint32_t), fh);
+  act += fwrite(&h->kmer_size, 1, sizeof(uint32_t), fh);
+  act += fwrite(&h->num_of_bitfields, 1, sizeof(uint32_t), fh);
+  act += fwrite(&h->num_of_cols, 1, sizeof(uint32_t), fh);
 
   if(act != b) die("Cannot write file");
-
   return b;
 }
 
+// Returns number of bytes written
+size_t graph_write_header(FILE *fh, const GraphFileHeader *h)
+{
+  ctx_assert(h->version != CTX_GRAPH_COLMAJOR_FILEFORMAT);
+
+  size_t b = graph_write_header_start(fh, h);
+  b += graph_write_colinfo(fh, h);
+
+  if(fwrite("CORTEX", 1, strlen("CORTEX"), fh) != strlen("CORTEX"))
+    die("Cannot write file");
+
+  return b + strlen("CORTEX");
+}
+
 
 // Write a single kmer with its edges and coverages for colours 0..ncols-1 to
 // 0..ncols-1 in the file. `covgs` and `edges` should be of length `filencols`.
@@ -131,10 +160,24 @@ static inline void graph_write_kmer_direct(hkey_t hkey,
                                            const GraphFileHeader *hdr,
                                            FILE *fh, const dBGraph *db_graph)
 {
-  graph_write_kmer(fh, hdr->num_of_cols,
-                   hash_table_fetch(&db_graph->ht, hkey),
-                   &db_node_covg(db_graph, hkey, 0),
-                   &db_node_edges(db_graph, hkey, 0));
+  size_t col, ncols = hdr->num_of_cols;
+
+  if(!db_graph->col_major && db_graph->col_covgs != NULL) {
+    graph_write_kmer(fh, ncols,
+                     hash_table_fetch(&db_graph->ht, hkey),
+                     &db_node_covg(db_graph, hkey, 0),
+                     &db_node_edges(db_graph, hkey, 0));
+    return;
+  }
+
+  Covg covgs[ncols];
+  Edges edges[ncols];
+  for(col = 0; col < ncols; col++) {
+    covgs[col] = db_node_get_covg(db_graph, hkey, col);
+    edges[col] = db_node_get_edges(db_graph, hkey, col);
+  }
+  graph_write_kmer(fh, ncols, hash_table_fetch(&db_graph->ht, hkey),
+                   covgs, edges);
 }
 
 
@@ -152,16 +195,11 @@ static void graph_write_kmer_indirect(hkey_t hkey, const GraphFileHeader *hdr,
   memset(covgs, 0, sizeof(Covg) * hdr->num_of_cols);
   memset(edges, 0, sizeof(Edges) * hdr->num_of_cols);
 
-  Edges (*col_edges)[db_graph->num_of_cols]
-    = (Edges (*)[db_graph->num_of_cols])db_graph->col_edges;
-  Covg (*col_covgs)[db_graph->num_of_cols]
-    = (Covg (*)[db_graph->num_of_cols])db_graph->col_covgs;
-
   for(i = 0; i < file_filter_num(fltr); i++) {
     into = file_filter_intocol(fltr, i);
     from = file_filter_fromcol(fltr, i);
-    SAFE_SUM_COVG(covgs[into], col_covgs[hkey][from]);
-    edges[into] |= col_edges[hkey][from];
+    SAFE_SUM_COVG(covgs[into], db_node_get_covg(db_graph, hkey, from));
+    edges[into] |= db_node_get_edges(db_graph, hkey, from);
     merge_covgs |= covgs[into];
     merge_edges |= edges[into];
   }
@@ -180,10 +218,11 @@ static void graph_write_kmer_indirect(hkey_t hkey, const GraphFileHeader *hdr,
 // `sort_kmer` if true, sort kmers before writing. Uses extra memory.
 // Returns num of kmers written
 size_t graph_write_all_kmers_direct(FILE *fh, const dBGraph *db_graph,
-                                    bool sort_kmers, const GraphFileHeader *hdr)
+                                    bool sort_kmers, size_t nthreads,
+                                    const GraphFileHeader *hdr)
 {
   if(sort_kmers) {
-    HASH_ITERATE_SORTED(&db_graph->ht, graph_write_kmer_direct,
+    HASH_ITERATE_SORTED(&db_graph->ht, nthreads, graph_write_kmer_direct,
                         hdr, fh, db_graph);
   } else {
     HASH_ITERATE(&db_graph->ht, graph_write_kmer_direct,
@@ -193,12 +232,13 @@ size_t graph_write_all_kmers_direct(FILE *fh, const dBGraph *db_graph,
 }
 
 size_t graph_write_all_kmers_filtered(FILE *fh, const dBGraph *db_graph,
-                                      bool sort_kmers, const GraphFileHeader *hdr,
+                                      bool sort_kmers, size_t nthreads,
+                                      const GraphFileHeader *hdr,
                                       const FileFilter *fltr)
 {
   size_t num_nodes_dumped = 0;
   if(sort_kmers) {
-    HASH_ITERATE_SORTED(&db_graph->ht, graph_write_kmer_indirect,
+    HASH_ITERATE_SORTED(&db_graph->ht, nthreads, graph_write_kmer_indirect,
                         hdr, fltr, fh, db_graph,
                         &num_nodes_dumped);
   } else {
@@ -209,15 +249,149 @@ size_t graph_write_all_kmers_filtered(FILE *fh, const dBGraph *db_graph,
   return num_nodes_dumped;
 }
 
+//
+// Column-major (version 8) graph files
+//
+
+#define GRAPH_COLMAJOR_BLOCK (1<<16)
+
+// Write header start, number of kmers and "CORTEX"
+static size_t graph_write_colmajor_header(FILE *fh, const GraphFileHeader *h,
+                                          uint64_t nkmers)
+{
+  ctx_assert(h->version == CTX_GRAPH_COLMAJOR_FILEFORMAT);
+  size_t b = graph_write_header_start(fh, h);
+  if(fwrite(&nkmers, 1, sizeof(uint64_t), fh) != sizeof(uint64_t) ||
+     fwrite("CORTEX", 1, strlen("CORTEX"), fh) != strlen("CORTEX"))
+    die("Cannot write file");
+  return b + sizeof(uint64_t) + strlen("CORTEX");
+}
+
+// Write per colour information and "CORTEX" after the last column
+static size_t graph_write_colmajor_end(FILE *fh, const GraphFileHeader *h)
+{
+  size_t b = graph_write_colinfo(fh, h);
+  if(fwrite("CORTEX", 1, strlen("CORTEX"), fh) != strlen("CORTEX"))
+    die("Cannot write file");
+  return b + strlen("CORTEX");
+}
+
+// Get the hkeys of kmers to write, in the order they are written.
+// If `fltr` is not NULL and does not map colours directly, only kmers with
+// coverage in one of the filter's colours are kept.
+// Returns array of length *nkmers_ptr, free with ctx_free()
+static hkey_t* graph_writer_hkeys(const dBGraph *db_graph, bool sort_kmers,
+                                  size_t nthreads, const FileFilter *fltr,
+                                  size_t filencols, size_t *nkmers_ptr)
+{
+  const HashTable *ht = &db_graph->ht;
+  size_t i, j, n = hash_table_nkmers(ht);
+  hkey_t hkey, *hkeys;
+
+  if(sort_kmers) hkeys = hash_table_sorted(ht, nthreads);
+  else {
+    hkeys = ctx_malloc(n * sizeof(hkey_t));
+    for(hkey = 0, i = 0; i < n; hkey++)
+      if(hash_table_assigned(ht, hkey)) hkeys[i++] = hkey;
+  }
+
+  if(fltr != NULL && !file_filter_into_direct(fltr, filencols)) {
+    for(i = j = 0; i < n; i++) {
+      Covg covg = 0;
+      for(size_t k = 0; k < file_filter_num(fltr) && !covg; k++)
+        covg = db_node_get_covg(db_graph, hkeys[i], file_filter_fromcol(fltr,k));
+      if(covg) hkeys[j++] = hkeys[i];
+    }
+    n = j;
+  }
+
+  *nkmers_ptr = n;
+  return hkeys;
+}
+
+// Write the coverage column then the edges column for one colour in the file,
+// summing over graph colours `from[0..nfrom-1]`
+static void graph_write_column(FILE *fh, const dBGraph *db_graph,
+                               const hkey_t *hkeys, size_t nkmers,
+                               const size_t *from, size_t nfrom,
+                               Covg *covgs, Edges *edges)
+{
+  size_t i, j, k, n;
+
+  for(i = 0; i < nkmers; i += n) {
+    n = MIN2(nkmers - i, GRAPH_COLMAJOR_BLOCK);
+    memset(covgs, 0, n * sizeof(Covg));
+    for(k = 0; k < nfrom; k++)
+      for(j = 0; j < n; j++)
+        SAFE_SUM_COVG(covgs[j], db_node_get_covg(db_graph, hkeys[i+j], from[k]));
+    if(fwrite(covgs, sizeof(Covg), n, fh) != n) die("Cannot write file");
+  }
+
+  for(i = 0; i < nkmers; i += n) {
+    n = MIN2(nkmers - i, GRAPH_COLMAJOR_BLOCK);
+    memset(edges, 0, n * sizeof(Edges));
+    for(k = 0; k < nfrom; k++)
+      for(j = 0; j < n; j++)
+        edges[j] |= db_node_get_edges(db_graph, hkeys[i+j], from[k]);
+    if(fwrite(edges, sizeof(Edges), n, fh) != n) die("Cannot write file");
+  }
+}
+
+// Write the kmers of `hkeys` in the order given
+static void graph_write_kmer_column(FILE *fh, const dBGraph *db_graph,
+                                    const hkey_t *hkeys, size_t nkmers)
+{
+  size_t i;
+  for(i = 0; i < nkmers; i++) {
+    BinaryKmer bkmer = db_node_get_bkey(db_graph, hkeys[i]);
+    if(fwrite(bkmer.b, 1, sizeof(BinaryKmer), fh) != sizeof(BinaryKmer))
+      die("Cannot write file");
+  }
+}
+
+// Write a whole column-major file, returns number of kmers written
+static size_t graph_write_colmajor(FILE *fh, const dBGraph *db_graph,
+                                   bool sort_kmers, size_t nthreads,
+                                   const GraphFileHeader *hdr,
+                                   const FileFilter *fltr)
+{
+  size_t i, col, nfrom, nkmers, ncols = hdr->num_of_cols;
+  hkey_t *hkeys = graph_writer_hkeys(db_graph, sort_kmers, nthreads,
+                                     fltr, ncols, &nkmers);
+
+  size_t *from = ctx_malloc(MAX2(file_filter_num(fltr),1) * sizeof(size_t));
+  Covg *covgs = ctx_malloc(GRAPH_COLMAJOR_BLOCK * sizeof(Covg));
+  Edges *edges = ctx_malloc(GRAPH_COLMAJOR_BLOCK * sizeof(Edges));
+
+  graph_write_colmajor_header(fh, hdr, nkmers);
+  graph_write_kmer_column(fh, db_graph, hkeys, nkmers);
+
+  for(col = 0; col < ncols; col++) {
+    for(i = nfrom = 0; i < file_filter_num(fltr); i++)
+      if(file_filter_intocol(fltr, i) == col)
+        from[nfrom++] = file_filter_fromcol(fltr, i);
+    graph_write_column(fh, db_graph, hkeys, nkmers, from, nfrom, covgs, edges);
+  }
+
+  graph_write_colmajor_end(fh, hdr);
+
+  ctx_free(from);
+  ctx_free(covgs);
+  ctx_free(edges);
+  ctx_free(hkeys);
+
+  return nkmers;
+}
+
 // Pass your own header
-// If sort_kmers is true, save kmers in lexigraphical order
+// If sort_kmers is true, save kmers in lexigraphical order (using `nthreads`)
 // returns number of nodes written out
 uint64_t graph_writer_save(const char *path, const dBGraph *db_graph,
                            const GraphFileHeader *hdr, bool sort_kmers,
-                           const FileFilter *fltr)
+                           size_t nthreads, const FileFilter *fltr)
 {
   ctx_assert(db_graph->col_edges != NULL);
-  ctx_assert(db_graph->col_covgs != NULL);
+  ctx_assert(db_graph_has_covgs(db_graph));
 
   uint64_t n_nodes = 0;
   const char *out_name = futil_outpath_str(path);
@@ -225,17 +399,27 @@ uint64_t graph_writer_save(const char *path, const dBGraph *db_graph,
   status("[graphwriter] Saving file to: %s", path);
   file_filter_status(fltr, true);
 
-  FILE *fh = futil_fopen(path, "w");
+  FILE *fh = graph_writer_compress(futil_fopen(path, "w"), path, nthreads);
+
+  if(hdr->version == CTX_GRAPH_COLMAJOR_FILEFORMAT) {
+    n_nodes = graph_write_colmajor(fh, db_graph, sort_kmers, nthreads,
+                                   hdr, fltr);
+    fclose(fh);
+    graph_writer_print_status(n_nodes, hdr->num_of_cols,
+                              out_name, hdr->version);
+    return n_nodes;
+  }
 
   // Write header
   graph_write_header(fh, hdr);
 
   if(file_filter_into_direct(fltr,hdr->num_of_cols)) {
-    n_nodes = graph_write_all_kmers_direct(fh, db_graph, sort_kmers, hdr);
+    n_nodes = graph_write_all_kmers_direct(fh, db_graph, sort_kmers, nthreads,
+                                           hdr);
   }
   else {
-    n_nodes = graph_write_all_kmers_filtered(fh, db_graph, sort_kmers, hdr,
-                                             fltr);
+    n_nodes = graph_write_all_kmers_filtered(fh, db_graph, sort_kmers, nthreads,
+                                             hdr, fltr);
   }
 
   fclose(fh);
@@ -249,7 +433,8 @@ uint64_t graph_writer_save(const char *path, const dBGraph *db_graph,
 // filencols must be <= db_graph->num_of_cols
 // Return number of kmers written out
 uint64_t graph_writer_save_mkhdr(const char *path, const dBGraph *db_graph,
-                                 bool sort_kmers,  size_t filencols)
+                                 bool sort_kmers, size_t nthreads,
+                                 size_t filencols)
 {
   ctx_assert(filencols <= db_graph->num_of_cols);
 
@@ -260,7 +445,8 @@ uint64_t graph_writer_save_mkhdr(const char *path, const dBGraph *db_graph,
 
   // Construct graph header
   GraphFileHeader *hdr = graph_writer_mkhdr(db_graph, &fltr, filencols);
-  uint64_t nkmers = graph_writer_save(path, db_graph, hdr, sort_kmers, &fltr);
+  uint64_t nkmers = graph_writer_save(path, db_graph, hdr, sort_kmers, nthreads,
+                                     &fltr);
 
   graph_header_free(hdr);
   file_filter_close(&fltr);
@@ -301,13 +487,15 @@ static inline void _dump_empty_bkmer(hkey_t hkey, const dBGraph *db_graph,
   @return Number of bytes written
  */
 static size_t graph_write_empty(const dBGraph *db_graph, FILE *fh,
-                                bool sort_kmers, size_t num_of_cols)
+                                bool sort_kmers, size_t nthreads,
+                                size_t num_of_cols)
 {
   size_t mem = num_of_cols * (sizeof(Covg)+sizeof(Edges));
   char buf[mem];
   memset(buf, 0, mem);
   if(sort_kmers) {
-    HASH_ITERATE_SORTED(&db_graph->ht, _dump_empty_bkmer, db_graph, buf, mem, fh);
+    HASH_ITERATE_SORTED(&db_graph->ht, nthreads, _dump_empty_bkmer,
+                        db_graph, buf, mem, fh);
   } else {
     HASH_ITERATE(&db_graph->ht, _dump_empty_bkmer, db_graph, buf, mem, fh);
   }
@@ -332,7 +520,7 @@ static void graph_writer_update_file_kmers(const dBGraph *db_graph,
                                            size_t hdrsize, FILE *fh, const char *path)
 {
   ctx_assert(db_graph->col_edges != NULL);
-  ctx_assert(db_graph->col_covgs != NULL);
+  ctx_assert(db_graph_has_covgs(db_graph));
   ctx_assert(db_graph->num_of_cols == db_graph->num_edge_cols);
   ctx_assert(first_graphcol+ngraphcols <= db_graph->num_of_cols);
 
@@ -345,11 +533,11 @@ static void graph_writer_update_file_kmers(const dBGraph *db_graph,
   size_t block_size = kmers_per_block * filekmersize;
   ctx_assert(block_size > 0);
 
-  size_t nkmers_printed = 0, nkmers, nbytes, end;
+  size_t nkmers_printed = 0, nkmers, nbytes, end, col;
   uint8_t *mem = ctx_malloc(block_size), *memptr;
   hkey_t hkey = 0;
-  const Covg *covgs = db_graph->col_covgs;
-  const Edges *edges = db_graph->col_edges;
+  Covg covgs[ngraphcols];
+  Edges edges[ngraphcols];
   BinaryKmer bkmer;
 
   if(fseek(fh, hdrsize, SEEK_SET) != 0) die("Cannot seek to file start: %s", path);
@@ -372,8 +560,10 @@ static void graph_writer_update_file_kmers(const dBGraph *db_graph,
       else { // linear search of the hash table (it's fast!)
         while(!db_graph_node_assigned(db_graph, hkey)) hkey++;
       }
-      covgs = db_graph->col_covgs + hkey * db_graph->num_of_cols;
-      edges = db_graph->col_edges + hkey * db_graph->num_of_cols;
+      for(col = 0; col < ngraphcols; col++) {
+        covgs[col] = db_node_get_covg(db_graph, hkey, first_graphcol+col);
+        edges[col] = db_node_get_edges(db_graph, hkey, first_graphcol+col);
+      }
       memptr += sizeof(BinaryKmer);
       memcpy(memptr + first_filecol*sizeof(Covg), covgs, ngraphcols*sizeof(Covg));
       memptr += sizeof(Covg)*nfilecols;
@@ -409,7 +599,8 @@ size_t graph_writer_stream(const char *out_ctx_path, GraphFileReader *file,
   if(graph_file_fseek(file, file->hdr_size, SEEK_SET) != 0)
     die("fseek failed: %s", strerror(errno));
 
-  FILE *out = futil_fopen(out_ctx_path, "w");
+  FILE *out = graph_writer_compress(futil_fopen(out_ctx_path, "w"),
+                                    out_ctx_path, DEFAULT_NTHREADS);
   graph_write_header(out, hdr);
 
   size_t i, nodes_dumped = 0, ncols = file_filter_into_ncols(fltr);
@@ -490,7 +681,7 @@ size_t graph_writer_merge(const char *out_ctx_path,
                           bool kmers_loaded, bool colours_loaded,
                           const Edges *only_load_if_in_edges,
                           GraphFileHeader *hdr, bool sort_kmers,
-                          dBGraph *db_graph)
+                          size_t nthreads, dBGraph *db_graph)
 {
   bool only_load_if_in_graph = (only_load_if_in_edges != NULL);
   ctx_assert(!only_load_if_in_graph || kmers_loaded);
@@ -514,6 +705,7 @@ size_t graph_writer_merge(const char *out_ctx_path,
   GraphLoadingPrefs gprefs = graph_loading_prefs(db_graph);
   gprefs.must_exist_in_graph = only_load_if_in_graph;
   gprefs.must_exist_in_edges = only_load_if_in_edges;
+  gprefs.nthreads = nthreads;
 
   if(kmers_loaded && colours_loaded)
   {
@@ -521,11 +713,13 @@ size_t graph_writer_merge(const char *out_ctx_path,
     FileFilter fltr;
     memset(&fltr, 0, sizeof(fltr));
     file_filter_create_direct(&fltr, db_graph->num_of_cols, hdr->num_of_cols);
-    nnodes = graph_writer_save(out_ctx_path, db_graph, hdr, sort_kmers, &fltr);
+    nnodes = graph_writer_save(out_ctx_path, db_graph, hdr, sort_kmers,
+                               nthreads, &fltr);
     file_filter_close(&fltr);
     return nnodes;
   }
-  else if(num_files == 1 && !sort_kmers)
+  else if(num_files == 1 && !sort_kmers &&
+          hdr->version != CTX_GRAPH_COLMAJOR_FILEFORMAT)
   {
     return graph_writer_stream(out_ctx_path, &files[0], db_graph, hdr,
                                only_load_if_in_edges);
@@ -545,7 +739,8 @@ size_t graph_writer_merge(const char *out_ctx_path,
     FileFilter fltr;
     memset(&fltr, 0, sizeof(fltr));
     file_filter_create_direct(&fltr, db_graph->num_of_cols, hdr->num_of_cols);
-    nnodes = graph_writer_save(out_ctx_path, db_graph, hdr, sort_kmers, &fltr);
+    nnodes = graph_writer_save(out_ctx_path, db_graph, hdr, sort_kmers,
+                               nthreads, &fltr);
     file_filter_close(&fltr);
     return nnodes;
   }
@@ -554,14 +749,28 @@ size_t graph_writer_merge(const char *out_ctx_path,
     ctx_assert2(strcmp(out_ctx_path,"-") != 0,
                 "Cannot use STDOUT for output if not enough colours to load");
 
+    // Colours are written into the file in place
+    if(graph_file_path_is_bgzf(out_ctx_path)) {
+      die("Cannot write a compressed graph if not all colours fit in memory: %s",
+          out_ctx_path);
+    }
+
     // Have to load a few colours at a time then dump, rinse and repeat
     status("[overwriting] Saving %zu colours, %zu colours at a time",
            out_ncols, db_graph->num_of_cols);
 
+    // Column-major files are written one column at a time rather than
+    // updated in place
+    bool colmajor = (hdr->version == CTX_GRAPH_COLMAJOR_FILEFORMAT);
+    size_t hdr_size = 0, nkmers = 0, c;
+    hkey_t *hkeys = NULL;
+    Covg *colcovgs = NULL;
+    Edges *coledges = NULL;
+
     // Open file, write header
-    FILE *fout = futil_fopen(out_ctx_path, "r+");
+    FILE *fout = futil_fopen(out_ctx_path, colmajor ? "w" : "r+");
 
-    size_t hdr_size = graph_write_header(fout, hdr);
+    if(!colmajor) hdr_size = graph_write_header(fout, hdr);
 
     // Load all kmers into flat graph
     if(!kmers_loaded)
@@ -571,9 +780,18 @@ size_t graph_writer_merge(const char *out_ctx_path,
     status("Generated merged hash table\n");
     hash_table_print_stats(&db_graph->ht);
 
-    // Write empty file
-    size_t file_len = hdr_size;
-    file_len += graph_write_empty(db_graph, fout, sort_kmers, out_ncols);
+    if(colmajor) {
+      hkeys = graph_writer_hkeys(db_graph, sort_kmers, nthreads, NULL,
+                                 out_ncols, &nkmers);
+      colcovgs = ctx_malloc(GRAPH_COLMAJOR_BLOCK * sizeof(Covg));
+      coledges = ctx_malloc(GRAPH_COLMAJOR_BLOCK * sizeof(Edges));
+      graph_write_colmajor_header(fout, hdr, nkmers);
+      graph_write_kmer_column(fout, db_graph, hkeys, nkmers);
+    }
+    else {
+      // Write empty file
+      graph_write_empty(db_graph, fout, sort_kmers, nthreads, out_ncols);
+    }
     fflush(fout);
 
     size_t num_kmer_cols = db_graph->ht.capacity * db_graph->num_of_cols;
@@ -591,7 +809,7 @@ size_t graph_writer_merge(const char *out_ctx_path,
       if(firstcol == 0 || files_loaded) {
         status("Wiping colours");
         memset(db_graph->col_edges, 0, num_kmer_cols * sizeof(Edges));
-        memset(db_graph->col_covgs, 0, num_kmer_cols * sizeof(Covg));
+        db_graph_zero_covgs(db_graph);
       }
 
       files_loaded = false;
@@ -621,8 +839,15 @@ size_t graph_writer_merge(const char *out_ctx_path,
         file_filter_copy(fltr, &origfltr);
       }
 
-      // if files_loaded, dump
-      if(files_loaded) {
+      if(colmajor) {
+        // Every column is written, empty colours are all zeros
+        for(c = 0; c <= lastcol-firstcol; c++) {
+          graph_write_column(fout, db_graph, hkeys, nkmers, &c, 1,
+                             colcovgs, coledges);
+        }
+      }
+      else if(files_loaded) {
+        // if files_loaded, dump
         if(db_graph->num_of_cols == 1)
           status("[graphwriter] Dumping into colour %zu...\n", firstcol);
         else
@@ -635,6 +860,16 @@ size_t graph_writer_merge(const char *out_ctx_path,
       }
     }
 
+    if(colmajor) {
+      for(c = out_ncols; c < hdr->num_of_cols; c++)
+        graph_write_column(fout, db_graph, hkeys, nkmers, NULL, 0,
+                           colcovgs, coledges);
+      graph_write_colmajor_end(fout, hdr);
+      ctx_free(hkeys);
+      ctx_free(colcovgs);
+      ctx_free(coledges);
+    }
+
     fclose(fout);
     file_filter_close(&origfltr);
 
@@ -646,6 +881,146 @@ size_t graph_writer_merge(const char *out_ctx_path,
   return hash_table_nkmers(&db_graph->ht);
 }
 
+// Set bits in mask[hkey] for each edge to a kmer that is in the graph
+static inline void graph_writer_mask_edges(hkey_t hkey, const dBGraph *db_graph,
+                                           Edges *mask)
+{
+  const size_t kmer_size = db_graph->kmer_size;
+  BinaryKmer bkey = db_node_get_bkey(db_graph, hkey), next;
+  Orientation orient;
+  Nucleotide nuc;
+
+  for(orient = 0; orient < 2; orient++) {
+    for(nuc = 0; nuc < 4; nuc++) {
+      next = bkmer_shift_add_last_nuc(bkey, orient, kmer_size, nuc);
+      if(db_graph_find(db_graph, next).key != HASH_NOT_FOUND)
+        mask[hkey] |= nuc_orient_to_edge(nuc, orient);
+    }
+  }
+}
+
+// Append the colours of graph files to an existing column-major graph file
+// at `path`. Only kmers already in `path` are loaded; edges to kmers that are
+// not in `path` are dropped.
+// `db_graph` must be empty with enough colours for all loaded colours
+// returns number of kmers in the file
+size_t graph_writer_append_colmajor(const char *path,
+                                    GraphFileReader *files, size_t num_files,
+                                    size_t nthreads, dBGraph *db_graph)
+{
+  ctx_assert(hash_table_nkmers(&db_graph->ht) == 0);
+
+  size_t i, f, n, col, from, into, nfilekmers, oldncols, newncols = 0;
+  GraphFileReader out;
+  memset(&out, 0, sizeof(out));
+  graph_file_open2(&out, path, "r+", false, 0);
+
+  if(!graph_file_is_colmajor(&out))
+    die("Can only append colours to a column-major graph: %s", path);
+  if(graph_file_is_bgzf(&out))
+    die("Cannot append colours to a compressed graph: %s", path);
+
+  for(f = 0; f < num_files; f++) {
+    newncols = MAX2(newncols, file_filter_into_ncols(&files[f].fltr));
+    if(files[f].hdr.kmer_size != out.hdr.kmer_size) {
+      die("Kmer-size mismatch %u vs %u [%s vs %s]",
+          out.hdr.kmer_size, files[f].hdr.kmer_size,
+          path, files[f].fltr.path.b);
+    }
+  }
+
+  ctx_assert(newncols <= db_graph->num_of_cols);
+
+  nfilekmers = out.num_of_kmers;
+  oldncols = out.hdr.num_of_cols;
+
+  status("[graphwriter] Appending %zu colour%s to %s (%zu colour%s)",
+         newncols, util_plural_str(newncols), path,
+         oldncols, util_plural_str(oldncols));
+
+  // Read kmers from the file, remembering where each one is in the hash table
+  hkey_t *hkeys = ctx_malloc(MAX2(nfilekmers,1) * sizeof(hkey_t));
+  BinaryKmer *bkmers = ctx_malloc(GRAPH_COLMAJOR_BLOCK * sizeof(BinaryKmer));
+  bool found;
+
+  if(fseek(out.fh, out.hdr_size, SEEK_SET) != 0)
+    die("Cannot seek to first kmer: %s", path);
+
+  for(i = 0; i < nfilekmers; i += n) {
+    n = MIN2(nfilekmers - i, GRAPH_COLMAJOR_BLOCK);
+    if(fread(bkmers, sizeof(BinaryKmer), n, out.fh) != n)
+      die("Cannot read kmers: %s", path);
+    for(f = 0; f < n; f++) {
+      hkeys[i+f] = hash_table_find_or_insert(&db_graph->ht, bkmers[f], &found);
+      if(found) die("Duplicate kmer in graph: %s", path);
+    }
+  }
+
+  ctx_free(bkmers);
+
+  // Only keep edges between kmers in the file
+  Edges *mask = ctx_calloc(db_graph->ht.capacity, sizeof(Edges));
+  HASH_ITERATE(&db_graph->ht, graph_writer_mask_edges, db_graph, mask);
+
+  GraphLoadingPrefs gprefs = graph_loading_prefs(db_graph);
+  gprefs.must_exist_in_graph = true;
+  gprefs.must_exist_in_edges = mask;
+  gprefs.nthreads = nthreads;
+
+  for(f = 0; f < num_files; f++)
+    graph_load(&files[f], gprefs, NULL);
+
+  ctx_free(mask);
+
+  // Merged header: old colours followed by the new ones
+  GraphFileHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  graph_file_merge_header(&hdr, &out);
+  hdr.version = CTX_GRAPH_COLMAJOR_FILEFORMAT;
+  hdr.num_of_cols = (uint32_t)(oldncols + newncols);
+  graph_header_capacity(&hdr, hdr.num_of_cols);
+
+  for(f = 0; f < num_files; f++) {
+    for(i = 0; i < file_filter_num(&files[f].fltr); i++) {
+      from = file_filter_fromcol(&files[f].fltr, i);
+      into = file_filter_intocol(&files[f].fltr, i);
+      graph_info_merge(&hdr.ginfo[oldncols+into], &files[f].hdr.ginfo[from]);
+    }
+  }
+
+  // Overwrite the old colour information with the new columns
+  Covg *covgs = ctx_malloc(GRAPH_COLMAJOR_BLOCK * sizeof(Covg));
+  Edges *edges = ctx_malloc(GRAPH_COLMAJOR_BLOCK * sizeof(Edges));
+
+  if(fseek(out.fh, graph_file_col_offset(&out, oldncols), SEEK_SET) != 0)
+    die("Cannot seek to end of columns: %s", path);
+
+  for(col = 0; col < newncols; col++)
+    graph_write_column(out.fh, db_graph, hkeys, nfilekmers, &col, 1,
+                       covgs, edges);
+
+  graph_write_colmajor_end(out.fh, &hdr);
+
+  // New columns may be shorter than the colour information they replaced
+  if(fflush(out.fh) != 0 || ftruncate(fileno(out.fh), ftell(out.fh)) != 0)
+    die("Cannot truncate file: %s", path);
+
+  // Finally update the number of colours in the header
+  if(fseek(out.fh, strlen("CORTEX") + 3*sizeof(uint32_t), SEEK_SET) != 0 ||
+     fwrite(&hdr.num_of_cols, 1, sizeof(uint32_t), out.fh) != sizeof(uint32_t))
+    die("Cannot update header: %s", path);
+
+  graph_writer_print_status(nfilekmers, hdr.num_of_cols, path, hdr.version);
+
+  ctx_free(covgs);
+  ctx_free(edges);
+  ctx_free(hkeys);
+  graph_header_dealloc(&hdr);
+  graph_file_close(&out);
+
+  return nfilekmers;
+}
+
 // if intersect_gname != NULL: only load kmers that are already in the hash table
 //    and use string as name for cleaning against
 // returns the number of kmers written
@@ -654,7 +1029,8 @@ size_t graph_writer_merge_mkhdr(const char *out_ctx_path,
                                bool kmers_loaded, bool colours_loaded,
                                const Edges *only_load_if_in_edges,
                                const char *intersect_gname,
-                               bool sort_kmers, dBGraph *db_graph)
+                               bool sort_kmers, size_t nthreads,
+                               dBGraph *db_graph)
 {
   size_t i, num_kmers;
   GraphFileHeader hdr;
@@ -663,6 +1039,8 @@ size_t graph_writer_merge_mkhdr(const char *out_ctx_path,
   for(i = 0; i < num_files; i++)
     graph_file_merge_header(&hdr, &files[i]);
 
+  if(db_graph->col_major) hdr.version = CTX_GRAPH_COLMAJOR_FILEFORMAT;
+
   if(intersect_gname != NULL) {
     for(i = 0; i < hdr.num_of_cols; i++)
       if(graph_file_is_colour_loaded(i, files, num_files))
@@ -672,7 +1050,262 @@ size_t graph_writer_merge_mkhdr(const char *out_ctx_path,
   num_kmers = graph_writer_merge(out_ctx_path, files, num_files,
                                  kmers_loaded, colours_loaded,
                                  only_load_if_in_edges,
-                                 &hdr, sort_kmers, db_graph);
+                                 &hdr, sort_kmers, nthreads, db_graph);
+
+  graph_header_dealloc(&hdr);
+  return num_kmers;
+}
+
+//
+// Merge sorted graph files
+//
+
+typedef struct
+{
+  GraphFileReader *file;
+  BinaryKmer bkmer; // current kmer
+  Covg *covgs; // current kmer covgs, edges (file->hdr.num_of_cols)
+  Edges *edges;
+  size_t nkmers; // number of kmers read
+} SortedGraphIn;
+
+// Read next kmer, returns false at the end of the file
+static inline bool sorted_gin_next(SortedGraphIn *in)
+{
+  BinaryKmer prev = in->bkmer;
+  if(!graph_file_read_raw(in->file, &in->bkmer, in->covgs, in->edges))
+    return false;
+  if(in->nkmers++ > 0 && !binary_kmer_lt(prev, in->bkmer))
+    die("Graph file is not sorted: %s", file_filter_path(&in->file->fltr));
+  return true;
+}
+
+static void sorted_gin_heap_down(SortedGraphIn **heap, size_t n, size_t i)
+{
+  size_t l, r, m;
+  while(1) {
+    l = 2*i+1; r = l+1; m = i;
+    if(l < n && binary_kmer_lt(heap[l]->bkmer, heap[m]->bkmer)) m = l;
+    if(r < n && binary_kmer_lt(heap[r]->bkmer, heap[m]->bkmer)) m = r;
+    if(m == i) break;
+    SWAP(heap[i], heap[m]);
+    i = m;
+  }
+}
+
+size_t graph_writer_merge_sorted(const char *out_ctx_path,
+                                 GraphFileReader *files, size_t num_files,
+                                 const GraphFileHeader *hdr, size_t bufsize)
+{
+  size_t i, n, ncols = hdr->num_of_cols, nsrccols = 0, nodes_dumped = 0;
+  Covg keep_kmer;
+
+  status("[graphwriter] Merging %zu sorted graph files into %s (%zu colour%s)",
+         num_files, futil_outpath_str(out_ctx_path),
+         ncols, util_plural_str(ncols));
+
+  for(i = 0; i < num_files; i++) nsrccols += files[i].hdr.num_of_cols;
+
+  SortedGraphIn *ins = ctx_calloc(num_files, sizeof(SortedGraphIn));
+  SortedGraphIn **heap = ctx_calloc(num_files, sizeof(SortedGraphIn*));
+  Covg *srccovgs = ctx_calloc(nsrccols, sizeof(Covg));
+  Edges *srcedges = ctx_calloc(nsrccols, sizeof(Edges));
+  Covg *covgs = ctx_calloc(ncols, sizeof(Covg));
+  Edges *edges = ctx_calloc(ncols, sizeof(Edges));
+
+  // Set read buffer size then seek to first kmer
+  for(i = n = 0; i < num_files; i++) {
+    if(!file_filter_isstdin(&files[i].fltr)) {
+      graph_file_set_buffered(&files[i], 0);
+      graph_file_set_buffered(&files[i], bufsize);
+      if(graph_file_fseek(&files[i], files[i].hdr_size, SEEK_SET) != 0)
+        die("fseek failed: %s", strerror(errno));
+    }
+    ins[i] = (SortedGraphIn){.file = &files[i],
+                             .covgs = srccovgs + n, .edges = srcedges + n};
+    n += files[i].hdr.num_of_cols;
+  }
+
+  for(i = n = 0; i < num_files; i++)
+    if(sorted_gin_next(&ins[i])) heap[n++] = &ins[i];
+
+  for(i = n/2; i-- > 0; ) sorted_gin_heap_down(heap, n, i);
+
+  FILE *fout = graph_writer_compress(futil_fopen(out_ctx_path, "w"),
+                                     out_ctx_path, DEFAULT_NTHREADS);
+  graph_write_header(fout, hdr);
+
+  BinaryKmer bkmer;
+
+  while(n > 0)
+  {
+    // Merge all entries for the smallest kmer
+    bkmer = heap[0]->bkmer;
+    memset(covgs, 0, ncols * sizeof(Covg));
+    memset(edges, 0, ncols * sizeof(Edges));
+
+    do {
+      graph_file_filter_kmer(heap[0]->file, heap[0]->covgs, heap[0]->edges,
+                             covgs, edges);
+      if(!sorted_gin_next(heap[0])) heap[0] = heap[--n];
+      sorted_gin_heap_down(heap, n, 0);
+    } while(n > 0 && binary_kmer_eq(heap[0]->bkmer, bkmer));
+
+    // If kmer has no covg in output colours -> don't write
+    for(i = 0, keep_kmer = 0; i < ncols; i++) keep_kmer |= covgs[i];
+
+    if(keep_kmer) {
+      graph_write_kmer(fout, ncols, bkmer, covgs, edges);
+      nodes_dumped++;
+    }
+  }
+
+  fclose(fout);
+
+  ctx_free(ins);
+  ctx_free(heap);
+  ctx_free(srccovgs);
+  ctx_free(srcedges);
+  ctx_free(covgs);
+  ctx_free(edges);
+
+  graph_writer_print_status(nodes_dumped, ncols, out_ctx_path, hdr->version);
+
+  return nodes_dumped;
+}
+
+size_t graph_writer_merge_sorted_mkhdr(const char *out_ctx_path,
+                                       GraphFileReader *files, size_t num_files,
+                                       size_t bufsize)
+{
+  size_t i, num_kmers;
+  GraphFileHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+
+  for(i = 0; i < num_files; i++)
+    graph_file_merge_header(&hdr, &files[i]);
+
+  num_kmers = graph_writer_merge_sorted(out_ctx_path, files, num_files,
+                                        &hdr, bufsize);
+
+  graph_header_dealloc(&hdr);
+  return num_kmers;
+}
+
+size_t graph_writer_merge_sorted_graph(const char *out_ctx_path,
+                                       GraphFileReader *file,
+                                       const dBGraph *db_graph,
+                                       const GraphFileHeader *hdr,
+                                       size_t nthreads, size_t bufsize)
+{
+  ctx_assert(db_graph->col_edges != NULL);
+  ctx_assert(db_graph_has_covgs(db_graph));
+  ctx_assert(db_graph->num_edge_cols == db_graph->num_of_cols);
+  ctx_assert(db_graph->num_of_cols <= hdr->num_of_cols);
+
+  const size_t ncols = hdr->num_of_cols, gcols = db_graph->num_of_cols;
+  const size_t ngkmers = hash_table_nkmers(&db_graph->ht);
+  size_t i, gi = 0, nodes_dumped = 0;
+  Covg keep_kmer;
+  bool fmore;
+
+  char ngkmers_str[50];
+  ulong_to_str(ngkmers, ngkmers_str);
+  status("[graphwriter] Merging %s kmers into sorted graph %s -> %s",
+         ngkmers_str, file_filter_path(&file->fltr),
+         futil_outpath_str(out_ctx_path));
+
+  hkey_t *hkeys = hash_table_sorted(&db_graph->ht, nthreads);
+
+  SortedGraphIn in = {.file = file,
+                      .covgs = ctx_calloc(file->hdr.num_of_cols, sizeof(Covg)),
+                      .edges = ctx_calloc(file->hdr.num_of_cols, sizeof(Edges))};
+  Covg *covgs = ctx_calloc(ncols, sizeof(Covg));
+  Edges *edges = ctx_calloc(ncols, sizeof(Edges));
+
+  // Set read buffer size then seek to first kmer
+  if(!file_filter_isstdin(&file->fltr)) {
+    graph_file_set_buffered(file, 0);
+    graph_file_set_buffered(file, bufsize);
+    if(graph_file_fseek(file, file->hdr_size, SEEK_SET) != 0)
+      die("fseek failed: %s", strerror(errno));
+  }
+
+  fmore = sorted_gin_next(&in);
+
+  FILE *fout = graph_writer_compress(futil_fopen(out_ctx_path, "w"),
+                                     out_ctx_path, nthreads);
+  graph_write_header(fout, hdr);
+
+  BinaryKmer bkmer, gkmer = BINARY_KMER_ZERO_MACRO;
+
+  while(fmore || gi < ngkmers)
+  {
+    memset(covgs, 0, ncols * sizeof(Covg));
+    memset(edges, 0, ncols * sizeof(Edges));
+
+    if(gi < ngkmers) gkmer = db_node_get_bkey(db_graph, hkeys[gi]);
+
+    // Take the smaller kmer, from the file and graph if they are equal
+    if(fmore && (gi == ngkmers || !binary_kmer_lt(gkmer, in.bkmer))) {
+      bkmer = in.bkmer;
+      graph_file_filter_kmer(file, in.covgs, in.edges, covgs, edges);
+      fmore = sorted_gin_next(&in);
+    }
+    else bkmer = gkmer;
+
+    if(gi < ngkmers && binary_kmer_eq(gkmer, bkmer)) {
+      for(i = 0; i < gcols; i++) {
+        covgs[i] = SAFE_ADD_COVG(covgs[i], db_node_get_covg(db_graph, hkeys[gi], i));
+        edges[i] |= db_node_get_edges(db_graph, hkeys[gi], i);
+      }
+      gi++;
+    }
+
+    // If kmer has no covg in output colours -> don't write
+    for(i = 0, keep_kmer = 0; i < ncols; i++) keep_kmer |= covgs[i];
+
+    if(keep_kmer) {
+      graph_write_kmer(fout, ncols, bkmer, covgs, edges);
+      nodes_dumped++;
+    }
+  }
+
+  fclose(fout);
+
+  ctx_free(hkeys);
+  ctx_free(in.covgs);
+  ctx_free(in.edges);
+  ctx_free(covgs);
+  ctx_free(edges);
+
+  char nfile_str[50];
+  ulong_to_str(in.nkmers, nfile_str);
+  status("[graphwriter] Read %s kmers from %s", nfile_str,
+         file_filter_path(&file->fltr));
+  graph_writer_print_status(nodes_dumped, ncols, out_ctx_path, hdr->version);
+
+  return nodes_dumped;
+}
+
+size_t graph_writer_merge_sorted_graph_mkhdr(const char *out_ctx_path,
+                                             GraphFileReader *file,
+                                             const dBGraph *db_graph,
+                                             size_t nthreads, size_t bufsize)
+{
+  size_t i, num_kmers;
+  GraphFileHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+
+  graph_file_merge_header(&hdr, file);
+  hdr.num_of_cols = MAX2(hdr.num_of_cols, db_graph->num_of_cols);
+  graph_header_capacity(&hdr, hdr.num_of_cols);
+
+  for(i = 0; i < db_graph->num_of_cols; i++)
+    graph_info_merge(&hdr.ginfo[i], &db_graph->ginfo[i]);
+
+  num_kmers = graph_writer_merge_sorted_graph(out_ctx_path, file, db_graph,
+                                              &hdr, nthreads, bufsize);
 
   graph_header_dealloc(&hdr);
   return num_kmers;
@@ -16,6 +16,11 @@ GraphFileHeader* graph_writer_mkhdr(const dBGraph *db_graph,
                                     const FileFilter *fltr,
                                     size_t filencols);
 
+// If `path` ends in .gz, return a FILE* that BGZF compresses graph data using
+// `nthreads` threads and writes it to `fh`. A block index is saved to
+// <path>.gzi when it is closed with fclose(). Otherwise returns `fh`.
+FILE* graph_writer_compress(FILE *fh, const char *path, size_t nthreads);
+
 // Returns number of bytes written
 size_t graph_write_header(FILE *fh, const GraphFileHeader *hdr);
 
@@ -31,30 +36,35 @@ size_t graph_write_kmer(FILE *fh, size_t filencols,
 // Do not use filters to re-arrange colours
 // `sort_kmer` if true, sort kmers before writing. Uses extra memory:
 //   requires sizeof(hkey_t) * num_kmers memory which it allocates and frees
+//   kmers are sorted with `nthreads`
 // Returns num of kmers written
 size_t graph_write_all_kmers_direct(FILE *fh, const dBGraph *db_graph,
-                                    bool sort_kmers, const GraphFileHeader *hdr);
+                                    bool sort_kmers, size_t nthreads,
+                                    const GraphFileHeader *hdr);
 
 // Dump all kmers with all colours to given file.
 // Filter kmers and re-arrange colours
 // `sort_kmer` if true, sort kmers before writing. Uses extra memory:
 //   requires sizeof(hkey_t) * num_kmers memory which it allocates and frees
+//   kmers are sorted with `nthreads`
 // Returns num of kmers written
 size_t graph_write_all_kmers_filtered(FILE *fh, const dBGraph *db_graph,
-                                      bool sort_kmers, const GraphFileHeader *hdr,
+                                      bool sort_kmers, size_t nthreads,
+                                      const GraphFileHeader *hdr,
                                       const FileFilter *fltr);
 
 // Pass your own header, ncols in file taken from the header
-// If sort_kmers is true, save kmers in lexigraphical order
+// If sort_kmers is true, save kmers in lexigraphical order (using `nthreads`)
 // returns number of nodes written out
 uint64_t graph_writer_save(const char *path, const dBGraph *db_graph,
                            const GraphFileHeader *hdr, bool sort_kmers,
-                           const FileFilter *fltr);
+                           size_t nthreads, const FileFilter *fltr);
 
 // filencols must be <= db_graph->num_of_cols
 // returns number of nodes dumped
 uint64_t graph_writer_save_mkhdr(const char *path, const dBGraph *db_graph,
-                                 bool sort_kmers, size_t filencols);
+                                 bool sort_kmers, size_t nthreads,
+                                 size_t filencols);
 
 void graph_writer_print_status(uint64_t nkmers, size_t ncols,
                                const char *path, uint32_t version);
@@ -82,7 +92,7 @@ size_t graph_writer_merge(const char *out_ctx_path,
                           bool kmers_loaded, bool colours_loaded,
                           const Edges *only_load_if_in_edges,
                           GraphFileHeader *hdr, bool sort_kmers,
-                          dBGraph *db_graph);
+                          size_t nthreads, dBGraph *db_graph);
 
 // if intersect only load kmers that are already in the hash table
 // returns number of kmers written
@@ -91,6 +101,51 @@ size_t graph_writer_merge_mkhdr(const char *out_ctx_path,
                                 bool kmers_loaded, bool colours_loaded,
                                 const Edges *only_load_if_in_edges,
                                 const char *intersect_gname,
-                                bool sort_kmers, dBGraph *db_graph);
+                                bool sort_kmers, size_t nthreads,
+                                dBGraph *db_graph);
+
+// Append the colours of graph files to an existing column-major (version 8)
+// graph file at `path`, without rewriting the existing colours. Only kmers
+// already in `path` are loaded and edges to kmers not in `path` are dropped.
+// `db_graph` must be empty and have at least as many colours as are loaded.
+// returns number of kmers in the file
+size_t graph_writer_append_colmajor(const char *path,
+                                    GraphFileReader *files, size_t num_files,
+                                    size_t nthreads, dBGraph *db_graph);
+
+//
+// Merge sorted graph files
+//
+
+// Merge sorted graph files with a k-way heap merge in a single pass, without a
+// hash table. Output is sorted. Memory used is a read buffer of `bufsize`
+// bytes per input file plus one kmer per input file. Kmers with zero coverage
+// in all output colours are dropped. Calls die() if an input is not sorted.
+// returns number of kmers written
+size_t graph_writer_merge_sorted(const char *out_ctx_path,
+                                 GraphFileReader *files, size_t num_files,
+                                 const GraphFileHeader *hdr, size_t bufsize);
+
+size_t graph_writer_merge_sorted_mkhdr(const char *out_ctx_path,
+                                       GraphFileReader *files, size_t num_files,
+                                       size_t bufsize);
+
+// Merge the kmers loaded in `db_graph` into sorted graph `file` in a single
+// pass, without loading the file. Colour i of the graph is added to colour i
+// of the output, file colours are placed by the file's filter. Graph kmers are
+// sorted using `nthreads` (sizeof(hkey_t) per kmer). The file is read with a
+// buffer of `bufsize` bytes. Output is sorted. Calls die() if `file` is not
+// sorted.
+// returns number of kmers written
+size_t graph_writer_merge_sorted_graph(const char *out_ctx_path,
+                                       GraphFileReader *file,
+                                       const dBGraph *db_graph,
+                                       const GraphFileHeader *hdr,
+                                       size_t nthreads, size_t bufsize);
+
+size_t graph_writer_merge_sorted_graph_mkhdr(const char *out_ctx_path,
+                                             GraphFileReader *file,
+                                             const dBGraph *db_graph,
+                                             size_t nthreads, size_t bufsize);
 
 #endif /* GRAPH_WRITER_H_ */
@@ -75,36 +75,265 @@ void graph_load_ginfo(dBGraph *graph, GraphFileReader *file)
   graph->num_of_cols_used = MAX2(graph->num_of_cols_used, ncols);
 }
 
-// We assume only_load_if_in_colour < load_first_colour_into
-// if all_kmers_are_unique != 0 an error is thrown if a node already exists
-// If stats != NULL, updates:
-//   stats->num_kmers_loaded
-//   stats->total_bases_read
+//
+// Multithreaded loading
+//
 
-/*!
-  @return number of kmers loaded
- */
-size_t graph_load(GraphFileReader *file, const GraphLoadingPrefs prefs,
-                  GraphLoadingStats *stats)
+// Kmers read per block by each worker thread
+#define GLOAD_BLOCK_NKMERS 4096
+// Don't bother starting threads for graphs smaller than this
+#define GLOAD_MIN_MT_NKMERS (1UL<<16)
+
+typedef struct
 {
-  dBGraph *graph = prefs.db_graph;
-  FileFilter *fltr = &file->fltr;
-  size_t i, ncols = file_filter_into_ncols(fltr);
+  GraphFileReader *const file;
+  const GraphLoadingPrefs prefs;
+  const size_t ncols; // file_filter_into_ncols(&file->fltr)
+  const uint64_t nkmers, nblocks;
+  volatile uint8_t *const bktlocks; // NULL => lock-free inserts
+  volatile uint64_t next_block;
+  volatile uint8_t warned_zero_covg, warned_missing_covg;
+  // merged from each thread at the end
+  pthread_mutex_t lock;
+  GraphLoadingStats *stats;
+  uint64_t nkmers_read, nkmers_loaded, nkmers_novel;
+} GraphLoaderMT;
+
+// Thread safe equivalent of the per-kmer body of graph_load()
+// Returns true if kmer was loaded
+static inline bool graph_load_kmer_mt(const GraphLoaderMT *ldr, BinaryKmer bkmer,
+                                      const Covg *covgs, const Edges *edges,
+                                      bool *novel)
+{
+  const GraphLoadingPrefs *prefs = &ldr->prefs;
+  dBGraph *graph = prefs->db_graph;
+  size_t i, ncols = ldr->ncols;
+  hkey_t hkey;
+  bool found;
 
-  ctx_assert(file_filter_num(fltr) > 0);
+  *novel = false;
 
-  // Print status
-  graph_loading_print_status(file);
+  // Fetch node in the de bruijn graph
+  if(prefs->must_exist_in_graph)
+  {
+    if((hkey = hash_table_find(&graph->ht, bkmer)) == HASH_NOT_FOUND) return false;
+  }
+  else
+  {
+    hkey = hash_table_find_or_insert_mt(&graph->ht, bkmer, &found, ldr->bktlocks);
+    if(prefs->empty_colours && found) die("Duplicate kmer loaded");
+    *novel = !found;
+  }
 
-  // Functions such as merging multiple coloured graphs required us to load
-  // each graph twice. It is convenient to do the fseek here.
-  if(!file_filter_isstdin(fltr)) {
-    if(graph_file_fseek(file, file->hdr_size, SEEK_SET) != 0)
-      die("fseek failed: %s", strerror(errno));
+  // Set presence in colours
+  if(graph->node_in_cols != NULL) {
+    for(i = 0; i < ncols; i++)
+      if(covgs[i] || edges[i])
+        db_node_set_col_mt(graph, hkey, i);
   }
 
-  // Load ginfo from file header into the graph and check compatible
-  graph_load_ginfo(graph, file);
+  if(db_graph_has_covgs(graph)) {
+    for(i = 0; i < ncols; i++)
+      if(covgs[i])
+        db_node_add_col_covg_mt(graph, hkey, i, covgs[i]);
+  }
+
+  // Merge all edges into one colour
+  if(graph->col_edges != NULL)
+  {
+    Edges edge_mask = 0xff, e;
+
+    if(prefs->must_exist_in_edges)
+      edge_mask = prefs->must_exist_in_edges[hkey];
+    else if(prefs->must_exist_in_graph)
+      edge_mask = db_node_get_edges_union(graph, hkey);
+
+    if(graph->num_edge_cols == 1) {
+      for(i = 0, e = 0; i < ncols; i++) e |= edges[i];
+      if(e & edge_mask)
+        __sync_or_and_fetch(&db_node_edges(graph, hkey, 0), e & edge_mask);
+    }
+    else {
+      for(i = 0; i < ncols; i++)
+        if(edges[i] & edge_mask)
+          __sync_or_and_fetch(&db_node_edges(graph, hkey, i), edges[i] & edge_mask);
+    }
+  }
+
+  return true;
+}
+
+// Each thread opens its own file handle, then repeatedly claims the next block
+// of fixed size kmer records, reads it and inserts the kmers
+static void graph_load_worker(void *arg, size_t threadid)
+{
+  (void)threadid;
+  GraphLoaderMT *ldr = (GraphLoaderMT*)arg;
+  GraphFileReader *file = ldr->file;
+  const GraphLoadingPrefs *prefs = &ldr->prefs;
+  const FileFilter *fltr = &file->fltr;
+  const char *path = file_filter_path(fltr);
+  const size_t kmer_size = file->hdr.kmer_size;
+  const size_t srcncols = file->hdr.num_of_cols, ncols = ldr->ncols;
+  const size_t covgs_bytes = srcncols * sizeof(Covg);
+  const size_t kmer_bytes = sizeof(BinaryKmer) + covgs_bytes +
+                            srcncols * sizeof(Edges);
+
+  BinaryKmer bkmer;
+  Covg kmercovgs[srcncols], covgs[ncols];
+  Edges kmeredges[srcncols], edges[ncols];
+  uint64_t nkmers_read = 0, nkmers_loaded = 0, nkmers_novel = 0;
+  uint64_t *col_nkmers = NULL, *col_sumcov = NULL;
+  size_t i, k, n, from, into;
+  uint64_t block;
+  bool novel;
+  char kstr[MAX_KMER_SIZE+1];
+
+  if(ldr->stats) {
+    col_nkmers = ctx_calloc(ncols, sizeof(col_nkmers[0]));
+    col_sumcov = ctx_calloc(ncols, sizeof(col_sumcov[0]));
+  }
+
+  // Compressed files are read through their block index with bgzf_pread()
+  FILE *fh = graph_file_is_bgzf(file) ? NULL : futil_fopen(path, "r");
+  BgzfCache cache = BGZF_CACHE_INIT;
+  char *buf = ctx_malloc(GLOAD_BLOCK_NKMERS * kmer_bytes), *ptr;
+
+  while((block = __sync_fetch_and_add(&ldr->next_block, 1)) < ldr->nblocks)
+  {
+    uint64_t first = block * GLOAD_BLOCK_NKMERS;
+    size_t nrecords = MIN2(GLOAD_BLOCK_NKMERS, ldr->nkmers - first);
+
+    if(fh == NULL) {
+      n = bgzf_pread(fileno(file->fh), file->bgzf_idx, buf,
+                     nrecords * kmer_bytes, graph_file_offset(file, first),
+                     &cache, path) / kmer_bytes;
+    }
+    else {
+      if(fseek(fh, graph_file_offset(file, first), SEEK_SET) != 0)
+        die("fseek failed: %s [%s]", strerror(errno), path);
+
+      n = fread(buf, kmer_bytes, nrecords, fh);
+      if(ferror(fh)) die("File error: %s [%s]", strerror(errno), path);
+    }
+    if(n != nrecords) die("Unexpected end of file: %s", path);
+
+    for(k = 0, ptr = buf; k < n; k++, ptr += kmer_bytes, nkmers_read++)
+    {
+      memcpy(bkmer.b, ptr, sizeof(BinaryKmer));
+      memcpy(kmercovgs, ptr+sizeof(BinaryKmer), covgs_bytes);
+      memcpy(kmeredges, ptr+sizeof(BinaryKmer)+covgs_bytes,
+             srcncols * sizeof(Edges));
+
+      // Same checks as graph_file_read_raw()
+      if(binary_kmer_oversized(bkmer, kmer_size))
+        die("Oversized kmer in path [kmer: %zu]: %s", kmer_size, path);
+
+      for(i = 0; i < srcncols && kmercovgs[i] == 0; i++) {}
+      if(i == srcncols && !__sync_lock_test_and_set(&ldr->warned_zero_covg, 1)) {
+        binary_kmer_to_str(bkmer, kmer_size, kstr);
+        warn("Kmer has zero covg in all colours [kmer: %s; path: %s]", kstr, path);
+      }
+
+      for(i = 0; i < srcncols && (!kmeredges[i] || kmercovgs[i]); i++) {}
+      if(i < srcncols && !__sync_lock_test_and_set(&ldr->warned_missing_covg, 1)) {
+        binary_kmer_to_str(bkmer, kmer_size, kstr);
+        warn("Kmer has edges but no coverage [kmer: %s; path: %s]", kstr, path);
+      }
+
+      // Apply filter
+      memset(covgs, 0, ncols*sizeof(Covg));
+      memset(edges, 0, ncols*sizeof(Edges));
+      for(i = 0; i < file_filter_num(fltr); i++) {
+        from = file_filter_fromcol(fltr, i);
+        into = file_filter_intocol(fltr, i);
+        covgs[into] = SAFE_ADD_COVG(covgs[into], kmercovgs[from]);
+        edges[into] |= kmeredges[from];
+      }
+
+      // If kmer has no covg -> don't load
+      Covg keep_kmer = 0;
+      for(i = 0; i < ncols; i++) keep_kmer |= covgs[i];
+      if(keep_kmer == 0) continue;
+
+      if(col_nkmers) {
+        for(i = 0; i < ncols; i++) {
+          col_nkmers[i] += covgs[i] > 0;
+          col_sumcov[i] += covgs[i];
+        }
+      }
+
+      if(prefs->boolean_covgs)
+        for(i = 0; i < ncols; i++)
+          covgs[i] = covgs[i] > 0;
+
+      if(graph_load_kmer_mt(ldr, bkmer, covgs, edges, &novel)) {
+        nkmers_loaded++;
+        nkmers_novel += novel;
+      }
+    }
+  }
+
+  if(fh) fclose(fh);
+  bgzf_cache_dealloc(&cache);
+  ctx_free(buf);
+
+  pthread_mutex_lock(&ldr->lock);
+  ldr->nkmers_read += nkmers_read;
+  ldr->nkmers_loaded += nkmers_loaded;
+  ldr->nkmers_novel += nkmers_novel;
+  if(col_nkmers) {
+    for(i = 0; i < ncols; i++) {
+      ldr->stats->nkmers[i] += col_nkmers[i];
+      ldr->stats->sumcov[i] += col_sumcov[i];
+    }
+  }
+  pthread_mutex_unlock(&ldr->lock);
+
+  ctx_free(col_nkmers);
+  ctx_free(col_sumcov);
+}
+
+static void graph_load_mt(GraphFileReader *file, const GraphLoadingPrefs prefs,
+                          GraphLoadingStats *stats, size_t ncols,
+                          uint64_t *nkmers_read, uint64_t *nkmers_loaded,
+                          uint64_t *nkmers_novel)
+{
+  dBGraph *graph = prefs.db_graph;
+  uint64_t nkmers = graph_file_nkmers(file);
+  uint64_t nblocks = (nkmers + GLOAD_BLOCK_NKMERS - 1) / GLOAD_BLOCK_NKMERS;
+  size_t nthreads = MIN2(prefs.nthreads, nblocks);
+
+  status("[GReader] Loading with %zu threads", nthreads);
+
+  GraphLoaderMT ldr = {.file = file, .prefs = prefs, .ncols = ncols,
+                       .nkmers = nkmers, .nblocks = nblocks,
+                       .bktlocks = graph->bktlocks, .next_block = 0,
+                       .warned_zero_covg = file->error_zero_covg,
+                       .warned_missing_covg = file->error_missing_covg,
+                       .stats = stats,
+                       .nkmers_read = 0, .nkmers_loaded = 0, .nkmers_novel = 0};
+
+  if(pthread_mutex_init(&ldr.lock, NULL) != 0) die("Mutex init failed");
+  util_multi_thread(&ldr, nthreads, graph_load_worker);
+  pthread_mutex_destroy(&ldr.lock);
+
+  file->error_zero_covg = ldr.warned_zero_covg;
+  file->error_missing_covg = ldr.warned_missing_covg;
+
+  *nkmers_read = ldr.nkmers_read;
+  *nkmers_loaded = ldr.nkmers_loaded;
+  *nkmers_novel = ldr.nkmers_novel;
+}
+
+static void graph_load_serial(GraphFileReader *file, const GraphLoadingPrefs prefs,
+                              GraphLoadingStats *stats, size_t ncols,
+                              uint64_t *nkmers_read_ptr,
+                              uint64_t *nkmers_loaded_ptr,
+                              uint64_t *nkmers_novel_ptr)
+{
+  dBGraph *graph = prefs.db_graph;
+  size_t i;
 
   // Read kmers, align colours to those they are updating
   //  e.g. covgs[i] -> colour i in the graph
@@ -112,9 +341,7 @@ size_t graph_load(GraphFileReader *file, const GraphLoadingPrefs prefs,
   Covg covgs[ncols];
   Edges edges[ncols];
   hkey_t hkey;
-  size_t nkmers_read = 0, nkmers_loaded = 0, nkmers_novel = 0;
-
-  if(stats) graph_loading_stats_capacity(stats, ncols);
+  uint64_t nkmers_read = 0, nkmers_loaded = 0, nkmers_novel = 0;
 
   for(; graph_file_read_reset(file, &bkmer, covgs, edges); nkmers_read++)
   {
@@ -154,7 +381,7 @@ size_t graph_load(GraphFileReader *file, const GraphLoadingPrefs prefs,
       }
     }
 
-    if(graph->col_covgs != NULL) {
+    if(db_graph_has_covgs(graph)) {
       for(i = 0; i < ncols; i++)
         db_node_add_col_covg(graph, hkey, i, covgs[i]);
     }
@@ -170,27 +397,81 @@ size_t graph_load(GraphFileReader *file, const GraphLoadingPrefs prefs,
       else if(prefs.must_exist_in_graph)
         edge_mask = db_node_get_edges_union(graph, hkey);
 
-      Edges *col_edges = &db_node_edges(graph, hkey, 0);
-
       if(graph->num_edge_cols == 1) {
         for(i = 0; i < ncols; i++)
-          col_edges[0] |= edges[i] & edge_mask;
+          db_node_edges(graph, hkey, 0) |= edges[i] & edge_mask;
       }
       else {
         for(i = 0; i < ncols; i++)
-          col_edges[i] |= edges[i] & edge_mask;
+          db_node_edges(graph, hkey, i) |= edges[i] & edge_mask;
       }
     }
 
     nkmers_loaded++;
   }
 
+  *nkmers_read_ptr = nkmers_read;
+  *nkmers_loaded_ptr = nkmers_loaded;
+  *nkmers_novel_ptr = nkmers_novel;
+}
+
+// We assume only_load_if_in_colour < load_first_colour_into
+// if all_kmers_are_unique != 0 an error is thrown if a node already exists
+// If stats != NULL, updates:
+//   stats->num_kmers_loaded
+//   stats->total_bases_read
+
+/*!
+  @return number of kmers loaded
+ */
+size_t graph_load(GraphFileReader *file, const GraphLoadingPrefs prefs,
+                  GraphLoadingStats *stats)
+{
+  dBGraph *graph = prefs.db_graph;
+  FileFilter *fltr = &file->fltr;
+  size_t ncols = file_filter_into_ncols(fltr);
+
+  ctx_assert(file_filter_num(fltr) > 0);
+
+  // Print status
+  graph_loading_print_status(file);
+
+  // Functions such as merging multiple coloured graphs required us to load
+  // each graph twice. It is convenient to do the fseek here.
+  if(!file_filter_isstdin(fltr)) {
+    if(graph_file_fseek(file, file->hdr_size, SEEK_SET) != 0)
+      die("fseek failed: %s", strerror(errno));
+  }
+
+  // Load ginfo from file header into the graph and check compatible
+  graph_load_ginfo(graph, file);
+
+  uint64_t nkmers_read = 0, nkmers_loaded = 0, nkmers_novel = 0;
+
+  if(stats) graph_loading_stats_capacity(stats, ncols);
+
+  // Only split seekable files big enough to be worth the thread overhead.
+  // Column-major files are already read a block of kmers at a time.
+  if(prefs.nthreads > 1 && !file_filter_isstdin(fltr) &&
+     !graph_file_is_colmajor(file) &&
+     graph_file_nkmers(file) >= GLOAD_MIN_MT_NKMERS)
+  {
+    graph_load_mt(file, prefs, stats, ncols,
+                  &nkmers_read, &nkmers_loaded, &nkmers_novel);
+  }
+  else
+  {
+    graph_file_set_threads(file, prefs.nthreads);
+    graph_load_serial(file, prefs, stats, ncols,
+                      &nkmers_read, &nkmers_loaded, &nkmers_novel);
+  }
+
   if(file->num_of_kmers >= 0 && nkmers_read != (uint64_t)file->num_of_kmers)
   {
     warn("%s kmers in the graph file than expected "
          "[exp: %zu; act: %zu; path: %s]",
          nkmers_read > (uint64_t)file->num_of_kmers ? "More" : "Fewer",
-         (size_t)file->num_of_kmers, nkmers_read, fltr->path.b);
+         (size_t)file->num_of_kmers, (size_t)nkmers_read, fltr->path.b);
   }
 
   if(stats != NULL)
@@ -18,6 +18,9 @@ typedef struct
   // if empty_colours is true an error is thrown if a kmer from a graph file
   // is already in the graph
   bool empty_colours;
+  // Number of threads to read and insert kmers with. Files that are not
+  // seekable (e.g. STDIN) or are small are always loaded with one thread
+  size_t nthreads;
 } GraphLoadingPrefs;
 
 typedef struct
@@ -38,7 +41,8 @@ static inline GraphLoadingPrefs graph_loading_prefs(dBGraph *graph)
     .boolean_covgs = false,
     .must_exist_in_graph = false,
     .must_exist_in_edges = NULL,
-    .empty_colours = false
+    .empty_colours = false,
+    .nthreads = 1
   };
   return prefs;
 }
@@ -55,6 +59,8 @@ void graph_load_ginfo(dBGraph *graph, GraphFileReader *file);
 //   stats->num_kmers_loaded
 //   stats->total_bases_read
 // If header is != NULL, header will be stored there.  Be sure to free.
+// If prefs.nthreads > 1, the file is split into blocks of kmers that are read
+// and inserted into the graph by prefs.nthreads threads in parallel
 size_t graph_load(GraphFileReader *file, const GraphLoadingPrefs prefs,
                   GraphLoadingStats *stats);
 
@@ -2,14 +2,51 @@
 #include "hash_table.h"
 #include "hash_mem.h"
 #include "util.h"
+#include "binary_kmer_sort.h"
 
 // bit macros from BitArray library used for spinlocking
 #include "bit_array/bit_macros.h"
 
+#if defined(HASH_TAGS) && defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
 // Hash table prefetching doesn't appear to be faster
 // #define HASH_PREFETCH 1
 
 #define ht_bckt_ptr(ht,bckt) ((ht)->table + (size_t)bckt * (ht)->bucket_size)
+#define ht_hash(ht,key,i) (binary_kmer_hash(key,(ht)->seed+(i)) & (ht)->hash_mask)
+
+#define ht_bckt_tags(ht,bckt) ((ht)->tags + (size_t)bckt * (ht)->tag_stride)
+
+// Prefetch the start of a bucket and its size counters
+// rw is 0 for read, 1 for write
+#ifdef HASH_TAGS
+  #define ht_prefetch_bucket(ht,h,rw) do { \
+    __builtin_prefetch(ht_bckt_tags(ht,h), rw, 1); \
+    __builtin_prefetch(ht_bckt_ptr(ht,h), rw, 1); \
+    __builtin_prefetch(&(ht)->buckets[h], rw, 1); \
+  } while(0)
+#else
+  #define ht_prefetch_bucket(ht,h,rw) do { \
+    __builtin_prefetch(ht_bckt_ptr(ht,h), rw, 1); \
+    __builtin_prefetch(&(ht)->buckets[h], rw, 1); \
+  } while(0)
+#endif
+
+#define TAG_ALIGN 64
+
+// One byte fingerprint of a kmer, never zero (zero marks an empty entry)
+// Independent of the bucket hash, so kmers in a bucket have unrelated tags
+static inline uint8_t ht_tag(const BinaryKmer bkmer)
+{
+  uint64_t h = 0;
+  size_t i;
+  for(i = 0; i < NUM_BKMER_WORDS; i++)
+    h = (h ^ bkmer.b[i]) * 0x9E3779B97F4A7C15UL;
+  uint8_t tag = (uint8_t)(h >> 56);
+  return tag ? tag : 1;
+}
 #define hash_table_bsize_mt(ht,bkt) (*(volatile uint8_t*)&ht->buckets[bkt][HT_BSIZE])
 #define hash_table_bitems_mt(ht,bkt) (*(volatile uint8_t*)&ht->buckets[bkt][HT_BITEMS])
 
@@ -21,8 +58,10 @@ void hash_table_alloc(HashTable *ht, uint64_t req_capacity)
   capacity = hash_table_cap(req_capacity, &num_of_buckets, &bucket_size);
   uint_fast32_t hash_mask = (uint_fast32_t)(num_of_buckets - 1);
 
+  size_t tag_stride = ht_tag_stride(bucket_size);
   size_t mem = capacity * sizeof(BinaryKmer) +
-               num_of_buckets * sizeof(uint8_t[2]);
+               num_of_buckets * sizeof(uint8_t[2]) +
+               num_of_buckets * tag_stride;
 
   char num_bkts_str[100], bkt_size_str[100], cap_str[100], mem_str[100];
   ulong_to_str(num_of_buckets, num_bkts_str);
@@ -37,6 +76,14 @@ void hash_table_alloc(HashTable *ht, uint64_t req_capacity)
   BinaryKmer *table = ctx_calloc(capacity, sizeof(BinaryKmer));
   uint8_t (*const buckets)[2] = ctx_calloc(num_of_buckets, sizeof(uint8_t[2]));
 
+  // Pad the end so we can always read 16 bytes of tags
+  uint8_t *tags_mem = NULL, *tags = NULL;
+  if(tag_stride) {
+    status("[hasht]  fingerprint tags: %zu bytes per bucket", tag_stride);
+    tags_mem = ctx_calloc(num_of_buckets * tag_stride + 2*TAG_ALIGN, 1);
+    tags = tags_mem + (TAG_ALIGN - (size_t)tags_mem % TAG_ALIGN) % TAG_ALIGN;
+  }
+
   HashTable data = {
     .table = table,
     .num_of_buckets = num_of_buckets,
@@ -46,7 +93,10 @@ void hash_table_alloc(HashTable *ht, uint64_t req_capacity)
     .buckets = buckets,
     .num_kmers = 0,
     .collisions = {0},
-    .seed = rand()};
+    .seed = rand(),
+    .tags = tags,
+    .tags_mem = tags_mem,
+    .tag_stride = (uint8_t)tag_stride};
 
   memcpy(ht, &data, sizeof(data));
 }
@@ -55,12 +105,14 @@ void hash_table_dealloc(HashTable *hash_table)
 {
   ctx_free(hash_table->table);
   ctx_free(hash_table->buckets);
+  ctx_free(hash_table->tags_mem);
 }
 
 void hash_table_empty(HashTable *const ht)
 {
   memset(ht->table, 0, ht->capacity * sizeof(BinaryKmer));
   memset(ht->buckets, 0, ht->num_of_buckets * sizeof(uint8_t[2]));
+  if(ht->tags) memset(ht->tags, 0, ht->num_of_buckets * ht->tag_stride);
 
   HashTable data = {
     .table = ht->table,
@@ -70,26 +122,66 @@ void hash_table_empty(HashTable *const ht)
     .capacity = ht->capacity,
     .buckets = ht->buckets,
     .num_kmers = 0,
-    .collisions = {0}};
+    .collisions = {0},
+    .seed = ht->seed,
+    .tags = ht->tags,
+    .tags_mem = ht->tags_mem,
+    .tag_stride = ht->tag_stride};
 
   memcpy(ht, &data, sizeof(data));
 }
 
-static inline const BinaryKmer* hash_table_find_in_bucket(const HashTable *const ht,
-                                                          uint_fast32_t bucket,
-                                                          BinaryKmer bkmer)
+// Search the first `bsize` entries of a bucket
+static inline const BinaryKmer* ht_find_in_bucket_bsize(const HashTable *const ht,
+                                                        uint_fast32_t bucket,
+                                                        BinaryKmer bkmer,
+                                                        const size_t bsize)
 {
   const BinaryKmer *ptr = ht_bckt_ptr(ht, bucket);
-  const BinaryKmer *end = ptr + hash_table_bsize(ht, bucket);
   bkmer.b[0] |= BKMER_SET_FLAG; // mark as assigned in the hash table
 
+#ifdef HASH_TAGS
+  // Only compare full kmers where the fingerprint matches
+  const uint8_t *tags = ht_bckt_tags(ht, bucket), tag = ht_tag(bkmer);
+  size_t i;
+
+  #ifdef __SSE2__
+    const __m128i vtag = _mm_set1_epi8((char)tag);
+    uint32_t bits;
+    for(i = 0; i < bsize; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(tags+i));
+      bits = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(vtag, v));
+      if(bsize - i < 16) bits &= (1U << (bsize - i)) - 1;
+      for(; bits; bits &= bits-1) {
+        const BinaryKmer *p = ptr + i + __builtin_ctz(bits);
+        if(binary_kmer_eq(bkmer, *p)) return p;
+      }
+    }
+  #else
+    for(i = 0; i < bsize; i++)
+      if(tags[i] == tag && binary_kmer_eq(bkmer, ptr[i])) return ptr+i;
+  #endif
+
+#else
+  const BinaryKmer *end = ptr + bsize;
+
   while(ptr < end) {
     if(binary_kmer_eq(bkmer, *ptr)) return ptr;
     ptr++;
   }
+#endif
+
   return NULL; // Not found
 }
 
+static inline const BinaryKmer* hash_table_find_in_bucket(const HashTable *const ht,
+                                                          uint_fast32_t bucket,
+                                                          BinaryKmer bkmer)
+{
+  return ht_find_in_bucket_bsize(ht, bucket, bkmer,
+                                 hash_table_bsize(ht, bucket));
+}
+
 // Remember to increment ht->num_kmers
 static inline BinaryKmer* hash_table_insert_in_bucket(HashTable *ht,
                                                       uint_fast32_t bucket,
@@ -113,6 +205,11 @@ static inline BinaryKmer* hash_table_insert_in_bucket(HashTable *ht,
 
   *ptr = bkmer;
   ht->buckets[bucket][HT_BITEMS]++;
+
+  #ifdef HASH_TAGS
+    ht_bckt_tags(ht, bucket)[ptr - ht_bckt_ptr(ht, bucket)] = ht_tag(bkmer);
+  #endif
+
   return ptr;
 }
 
@@ -122,14 +219,15 @@ static inline BinaryKmer* hash_table_insert_in_bucket(HashTable *ht,
   die("Hash table is full"); \
 } while(0)
 
-hkey_t hash_table_find(const HashTable *const ht, const BinaryKmer key)
+// Search starting with the first bucket `h`
+static inline hkey_t _hash_table_find(const HashTable *const ht,
+                                      const BinaryKmer key, uint_fast32_t h)
 {
   const BinaryKmer *ptr;
   size_t i;
-  uint_fast32_t h;
 
   #ifdef HASH_PREFETCH
-    uint_fast32_t h2 = binary_kmer_hash(key,ht->seed+0) & ht->hash_mask;
+    uint_fast32_t h2 = h;
     __builtin_prefetch(ht_bckt_ptr(ht, h2), 0, 1);
   #endif
 
@@ -138,11 +236,11 @@ hkey_t hash_table_find(const HashTable *const ht, const BinaryKmer key)
     #ifdef HASH_PREFETCH
       h = h2;
       if(ht->buckets[h][HT_BSIZE] == ht->bucket_size) {
-        h2 = binary_kmer_hash(key,ht->seed+i+1) & ht->hash_mask;
+        h2 = ht_hash(ht,key,i+1);
         __builtin_prefetch(ht_bckt_ptr(ht, h2), 0, 1);
       }
     #else
-      h = binary_kmer_hash(key,ht->seed+i) & ht->hash_mask;
+      if(i > 0) h = ht_hash(ht,key,i);
     #endif
 
     ptr = hash_table_find_in_bucket(ht, h, key);
@@ -153,6 +251,149 @@ hkey_t hash_table_find(const HashTable *const ht, const BinaryKmer key)
   return HASH_NOT_FOUND;
 }
 
+hkey_t hash_table_find(const HashTable *const ht, const BinaryKmer key)
+{
+  return _hash_table_find(ht, key, ht_hash(ht,key,0));
+}
+
+//
+// Lock-free find / insert
+//
+// Used by the _mt functions when they are passed bktlocks == NULL.
+// An empty entry is claimed by compare-and-swap on its first word, which holds
+// HT_SLOT_BUSY whilst the rest of the kmer is written. Empty entries in a
+// bucket are always claimed in order, so a thread only moves past an empty
+// entry once another thread has claimed it and we have checked what they
+// wrote. Finds of kmers already in the table make no writes at all.
+//
+// Not safe to use at the same time as locked inserts or hash_table_delete().
+//
+
+// Assigned entries have BKMER_SET_FLAG set so are never equal to this
+#define HT_SLOT_BUSY 1UL
+
+// Wait for an entry that is being written, returns its first word (0 if empty)
+static inline uint64_t ht_lf_slot_wait(const BinaryKmer *slot)
+{
+  // acquire: read the rest of the kmer after the first word
+  uint64_t w;
+  while((w = __atomic_load_n(&slot->b[0], __ATOMIC_ACQUIRE)) == HT_SLOT_BUSY)
+    sched_yield();
+  return w;
+}
+
+// Bucket size is only increased once an entry has been written, so entries
+// before bsize can be searched as usual. Entries at or after bsize are filled
+// in order, so we can stop at the first empty one. Sets *end to the index of
+// that entry, or bucket_size if there were no empty entries at or after bsize
+// (i.e. kmer could be in the next bucket)
+static inline const BinaryKmer* ht_lf_find_in_bucket(const HashTable *ht,
+                                                     uint_fast32_t bucket,
+                                                     BinaryKmer bkmer,
+                                                     size_t *end)
+{
+  const BinaryKmer *ptr;
+  size_t i, bsize;
+  uint64_t w;
+
+  bsize = __atomic_load_n(&ht->buckets[bucket][HT_BSIZE], __ATOMIC_ACQUIRE);
+  ptr = ht_find_in_bucket_bsize(ht, bucket, bkmer, bsize);
+  if(ptr != NULL) return ptr;
+
+  ptr = ht_bckt_ptr(ht, bucket);
+  bkmer.b[0] |= BKMER_SET_FLAG;
+
+  for(i = bsize; i < ht->bucket_size; i++) {
+    if((w = ht_lf_slot_wait(ptr+i)) == 0) break;
+    if(w == bkmer.b[0] && binary_kmer_eq(bkmer, ptr[i])) return ptr+i;
+  }
+
+  *end = i;
+  return NULL;
+}
+
+static inline hkey_t _hash_table_find_lf(const HashTable *ht,
+                                         const BinaryKmer key)
+{
+  const BinaryKmer *ptr;
+  size_t i, end;
+
+  for(i = 0; i < REHASH_LIMIT; i++) {
+    ptr = ht_lf_find_in_bucket(ht, ht_hash(ht,key,i), key, &end);
+    if(ptr != NULL) return (hkey_t)(ptr - ht->table);
+    if(end < ht->bucket_size) break;
+  }
+
+  return HASH_NOT_FOUND;
+}
+
+// Add an item to a bucket, increasing bucket size to at least n.
+// Bucket size and number of items are updated together with one
+// compare-and-swap on both bytes.
+static inline void ht_lf_bucket_add(HashTable *ht, uint_fast32_t bucket,
+                                    uint8_t n)
+{
+  uint16_t *bptr = (uint16_t*)ht->buckets[bucket], v, u;
+  uint8_t *vb = (uint8_t*)&v, *ub = (uint8_t*)&u;
+  do {
+    v = u = __atomic_load_n(bptr, __ATOMIC_RELAXED);
+    ub[HT_BSIZE] = MAX2(vb[HT_BSIZE], n);
+    ub[HT_BITEMS] = vb[HT_BITEMS] + 1;
+  } while(!__sync_bool_compare_and_swap(bptr, v, u));
+}
+
+static inline hkey_t _hash_table_find_or_insert_lf(HashTable *ht,
+                                                   const BinaryKmer key,
+                                                   uint_fast32_t h, bool *found)
+{
+  BinaryKmer bkmer = key, *ptr;
+  const BinaryKmer *fptr;
+  size_t i, j, w;
+
+  bkmer.b[0] |= BKMER_SET_FLAG; // mark as assigned in the hash table
+
+  for(i = 0; i < REHASH_LIMIT; i++)
+  {
+    if(i > 0) h = ht_hash(ht,key,i);
+
+    // Look without claiming anything first
+    fptr = ht_lf_find_in_bucket(ht, h, key, &j);
+    if(fptr != NULL) {
+      *found = true;
+      return (hkey_t)(fptr - ht->table);
+    }
+
+    // Claim the first empty entry, unless someone else adds our kmer first
+    ptr = ht_bckt_ptr(ht, h);
+    for(; j < ht->bucket_size; j++)
+    {
+      if(__atomic_load_n(&ptr[j].b[0], __ATOMIC_RELAXED) == 0 &&
+         __sync_bool_compare_and_swap(&ptr[j].b[0], 0, HT_SLOT_BUSY))
+      {
+        for(w = 1; w < NUM_BKMER_WORDS; w++) ptr[j].b[w] = bkmer.b[w];
+        #ifdef HASH_TAGS
+          ht_bckt_tags(ht, h)[j] = ht_tag(bkmer);
+        #endif
+        // release: publish the first word after the rest of the kmer
+        __atomic_store_n(&ptr[j].b[0], bkmer.b[0], __ATOMIC_RELEASE);
+
+        ht_lf_bucket_add(ht, h, (uint8_t)(j+1));
+        __sync_add_and_fetch((volatile uint64_t*)&ht->collisions[i], 1);
+        __sync_add_and_fetch((volatile uint64_t*)&ht->num_kmers, 1);
+        *found = false;
+        return (hkey_t)(ptr + j - ht->table);
+      }
+
+      if(ht_lf_slot_wait(ptr+j) != 0 && binary_kmer_eq(bkmer, ptr[j])) {
+        *found = true;
+        return (hkey_t)(ptr + j - ht->table);
+      }
+    }
+  }
+
+  rehash_error_exit(ht);
+}
+
 hkey_t hash_table_find_mt(HashTable *ht, const BinaryKmer key,
                           volatile uint8_t *bktlocks)
 {
@@ -160,6 +401,8 @@ hkey_t hash_table_find_mt(HashTable *ht, const BinaryKmer key,
   size_t i, bsize;
   uint_fast32_t h;
 
+  if(bktlocks == NULL) return _hash_table_find_lf(ht, key);
+
   for(i = 0; i < REHASH_LIMIT; i++)
   {
     h = binary_kmer_hash(key,ht->seed+i) & ht->hash_mask;
@@ -247,16 +490,21 @@ hkey_t hash_table_find_or_insert(HashTable *ht, const BinaryKmer key,
   rehash_error_exit(ht);
 }
 
-hkey_t hash_table_find_or_insert_mt(HashTable *ht, const BinaryKmer key,
-                                    bool *found, volatile uint8_t *bktlocks)
+// Search starting with the first bucket `h`
+static inline hkey_t _hash_table_find_or_insert_mt(HashTable *ht,
+                                                   const BinaryKmer key,
+                                                   uint_fast32_t h, bool *found,
+                                                   volatile uint8_t *bktlocks)
 {
   const BinaryKmer *ptr;
   size_t i;
-  uint_fast32_t h;
+
+  if(bktlocks == NULL)
+    return _hash_table_find_or_insert_lf(ht, key, h, found);
 
   for(i = 0; i < REHASH_LIMIT; i++)
   {
-    h = binary_kmer_hash(key,ht->seed+i) & ht->hash_mask;
+    if(i > 0) h = ht_hash(ht,key,i);
     bitlock_yield_acquire(bktlocks, h);
     ptr = hash_table_find_in_bucket(ht, h, key);
 
@@ -280,6 +528,60 @@ hkey_t hash_table_find_or_insert_mt(HashTable *ht, const BinaryKmer key,
   rehash_error_exit(ht);
 }
 
+hkey_t hash_table_find_or_insert_mt(HashTable *ht, const BinaryKmer key,
+                                    bool *found, volatile uint8_t *bktlocks)
+{
+  return _hash_table_find_or_insert_mt(ht, key, ht_hash(ht,key,0),
+                                       found, bktlocks);
+}
+
+//
+// Batched lookups
+//
+// Hash all keys in a batch and prefetch the first bucket of each, then search.
+// By the time we search for a key its bucket should be in cache, so we wait
+// on main memory once per batch rather than once per key.
+//
+
+void hash_table_find_batch(const HashTable *const ht,
+                           const BinaryKmer *keys, size_t n, hkey_t *hkeys)
+{
+  uint_fast32_t h[HT_BATCH_SIZE];
+  size_t i, j, m;
+
+  for(i = 0; i < n; i += m) {
+    m = MIN2(n - i, HT_BATCH_SIZE);
+    for(j = 0; j < m; j++) {
+      h[j] = ht_hash(ht, keys[i+j], 0);
+      ht_prefetch_bucket(ht, h[j], 0);
+    }
+    for(j = 0; j < m; j++)
+      hkeys[i+j] = _hash_table_find(ht, keys[i+j], h[j]);
+  }
+}
+
+void hash_table_find_or_insert_mt_batch(HashTable *ht,
+                                        const BinaryKmer *keys, size_t n,
+                                        hkey_t *hkeys, bool *found,
+                                        volatile uint8_t *bktlocks)
+{
+  uint_fast32_t h[HT_BATCH_SIZE];
+  size_t i, j, m;
+
+  for(i = 0; i < n; i += m) {
+    m = MIN2(n - i, HT_BATCH_SIZE);
+    for(j = 0; j < m; j++) {
+      h[j] = ht_hash(ht, keys[i+j], 0);
+      ht_prefetch_bucket(ht, h[j], 1);
+      if(bktlocks) __builtin_prefetch((const void*)&bktlocks[h[j]>>3], 1, 1);
+    }
+    for(j = 0; j < m; j++) {
+      hkeys[i+j] = _hash_table_find_or_insert_mt(ht, keys[i+j], h[j],
+                                                 &found[i+j], bktlocks);
+    }
+  }
+}
+
 // Safe to call on different entries at the same time
 // NOT safe to do find() whilst doing delete()
 void hash_table_delete(HashTable *const ht, hkey_t pos)
@@ -290,6 +592,9 @@ void hash_table_delete(HashTable *const ht, hkey_t pos)
   ctx_assert(HASH_ENTRY_ASSIGNED(ht->table[pos]));
 
   memset(ht->table+pos, 0, sizeof(BinaryKmer));
+  #ifdef HASH_TAGS
+    ht_bckt_tags(ht, bucket)[pos % ht->bucket_size] = 0;
+  #endif
   n = __sync_fetch_and_sub((volatile uint64_t *)&ht->num_kmers, 1);
   m = __sync_fetch_and_sub((volatile uint8_t *)&ht->buckets[bucket][HT_BITEMS], 1);
 
@@ -303,7 +608,8 @@ void hash_table_print_stats_brief(const HashTable *const ht)
   size_t nbytes, nkeybits;
   double occupancy = (100.0 * ht->num_kmers) / ht->capacity;
   nbytes = ht->capacity * sizeof(BinaryKmer) +
-           ht->num_of_buckets * sizeof(uint8_t[2]);
+           ht->num_of_buckets * sizeof(uint8_t[2]) +
+           ht->num_of_buckets * ht->tag_stride;
   nkeybits = (size_t)__builtin_ctzl(ht->num_of_buckets);
 
   char mem_str[50], num_buckets_str[100], num_entries_str[100], capacity_str[100];
@@ -358,8 +664,8 @@ static inline void _fetch_kmer_union(hkey_t hkey, const HashTable *htable,
   (*bkptr)++;
 }
 
-// Returns sorted array of hkey_t from the hash table
-hkey_t* hash_table_sorted(const HashTable *htable)
+// Returns sorted array of hkey_t from the hash table, sorted with `nthreads`
+hkey_t* hash_table_sorted(const HashTable *htable, size_t nthreads)
 {
   ctx_assert(sizeof(hkey_t) == sizeof(BinaryKmer*));
   ctx_assert(sizeof(hkey_t) == sizeof(BkmerPtrHkeyUnion));
@@ -368,7 +674,7 @@ hkey_t* hash_table_sorted(const HashTable *htable)
   end = kmers + htable->num_kmers;
   HASH_ITERATE(htable, _fetch_kmer_union, htable, &nxt);
   // Can sort ignoring that the top flag bit is set on all kmers
-  qsort(kmers, htable->num_kmers, sizeof(BinaryKmer*), binary_kmers_qcmp_ptrs);
+  binary_kmer_sort_ptrs((void**)kmers, htable->num_kmers, nthreads);
   for(nxt = kmers; nxt < end; nxt++) nxt->h = nxt->bptr - htable->table;
   return (hkey_t*)kmers;
 }
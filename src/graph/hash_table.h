@@ -6,6 +6,7 @@
 #include "hash_mem.h"
 #include "binary_kmer.h"
 #include "util.h"
+#include "work_steal.h"
 
 #define HT_BSIZE 0
 #define HT_BITEMS 1
@@ -28,6 +29,11 @@ typedef struct
   uint64_t num_kmers;
   uint64_t collisions[REHASH_LIMIT];
   const uint32_t seed; // random seed used in hashing
+  // Only used if compiled with HASH_TAGS=1, otherwise NULL
+  // tags[b*tag_stride+i] is a fingerprint of entry i in bucket b, 0 if empty
+  // tags is aligned to 64 bytes, tags_mem is the pointer to free
+  uint8_t *const tags, *const tags_mem;
+  const uint8_t tag_stride;
 } HashTable;
 
 // Returns NULL if not enough memory
@@ -56,13 +62,32 @@ hkey_t hash_table_find_or_insert(HashTable *htable, const BinaryKmer bkmer,
                                  bool *found);
 
 // Threadsafe find, using bucket level locks
+// If bktlocks is NULL, uses lock-free find (see hash_table_find_or_insert_mt)
 hkey_t hash_table_find_mt(HashTable *ht, const BinaryKmer key,
                           volatile uint8_t *bktlocks);
 
 // Threadsafe find or insert, using bucket level locks
+// If bktlocks is NULL, entries are claimed with compare-and-swap and finds take
+// no locks. Don't mix locked and lock-free calls on a table at the same time,
+// and don't delete whilst using either.
 hkey_t hash_table_find_or_insert_mt(HashTable *htable, const BinaryKmer key,
                                     bool *found, volatile uint8_t *bktlocks);
 
+// Number of keys hashed and prefetched together by the batch functions
+#define HT_BATCH_SIZE 16
+
+// Look up `n` keys, results are stored in hkeys[0..n-1]
+// Equivalent to calling hash_table_find() on each key, but prefetches buckets
+void hash_table_find_batch(const HashTable *const htable,
+                           const BinaryKmer *keys, size_t n, hkey_t *hkeys);
+
+// Threadsafe batched find or insert, using bucket level locks
+// Equivalent to calling hash_table_find_or_insert_mt() on each key in order
+void hash_table_find_or_insert_mt_batch(HashTable *htable,
+                                        const BinaryKmer *keys, size_t n,
+                                        hkey_t *hkeys, bool *found,
+                                        volatile uint8_t *bktlocks);
+
 // Safe to call on different entries at the same time
 // NOT safe to do find() whilst doing delete()
 void hash_table_delete(HashTable *const htable, hkey_t pos);
@@ -74,7 +99,7 @@ void hash_table_print_stats(const HashTable *const htable);
 void hash_table_print_stats_brief(const HashTable *const htable);
 
 // Returns sorted array of hkey_t from the hash table, use kmers[i].h
-hkey_t* hash_table_sorted(const HashTable *htable);
+hkey_t* hash_table_sorted(const HashTable *htable, size_t nthreads);
 
 // This is for debugging
 uint64_t hash_table_count_kmers(const HashTable *const htable);
@@ -111,9 +136,10 @@ uint64_t hash_table_count_kmers(const HashTable *const htable);
 } while(0)
 
 // iterate over kmers in lexigraphic order
-// Requires sizeof(hkey_t) * ht->num_kmers memory which it allocates and frees
-#define HASH_ITERATE_SORTED(ht,func, ...) do {                                 \
-  hkey_t *_hkeys = hash_table_sorted(ht);                                      \
+// Requires (sizeof(hkey_t)+2) * ht->num_kmers memory, which it allocates/frees
+// Kmers are sorted with `nthreads`, func is called by a single thread
+#define HASH_ITERATE_SORTED(ht,nthreads,func, ...) do {                        \
+  hkey_t *_hkeys = hash_table_sorted(ht,nthreads);                             \
   size_t _i, _nkmers = hash_table_nkmers(ht);                                  \
   for(_i = 0; _i < _nkmers; _i++) { func(_hkeys[_i], ##__VA_ARGS__); }         \
   ctx_free(_hkeys);                                                            \
@@ -133,10 +159,30 @@ uint64_t hash_table_count_kmers(const HashTable *const htable);
   }                                                                            \
 } while(0)
 
+// Iterate over chunks of the hash table handed out by a work-stealing
+// scheduler (see work_steal.h) allocated with hash_table_size(ht) items.
+// Use in place of HASH_ITERATE_PART when some slices of the table take much
+// longer than others. Allows adding/removing items.
+// Thread stops taking chunks if func() returns non-zero value
+#define HASH_ITERATE_STEAL(ht,ws,threadid,func, ...) do {                      \
+  size_t _start, _end;                                                         \
+  hkey_t _hi;                                                                  \
+  bool _stop = false;                                                          \
+  while(!_stop && work_steal_next(ws, threadid, &_start, &_end)) {             \
+    for(_hi = _start; _hi < _end; _hi++) {                                     \
+      if(hash_table_assigned(ht,_hi) && func(_hi, ##__VA_ARGS__)) {            \
+        _stop = true;                                                          \
+        break;                                                                 \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+  work_steal_thread_done(ws, threadid);                                        \
+} while(0)
+
 typedef struct
 {
   const HashTable *const ht;
-  const size_t nthreads;
+  WorkSteal *const ws;
   bool (*const func)(hkey_t _h, size_t threadid, void *_arg);
   void *arg;
 } HashTableIterator;
@@ -144,20 +190,29 @@ typedef struct
 static inline void _hash_table_iterate(void *arg, size_t threadid)
 {
   HashTableIterator itr = *(HashTableIterator*)arg;
-  HASH_ITERATE_PART(itr.ht, threadid, itr.nthreads,
-                    itr.func, threadid, itr.arg);
+  HASH_ITERATE_STEAL(itr.ht, itr.ws, threadid, itr.func, threadid, itr.arg);
 }
 
+// Call func on every kmer in the hash table using `nthreads` with work
+// stealing. If `name` is not NULL, print per-thread busy/idle time at the end.
 static inline void hash_table_iterate(const HashTable *ht, size_t nthreads,
+                                      const char *name,
                                       bool (*func)(hkey_t _h, size_t threadid,
                                                    void *_arg),
                                       void *arg)
 {
   ctx_assert(nthreads > 0);
-  HashTableIterator ht_iter = {.ht = ht, .nthreads = nthreads,
+  WorkSteal ws;
+  work_steal_alloc(&ws, hash_table_size(ht), nthreads,
+                   WORK_STEAL_CHUNKS_PER_THREAD);
+
+  HashTableIterator ht_iter = {.ht = ht, .ws = &ws,
                                .func = func, .arg = arg};
 
   util_multi_thread(&ht_iter, nthreads, _hash_table_iterate);
+
+  if(name != NULL) work_steal_print_stats(&ws, name);
+  work_steal_dealloc(&ws);
 }
 
 #endif /* HASH_TABLE_H_ */
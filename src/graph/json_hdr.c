@@ -304,6 +304,14 @@ void json_hdr_fprint(cJSON *json, FILE *fout)
   free(jstr);
 }
 
+void json_hdr_bgzfprint(cJSON *json, BgzfWriter *out)
+{
+  char *jstr = cJSON_Print(json);
+  bgzf_writer_puts(out, jstr);
+  bgzf_writer_puts(out, "\n\n");
+  free(jstr);
+}
+
 cJSON* json_hdr_try(cJSON *json, const char *field, int type, const char *path)
 {
   cJSON *obj = cJSON_GetObjectItem(json, field);
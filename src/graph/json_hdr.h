@@ -2,6 +2,7 @@
 #define JSON_HDR_H_
 
 #include "db_graph.h"
+#include "bgzf_writer.h"
 #include "cJSON/cJSON.h"
 
 #define MAX_JSON_HDR_BYTES (1<<20) /* 1M max json header */
@@ -35,6 +36,7 @@ void json_hdr_augment_cmd(cJSON *json, const char *cmdstr,
 
 void json_hdr_gzprint(cJSON *json, gzFile gzout);
 void json_hdr_fprint(cJSON *json, FILE *fout);
+void json_hdr_bgzfprint(cJSON *json, BgzfWriter *out);
 
 // Get values from a JSON header - return NULL if not found
 cJSON* json_hdr_try(cJSON *json, const char *field, int type, const char *path);
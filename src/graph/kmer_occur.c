@@ -3,6 +3,9 @@
 #include "seq_reader.h"
 #include "util.h"
 #include "db_node.h"
+#include "file_util.h"
+
+#include <sys/mman.h>
 
 //
 // This file provides a datastore for loading sequences and recording where
@@ -41,9 +44,9 @@ void koruns_print(const KOccurRun *runs, size_t n, size_t kmer_size, FILE *fout)
   }
 }
 
-void korun_gzprint(gzFile gzout, size_t kmer_size,
-                   const KOGraph *kograph, KOccurRun korun,
-                   size_t first_kmer_idx, size_t kmer_offset)
+void korun_strbuf(StrBuf *sbuf, size_t kmer_size,
+                  const KOGraph *kograph, KOccurRun korun,
+                  size_t first_kmer_idx, size_t kmer_offset)
 {
   const char strand[] = {'+','-'};
   const char *chrom = kograph_chrom(kograph,korun).name;
@@ -60,20 +63,20 @@ void korun_gzprint(gzFile gzout, size_t kmer_size,
   }
   qoffset = korun.qoffset - first_kmer_idx;
   // +1 to coords to convert to 1-based
-  gzprintf(gzout, "%s:%zu-%zu:%c:%u",
-           chrom, start+1, end+1, strand[korun.strand], qoffset+1);
+  strbuf_sprintf(sbuf, "%s:%zu-%zu:%c:%zu",
+                 chrom, start+1, end+1, strand[korun.strand], qoffset+1);
 }
 
-void koruns_gzprint(gzFile gzout, size_t kmer_size, const KOGraph *kograph,
-                    const KOccurRun *koruns, size_t n,
-                    size_t first_kmer_idx, size_t kmer_offset)
+void koruns_strbuf(StrBuf *sbuf, size_t kmer_size, const KOGraph *kograph,
+                   const KOccurRun *koruns, size_t n,
+                   size_t first_kmer_idx, size_t kmer_offset)
 {
   size_t i;
   if(n == 0) return;
-  korun_gzprint(gzout, kmer_size, kograph, koruns[0], first_kmer_idx, kmer_offset);
+  korun_strbuf(sbuf, kmer_size, kograph, koruns[0], first_kmer_idx, kmer_offset);
   for(i = 1; i < n; i++) {
-    gzputc(gzout, ',');
-    korun_gzprint(gzout, kmer_size, kograph, koruns[i], first_kmer_idx, kmer_offset);
+    strbuf_append_char(sbuf, ',');
+    korun_strbuf(sbuf, kmer_size, kograph, koruns[i], first_kmer_idx, kmer_offset);
   }
 }
 
@@ -390,9 +393,284 @@ void kograph_dealloc(KOGraph *kograph)
   ctx_free(kograph->chrom_name_buf);
   ctx_free(kograph->chroms);
   ctx_free(kograph->klists);
-  ctx_free(kograph->koccurs);
+  if(kograph->mmap_ptr == NULL) ctx_free(kograph->koccurs);
+  else if(munmap(kograph->mmap_ptr, kograph->mmap_len) == -1)
+    die("Cannot release mmap reference index [%s]", strerror(errno));
+}
+
+void kograph_clean_read_names(read_t *reads, size_t num_reads)
+{
+  size_t i;
+  for(i = 0; i < num_reads; i++) {
+    read_t *r = &reads[i];
+    seq_read_truncate_name(r); // strip fast[aq] comments (after whitespace)
+    string_char_replace(r->name.b, ',', '.'); // change , -> . in read name
+    string_char_replace(r->name.b, ':', ';'); // change : -> ; in read name
+  }
+}
+
+//
+// Reference index files
+//
+
+#define koidx_pad8(x) (((x) + 7) & ~(size_t)7)
+
+static void koidx_fwrite(const void *ptr, size_t len, FILE *fh,
+                         const char *path)
+{
+  if(len && fwrite(ptr, 1, len, fh) != len)
+    die("Cannot write to file: %s", path);
+}
+
+// Pad a section of `len` bytes to a multiple of 8 bytes
+static void koidx_fwrite_pad(size_t len, FILE *fh, const char *path)
+{
+  const char zeros[8] = {0};
+  koidx_fwrite(zeros, koidx_pad8(len) - len, fh, path);
+}
+
+// Number of occurrences in the list starting at `ko`
+static inline size_t kolist_len(const KOccur *ko)
+{
+  size_t n = 1;
+  while(ko[n-1].next) n++;
+  return n;
+}
+
+static size_t koidx_file_size(const KOGraphIndexHdr *hdr)
+{
+  return sizeof(KOGraphIndexHdr) +
+         hdr->nchroms * sizeof(uint64_t) +
+         koidx_pad8(hdr->names_len) +
+         hdr->nkmers * sizeof(BinaryKmer) +
+         (hdr->nkmers+1) * sizeof(uint64_t) +
+         koidx_pad8(hdr->nkmers * sizeof(Edges)) +
+         hdr->noccurs * sizeof(KOccur);
+}
+
+void kograph_save(const KOGraph *kograph, const char *path,
+                  size_t num_threads, const dBGraph *db_graph)
+{
+  size_t i, j, nkmers = hash_table_nkmers(&db_graph->ht);
+  const KOccur *ko;
+  uint64_t kstart;
+
+  KOGraphIndexHdr hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, KOGRAPH_INDEX_MAGIC, sizeof(hdr.magic));
+  hdr.version = KOGRAPH_INDEX_VERSION;
+  hdr.kmer_size = db_graph->kmer_size;
+  hdr.nchroms = kograph->nchroms;
+
+  for(i = 0; i < kograph->nchroms; i++) {
+    hdr.names_len += strlen(kograph->chroms[i].name) + 1;
+    hdr.nbases += kograph->chroms[i].length;
+  }
+
+  // Only save kmers that occur in the reference
+  hkey_t *hkeys = hash_table_sorted(&db_graph->ht, num_threads);
+  for(i = j = 0; i < nkmers; i++)
+    if(kograph_occurs(kograph, hkeys[i]))
+      hkeys[j++] = hkeys[i];
+  nkmers = hdr.nkmers = j;
+
+  for(i = 0; i < nkmers; i++)
+    hdr.noccurs += kolist_len(kograph_get(kograph, hkeys[i]));
+
+  FILE *fout = futil_fopen_create(path, "w");
+
+  koidx_fwrite(&hdr, sizeof(hdr), fout, path);
+
+  for(i = 0; i < kograph->nchroms; i++) {
+    uint64_t len = kograph->chroms[i].length;
+    koidx_fwrite(&len, sizeof(len), fout, path);
+  }
+
+  for(i = 0; i < kograph->nchroms; i++) {
+    const char *name = kograph->chroms[i].name;
+    koidx_fwrite(name, strlen(name)+1, fout, path);
+  }
+  koidx_fwrite_pad(hdr.names_len, fout, path);
+
+  for(i = 0; i < nkmers; i++) {
+    BinaryKmer bkey = db_node_get_bkey(db_graph, hkeys[i]);
+    koidx_fwrite(&bkey, sizeof(bkey), fout, path);
+  }
+
+  for(i = 0, kstart = 0; i <= nkmers; i++) {
+    koidx_fwrite(&kstart, sizeof(kstart), fout, path);
+    if(i < nkmers) kstart += kolist_len(kograph_get(kograph, hkeys[i]));
+  }
+
+  for(i = 0; i < nkmers; i++) {
+    Edges edges = db_graph->col_edges ? db_node_get_edges_union(db_graph, hkeys[i])
+                                      : 0;
+    koidx_fwrite(&edges, sizeof(edges), fout, path);
+  }
+  koidx_fwrite_pad(nkmers * sizeof(Edges), fout, path);
+
+  for(i = 0; i < nkmers; i++) {
+    ko = kograph_get(kograph, hkeys[i]);
+    koidx_fwrite(ko, kolist_len(ko) * sizeof(KOccur), fout, path);
+  }
+
+  futil_fclose(fout);
+  ctx_free(hkeys);
+
+  char nkmers_str[50], noccurs_str[50];
+  ulong_to_str(hdr.nkmers, nkmers_str);
+  ulong_to_str(hdr.noccurs, noccurs_str);
+  status("[kograph] Saved %s kmers with %s occurrences in %zu chrom%s to %s",
+         nkmers_str, noccurs_str, kograph->nchroms,
+         util_plural_str(kograph->nchroms), futil_outpath_str(path));
+}
+
+static void koidx_check_hdr(const KOGraphIndexHdr *hdr, size_t file_size,
+                            const char *path)
+{
+  if(memcmp(hdr->magic, KOGRAPH_INDEX_MAGIC, sizeof(hdr->magic)) != 0)
+    die("Not a reference index file: %s", path);
+  if(hdr->version != KOGRAPH_INDEX_VERSION)
+    die("Reference index version %u not supported [%i]: %s",
+        hdr->version, KOGRAPH_INDEX_VERSION, path);
+  if(hdr->nchroms > KMER_OCCUR_MAX_CHROMS)
+    die("Too many chromosomes in reference index: %s", path);
+  if(file_size != koidx_file_size(hdr))
+    die("Reference index is truncated or corrupt: %s", path);
+}
+
+void kograph_index_read_hdr(const char *path, KOGraphIndexHdr *hdr)
+{
+  FILE *fh = futil_fopen(path, "r");
+  off_t file_size = futil_get_file_size(path);
+  if(fread(hdr, 1, sizeof(*hdr), fh) != sizeof(*hdr))
+    die("Cannot read reference index header: %s", path);
+  fclose(fh);
+  koidx_check_hdr(hdr, file_size, path);
+}
+
+typedef struct
+{
+  const BinaryKmer *kmers;
+  const uint64_t *kstarts;
+  const Edges *edges; // NULL if not loading edges
+  KOccur *occurs;
+  size_t nkmers, nthreads, ref_col;
+  KONodeList *klists;
+  dBGraph *db_graph;
+} KOIndexLoader;
+
+// Each thread adds a contiguous block of kmers to the graph
+static void koidx_load_kmers(void *arg, size_t threadid)
+{
+  const KOIndexLoader *ld = (const KOIndexLoader*)arg;
+  dBGraph *db_graph = ld->db_graph;
+  size_t i, start, end;
+  dBNode node;
+  bool found;
+
+  start = (ld->nkmers * threadid) / ld->nthreads;
+  end = (ld->nkmers * (threadid+1)) / ld->nthreads;
+
+  // Reference edges go in the only edge colour, which is at the same index
+  // whether the graph is row- or column-major
+  ctx_assert(db_graph->num_edge_cols <= 1);
+
+  for(i = start; i < end; i++) {
+    node = db_graph_find_or_add_node_mt(db_graph, ld->kmers[i], &found);
+    db_graph_update_node_mt(db_graph, node, ld->ref_col);
+    if(ld->edges && ld->edges[i])
+      __sync_or_and_fetch(&db_node_edges(db_graph, node.key, 0), ld->edges[i]);
+    ld->klists[node.key].first = ld->occurs + ld->kstarts[i];
+  }
 }
 
+KOGraph kograph_load(const char *path, bool load_edges, size_t ref_col,
+                     size_t num_threads, dBGraph *db_graph)
+{
+  size_t i;
+  KOGraphIndexHdr hdr;
+  kograph_index_read_hdr(path, &hdr);
+
+  if(hdr.kmer_size != db_graph->kmer_size)
+    die("Reference index kmer size doesn't match graph [%u vs %zu]: %s",
+        hdr.kmer_size, db_graph->kmer_size, path);
+
+  ctx_assert(db_graph->num_edge_cols <= 1);
+  ctx_assert(db_graph->bktlocks != NULL);
+
+  status("[kograph] Loading reference index %s using %zu thread%s",
+         path, num_threads, util_plural_str(num_threads));
+
+  KOGraph kograph;
+  memset(&kograph, 0, sizeof(KOGraph));
+  kograph.nchroms = hdr.nchroms;
+  kograph.mmap_len = koidx_file_size(&hdr);
+
+  FILE *fh = futil_fopen(path, "r");
+  kograph.mmap_ptr = mmap(NULL, kograph.mmap_len, PROT_READ, MAP_SHARED,
+                          fileno(fh), 0);
+
+  if(kograph.mmap_ptr == MAP_FAILED)
+    die("Cannot memory map file: %s [%s]", path, strerror(errno));
+
+  fclose(fh); // mapping remains valid after closing
+
+  // Split file into sections
+  const char *ptr = (const char*)kograph.mmap_ptr + sizeof(KOGraphIndexHdr);
+  const uint64_t *chrom_lens = (const uint64_t*)ptr;
+  ptr += hdr.nchroms * sizeof(uint64_t);
+  const char *names = ptr, *names_end = ptr + hdr.names_len;
+  ptr += koidx_pad8(hdr.names_len);
+  const BinaryKmer *kmers = (const BinaryKmer*)ptr;
+  ptr += hdr.nkmers * sizeof(BinaryKmer);
+  const uint64_t *kstarts = (const uint64_t*)ptr;
+  ptr += (hdr.nkmers+1) * sizeof(uint64_t);
+  const Edges *edges = (const Edges*)ptr;
+  ptr += koidx_pad8(hdr.nkmers * sizeof(Edges));
+  kograph.koccurs = (KOccur*)ptr;
+
+  if(hdr.nkmers && kstarts[hdr.nkmers] != hdr.noccurs)
+    die("Reference index is corrupt: %s", path);
+
+  // Chromosome names point into the file
+  kograph.chroms = hdr.nchroms ? ctx_malloc(hdr.nchroms * sizeof(KOChrom)) : NULL;
+  for(i = 0; i < hdr.nchroms; i++) {
+    if(names >= names_end) die("Reference index is corrupt: %s", path);
+    kograph.chroms[i] = (KOChrom){.id = i, .length = chrom_lens[i],
+                                  .name = names};
+    names += strlen(names)+1;
+  }
+
+  kograph.klists = ctx_calloc(db_graph->ht.capacity, sizeof(KONodeList));
+
+  KOIndexLoader loader = {.kmers = kmers, .kstarts = kstarts,
+                          .edges = (load_edges && db_graph->col_edges) ? edges : NULL,
+                          .occurs = kograph.koccurs,
+                          .nkmers = hdr.nkmers, .nthreads = num_threads,
+                          .ref_col = ref_col, .klists = kograph.klists,
+                          .db_graph = db_graph};
+
+  util_multi_thread(&loader, num_threads, koidx_load_kmers);
+
+  // Update ginfo as if we had loaded the reference sequence
+  SeqLoadingStats stats;
+  memset(&stats, 0, sizeof(stats));
+  stats.num_se_reads   = hdr.nchroms;
+  stats.contigs_parsed = hdr.nchroms;
+  stats.total_bases_read   = hdr.nbases;
+  stats.total_bases_loaded = hdr.nbases;
+  graph_info_update_stats(&db_graph->ginfo[ref_col], &stats);
+
+  char nkmers_str[50], noccurs_str[50];
+  ulong_to_str(hdr.nkmers, nkmers_str);
+  ulong_to_str(hdr.noccurs, noccurs_str);
+  status("[kograph] Loaded %s kmers with %s occurrences in %zu chrom%s",
+         nkmers_str, noccurs_str, kograph.nchroms,
+         util_plural_str(kograph.nchroms));
+
+  return kograph;
+}
 
 //
 // Check for a run of kmers in the reference genome
@@ -9,6 +9,9 @@
 // This file provides a datastore for loading sequences and recording where
 // each kmer occurs in the sequences. Used in breakpoint_caller.c.
 //
+// A KOGraph can be saved as a reference index with kograph_save() and memory
+// mapped with kograph_load(), so a reference only needs to be indexed once.
+//
 
 // Limits on number of chromosomes and max chromosome length
 // [30] max chroms    = 1,073,741,824
@@ -39,8 +42,27 @@ typedef struct
   KONodeList *klists; // one entry per hash entry
   size_t nchroms;
   char *chrom_name_buf;
+  void *mmap_ptr; // set if loaded from an index, koccurs points into it
+  size_t mmap_len;
 } KOGraph;
 
+// Reference index file format (sections are 8 byte aligned):
+//   KOGraphIndexHdr | uint64 chrom_lens[nchroms] |
+//   char names[names_len] (NUL terminated names) | padding |
+//   BinaryKmer kmers[nkmers] (sorted) | uint64 kstarts[nkmers+1] |
+//   Edges edges[nkmers] | padding | KOccur occurs[noccurs]
+// Occurrences of kmers[i] are occurs[kstarts[i]..kstarts[i+1]-1], in order of
+// chromosome and offset with `next` unset on the last one.
+#define KOGRAPH_INDEX_MAGIC "CTXKOIDX"
+#define KOGRAPH_INDEX_VERSION 1
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version, kmer_size;
+  uint64_t nchroms, names_len, nbases, nkmers, noccurs;
+} KOGraphIndexHdr;
+
 typedef struct {
   uint64_t first, last; // 0-bases chromosome coordinates
   uint32_t qoffset, chrom; // qoffset some query offset
@@ -65,6 +87,27 @@ KOGraph kograph_create(const read_t *reads, size_t num_reads,
 
 void kograph_dealloc(KOGraph *kograph);
 
+// Strip comments from reference names and replace characters used to separate
+// runs when printing them: ',' -> '.' and ':' -> ';'
+void kograph_clean_read_names(read_t *reads, size_t num_reads);
+
+// Save reference kmers that occur in the KOGraph with their edges and
+// occurrences. Kmers are sorted using `num_threads`.
+void kograph_save(const KOGraph *kograph, const char *path,
+                  size_t num_threads, const dBGraph *db_graph);
+
+// Read and check the header of a reference index, dies if it is not valid
+void kograph_index_read_hdr(const char *path, KOGraphIndexHdr *hdr);
+
+/**
+ * Memory map a reference index saved with kograph_save(). Kmers are added to
+ * the graph in colour ref_col and point to their occurrences in the file.
+ * Like kograph_create(), db_graph->col_edges can be NULL
+ * @param load_edges  If true, add reference edges to the first edge colour
+ **/
+KOGraph kograph_load(const char *path, bool load_edges, size_t ref_col,
+                     size_t num_threads, dBGraph *db_graph);
+
 // Get KOccur* to first occurance of a kmer in sequence
 #define kograph_get(kograph,hkey) ((kograph)->klists[hkey].first)
 
@@ -100,13 +143,15 @@ void korun_print(KOccurRun run, size_t kmer_size, FILE *fout);
 // Mostly used for debugging
 void koruns_print(const KOccurRun *run, size_t n, size_t kmer_size, FILE *fout);
 
-void korun_gzprint(gzFile gzout, size_t kmer_size,
-                   const KOGraph *kograph, KOccurRun korun,
-                   size_t first_kmer_idx, size_t kmer_offset);
+// Append "chrom:start-end:strand:offset" to sbuf, coords are 1-based
+void korun_strbuf(StrBuf *sbuf, size_t kmer_size,
+                  const KOGraph *kograph, KOccurRun korun,
+                  size_t first_kmer_idx, size_t kmer_offset);
 
-void koruns_gzprint(gzFile gzout, size_t kmer_size, const KOGraph *kograph,
-                    const KOccurRun *koruns, size_t n,
-                    size_t first_kmer_idx, size_t kmer_offset);
+// Append comma separated list of runs
+void koruns_strbuf(StrBuf *sbuf, size_t kmer_size, const KOGraph *kograph,
+                   const KOccurRun *koruns, size_t n,
+                   size_t first_kmer_idx, size_t kmer_offset);
 
 // src, dst can point to the same place
 // returns number of elements added
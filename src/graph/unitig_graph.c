@@ -45,12 +45,12 @@ size_t unitig_graph_store_end_mt(const dBNode *nodes, size_t n,
 
 static void _create_unitig(dBNodeBuffer nbuf, size_t threadid, void *arg)
 {
-  (void)threadid; // unused
   UnitigKmerGraph *ugraph = (UnitigKmerGraph*)arg;
   db_unitig_normalise(nbuf.b, nbuf.len, ugraph->db_graph);
   size_t uidx = unitig_graph_store_end_mt(nbuf.b, nbuf.len, ugraph);
   if(ugraph->per_untig) {
-    ugraph->per_untig(nbuf.b, nbuf.len, uidx, ugraph->per_untig_arg);
+    ugraph->per_untig(nbuf.b, nbuf.len, uidx, threadid,
+                      ugraph->per_untig_arg);
   }
 }
 
@@ -61,7 +61,8 @@ void unitig_graph_create(UnitigKmerGraph *ugraph,
                          size_t nthreads,
                          uint8_t *visited,
                          void (*per_untig)(const dBNode *nodes, size_t n,
-                                           size_t uidx, void *arg),
+                                           size_t uidx, size_t threadid,
+                                           void *arg),
                         void *per_untig_arg)
 {
   ugraph->per_untig = per_untig;
@@ -264,7 +264,7 @@ bool gpath_checks_path_col(dBNode node, const GPath *gpath,
     // Check this node is in this colour
     if(db_graph->node_in_cols != NULL) {
       ctx_assert_ret(db_node_has_col(db_graph, node.key, ctxcol));
-    } else if(db_graph->col_covgs != NULL) {
+    } else if(db_graph_has_covgs(db_graph)) {
       ctx_assert_ret(db_node_get_covg(db_graph, node.key, ctxcol) > 0);
     }
 
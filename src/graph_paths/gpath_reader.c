@@ -13,6 +13,9 @@
 #include "gpath_subset.h"
 #include "json_hdr.h"
 
+#include <pthread.h>
+#include "msg-pool/msgpool.h"
+
 /*
 // File format:
 <JSON_HEADER>
@@ -158,6 +161,172 @@ void _parse_json_header(GPathReader *file)
   if(file->ncolours == 0) die("No colours in JSON header");
 }
 
+//
+// Binary link files
+//
+
+#define _ctpbin_read(file,ptr,size,desc) do {                                  \
+  if(fread(ptr, 1, size, (file)->fh) != (size_t)(size))                       \
+    die("Couldn't read '%s' [%s]", (desc), file_filter_path(&(file)->fltr));    \
+} while(0)
+
+// Returns true if the file starts with CTP_BIN_MAGIC
+static bool _ctpbin_is_binary(const char *path)
+{
+  char magic[strlen(CTP_BIN_MAGIC)];
+  bool is_bin;
+  if(strcmp(path,"-") == 0) return false;
+  FILE *fh = futil_fopen(path, "r");
+  is_bin = (fread(magic, 1, sizeof(magic), fh) == sizeof(magic) &&
+            memcmp(magic, CTP_BIN_MAGIC, sizeof(magic)) == 0);
+  fclose(fh);
+  return is_bin;
+}
+
+// Read header fields and block index, load JSON header into file->hdrstr
+static void _ctpbin_open(GPathReader *file, const char *mode)
+{
+  const char *path = file_filter_path(&file->fltr);
+  char magic[strlen(CTP_BIN_MAGIC)];
+  uint32_t version, nbitfields, ncols, json_len;
+  uint64_t index_offset, nblocks;
+  size_t i;
+
+  file->fh = futil_fopen(path, mode);
+
+  _ctpbin_read(file, magic, sizeof(magic), "magic word");
+  _ctpbin_read(file, &version, sizeof(uint32_t), "version");
+  _ctpbin_read(file, &nbitfields, sizeof(uint32_t), "num of bitfields");
+  _ctpbin_read(file, &ncols, sizeof(uint32_t), "number of colours");
+  _ctpbin_read(file, &json_len, sizeof(uint32_t), "JSON header length");
+
+  if(version > CTP_BIN_VERSION)
+    die("Binary link file version %u not supported (max %i) [%s]",
+        version, CTP_BIN_VERSION, path);
+  if(nbitfields != NUM_BKMER_WORDS)
+    die("Binary link file has %u bitfields, need %i (recompile with "
+        "different MAXK?) [%s]", nbitfields, NUM_BKMER_WORDS, path);
+  if(json_len == 0 || json_len > MAX_JSON_HDR_BYTES)
+    die("Bad JSON header length %u [%s]", json_len, path);
+
+  strbuf_ensure_capacity(&file->hdrstr, json_len);
+  _ctpbin_read(file, file->hdrstr.b, json_len, "JSON header");
+  file->hdrstr.b[json_len] = '\0';
+  file->hdrstr.end = json_len;
+  file->filencols = ncols;
+
+  // Trailer
+  if(fseeko(file->fh, -(off_t)(2*sizeof(uint64_t)+sizeof(magic)), SEEK_END) != 0)
+    die("Cannot seek to end of binary link file [%s]", path);
+  _ctpbin_read(file, &index_offset, sizeof(uint64_t), "index offset");
+  _ctpbin_read(file, &nblocks, sizeof(uint64_t), "number of blocks");
+  _ctpbin_read(file, magic, sizeof(magic), "magic word");
+  if(memcmp(magic, CTP_BIN_MAGIC, sizeof(magic)) != 0)
+    die("Binary link file is truncated [%s]", path);
+
+  // Index
+  if(fseeko(file->fh, (off_t)index_offset, SEEK_SET) != 0)
+    die("Cannot seek to index of binary link file [%s]", path);
+
+  file->nblocks = nblocks;
+  file->blocks = ctx_calloc(MAX2(nblocks,1), sizeof(GPathBinBlock));
+  for(i = 0; i < nblocks; i++) {
+    GPathBinBlock *blk = &file->blocks[i];
+    _ctpbin_read(file, blk->first_kmer.b, sizeof(BinaryKmer), "block kmer");
+    _ctpbin_read(file, &blk->offset, sizeof(uint64_t), "block offset");
+    _ctpbin_read(file, &blk->zlen, sizeof(uint32_t), "block size");
+    _ctpbin_read(file, &blk->len, sizeof(uint32_t), "block size");
+    _ctpbin_read(file, &blk->nkmers, sizeof(uint32_t), "block nkmers");
+    _ctpbin_read(file, &blk->nlinks, sizeof(uint32_t), "block nlinks");
+    if(blk->offset + blk->zlen > index_offset)
+      die("Bad block offset in index [%s]", path);
+  }
+
+  byte_buf_alloc(&file->zbuf, 1024);
+  byte_buf_alloc(&file->blkbuf, 1024);
+  file->blkidx = nblocks;
+  file->blkpos = file->links_rem = 0;
+}
+
+// Decompress block `b` into file->blkbuf
+static void _ctpbin_load_block(GPathReader *file, size_t b)
+{
+  ctx_assert(b < file->nblocks);
+
+  // Block already decoded, rewind to its first kmer
+  if(file->blkidx == b) { file->blkpos = file->links_rem = 0; return; }
+
+  const char *path = file_filter_path(&file->fltr);
+  const GPathBinBlock *blk = &file->blocks[b];
+  uLongf len = blk->len;
+
+  byte_buf_capacity(&file->zbuf, blk->zlen);
+  byte_buf_capacity(&file->blkbuf, blk->len);
+
+  if(fseeko(file->fh, (off_t)blk->offset, SEEK_SET) != 0)
+    die("Cannot seek to block %zu [%s]", b, path);
+  _ctpbin_read(file, file->zbuf.b, blk->zlen, "block");
+
+  if(uncompress(file->blkbuf.b, &len, file->zbuf.b, blk->zlen) != Z_OK ||
+     len != blk->len) {
+    die("Corrupt block %zu [%s]", b, path);
+  }
+
+  file->blkidx = b;
+  file->blkpos = file->links_rem = 0;
+}
+
+// Reads the kmer starting at file->blkbuf.b[file->blkpos]
+static inline void _ctpbin_parse_kmer(GPathReader *file,
+                                      BinaryKmer *bkey, size_t *nlinks)
+{
+  const uint8_t *ptr = file->blkbuf.b + file->blkpos;
+  uint32_t n;
+  if(file->blkpos + sizeof(BinaryKmer) + sizeof(uint32_t) >
+     file->blocks[file->blkidx].len) {
+    die("Corrupt block %zu [%s]", file->blkidx, file_filter_path(&file->fltr));
+  }
+  memcpy(bkey->b, ptr, sizeof(BinaryKmer));
+  memcpy(&n, ptr+sizeof(BinaryKmer), sizeof(uint32_t));
+  file->blkpos += sizeof(BinaryKmer) + sizeof(uint32_t);
+  *nlinks = n;
+}
+
+// Reads the link starting at file->blkbuf.b[file->blkpos]
+// `nseen` and `seq` point into file->blkbuf
+static inline void _ctpbin_parse_link(GPathReader *file,
+                                      bool *fw, size_t *njuncs,
+                                      const uint8_t **nseen,
+                                      const uint8_t **seq)
+{
+  const uint8_t *ptr = file->blkbuf.b + file->blkpos;
+  size_t len = file->blocks[file->blkidx].len;
+  uint16_t juncs_orient;
+
+  if(file->blkpos + sizeof(uint16_t) > len)
+    die("Corrupt block %zu [%s]", file->blkidx, file_filter_path(&file->fltr));
+
+  memcpy(&juncs_orient, ptr, sizeof(uint16_t));
+  *njuncs = juncs_orient & GPATH_MAX_JUNCS;
+  *fw = !(juncs_orient >> 15);
+  *nseen = ptr + sizeof(uint16_t);
+  *seq = *nseen + file->filencols;
+  file->blkpos += sizeof(uint16_t) + file->filencols + binary_seq_mem(*njuncs);
+
+  if(file->blkpos > len)
+    die("Corrupt block %zu [%s]", file->blkidx, file_filter_path(&file->fltr));
+}
+
+// Skip links until the start of the next kmer
+static inline void _ctpbin_skip_links(GPathReader *file, size_t nlinks)
+{
+  bool fw;
+  size_t njuncs;
+  const uint8_t *nseen, *seq;
+  for(; nlinks > 0; nlinks--)
+    _ctpbin_parse_link(file, &fw, &njuncs, &nseen, &seq);
+}
+
 // Open file, exit on error
 // if successful creates a new GPathReader and returns 1
 void gpath_reader_open2(GPathReader *file, const char *path, const char *mode,
@@ -166,16 +335,21 @@ void gpath_reader_open2(GPathReader *file, const char *path, const char *mode,
   FileFilter *fltr = &file->fltr;
   file_filter_open(fltr, path); // calls die() on error
 
-  file->gz = futil_gzopen(fltr->path.b, mode);
-  strm_buf_alloc(&file->strmbuf, 4*ONE_MEGABYTE);
-
   // Temporary variable for loading
   strbuf_alloc(&file->line, 1024);
 
   // Load JSON header into file->hdrstr
   StrBuf *hdrstr = &file->hdrstr;
   if(hdrstr->b == NULL) strbuf_alloc(hdrstr, 1024);
-  json_hdr_read(NULL, file->gz, path, hdrstr);
+
+  if(_ctpbin_is_binary(fltr->path.b)) {
+    _ctpbin_open(file, mode);
+  } else {
+    file->gz = futil_gzopen(fltr->path.b, mode);
+    strm_buf_alloc(&file->strmbuf, 4*ONE_MEGABYTE);
+    json_hdr_read(NULL, file->gz, path, hdrstr);
+  }
+
   file->json = cJSON_Parse(hdrstr->b);
   if(file->json == NULL) die("Invalid JSON header: %s", path);
 
@@ -196,6 +370,11 @@ void gpath_reader_open2(GPathReader *file, const char *path, const char *mode,
   size_t filencols = _gpath_reader_get_filencols(file);
   file_filter_set_cols(fltr, filencols, into_offset);
 
+  if(gpath_reader_is_binary(file) && file->filencols != filencols) {
+    die("Binary link file has %zu colours but header says %zu [%s]",
+        file->filencols, filencols, path);
+  }
+
   // Check we can handle the kmer size
   db_graph_check_kmer_size(kmer_size, file->fltr.path.b);
 }
@@ -208,6 +387,12 @@ void gpath_reader_open(GPathReader *file, const char *path)
 void gpath_reader_close(GPathReader *file)
 {
   if(file->gz) gzclose(file->gz);
+  if(file->fh) {
+    fclose(file->fh);
+    ctx_free(file->blocks);
+    byte_buf_dealloc(&file->zbuf);
+    byte_buf_dealloc(&file->blkbuf);
+  }
   strm_buf_dealloc(&file->strmbuf);
   strbuf_dealloc(&file->line);
   file_filter_close(&file->fltr);
@@ -253,6 +438,24 @@ bool gpath_reader_read_kmer(GPathReader *file, StrBuf *kmer, size_t *num_links)
   strbuf_reset(kmer);
   *num_links = 0;
 
+  if(gpath_reader_is_binary(file)) {
+    BinaryKmer bkey;
+    size_t b = file->blkidx, kmer_size = gpath_reader_get_kmer_size(file);
+    _ctpbin_skip_links(file, file->links_rem);
+    // Move onto the next block
+    if(b == file->nblocks || file->blkpos == file->blocks[b].len) {
+      b = (b == file->nblocks ? 0 : b+1);
+      if(b == file->nblocks) return false;
+      _ctpbin_load_block(file, b);
+    }
+    _ctpbin_parse_kmer(file, &bkey, &file->links_rem);
+    strbuf_ensure_capacity(kmer, kmer_size);
+    binary_kmer_to_str(bkey, kmer_size, kmer->b);
+    kmer->end = kmer_size;
+    *num_links = file->links_rem;
+    return true;
+  }
+
   const char *path = file_filter_path(&file->fltr);
   int c;
   char *space;
@@ -282,6 +485,24 @@ bool gpath_reader_read_kmer(GPathReader *file, StrBuf *kmer, size_t *num_links)
 
 #define bad_link_line(path,line) die("Bad link line [%s]: %s", path, (line)->b)
 
+// Convert counts for each colour in the file into counts for each colour we
+// are loading into, using the file filter
+static inline void _link_counts_filter(SizeBuffer *counts, const FileFilter *fltr)
+{
+  size_t i, fromcol, intocol;
+  size_t offset = counts->len, num_into = file_filter_into_ncols(fltr);
+
+  // Use filter - append zeros first
+  size_buf_push_zero(counts, num_into);
+  for(i = 0; i < file_filter_num(fltr); i++) {
+    fromcol = file_filter_fromcol(fltr, i);
+    intocol = file_filter_intocol(fltr, i);
+    counts->b[offset+intocol] += counts->b[fromcol];
+  }
+  memmove(counts->b, counts->b+offset, num_into*sizeof(counts->b[0]));
+  counts->len = num_into;
+}
+
 /**
  * Parse line with format:
  *  [FR] [njuncs] [nseen0,nseen1,...] [juncs:ACAGT] ([seq=] [juncpos=])?
@@ -294,7 +515,7 @@ void link_line_parse(const StrBuf *line, int version, const FileFilter *fltr,
                      StrBuf *seq, SizeBuffer *juncpos)
 {
   const char *path = file_filter_path(fltr);
-  size_t i, fromcol, intocol;
+  size_t i;
   char *end = NULL;
 
   // First first 5 required columns
@@ -340,17 +561,7 @@ void link_line_parse(const StrBuf *line, int version, const FileFilter *fltr,
   else if(counts->len != fltr->srcncols)
     bad_link_line(path,line);
 
-  // Use filter - append zeros first
-  // size_buf_reset(counts);
-  size_t offset = counts->len, num_into = file_filter_into_ncols(fltr);
-  size_buf_push_zero(counts, num_into);
-  for(i = 0; i < file_filter_num(fltr); i++) {
-    fromcol = file_filter_fromcol(fltr, i);
-    intocol = file_filter_intocol(fltr, i);
-    counts->b[offset+intocol] += counts->b[fromcol];
-  }
-  memmove(counts->b, counts->b+offset, num_into*sizeof(counts->b[0]));
-  counts->len = num_into;
+  _link_counts_filter(counts, fltr);
 
   // 4:[juncs:ACAGA]
   strbuf_reset(juncs);
@@ -424,6 +635,25 @@ bool gpath_reader_read_link(GPathReader *file,
   StrBuf *line = &file->line;
   strbuf_reset(line);
 
+  if(gpath_reader_is_binary(file)) {
+    const uint8_t *nseen, *bseq;
+    size_t i;
+    if(file->links_rem == 0) return false;
+    _ctpbin_parse_link(file, fw, njuncs, &nseen, &bseq);
+    file->links_rem--;
+    size_buf_capacity(countbuf, file->filencols);
+    for(i = 0; i < file->filencols; i++) countbuf->b[i] = nseen[i];
+    countbuf->len = file->filencols;
+    _link_counts_filter(countbuf, &file->fltr);
+    strbuf_ensure_capacity(juncs, *njuncs+1);
+    binary_seq_to_str(bseq, *njuncs, juncs->b);
+    juncs->b[juncs->end = *njuncs] = '\0';
+    // seq= and juncpos= are not stored in binary files
+    if(seq) strbuf_reset(seq);
+    if(juncpos) size_buf_reset(juncpos);
+    return true;
+  }
+
   while((c = gzgetc_buf(file->gz, &file->strmbuf)) != -1)
   {
     if(char_is_acgt(c)) {
@@ -521,20 +751,222 @@ static size_t _load_paths_from_set(dBGraph *db_graph, GPathSet *gpset,
   return subset1->list.len;
 }
 
+// Add a link to a temporary set of links if it has coverage in any of the
+// colours we are loading into
+// @param seq is packed junction sequence
+// @param counts is count for each colour we are loading into
+static inline void _gpset_add_link(GPathSet *gpset, const uint8_t *seq,
+                                   size_t njuncs, bool fw,
+                                   const SizeBuffer *counts)
+{
+  size_t i, link_covg = 0;
+  for(i = 0; i < counts->len; i++) link_covg |= counts->b[i];
+  if(!link_covg) return;
+
+  GPathNew newgpath = {.seq = (uint8_t*)seq,
+                       .colset = NULL, .nseen = NULL,
+                       .orient = fw ? FORWARD : REVERSE,
+                       .num_juncs = njuncs};
+
+  GPath *gpath = gpath_set_add_mt(gpset, newgpath);
+
+  // Update nseen and colset
+  // Our temporary gpset always stores nseen counts
+  uint8_t *nseen = gpath_set_get_nseen(gpset, gpath);
+  uint8_t *colset = gpath_get_colset(gpath, gpset->ncols);
+  for(i = 0; i < counts->len; i++) {
+    nseen[i] = MIN2((size_t)UINT8_MAX, (size_t)nseen[i] + counts->b[i]);
+    bitset_or(colset, i, counts->b[i] > 0);
+  }
+}
+
+// Read counts for a link in a binary file, filtered into the colours we are
+// loading into
+static inline void _ctpbin_link_counts(const GPathReader *file,
+                                       const uint8_t *nseen,
+                                       SizeBuffer *counts)
+{
+  size_t i;
+  size_buf_capacity(counts, file->filencols);
+  for(i = 0; i < file->filencols; i++) counts->b[i] = nseen[i];
+  counts->len = file->filencols;
+  _link_counts_filter(counts, &file->fltr);
+}
+
+// Returns index of the last block with first kmer <= bkey, or nblocks if
+// there isn't one
+static size_t _ctpbin_find_block(const GPathReader *file, BinaryKmer bkey)
+{
+  size_t l = 0, r = file->nblocks, mid;
+  while(l < r) {
+    mid = (l+r)/2;
+    if(binary_kmer_le(file->blocks[mid].first_kmer, bkey)) l = mid+1;
+    else r = mid;
+  }
+  return l == 0 ? file->nblocks : l-1;
+}
+
+// Load kmers with `first` <= kmer <= `last` from a binary link file
+// If first and last are NULL, load all kmers and check the header counts
+static void _ctpbin_load(GPathReader *file, int kmer_flags,
+                         const BinaryKmer *first, const BinaryKmer *last,
+                         dBGraph *db_graph)
+{
+  const char *path = file_filter_path(&file->fltr);
+  const bool load_all = (first == NULL && last == NULL);
+
+  file_filter_status(&file->fltr, false);
+
+  GPathSet gpset;
+  gpath_set_alloc(&gpset, db_graph->num_of_cols, ONE_MEGABYTE, true, true);
+
+  GPathSubset subset0, subset1;
+  gpath_subset_alloc(&subset0);
+  gpath_subset_alloc(&subset1);
+
+  SizeBuffer counts;
+  size_buf_alloc(&counts, 256);
+
+  size_t b, k, l, nlinks, njuncs;
+  size_t num_kmers_seen = 0, num_links_seen = 0;
+  size_t num_kmers_loaded = 0, num_links_loaded = 0;
+  const uint8_t *nseen, *seq;
+  BinaryKmer bkey;
+  hkey_t hkey;
+  bool fw, in_range;
+
+  b = first ? _ctpbin_find_block(file, *first) : 0;
+  if(b == file->nblocks) b = 0;
+
+  for(; b < file->nblocks; b++)
+  {
+    if(last && binary_kmer_lt(*last, file->blocks[b].first_kmer)) break;
+
+    _ctpbin_load_block(file, b);
+
+    for(k = 0; k < file->blocks[b].nkmers; k++)
+    {
+      _ctpbin_parse_kmer(file, &bkey, &nlinks);
+      in_range = (!first || binary_kmer_le(*first, bkey)) &&
+                 (!last || binary_kmer_le(bkey, *last));
+
+      if(!in_range) { _ctpbin_skip_links(file, nlinks); continue; }
+
+      gpath_set_reset(&gpset);
+      for(l = 0; l < nlinks; l++) {
+        _ctpbin_parse_link(file, &fw, &njuncs, &nseen, &seq);
+        _ctpbin_link_counts(file, nseen, &counts);
+        _gpset_add_link(&gpset, seq, njuncs, fw, &counts);
+      }
+
+      num_kmers_seen++;
+      num_links_seen += nlinks;
+
+      if(gpset.entries.len > 0) {
+        num_kmers_loaded++;
+        hkey = find_link_kmer(bkey, kmer_flags, path, db_graph);
+        if(hkey != HASH_NOT_FOUND) {
+          num_links_loaded += _load_paths_from_set(db_graph, &gpset,
+                                                   &subset0, &subset1,
+                                                   hkey);
+        }
+      }
+    }
+
+    if(file->blkpos != file->blocks[b].len)
+      die("Corrupt block %zu [%s]", b, path);
+  }
+
+  if(load_all) {
+    load_check(gpath_reader_get_num_kmers(file) == num_kmers_seen,
+               "header number of kmers don't match seen (exp %zu vs %zu)",
+               gpath_reader_get_num_kmers(file), num_kmers_seen);
+
+    load_check(gpath_reader_get_num_paths(file) == num_links_seen,
+               "header number of links don't match seen (exp %zu vs %zu)",
+               gpath_reader_get_num_paths(file), num_links_seen);
+  }
+
+  // Print status update
+  char nlinks_str[50], nkmers_str[50];
+  ulong_to_str(num_links_loaded, nlinks_str);
+  ulong_to_str(num_kmers_loaded, nkmers_str);
+  status("Loaded %s paths from %s kmers", nlinks_str, nkmers_str);
+
+  size_buf_dealloc(&counts);
+  gpath_subset_dealloc(&subset0);
+  gpath_subset_dealloc(&subset1);
+  gpath_set_dealloc(&gpset);
+}
+
+void gpath_reader_load_range(GPathReader *file, int kmer_flags,
+                             BinaryKmer first, BinaryKmer last,
+                             dBGraph *db_graph)
+{
+  if(!gpath_reader_is_binary(file)) {
+    die("Can only load a kmer range from a binary link file [%s]",
+        file_filter_path(&file->fltr));
+  }
+  _ctpbin_load(file, kmer_flags, &first, &last, db_graph);
+}
+
+size_t gpath_reader_fetch(GPathReader *file, BinaryKmer bkey, GPathSet *gpset)
+{
+  if(!gpath_reader_is_binary(file)) {
+    die("Can only fetch links from a binary link file [%s]",
+        file_filter_path(&file->fltr));
+  }
+
+  ctx_assert(gpath_set_has_nseen(gpset));
+  ctx_assert(gpset->ncols >= file_filter_into_ncols(&file->fltr));
+
+  size_t b, k, l, nlinks, njuncs, nadded = 0;
+  const uint8_t *nseen, *seq;
+  BinaryKmer bkmer;
+  bool fw;
+  SizeBuffer counts;
+
+  b = _ctpbin_find_block(file, bkey);
+  if(b == file->nblocks) return 0;
+
+  _ctpbin_load_block(file, b);
+  size_buf_alloc(&counts, file->filencols + gpset->ncols);
+
+  for(k = 0; k < file->blocks[b].nkmers; k++)
+  {
+    _ctpbin_parse_kmer(file, &bkmer, &nlinks);
+    if(binary_kmer_lt(bkmer, bkey)) { _ctpbin_skip_links(file, nlinks); }
+    else {
+      if(binary_kmer_eq(bkmer, bkey)) {
+        for(l = 0; l < nlinks; l++) {
+          _ctpbin_parse_link(file, &fw, &njuncs, &nseen, &seq);
+          _ctpbin_link_counts(file, nseen, &counts);
+          _gpset_add_link(gpset, seq, njuncs, fw, &counts);
+        }
+        nadded = nlinks;
+      }
+      break;
+    }
+  }
+
+  size_buf_dealloc(&counts);
+  return nadded;
+}
+
 /**
  * @param kmer_flags must be one of:
  *   * GPATH_ADD_MISSING_KMERS - add kmers to the graph before loading path
  *   * GPATH_DIE_MISSING_KMERS - die with error if cannot find kmer
  *   * GPATH_SKIP_MISSING_KMERS - skip paths where kmer is not in graph
  */
-void gpath_reader_load(GPathReader *file, int kmer_flags, dBGraph *db_graph)
+static void gpath_reader_load_serial(GPathReader *file, int kmer_flags,
+                                     dBGraph *db_graph)
 {
+
   const char *path = file_filter_path(&file->fltr);
 
   file_filter_status(&file->fltr, false);
 
-  size_t into_ncols = file_filter_into_ncols(&file->fltr);
-
   // Load paths into this temporary set for each kmer
   GPathSet gpset;
   gpath_set_alloc(&gpset, db_graph->num_of_cols, ONE_MEGABYTE, true, true);
@@ -543,7 +975,7 @@ void gpath_reader_load(GPathReader *file, int kmer_flags, dBGraph *db_graph)
   gpath_subset_alloc(&subset0);
   gpath_subset_alloc(&subset1);
 
-  size_t i, nlink, num_links_exp = 0;
+  size_t nlink, num_links_exp = 0;
   size_t total_kmers_exp = gpath_reader_get_num_kmers(file);
   size_t total_links_exp = gpath_reader_get_num_paths(file);
   size_t num_kmers_seen = 0, num_links_seen = 0;
@@ -574,32 +1006,9 @@ void gpath_reader_load(GPathReader *file, int kmer_flags, dBGraph *db_graph)
                                &counts, &juncs, NULL, NULL);
         nlink++)
     {
-      // Check if link has coverage in any colours
-      size_t link_covg = 0;
-      for(i = 0; i < into_ncols; i++) link_covg |= counts.b[i];
-
-      if(link_covg)
-      {
-        byte_buf_capacity(&seqbuf, binary_seq_mem(juncs.end));
-        binary_seq_from_str(juncs.b, juncs.end, seqbuf.b);
-
-        // Add to GPathSet
-        GPathNew newgpath = {.seq = seqbuf.b,
-                             .colset = NULL, .nseen = NULL,
-                             .orient = fw ? FORWARD : REVERSE,
-                             .num_juncs = juncs.end};
-
-        GPath *gpath = gpath_set_add_mt(&gpset, newgpath);
-
-        // Update nseen and colset
-        // Our temporary gpset always stores nseen counts
-        uint8_t *nseen = gpath_set_get_nseen(&gpset, gpath);
-        uint8_t *colset = gpath_get_colset(gpath, gpset.ncols);
-        for(i = 0; i < into_ncols; i++) {
-          nseen[i] = MIN2((size_t)UINT8_MAX, (size_t)nseen[i] + counts.b[i]);
-          bitset_or(colset, i, counts.b[i] > 0);
-        }
-      }
+      byte_buf_capacity(&seqbuf, binary_seq_mem(juncs.end));
+      binary_seq_from_str(juncs.b, juncs.end, seqbuf.b);
+      _gpset_add_link(&gpset, seqbuf.b, juncs.end, fw, &counts);
     }
 
     if(nlink != num_links_exp && !warn_nlink_mismatch) {
@@ -647,6 +1056,283 @@ void gpath_reader_load(GPathReader *file, int kmer_flags, dBGraph *db_graph)
   byte_buf_dealloc(&seqbuf);
 }
 
+//
+// Multithreaded loading of text link files
+// A reader thread inflates the file and cuts it into chunks of text that
+// end on kmer boundaries. Worker threads parse chunks and add links to the
+// GPathStore with the thread-safe gpath_store_add_mt() /
+// gpath_hash_find_or_insert_mt().
+//
+
+// Bytes of text passed to a worker thread at a time
+#define GPATH_LOAD_CHUNK_SIZE (1<<20)
+// Number of chunks in flight per worker thread
+#define GPATH_LOAD_CHUNKS_PER_THREAD 2
+
+typedef struct
+{
+  GPathReader *const file;
+  const int kmer_flags;
+  dBGraph *const db_graph;
+  MsgPool *const pool;
+  volatile uint8_t warned_nlink_mismatch;
+  // summed from each thread
+  volatile size_t num_kmers_seen, num_links_seen;
+  volatile size_t num_kmers_loaded, num_links_loaded;
+} GPathLoaderMT;
+
+// Temporary memory for each worker
+typedef struct
+{
+  GPathSet gpset;
+  GPathSubset subset0, subset1;
+  StrBuf line, juncs;
+  SizeBuffer counts;
+  ByteBuffer seqbuf;
+  size_t num_kmers_seen, num_links_seen;
+  size_t num_kmers_loaded, num_links_loaded;
+} GPathLoadWorker;
+
+static void _gpath_load_pool_init(void *el, size_t idx, void *args)
+{
+  StrBuf *chunk = (StrBuf*)args + idx;
+  memcpy(el, &chunk, sizeof(StrBuf*));
+}
+
+static void* gpath_load_reader(void *arg)
+{
+  GPathLoaderMT *ldr = (GPathLoaderMT*)arg;
+  GPathReader *file = ldr->file;
+  MsgPool *pool = ldr->pool;
+  const char *path = file_filter_path(&file->fltr);
+  StrBuf *chunk;
+  int c, pos;
+
+  pos = msgpool_claim_write(pool);
+  memcpy(&chunk, msgpool_get_ptr(pool, pos), sizeof(StrBuf*));
+  strbuf_reset(chunk);
+
+  while((c = gzgetc_buf(file->gz, &file->strmbuf)) != -1)
+  {
+    if(c == '#') { gzskipline_buf(file->gz, &file->strmbuf); continue; }
+    if(c == '\n') continue;
+
+    // Only end a chunk at the start of a kmer line
+    if(char_is_acgt(c) && chunk->end >= GPATH_LOAD_CHUNK_SIZE) {
+      msgpool_release(pool, pos, MPOOL_FULL);
+      pos = msgpool_claim_write(pool);
+      memcpy(&chunk, msgpool_get_ptr(pool, pos), sizeof(StrBuf*));
+      strbuf_reset(chunk);
+    }
+
+    strbuf_append_char(chunk, c);
+    strbuf_gzreadline_buf(chunk, file->gz, &file->strmbuf);
+    futil_gzcheck(0, file->gz, path);
+    if(chunk->b[chunk->end-1] != '\n') strbuf_append_char(chunk, '\n');
+  }
+
+  futil_gzcheck(0, file->gz, path);
+  msgpool_release(pool, pos, chunk->end ? MPOOL_FULL : MPOOL_EMPTY);
+  msgpool_close(pool);
+  return NULL;
+}
+
+// Add links for a kmer that have been parsed into wrkr->gpset
+static void _gpath_load_kmer_mt(GPathLoaderMT *ldr, GPathLoadWorker *wrkr,
+                                const char *kmerstr, size_t nlinks_exp,
+                                size_t nlinks)
+{
+  dBGraph *db_graph = ldr->db_graph;
+  const char *path = file_filter_path(&ldr->file->fltr);
+  BinaryKmer bkey;
+  hkey_t hkey;
+  bool found;
+
+  if(nlinks != nlinks_exp &&
+     __sync_bool_compare_and_swap(&ldr->warned_nlink_mismatch, 0, 1)) {
+    warn("Number of links mismatches: %.*s %zu != %zu [%s]",
+         (int)db_graph->kmer_size, kmerstr, nlinks_exp, nlinks, path);
+  }
+
+  wrkr->num_kmers_seen++;
+  wrkr->num_links_seen += nlinks;
+
+  if(wrkr->gpset.entries.len == 0) return;
+  wrkr->num_kmers_loaded++;
+
+  bkey = binary_kmer_from_str(kmerstr, db_graph->kmer_size);
+
+  // Other threads may be adding kmers, so use the thread-safe insert
+  if(ldr->kmer_flags == GPATH_ADD_MISSING_KMERS) {
+    hkey = hash_table_find_or_insert_mt(&db_graph->ht, bkey, &found,
+                                        db_graph->bktlocks);
+  } else {
+    hkey = find_link_kmer(bkey, ldr->kmer_flags, path, db_graph);
+  }
+
+  if(hkey != HASH_NOT_FOUND) {
+    wrkr->num_links_loaded += _load_paths_from_set(db_graph, &wrkr->gpset,
+                                                   &wrkr->subset0,
+                                                   &wrkr->subset1, hkey);
+  }
+
+  gpath_set_reset(&wrkr->gpset);
+}
+
+// Parse a chunk of text: one or more kmer lines, each followed by its links
+static void _gpath_load_chunk(GPathLoaderMT *ldr, GPathLoadWorker *wrkr,
+                              const StrBuf *chunk)
+{
+  const GPathReader *file = ldr->file;
+  const char *path = file_filter_path(&file->fltr);
+  const char *ptr = chunk->b, *end = chunk->b + chunk->end, *eol;
+  char kmerstr[MAX_KMER_SIZE+1];
+  size_t nlinks = 0, nlinks_exp = 0, njuncs = 0;
+  bool fw = true, have_kmer = false;
+  StrBuf *line = &wrkr->line;
+  char *space;
+
+  for(; ptr < end; ptr = eol+1)
+  {
+    eol = memchr(ptr, '\n', end - ptr);
+    strbuf_reset(line);
+    strbuf_append_strn(line, ptr, eol - ptr);
+
+    if(char_is_acgt(line->b[0]))
+    {
+      if(have_kmer) _gpath_load_kmer_mt(ldr, wrkr, kmerstr, nlinks_exp, nlinks);
+
+      if((space = strchr(line->b, ' ')) == NULL ||
+         (size_t)(space - line->b) != ldr->db_graph->kmer_size ||
+         !parse_entire_size(space+1, &nlinks_exp))
+      {
+        die("Bad kmer line [%s]: %s", path, line->b);
+      }
+
+      memcpy(kmerstr, line->b, ldr->db_graph->kmer_size);
+      kmerstr[ldr->db_graph->kmer_size] = '\0';
+      have_kmer = true;
+      nlinks = 0;
+    }
+    else
+    {
+      if(!have_kmer) die("Bad kmer line [%s]: %s", path, line->b);
+      link_line_parse(line, file->version, &file->fltr,
+                      &fw, &njuncs, &wrkr->counts, &wrkr->juncs,
+                      NULL, NULL);
+      byte_buf_capacity(&wrkr->seqbuf, binary_seq_mem(njuncs));
+      binary_seq_from_str(wrkr->juncs.b, njuncs, wrkr->seqbuf.b);
+      _gpset_add_link(&wrkr->gpset, wrkr->seqbuf.b, njuncs, fw, &wrkr->counts);
+      nlinks++;
+    }
+  }
+
+  if(have_kmer) _gpath_load_kmer_mt(ldr, wrkr, kmerstr, nlinks_exp, nlinks);
+}
+
+static void gpath_load_worker(void *arg, size_t threadid)
+{
+  (void)threadid;
+  GPathLoaderMT *ldr = (GPathLoaderMT*)arg;
+  GPathLoadWorker wrkr;
+  memset(&wrkr, 0, sizeof(wrkr));
+  StrBuf *chunk;
+  int pos;
+
+  gpath_set_alloc(&wrkr.gpset, ldr->db_graph->num_of_cols, ONE_MEGABYTE,
+                  true, true);
+  gpath_subset_alloc(&wrkr.subset0);
+  gpath_subset_alloc(&wrkr.subset1);
+  strbuf_alloc(&wrkr.line, 256);
+  strbuf_alloc(&wrkr.juncs, 256);
+  size_buf_alloc(&wrkr.counts, 256);
+  byte_buf_alloc(&wrkr.seqbuf, 64);
+
+  while((pos = msgpool_claim_read(ldr->pool)) != -1)
+  {
+    memcpy(&chunk, msgpool_get_ptr(ldr->pool, pos), sizeof(StrBuf*));
+    _gpath_load_chunk(ldr, &wrkr, chunk);
+    msgpool_release(ldr->pool, pos, MPOOL_EMPTY);
+  }
+
+  __sync_fetch_and_add(&ldr->num_kmers_seen, wrkr.num_kmers_seen);
+  __sync_fetch_and_add(&ldr->num_links_seen, wrkr.num_links_seen);
+  __sync_fetch_and_add(&ldr->num_kmers_loaded, wrkr.num_kmers_loaded);
+  __sync_fetch_and_add(&ldr->num_links_loaded, wrkr.num_links_loaded);
+
+  gpath_set_dealloc(&wrkr.gpset);
+  gpath_subset_dealloc(&wrkr.subset0);
+  gpath_subset_dealloc(&wrkr.subset1);
+  strbuf_dealloc(&wrkr.line);
+  strbuf_dealloc(&wrkr.juncs);
+  size_buf_dealloc(&wrkr.counts);
+  byte_buf_dealloc(&wrkr.seqbuf);
+}
+
+static void gpath_reader_load_text_mt(GPathReader *file, int kmer_flags,
+                                      size_t nthreads, dBGraph *db_graph)
+{
+  const char *path = file_filter_path(&file->fltr);
+  size_t i, nchunks = nthreads * GPATH_LOAD_CHUNKS_PER_THREAD;
+  int rc;
+
+  file_filter_status(&file->fltr, false);
+  status("[GPathReader] Loading links with %zu threads", nthreads);
+
+  StrBuf *chunks = ctx_calloc(nchunks, sizeof(StrBuf));
+  for(i = 0; i < nchunks; i++) strbuf_alloc(&chunks[i], GPATH_LOAD_CHUNK_SIZE);
+
+  MsgPool pool;
+  msgpool_alloc(&pool, nchunks, sizeof(StrBuf*), USE_MSG_POOL);
+  msgpool_iterate(&pool, _gpath_load_pool_init, chunks);
+
+  GPathLoaderMT ldr = {.file = file, .kmer_flags = kmer_flags,
+                       .db_graph = db_graph, .pool = &pool};
+
+  pthread_t reader;
+  rc = pthread_create(&reader, NULL, gpath_load_reader, &ldr);
+  if(rc != 0) die("Creating thread failed: %s", strerror(rc));
+
+  util_multi_thread(&ldr, nthreads, gpath_load_worker);
+
+  rc = pthread_join(reader, NULL);
+  if(rc != 0) die("Joining thread failed: %s", strerror(rc));
+
+  msgpool_dealloc(&pool);
+  for(i = 0; i < nchunks; i++) strbuf_dealloc(&chunks[i]);
+  ctx_free(chunks);
+
+  load_check(gpath_reader_get_num_kmers(file) == ldr.num_kmers_seen,
+             "header number of kmers don't match seen (exp %zu vs %zu) [%s]",
+             gpath_reader_get_num_kmers(file), ldr.num_kmers_seen, path);
+
+  load_check(gpath_reader_get_num_paths(file) == ldr.num_links_seen,
+             "header number of links don't match seen (exp %zu vs %zu) [%s]",
+             gpath_reader_get_num_paths(file), ldr.num_links_seen, path);
+
+  // Print status update
+  char nlinks_str[50], nkmers_str[50];
+  ulong_to_str(ldr.num_links_loaded, nlinks_str);
+  ulong_to_str(ldr.num_kmers_loaded, nkmers_str);
+  status("Loaded %s paths from %s kmers", nlinks_str, nkmers_str);
+}
+
+void gpath_reader_load_mt(GPathReader *file, int kmer_flags, size_t nthreads,
+                          dBGraph *db_graph)
+{
+  if(gpath_reader_is_binary(file))
+    _ctpbin_load(file, kmer_flags, NULL, NULL, db_graph);
+  else if(nthreads > 1 && !db_graph->gpstore.gpset.can_resize)
+    gpath_reader_load_text_mt(file, kmer_flags, nthreads, db_graph);
+  else
+    gpath_reader_load_serial(file, kmer_flags, db_graph);
+}
+
+void gpath_reader_load(GPathReader *file, int kmer_flags, dBGraph *db_graph)
+{
+  gpath_reader_load_mt(file, kmer_flags, 1, db_graph);
+}
+
 void gpath_reader_load_sample_names(const GPathReader *file, dBGraph *db_graph)
 {
   const FileFilter *fltr = &file->fltr;
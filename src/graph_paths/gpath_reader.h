@@ -9,11 +9,44 @@
 
 #define CTP_FORMAT_VERSION 4
 
+/*
+// Binary link file format (written by gpath_save_bin()):
+"CTPBIN" <uint32:version> <uint32:num_bitfields> <uint32:ncols>
+<uint32:json_len> <JSON_HEADER>
+<block0> <block1> ...   zlib compressed blocks of kmers
+<index>                 one entry per block, see GPathBinBlock
+<uint64:index_offset> <uint64:nblocks> "CTPBIN"
+
+// Each block is a list of kmers sorted by kmer, each with:
+<BinaryKmer> <uint32:nlinks>
+  <uint16:njuncs|orient<<15> <uint8:nseen>*ncols <packed juncs>
+  ...
+*/
+#define CTP_BIN_MAGIC "CTPBIN"
+#define CTP_BIN_VERSION 1
+
+// Index entry for a block of kmers in a binary link file
+typedef struct
+{
+  BinaryKmer first_kmer;
+  uint64_t offset; // offset of compressed block in the file
+  uint32_t zlen, len; // compressed and uncompressed size in bytes
+  uint32_t nkmers, nlinks;
+} GPathBinBlock;
+
 typedef struct
 {
   StreamBuffer strmbuf;
   gzFile gz;
 
+  // Binary files only, see gpath_reader_is_binary()
+  FILE *fh;
+  GPathBinBlock *blocks;
+  size_t nblocks, filencols;
+  ByteBuffer zbuf, blkbuf; // compressed and uncompressed block
+  size_t blkidx; // block in blkbuf, nblocks if none
+  size_t blkpos, links_rem; // read position for gpath_reader_read_*()
+
   // For parsing input
   StrBuf line;
   SizeBuffer numbuf;
@@ -49,11 +82,33 @@ void gpath_reader_open2(GPathReader *file, const char *path, const char *mode,
 
 void gpath_reader_check(const GPathReader *file, size_t kmer_size, size_t ncols);
 
+// Binary files are indexed and can be loaded by kmer range / fetched by kmer
+#define gpath_reader_is_binary(file) ((file)->fh != NULL)
+
 // @kmer_flags must be one of:
 //   GPATH_ADD_MISSING_KMERS - add kmers to the graph before loading path
 //   GPATH_DIE_MISSING_KMERS - die with error if cannot find kmer
 //   GPATH_SKIP_MISSING_KMERS - skip paths where kmer is not in graph
 void gpath_reader_load(GPathReader *file, int kmer_flags, dBGraph *db_graph);
+
+// As gpath_reader_load(), parsing text link files with `nthreads` threads while
+// another thread decompresses the file. Requires the GPathStore to be
+// thread-safe (not resizable), otherwise loads with a single thread.
+void gpath_reader_load_mt(GPathReader *file, int kmer_flags, size_t nthreads,
+                          dBGraph *db_graph);
+
+// Load links for kmers `first` <= kmer <= `last` (kmer keys) from a binary
+// link file. Only the blocks that overlap the range are read.
+void gpath_reader_load_range(GPathReader *file, int kmer_flags,
+                             BinaryKmer first, BinaryKmer last,
+                             dBGraph *db_graph);
+
+// Fetch links for a kmer key from a binary link file into `gpset`, which must
+// store counts (nseen). Uses the colour filter of the file.
+// Returns the number of links added to `gpset`. Resets the read position used
+// by gpath_reader_read_kmer() / gpath_reader_read_link().
+size_t gpath_reader_fetch(GPathReader *file, BinaryKmer bkey, GPathSet *gpset);
+
 void gpath_reader_close(GPathReader *file);
 
 // Given an array of GPathReaders, find the max and sum of the number of kmers
@@ -73,7 +128,7 @@ void link_line_parse(const StrBuf *line, int version, const FileFilter *fltr,
                      SizeBuffer *counts, StrBuf *juncs,
                      StrBuf *seq, SizeBuffer *juncpos);
 
-// Reads line <kmer> <num_links>
+// Reads line <kmer> <num_links>, or the next kmer in a binary file
 // Calls die() on error
 // Returns true unless end of file
 bool gpath_reader_read_kmer(GPathReader *file, StrBuf *kmer, size_t *num_links);
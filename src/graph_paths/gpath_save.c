@@ -1,10 +1,12 @@
 #include "global.h"
 #include "gpath_save.h"
+#include "gpath_reader.h" // binary format definitions
 #include "gpath_checks.h"
 #include "gpath_set.h"
 #include "gpath_subset.h"
 #include "binary_seq.h"
 #include "util.h"
+#include "binary_kmer_sort.h"
 #include "json_hdr.h"
 
 const char ctp_explanation_comment[] =
@@ -329,3 +331,255 @@ void gpath_save(gzFile gzout, const char *path,
   pthread_mutex_destroy(&outlock);
   status("[GPathSave] Graph paths saved to %s", path);
 }
+
+//
+// Binary link files, see gpath_reader.h for the format
+//
+
+// Max uncompressed size of a block of kmers (a kmer may exceed this)
+#define CTPBIN_BLOCK_SIZE (256*1024)
+// Number of blocks to compress per thread before writing out
+#define CTPBIN_BLOCKS_PER_THREAD 8
+
+// Bytes required to store all links for a kmer
+static size_t _ctpbin_kmer_bytes(const GPath *gpath, size_t ncols)
+{
+  size_t bytes = sizeof(BinaryKmer) + sizeof(uint32_t);
+  for(; gpath != NULL; gpath = gpath->next)
+    bytes += sizeof(uint16_t) + ncols + binary_seq_mem(gpath->num_juncs);
+  return bytes;
+}
+
+typedef union { BinaryKmer *bptr; hkey_t h; } CtpBinKmerUnion;
+
+static inline void _ctpbin_add_kmer(hkey_t hkey, const dBGraph *db_graph,
+                                    CtpBinKmerUnion **nxt)
+{
+  if(gpath_store_fetch(&db_graph->gpstore, hkey) != NULL) {
+    (**nxt).bptr = db_graph->ht.table + hkey;
+    (*nxt)++;
+  }
+}
+
+// Returns kmers with links, sorted by kmer using `nthreads`. Sets *nkmers.
+static hkey_t* _ctpbin_sorted_hkeys(const dBGraph *db_graph, size_t nthreads,
+                                    size_t *nkmers)
+{
+  ctx_assert(sizeof(hkey_t) == sizeof(CtpBinKmerUnion));
+  CtpBinKmerUnion *kmers, *nxt, *end;
+  size_t n = db_graph->gpstore.num_kmers_with_paths;
+  nxt = kmers = ctx_malloc(sizeof(CtpBinKmerUnion) * MAX2(n,1));
+  HASH_ITERATE(&db_graph->ht, _ctpbin_add_kmer, db_graph, &nxt);
+  end = nxt;
+  ctx_assert2((size_t)(end - kmers) <= n, "%zu vs %zu", (size_t)(end-kmers), n);
+  n = end - kmers;
+  // Can sort ignoring that the top flag bit is set on all kmers
+  binary_kmer_sort_ptrs((void**)kmers, n, nthreads);
+  for(nxt = kmers; nxt < end; nxt++) nxt->h = nxt->bptr - db_graph->ht.table;
+  *nkmers = n;
+  return (hkey_t*)kmers;
+}
+
+typedef struct
+{
+  const dBGraph *db_graph;
+  const hkey_t *hkeys;
+  const size_t *blkstarts; // block i is hkeys[blkstarts[i]..blkstarts[i+1]-1]
+  size_t blk_offset, nblocks, next_blk;
+  ByteBuffer *zbufs; // compressed block i is zbufs[i-blk_offset]
+  GPathBinBlock *blocks;
+} GPathBinSaving;
+
+// Encode block b of kmers into buf
+static void _ctpbin_encode_block(const GPathBinSaving *save, size_t b,
+                                 ByteBuffer *buf, GPathSubset *subset)
+{
+  const dBGraph *db_graph = save->db_graph;
+  const GPathStore *gpstore = &db_graph->gpstore;
+  const GPathSet *gpset = &gpstore->gpset;
+  const size_t ncols = gpset->ncols;
+  GPathBinBlock *blk = &save->blocks[b];
+  const GPath *gpath;
+  BinaryKmer bkmer;
+  uint32_t nlinks;
+  uint16_t juncs_orient;
+  size_t i, j;
+
+  byte_buf_reset(buf);
+  blk->nkmers = save->blkstarts[b+1] - save->blkstarts[b];
+  blk->nlinks = 0;
+
+  for(i = save->blkstarts[b]; i < save->blkstarts[b+1]; i++)
+  {
+    // Load and sort paths for given kmer
+    gpath_subset_reset(subset);
+    gpath_subset_load_llist(subset, gpath_store_fetch(gpstore, save->hkeys[i]));
+    gpath_subset_sort(subset);
+
+    bkmer = hash_table_fetch(&db_graph->ht, save->hkeys[i]);
+    if(i == save->blkstarts[b]) blk->first_kmer = bkmer;
+    nlinks = subset->list.len;
+    blk->nlinks += nlinks;
+
+    byte_buf_push(buf, (const uint8_t*)bkmer.b, sizeof(BinaryKmer));
+    byte_buf_push(buf, (const uint8_t*)&nlinks, sizeof(uint32_t));
+
+    for(j = 0; j < subset->list.len; j++) {
+      gpath = subset->list.b[j];
+      juncs_orient = gpath->num_juncs | (gpath->orient == REVERSE ? 1<<15 : 0);
+      byte_buf_push(buf, (const uint8_t*)&juncs_orient, sizeof(uint16_t));
+      byte_buf_push(buf, gpath_set_get_nseen(gpset, gpath), ncols);
+      byte_buf_push(buf, gpath->seq, binary_seq_mem(gpath->num_juncs));
+    }
+  }
+}
+
+static void gpath_save_bin_thread(void *arg, size_t threadid)
+{
+  (void)threadid;
+  GPathBinSaving *save = (GPathBinSaving*)arg;
+  const char *path = "binary link file";
+  GPathSubset subset;
+  ByteBuffer buf;
+  ByteBuffer *zbuf;
+  GPathBinBlock *blk;
+  uLongf zlen;
+  size_t b;
+
+  gpath_subset_alloc(&subset);
+  gpath_subset_init(&subset, (GPathSet*)&save->db_graph->gpstore.gpset);
+  byte_buf_alloc(&buf, CTPBIN_BLOCK_SIZE);
+
+  while((b = __sync_fetch_and_add(&save->next_blk, 1)) < save->nblocks)
+  {
+    _ctpbin_encode_block(save, b, &buf, &subset);
+
+    blk = &save->blocks[b];
+    zbuf = &save->zbufs[b - save->blk_offset];
+    zlen = compressBound(buf.len);
+    byte_buf_capacity(zbuf, zlen);
+
+    if(compress2(zbuf->b, &zlen, buf.b, buf.len, Z_DEFAULT_COMPRESSION) != Z_OK)
+      die("Failed to compress block %zu of %s", b, path);
+
+    zbuf->len = zlen;
+    blk->zlen = zlen;
+    blk->len = buf.len;
+  }
+
+  byte_buf_dealloc(&buf);
+  gpath_subset_dealloc(&subset);
+}
+
+static inline void _ctpbin_fwrite(FILE *fout, const void *ptr, size_t n,
+                                  const char *path, uint64_t *offset)
+{
+  if(fwrite(ptr, 1, n, fout) != n)
+    die("Cannot write to file: %s [%s]", path, strerror(errno));
+  *offset += n;
+}
+
+void gpath_save_bin(FILE *fout, const char *path, size_t nthreads,
+                    const char *cmdstr, cJSON *cmdhdr,
+                    cJSON **hdrs, size_t nhdrs,
+                    const ZeroSizeBuffer *contig_hists, size_t ncols,
+                    dBGraph *db_graph)
+{
+  ctx_assert(nthreads > 0);
+  ctx_assert(gpath_set_has_nseen(&db_graph->gpstore.gpset));
+  ctx_assert(ncols == db_graph->gpstore.gpset.ncols);
+
+  char npaths_str[50];
+  ulong_to_str(db_graph->gpstore.num_paths, npaths_str);
+
+  status("Saving %s paths to: %s (binary)", npaths_str, path);
+  status("  using %zu threads", nthreads);
+
+  uint64_t offset = 0;
+  uint32_t version = CTP_BIN_VERSION, nbitfields = NUM_BKMER_WORDS;
+  uint32_t filencols = ncols, json_len;
+
+  // Write header
+  cJSON *json = gpath_save_mkhdr(path, cmdstr, cmdhdr, hdrs, nhdrs,
+                                 contig_hists, ncols, db_graph);
+  char *jstr = cJSON_Print(json);
+  json_len = strlen(jstr);
+  cJSON_Delete(json);
+
+  _ctpbin_fwrite(fout, CTP_BIN_MAGIC, strlen(CTP_BIN_MAGIC), path, &offset);
+  _ctpbin_fwrite(fout, &version, sizeof(uint32_t), path, &offset);
+  _ctpbin_fwrite(fout, &nbitfields, sizeof(uint32_t), path, &offset);
+  _ctpbin_fwrite(fout, &filencols, sizeof(uint32_t), path, &offset);
+  _ctpbin_fwrite(fout, &json_len, sizeof(uint32_t), path, &offset);
+  _ctpbin_fwrite(fout, jstr, json_len, path, &offset);
+  free(jstr);
+
+  // Sort kmers and split into blocks
+  size_t i, b, nkmers, blk_bytes = 0, kmer_bytes;
+  hkey_t *hkeys = _ctpbin_sorted_hkeys(db_graph, nthreads, &nkmers);
+  SizeBuffer blkstarts;
+  size_buf_alloc(&blkstarts, 1024);
+
+  for(i = 0; i < nkmers; i++) {
+    kmer_bytes = _ctpbin_kmer_bytes(gpath_store_fetch(&db_graph->gpstore,
+                                                      hkeys[i]), ncols);
+    if(i == 0 || blk_bytes + kmer_bytes > CTPBIN_BLOCK_SIZE) {
+      size_buf_push(&blkstarts, &i, 1);
+      blk_bytes = 0;
+    }
+    blk_bytes += kmer_bytes;
+  }
+
+  size_t nblocks = blkstarts.len;
+  size_buf_push(&blkstarts, &nkmers, 1);
+
+  // Compress blocks in batches, write each batch in order
+  size_t batch = nthreads * CTPBIN_BLOCKS_PER_THREAD;
+  GPathBinBlock *blocks = ctx_calloc(MAX2(nblocks,1), sizeof(GPathBinBlock));
+  ByteBuffer *zbufs = ctx_calloc(batch, sizeof(ByteBuffer));
+  for(i = 0; i < batch; i++) byte_buf_alloc(&zbufs[i], 1024);
+
+  GPathBinSaving save = {.db_graph = db_graph, .hkeys = hkeys,
+                         .blkstarts = blkstarts.b, .zbufs = zbufs,
+                         .blocks = blocks};
+
+  for(b = 0; b < nblocks; b += batch)
+  {
+    save.blk_offset = save.next_blk = b;
+    save.nblocks = MIN2(b+batch, nblocks);
+    util_multi_thread(&save, MIN2(nthreads, save.nblocks-b),
+                      gpath_save_bin_thread);
+
+    for(i = b; i < save.nblocks; i++) {
+      blocks[i].offset = offset;
+      _ctpbin_fwrite(fout, zbufs[i-b].b, zbufs[i-b].len, path, &offset);
+    }
+  }
+
+  // Write index and trailer
+  uint64_t index_offset = offset, nblocks64 = nblocks;
+  for(i = 0; i < nblocks; i++) {
+    _ctpbin_fwrite(fout, blocks[i].first_kmer.b, sizeof(BinaryKmer), path, &offset);
+    _ctpbin_fwrite(fout, &blocks[i].offset, sizeof(uint64_t), path, &offset);
+    _ctpbin_fwrite(fout, &blocks[i].zlen, sizeof(uint32_t), path, &offset);
+    _ctpbin_fwrite(fout, &blocks[i].len, sizeof(uint32_t), path, &offset);
+    _ctpbin_fwrite(fout, &blocks[i].nkmers, sizeof(uint32_t), path, &offset);
+    _ctpbin_fwrite(fout, &blocks[i].nlinks, sizeof(uint32_t), path, &offset);
+  }
+
+  _ctpbin_fwrite(fout, &index_offset, sizeof(uint64_t), path, &offset);
+  _ctpbin_fwrite(fout, &nblocks64, sizeof(uint64_t), path, &offset);
+  _ctpbin_fwrite(fout, CTP_BIN_MAGIC, strlen(CTP_BIN_MAGIC), path, &offset);
+
+  for(i = 0; i < batch; i++) byte_buf_dealloc(&zbufs[i]);
+  ctx_free(zbufs);
+  ctx_free(blocks);
+  ctx_free(hkeys);
+  size_buf_dealloc(&blkstarts);
+
+  char nkmers_str[50], nblocks_str[50];
+  ulong_to_str(nkmers, nkmers_str);
+  ulong_to_str(nblocks, nblocks_str);
+  status("[GPathSave] Graph paths saved to %s [%s kmers in %s blocks]",
+         path, nkmers_str, nblocks_str);
+}
@@ -11,6 +11,8 @@
 <JSON_HEADER>
 kmer [num] .. ignored
 [FR] [njuncs] [nseen,nseen,nseen] [seq:ACAGT] .. ignored
+
+// Binary file format (gpath_save_bin()) is described in gpath_reader.h
 */
 
 extern const char ctp_explanation_comment[];
@@ -60,4 +62,16 @@ void gpath_save(gzFile gzout, const char *path,
                 const ZeroSizeBuffer *contig_hists, size_t ncols,
                 dBGraph *db_graph);
 
+/**
+ * Save paths to a binary link file (see gpath_reader.h for the format).
+ * Kmers are sorted and their links written in zlib compressed blocks,
+ * followed by an index of the first kmer in each block. seq=... and
+ * juncpos=... are not saved. @fout does not need to be seekable.
+ */
+void gpath_save_bin(FILE *fout, const char *path, size_t nthreads,
+                    const char *cmdstr, cJSON *cmdhdr,
+                    cJSON **hdrs, size_t nhdrs,
+                    const ZeroSizeBuffer *contig_hists, size_t ncols,
+                    dBGraph *db_graph);
+
 #endif /* GPATH_SAVE_H_ */
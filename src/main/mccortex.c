@@ -111,6 +111,11 @@ CtxCmd cmdobjs[] = {
   .blurb = "use a trusted assembled genome to call large events",
   .usage = breakpoints_usage
 },
+{
+  .cmd = "refindex", .func = ctx_refindex, .hide = false,
+  .blurb = "index reference kmers for breakpoint calling",
+  .usage = refindex_usage
+},
 {
   .cmd = "coverage", .func = ctx_coverage, .hide = false,
   .blurb = "print contig coverage",
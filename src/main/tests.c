@@ -24,11 +24,13 @@ int main(int argc, char **argv)
     test_util();
     test_dna_functions();
     test_binary_seq_functions();
+    test_seqout();
 
     // only written in k=31
     test_db_node();
     test_build_graph();
     test_db_unitig();
+    test_compact_graph();
     test_subgraph();
     test_cleaning();
     test_paths();
@@ -40,6 +42,7 @@ int main(int argc, char **argv)
     test_bubble_caller();
     test_kmer_occur();
     test_infer_edges_tests();
+    test_dist_matrix();
   #endif
 
   cmd_destroy();
@@ -97,6 +97,9 @@ static inline void _tests_add_to_graph(dBGraph *graph, const char *str, size_t c
 // util_tests.c
 void test_util();
 
+// seqout_tests.c
+void test_seqout();
+
 // dna_tests.c
 void test_dna_functions();
 
@@ -118,6 +121,9 @@ void test_build_graph();
 // db_unitig_tests.c
 void test_db_unitig();
 
+// compact_graph_tests.c
+void test_compact_graph();
+
 // cleaning_tests.c
 void test_cleaning();
 
@@ -151,4 +157,7 @@ void test_graph_crawler();
 // infer_edges_tests.c
 void test_infer_edges_tests();
 
+// dist_matrix_tests.c
+void test_dist_matrix();
+
 #endif  /* ALL_TESTS_H_ */
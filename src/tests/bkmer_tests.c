@@ -1,6 +1,7 @@
 #include "global.h"
 #include "all_tests.h"
 #include "binary_kmer.h"
+#include "binary_kmer_sort.h"
 
 void test_bkmer_str()
 {
@@ -149,6 +150,54 @@ static void test_bkmer_first_last_nuc()
   }
 }
 
+// Sort unaligned kmers with a radix sort and compare with qsort
+static void test_bkmer_sort_nthreads(size_t nkmers, size_t nthreads)
+{
+  const size_t stride = sizeof(BinaryKmer)+3; // unaligned entries
+  char *mem = ctx_malloc(nkmers * stride);
+  char **ptrs = ctx_malloc(nkmers * sizeof(char*));
+  char **expt = ctx_malloc(nkmers * sizeof(char*));
+  char tmp[MAX_KMER_SIZE+1];
+  BinaryKmer bkmer;
+  size_t i, k = MAX_KMER_SIZE;
+
+  for(i = 0; i < nkmers; i++) {
+    // Add some repeated kmers and kmers with a shared prefix
+    if(i > 0 && i % 7 == 0) {
+      memcpy(mem+i*stride, mem+(rand()%i)*stride, sizeof(BinaryKmer));
+    } else {
+      dna_rand_str(tmp, k);
+      if(i % 5 == 0) memset(tmp, 'A', k/2);
+      bkmer = binary_kmer_from_str(tmp, k);
+      memcpy(mem+i*stride, bkmer.b, sizeof(BinaryKmer));
+    }
+    ptrs[i] = expt[i] = mem+i*stride;
+  }
+
+  qsort(expt, nkmers, sizeof(char*), binary_kmers_qcmp_unaligned_ptrs);
+  binary_kmer_sort_ptrs((void**)ptrs, nkmers, nthreads);
+
+  size_t nmismatch = 0;
+  for(i = 0; i < nkmers; i++)
+    nmismatch += (memcmp(ptrs[i], expt[i], sizeof(BinaryKmer)) != 0);
+
+  TASSERT2(nmismatch == 0, "nkmers: %zu nthreads: %zu", nkmers, nthreads);
+
+  ctx_free(mem);
+  ctx_free(ptrs);
+  ctx_free(expt);
+}
+
+static void test_bkmer_sort()
+{
+  test_status("Testing radix sorting kmers...");
+  size_t nkmers[] = {0, 1, 10, 1000, 200000}, i;
+  for(i = 0; i < sizeof(nkmers)/sizeof(nkmers[0]); i++) {
+    test_bkmer_sort_nthreads(nkmers[i], 1);
+    test_bkmer_sort_nthreads(nkmers[i], 4);
+  }
+}
+
 void test_bkmer_functions()
 {
   TASSERT(sizeof(BinaryKmer) == NUM_BKMER_WORDS * 8);
@@ -156,5 +205,6 @@ void test_bkmer_functions()
   test_bkmer_revcmp();
   test_bkmer_shifts();
   test_bkmer_first_last_nuc();
+  test_bkmer_sort();
   // TODO: equal, less than, cmp
 }
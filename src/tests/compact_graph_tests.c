@@ -0,0 +1,150 @@
+#include "global.h"
+#include "all_tests.h"
+#include "db_node.h"
+#include "db_unitig.h"
+#include "compact_graph.h"
+#include "graph_cache.h"
+
+// Every link should have a link back
+static void check_links_symmetric(const CompactGraph *cgraph)
+{
+  const uint64_t *next, *back;
+  size_t uid, side, i, j, n, nback;
+  uint64_t e;
+
+  for(uid = 0; uid < cgraph->num_unitigs; uid++) {
+    for(side = 0; side < 2; side++) {
+      e = cgraph_end(uid, side);
+      n = compact_graph_next(cgraph, e, &next);
+      for(i = 0; i < n; i++) {
+        nback = compact_graph_next(cgraph, next[i], &back);
+        for(j = 0; j < nback && back[j] != e; j++) {}
+        TASSERT(j < nback);
+      }
+    }
+  }
+}
+
+// Unitig sequences should match db_unitig_fetch()
+static void check_unitig_nodes(const CompactGraph *cgraph,
+                               const dBGraph *graph)
+{
+  dBNodeBuffer nbuf0, nbuf1;
+  db_node_buf_alloc(&nbuf0, 64);
+  db_node_buf_alloc(&nbuf1, 64);
+  size_t uid, i, nkmers = 0;
+
+  for(uid = 0; uid < cgraph->num_unitigs; uid++)
+  {
+    db_node_buf_reset(&nbuf0);
+    db_node_buf_reset(&nbuf1);
+    compact_graph_unitig_nodes(cgraph, uid, &nbuf0);
+    TASSERT(nbuf0.len == cgraph->unitigs[uid].nkmers);
+
+    db_unitig_fetch(nbuf0.b[0].key, &nbuf1, graph);
+    db_unitig_normalise(nbuf1.b, nbuf1.len, graph);
+    TASSERT(nbuf0.len == nbuf1.len);
+    for(i = 0; i < nbuf0.len && i < nbuf1.len; i++)
+      TASSERT(db_nodes_are_equal(nbuf0.b[i], nbuf1.b[i]));
+
+    nkmers += nbuf0.len;
+  }
+
+  TASSERT(nkmers == hash_table_nkmers(&graph->ht));
+
+  db_node_buf_dealloc(&nbuf0);
+  db_node_buf_dealloc(&nbuf1);
+}
+
+// GraphCache should load the same unitigs with and without a compact graph
+static void check_graph_cache(const CompactGraph *cgraph, const dBGraph *graph)
+{
+  GraphCache cache0, cache1;
+  graph_cache_alloc(&cache0, graph);
+  graph_cache_alloc(&cache1, graph);
+  graph_cache_set_compact(&cache1, cgraph);
+
+  const GCacheStep *step0, *step1;
+  const GCacheUnitig *unitig0, *unitig1;
+  const dBNode *nodes0, *nodes1;
+  size_t uid, i, orient;
+  dBNode node;
+
+  for(uid = 0; uid < cgraph->num_unitigs; uid++)
+  {
+    for(orient = 0; orient < 2; orient++)
+    {
+      const CompactUnitig *u = &cgraph->unitigs[uid];
+      BinaryKmer bkmer = compact_graph_unitig_bkmer(cgraph, uid,
+                                                    orient ? u->nkmers-1 : 0);
+      node = db_graph_find(graph, bkmer);
+      if(orient) node = db_node_reverse(node);
+
+      graph_cache_reset(&cache0);
+      graph_cache_reset(&cache1);
+      graph_cache_new_path(&cache0);
+      graph_cache_new_path(&cache1);
+      step0 = graph_cache_new_step(&cache0, node);
+      step1 = graph_cache_new_step(&cache1, node);
+      TASSERT(step0->orient == step1->orient);
+
+      unitig0 = gc_step_get_unitig(&cache0, step0);
+      unitig1 = gc_step_get_unitig(&cache1, step1);
+      TASSERT(unitig0->num_nodes == u->nkmers);
+      TASSERT(unitig0->num_nodes == unitig1->num_nodes);
+      TASSERT(unitig0->num_next == unitig1->num_next);
+      TASSERT(unitig0->num_prev == unitig1->num_prev);
+
+      nodes0 = gc_unitig_get_nodes(&cache0, unitig0);
+      nodes1 = gc_unitig_get_nodes(&cache1, unitig1);
+      for(i = 0; i < unitig0->num_nodes && i < unitig1->num_nodes; i++)
+        TASSERT(db_nodes_are_equal(nodes0[i], nodes1[i]));
+    }
+  }
+
+  graph_cache_dealloc(&cache0);
+  graph_cache_dealloc(&cache1);
+}
+
+void test_compact_graph()
+{
+  test_status("testing compact_graph_build()...");
+
+  dBGraph graph;
+  size_t kmer_size = 19, ncols = 1;
+
+  db_graph_alloc(&graph, kmer_size, ncols, ncols, 1024,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+
+  // SNP bubble: two flanks and two branches of 19 kmers
+  const char *seq0 = "CCTAGGGTGCAGTCAATTGCCAACGGTCGGGAGATAACTTCTCCAAACCAGGTTCATGACAGCCAACCAA";
+  const char *seq1 = "CCTAGGGTGCAGTCAATTGCCAACGGTCGGGAcATAACTTCTCCAAACCAGGTTCATGACAGCCAACCAA";
+
+  build_graph_from_str_mt(&graph, 0, seq0, strlen(seq0), false);
+  build_graph_from_str_mt(&graph, 0, seq0, strlen(seq0), false);
+  build_graph_from_str_mt(&graph, 0, seq1, strlen(seq1), false);
+
+  CompactGraph cgraph;
+  compact_graph_alloc(&cgraph, &graph);
+  compact_graph_build(&cgraph, 2);
+
+  TASSERT2(cgraph.num_unitigs == 4, "num_unitigs: %zu", cgraph.num_unitigs);
+  check_links_symmetric(&cgraph);
+  check_unitig_nodes(&cgraph, &graph);
+  check_graph_cache(&cgraph, &graph);
+
+  // Branches have coverage 2 and 1
+  size_t uid, nbranch_covg[3] = {0};
+  for(uid = 0; uid < cgraph.num_unitigs; uid++) {
+    const CompactUnitig *u = &cgraph.unitigs[uid];
+    if(u->nkmers == kmer_size) {
+      TASSERT(u->covg_min == u->covg_max);
+      if(u->covg_min < 3) nbranch_covg[u->covg_min]++;
+      TASSERT(u->nnext[0] == 1 && u->nnext[1] == 1);
+    }
+  }
+  TASSERT(nbranch_covg[1] == 1 && nbranch_covg[2] == 1);
+
+  compact_graph_dealloc(&cgraph);
+  db_graph_dealloc(&graph);
+}
@@ -0,0 +1,79 @@
+#include "global.h"
+#include "all_tests.h"
+#include "db_graph.h"
+#include "db_node.h"
+#include "dist_matrix.h"
+
+#define DIST_NCOLS 70
+#define DIST_NKMERS 5000
+
+static void naive_dist_node(hkey_t hkey, const dBGraph *db_graph,
+                            uint64_t *matrix)
+{
+  size_t i, j, ncols = db_graph->num_of_cols;
+  for(i = 0; i < ncols; i++) {
+    if(db_node_has_col(db_graph, hkey, i)) {
+      for(j = i; j < ncols; j++) {
+        if(db_node_has_col(db_graph, hkey, j)) matrix[ncols*i+j]++;
+      }
+    }
+  }
+}
+
+static void test_dist_matrix_counts()
+{
+  test_status("Testing dist_matrix_count() against naive count");
+
+  dBGraph db_graph;
+  size_t i, col, nthreads, kmer_size = MAX_KMER_SIZE;
+  size_t ncols = DIST_NCOLS;
+  BinaryKmer bkmer;
+  bool found;
+  hkey_t hkey;
+
+  db_graph_alloc(&db_graph, kmer_size, ncols, 0, DIST_NKMERS*2,
+                 DBG_ALLOC_NODE_IN_COL);
+
+  // Colour i has each kmer with probability ~ (i+1)/ncols
+  for(i = 0; i < DIST_NKMERS; i++) {
+    bkmer = binary_kmer_get_key(binary_kmer_random(kmer_size), kmer_size);
+    hkey = hash_table_find_or_insert(&db_graph.ht, bkmer, &found);
+    for(col = 0; col < ncols; col++)
+      if((size_t)(rand() % ncols) <= col) db_node_set_col(&db_graph, hkey, col);
+    // Deleted kmers keep their colour bits, they must not be counted
+    if(i % 7 == 0) hash_table_delete(&db_graph.ht, hkey);
+  }
+
+  uint64_t *naive = ctx_calloc(ncols*ncols, sizeof(uint64_t));
+  uint64_t *matrix = ctx_calloc(ncols*ncols, sizeof(uint64_t));
+
+  HASH_ITERATE(&db_graph.ht, naive_dist_node, &db_graph, naive);
+
+  for(nthreads = 1; nthreads <= 3; nthreads++) {
+    memset(matrix, 0, ncols*ncols*sizeof(uint64_t));
+    dist_matrix_count(&db_graph, nthreads, matrix);
+    TASSERT(memcmp(matrix, naive, ncols*ncols*sizeof(uint64_t)) == 0);
+  }
+
+  ctx_free(naive);
+  ctx_free(matrix);
+  db_graph_dealloc(&db_graph);
+}
+
+static void test_dist_jaccard_mash()
+{
+  test_status("Testing Jaccard and Mash distances");
+  TASSERT(dist_jaccard(0, 0, 0) == 1);
+  TASSERT(dist_jaccard(0, 10, 5) == 0);
+  TASSERT(dist_jaccard(5, 10, 5) == 0.5);
+  TASSERT(dist_jaccard(10, 10, 10) == 1);
+  TASSERT(dist_mash(1, 21) == 0);
+  TASSERT(dist_mash(0, 21) == 1);
+  TASSERT(dist_mash(0.5, 21) > 0 && dist_mash(0.5, 21) < dist_mash(0.1, 21));
+}
+
+void test_dist_matrix()
+{
+  test_dist_matrix_counts();
+  test_dist_jaccard_mash();
+}
@@ -94,22 +94,23 @@ void load_bset(void *arg, size_t threadid)
   }
 }
 
-static void test_hash_table_mt()
+// If lock_free, pass bktlocks=NULL to use the lock-free insert
+static void test_hash_table_mt(bool lock_free)
 {
   // Generate 2000 random binary kmers
   // start 20 threads adding them to the hash table
   size_t i, kmer_size = MAX_KMER_SIZE;
   size_t nthreads = (rand() % 50)+1, nkmers = 1000000;
 
-  test_status("Testing hash table multithreading %zu threads, %zu kmers",
-              nthreads, nkmers);
+  test_status("Testing hash table multithreading %zu threads, %zu kmers%s",
+              nthreads, nkmers, lock_free ? " (lock-free)" : "");
 
   BKmerTestSet bset;
   bset.n = nkmers;
   hash_table_alloc(&bset.ht, bset.n*1.5);
   bset.bkmers = ctx_calloc(bset.n, sizeof(bset.bkmers[0]));
   bset.nadded = ctx_calloc(bset.n, sizeof(bset.nadded[0]));
-  bset.bktlocks = ctx_calloc((bset.ht.capacity+7)/8, 1);
+  bset.bktlocks = lock_free ? NULL : ctx_calloc((bset.ht.capacity+7)/8, 1);
 
   for(i = 0; i < bset.n; i++)
     bset.bkmers[i] = binary_kmer_random(kmer_size);
@@ -122,14 +123,66 @@ static void test_hash_table_mt()
 
   TASSERT(hash_table_nkmers(&bset.ht) == nkmers);
 
+  // Check every kmer can be found with both locked and lock-free finds
+  for(i = 0; i < bset.n; i++) {
+    TASSERT(hash_table_find(&bset.ht, bset.bkmers[i]) != HASH_NOT_FOUND);
+    TASSERT(hash_table_find_mt(&bset.ht, bset.bkmers[i], NULL) != HASH_NOT_FOUND);
+  }
+
   ctx_free(bset.bktlocks);
   ctx_free(bset.nadded);
   ctx_free(bset.bkmers);
   hash_table_dealloc(&bset.ht);
 }
 
+static void test_hash_table_batch()
+{
+  test_status("Testing batched hash table find / insert");
+
+  HashTable ht;
+  size_t i, j, kmer_size = MAX_KMER_SIZE, n = 1000, nnovel = 0;
+  uint8_t *bktlocks;
+  BinaryKmer bkeys[n];
+  hkey_t hkeys[n], hkeys2[n];
+  bool found[n];
+
+  hash_table_alloc(&ht, n*2);
+  bktlocks = ctx_calloc((ht.num_of_buckets+7)/8, 1);
+
+  for(i = 0; i < n; i++) {
+    bkeys[i] = binary_kmer_get_key(binary_kmer_random(kmer_size), kmer_size);
+    // repeat some kmers
+    if(i > 10 && rand() % 4 == 0) bkeys[i] = bkeys[rand() % i];
+  }
+
+  // Only first half are in the table
+  hash_table_find_or_insert_mt_batch(&ht, bkeys, n/2, hkeys, found, bktlocks);
+  for(i = 0; i < n/2; i++) nnovel += !found[i];
+  TASSERT(hash_table_nkmers(&ht) == nnovel);
+
+  hash_table_find_batch(&ht, bkeys, n, hkeys2);
+  for(i = 0; i < n; i++)
+    TASSERT(hkeys2[i] == hash_table_find(&ht, bkeys[i]));
+  for(i = 0; i < n/2; i++)
+    TASSERT(hkeys2[i] == hkeys[i]);
+
+  // Insert all, a kmer is found if it appeared earlier in the list
+  hash_table_find_or_insert_mt_batch(&ht, bkeys, n, hkeys, found, bktlocks);
+  for(i = 0; i < n; i++) {
+    TASSERT(hkeys[i] != HASH_NOT_FOUND);
+    TASSERT(hkeys[i] == hash_table_find(&ht, bkeys[i]));
+    for(j = 0; j < i && !binary_kmer_eq(bkeys[i], bkeys[j]); j++) {}
+    TASSERT(found[i] == (i < n/2 || j < i));
+  }
+
+  ctx_free(bktlocks);
+  hash_table_dealloc(&ht);
+}
+
 void test_hash_table()
 {
   test_add_remove();
-  test_hash_table_mt();
+  test_hash_table_mt(false);
+  test_hash_table_mt(true);
+  test_hash_table_batch();
 }
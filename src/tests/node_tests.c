@@ -87,8 +87,81 @@ static void test_left_shift()
   }
 }
 
+// Compare 8 bit coverage counters (DBG_ALLOC_COVGS8) against Covg counters
+static void test_covgs8_graph(bool col_major)
+{
+  dBGraph graph32, graph8;
+  size_t i, col, kmer_size = 11, ncols = 3, nkmers = 100;
+  int flags = col_major ? DBG_ALLOC_COLMAJOR : 0;
+  hkey_t hkeys[nkmers];
+  Covg covg;
+  bool found;
+
+  db_graph_alloc(&graph32, kmer_size, ncols, 1, 1024, DBG_ALLOC_COVGS | flags);
+  db_graph_alloc(&graph8,  kmer_size, ncols, 1, 1024, DBG_ALLOC_COVGS8 | flags);
+
+  for(i = 0; i < nkmers; i++) {
+    BinaryKmer bkmer = binary_kmer_random(kmer_size);
+    bkmer = binary_kmer_get_key(bkmer, kmer_size);
+    hkeys[i] = hash_table_find_or_insert(&graph32.ht, bkmer, &found);
+    TASSERT(hash_table_find_or_insert(&graph8.ht, bkmer, &found) == hkeys[i]);
+  }
+
+  // Add small and large updates so that some counters overflow
+  for(i = 0; i < 3000; i++) {
+    hkey_t hkey = hkeys[rand() % nkmers];
+    col = rand() % ncols;
+    covg = (rand() % 10 == 0) ? rand() % 1000 : 1;
+    if(i & 1) {
+      db_node_add_col_covg(&graph32, hkey, col, covg);
+      db_node_add_col_covg(&graph8, hkey, col, covg);
+    } else {
+      db_node_add_col_covg_mt(&graph32, hkey, col, covg);
+      db_node_add_col_covg_mt(&graph8, hkey, col, covg);
+    }
+  }
+
+  for(i = 0; i < nkmers; i++)
+    for(col = 0; col < ncols; col++)
+      TASSERT(db_node_get_covg(&graph32, hkeys[i], col) ==
+              db_node_get_covg(&graph8, hkeys[i], col));
+
+  // Set values below and above the 8 bit maximum
+  db_node_set_covg(&graph8, hkeys[0], 0, 300);
+  TASSERT(db_node_get_covg(&graph8, hkeys[0], 0) == 300);
+  db_node_set_covg(&graph8, hkeys[0], 0, 3);
+  TASSERT(db_node_get_covg(&graph8, hkeys[0], 0) == 3);
+  db_node_add_col_covg(&graph8, hkeys[0], 0, COVG8_MAX);
+  TASSERT(db_node_get_covg(&graph8, hkeys[0], 0) == COVG8_MAX + 3);
+  db_node_add_col_covg(&graph8, hkeys[0], 0, COVG_MAX);
+  TASSERT(db_node_get_covg(&graph8, hkeys[0], 0) == COVG_MAX);
+
+  // Wiping a colour removes its overflow entries
+  db_graph_wipe_colour(&graph8, 1);
+  for(i = 0; i < nkmers; i++) {
+    TASSERT(db_node_get_covg(&graph8, hkeys[i], 1) == 0);
+    TASSERT(db_node_get_covg(&graph8, hkeys[i], 2) ==
+            db_node_get_covg(&graph32, hkeys[i], 2));
+  }
+
+  db_graph_zero_covgs(&graph8);
+  TASSERT(covg_ovf_size(graph8.covg_ovf) == 0);
+  for(i = 0; i < nkmers; i++) TASSERT(db_node_sum_covg(&graph8, hkeys[i]) == 0);
+
+  db_graph_dealloc(&graph32);
+  db_graph_dealloc(&graph8);
+}
+
+static void test_covgs8()
+{
+  test_status("Testing 8 bit coverage counters with overflow table");
+  test_covgs8_graph(false);
+  test_covgs8_graph(true);
+}
+
 void test_db_node()
 {
   test_db_graph_next_nodes();
   test_left_shift();
+  test_covgs8();
 }
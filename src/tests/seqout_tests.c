@@ -0,0 +1,151 @@
+#include "global.h"
+#include "all_tests.h"
+#include "seqout.h"
+#include "bgzf_writer.h"
+
+#include <zlib.h>
+
+// Decompress a whole file with zlib, the same as `gzip -dc`
+static bool _read_gzip_file(const char *path, StrBuf *sbuf)
+{
+  char buf[4096];
+  int n;
+  gzFile gz = gzopen(path, "r");
+  if(gz == NULL) return false;
+  strbuf_reset(sbuf);
+  while((n = gzread(gz, buf, sizeof(buf))) > 0)
+    strbuf_append_strn(sbuf, buf, n);
+  bool compressed = !gzdirect(gz);
+  gzclose(gz);
+  return compressed && n == 0;
+}
+
+static bool _sbuf_eq(const StrBuf *a, const StrBuf *b)
+{
+  return a->end == b->end && memcmp(a->b, b->b, a->end) == 0;
+}
+
+static void test_bgzf_writer_gzip(const char *dir)
+{
+  test_status("Testing BgzfWriter output can be read by gzip");
+
+  // Several blocks of data written in uneven pieces by 3 threads
+  size_t i, n, len = BGZF_BLOCK_SIZE*5 + 1000;
+  char *data = ctx_malloc(len);
+  rand_bases(data, len);
+  for(i = 100; i < len; i += 100) data[i] = '\n';
+
+  StrBuf path, sbuf;
+  strbuf_alloc(&path, 256);
+  strbuf_alloc(&sbuf, len+1);
+  strbuf_sprintf(&path, "%s/bgzf.txt.gz", dir);
+
+  BgzfWriter *bw = bgzf_writer_open(path.b, 3);
+  for(i = 0; i < len; i += n) {
+    n = MIN2((size_t)(rand() % 5000) + 1, len - i);
+    bgzf_writer_write(bw, data + i, n);
+  }
+  bgzf_writer_close(bw);
+
+  TASSERT(_read_gzip_file(path.b, &sbuf));
+  TASSERT(sbuf.end == len && memcmp(sbuf.b, data, len) == 0);
+
+  // Empty file
+  bw = bgzf_writer_open(path.b, 3);
+  bgzf_writer_close(bw);
+  TASSERT(_read_gzip_file(path.b, &sbuf));
+  TASSERT(sbuf.end == 0);
+
+  TASSERT(unlink(path.b) == 0);
+  strbuf_dealloc(&path);
+  strbuf_dealloc(&sbuf);
+  ctx_free(data);
+}
+
+// Submit reads to seqout_print_ordered() in a random order and check they are
+// written in order of idx
+static void test_seqout_ordered(const char *dir, bool is_pe)
+{
+  test_status("Testing seqout_print_ordered() %s", is_pe ? "PE" : "SE");
+
+  const size_t nreads = 2000;
+  size_t i, j, *order = ctx_calloc(nreads, sizeof(size_t));
+  StrBuf *reads = ctx_calloc(nreads*2, sizeof(StrBuf));
+  StrBuf exp[2], out, base, path;
+  char seq[100];
+
+  strbuf_alloc(&exp[0], 1024);
+  strbuf_alloc(&exp[1], 1024);
+  strbuf_alloc(&out, 1024);
+  strbuf_alloc(&base, 256);
+  strbuf_alloc(&path, 256);
+
+  for(i = 0; i < nreads; i++) {
+    for(j = 0; j < 2; j++) {
+      rand_bases(seq, 50 + i % 50);
+      strbuf_alloc(&reads[2*i+j], 128);
+      strbuf_sprintf(&reads[2*i+j], ">r%zu/%zu\n%.*s\n",
+                     i, j+1, (int)(50 + i % 50), seq);
+      strbuf_append_strn(&exp[j], reads[2*i+j].b, reads[2*i+j].end);
+    }
+  }
+
+  // Shuffle, then move the last read to the front so that the pending buffer
+  // must grow past its initial size before anything is written
+  for(i = 0; i < nreads; i++) order[i] = i;
+  for(i = nreads-1; i > 0; i--) {
+    j = (size_t)rand() % (i+1);
+    SWAP(order[i], order[j]);
+  }
+  for(i = 0; order[i] != nreads-1; i++) {}
+  SWAP(order[0], order[i]);
+
+  SeqOutput seqout;
+  strbuf_sprintf(&base, "%s/%s", dir, is_pe ? "pe" : "se");
+  TASSERT(seqout_open(&seqout, base.b, SEQ_FMT_FASTA, is_pe, 4));
+
+  for(i = 0; i < nreads; i++) {
+    j = order[i];
+    seqout_print_ordered(&seqout, j, &reads[2*j],
+                         is_pe ? &reads[2*j+1] : NULL);
+    if(i == 0) TASSERT(seqout.next_idx == 0 && seqout.npending >= nreads);
+  }
+  TASSERT(seqout.next_idx == nreads);
+  seqout_close(&seqout, false);
+
+  strbuf_reset(&path);
+  strbuf_sprintf(&path, "%s.fa.gz", base.b);
+  TASSERT(_read_gzip_file(path.b, &out));
+  if(is_pe) TASSERT(out.end == 0);
+  else TASSERT(_sbuf_eq(&out, &exp[0]));
+  TASSERT(unlink(path.b) == 0);
+
+  for(j = 0; is_pe && j < 2; j++) {
+    strbuf_reset(&path);
+    strbuf_sprintf(&path, "%s.%zu.fa.gz", base.b, j+1);
+    TASSERT(_read_gzip_file(path.b, &out));
+    TASSERT(_sbuf_eq(&out, &exp[j]));
+    TASSERT(unlink(path.b) == 0);
+  }
+
+  for(i = 0; i < nreads*2; i++) strbuf_dealloc(&reads[i]);
+  ctx_free(reads);
+  ctx_free(order);
+  strbuf_dealloc(&exp[0]);
+  strbuf_dealloc(&exp[1]);
+  strbuf_dealloc(&out);
+  strbuf_dealloc(&base);
+  strbuf_dealloc(&path);
+}
+
+void test_seqout()
+{
+  char dir[] = "/tmp/ctx_seqout_tests.XXXXXX";
+  if(mkdtemp(dir) == NULL) die("Cannot create temp dir: %s", strerror(errno));
+
+  test_bgzf_writer_gzip(dir);
+  test_seqout_ordered(dir, false);
+  test_seqout_ordered(dir, true);
+
+  if(rmdir(dir) != 0) warn("Cannot remove temp dir: %s", dir);
+}
@@ -1,6 +1,7 @@
 #include "global.h"
 #include "all_tests.h"
 #include "util.h"
+#include "work_steal.h"
 
 #include <math.h> // NAN, INFINITY
 
@@ -145,6 +146,52 @@ static void test_util_calc_N50()
   TASSERT(calc_N50(arr, 10, 55) == 8);
 }
 
+typedef struct {
+  WorkSteal *ws;
+  volatile uint8_t *visits;
+} WorkStealTest;
+
+static void _work_steal_thread(void *arg, size_t threadid)
+{
+  WorkStealTest *t = (WorkStealTest*)arg;
+  size_t i, start, end;
+  while(work_steal_next(t->ws, threadid, &start, &end)) {
+    for(i = start; i < end; i++) __sync_fetch_and_add(&t->visits[i], 1);
+  }
+  work_steal_thread_done(t->ws, threadid);
+}
+
+static void test_work_steal()
+{
+  test_status("Testing work stealing visits each item once");
+  size_t nitems[] = {0, 1, 1023, 1024, 1025, 100000};
+  size_t nthreads[] = {1, 2, 3, 7};
+  size_t i, j, k, nvisited;
+  volatile uint8_t *visits = ctx_malloc(100000);
+  WorkSteal ws;
+
+  for(i = 0; i < sizeof(nitems)/sizeof(nitems[0]); i++) {
+    for(j = 0; j < sizeof(nthreads)/sizeof(nthreads[0]); j++) {
+      memset((uint8_t*)visits, 0, nitems[i]);
+      work_steal_alloc(&ws, nitems[i], nthreads[j], 4);
+      WorkStealTest t = {.ws = &ws, .visits = visits};
+      util_multi_thread(&t, nthreads[j], _work_steal_thread);
+      work_steal_dealloc(&ws);
+      for(k = nvisited = 0; k < nitems[i]; k++) nvisited += (visits[k] == 1);
+      TASSERT2(nvisited == nitems[i], "%zu / %zu", nvisited, nitems[i]);
+      // one item per chunk
+      memset((uint8_t*)visits, 0, nitems[i]);
+      work_steal_alloc_chunks(&ws, nitems[i], nthreads[j], 1);
+      util_multi_thread(&t, nthreads[j], _work_steal_thread);
+      work_steal_dealloc(&ws);
+      for(k = nvisited = 0; k < nitems[i]; k++) nvisited += (visits[k] == 1);
+      TASSERT2(nvisited == nitems[i], "%zu / %zu", nvisited, nitems[i]);
+    }
+  }
+
+  ctx_free((uint8_t*)visits);
+}
+
 void test_util()
 {
   test_util_rev_nibble_lookup();
@@ -154,4 +201,5 @@ void test_util()
   test_util_calc_GCD();
   test_util_calc_N50();
   test_strnstr();
+  test_work_steal();
 }
@@ -43,8 +43,8 @@ typedef struct
   // Passed to all instances
   const KOGraph *kograph;
   const dBGraph *db_graph;
-  gzFile gzout;
-  pthread_mutex_t *const out_lock;
+  BgzfWriter *out;
+  StrBuf outbuf; // each call is built here then written out in one go
   size_t *callid;
   const size_t min_ref_nkmers, max_ref_nkmers; // how many kmers of homology req
 } BreakpointCaller;
@@ -57,7 +57,7 @@ typedef struct
 #define MAX_REFRUNS_PER_CALLER(ncols) MAX_REFRUNS_PER_ORIENT(ncols)*2
 
 static BreakpointCaller* brkpt_callers_new(size_t num_callers,
-                                           gzFile gzout,
+                                           BgzfWriter *out,
                                            size_t min_ref_nkmers,
                                            size_t max_ref_nkmers,
                                            const KOGraph *kograph,
@@ -68,9 +68,6 @@ static BreakpointCaller* brkpt_callers_new(size_t num_callers,
   const size_t ncols = db_graph->num_of_cols;
   BreakpointCaller *callers = ctx_malloc(num_callers * sizeof(BreakpointCaller));
 
-  pthread_mutex_t *out_lock = ctx_malloc(sizeof(pthread_mutex_t));
-  if(pthread_mutex_init(out_lock, NULL) != 0) die("mutex init failed");
-
   size_t *callid = ctx_calloc(1, sizeof(size_t));
 
   // Each colour in each caller can have a GraphCache path at once
@@ -83,8 +80,7 @@ static BreakpointCaller* brkpt_callers_new(size_t num_callers,
     BreakpointCaller tmp = {.nthreads = num_callers,
                             .kograph = kograph,
                             .db_graph = db_graph,
-                            .gzout = gzout,
-                            .out_lock = out_lock,
+                            .out = out,
                             .callid = callid,
                             .allele_refs = path_ref_runs,
                             .flank5p_refs = path_ref_runs+MAX_REFRUNS_PER_ORIENT(ncols),
@@ -95,6 +91,7 @@ static BreakpointCaller* brkpt_callers_new(size_t num_callers,
 
     path_ref_runs += MAX_REFRUNS_PER_CALLER(ncols);
 
+    strbuf_alloc(&callers[i].outbuf, 4096);
     db_node_buf_alloc(&callers[i].allelebuf, 1024);
     db_node_buf_alloc(&callers[i].flank5pbuf, 1024);
     korun_buf_alloc(&callers[i].koruns_5p, 128);
@@ -115,6 +112,7 @@ static void brkpt_callers_destroy(BreakpointCaller *callers, size_t num_callers)
 {
   size_t i;
   for(i = 0; i < num_callers; i++) {
+    strbuf_dealloc(&callers[i].outbuf);
     db_node_buf_dealloc(&callers[i].allelebuf);
     db_node_buf_dealloc(&callers[i].flank5pbuf);
     korun_buf_dealloc(&callers[i].koruns_5p);
@@ -127,8 +125,6 @@ static void brkpt_callers_destroy(BreakpointCaller *callers, size_t num_callers)
     graph_crawler_dealloc(&callers[i].crawlers[0]);
     graph_crawler_dealloc(&callers[i].crawlers[1]);
   }
-  pthread_mutex_destroy(callers[0].out_lock);
-  ctx_free(callers[0].out_lock);
   ctx_free(callers[0].callid);
   ctx_free(callers[0].allele_refs);
   ctx_free(callers);
@@ -141,7 +137,7 @@ static void process_contig(BreakpointCaller *caller,
                            const KOccurRun *flank5p_runs, size_t nflank5p_runs,
                            const KOccurRun *flank3p_runs, size_t nflank3p_runs)
 {
-  gzFile gzout = caller->gzout;
+  StrBuf *sbuf = &caller->outbuf;
   const KOGraph *kograph = caller->kograph;
   const size_t kmer_size = caller->db_graph->kmer_size;
 
@@ -159,36 +155,37 @@ static void process_contig(BreakpointCaller *caller,
   size_t kmer3poffset = kmer_size-1-extra3pbases;
 
   size_t callid = __sync_fetch_and_add((volatile size_t*)caller->callid, 1);
-  pthread_mutex_lock(caller->out_lock);
+  strbuf_reset(sbuf);
 
   // This can be set to anything without a '.' in it
   const char prefix[] = "call";
 
   // 5p flank with list of ref intersections
-  gzprintf(gzout, ">brkpnt.%s%zu.5pflank chr=", prefix, callid);
-  koruns_gzprint(gzout, kmer_size, kograph, flank5p_runs, nflank5p_runs, 0, 0);
-  gzputc(gzout, '\n');
-  db_nodes_gzprint(flank5p->b, flank5p->len, caller->db_graph, gzout);
-  gzputc(gzout, '\n');
+  strbuf_sprintf(sbuf, ">brkpnt.%s%zu.5pflank chr=", prefix, callid);
+  koruns_strbuf(sbuf, kmer_size, kograph, flank5p_runs, nflank5p_runs, 0, 0);
+  strbuf_append_char(sbuf, '\n');
+  db_nodes_strbuf(flank5p->b, flank5p->len, caller->db_graph, sbuf);
+  strbuf_append_char(sbuf, '\n');
 
   // 3p flank with list of ref intersections
-  gzprintf(gzout, ">brkpnt.%s%zu.3pflank chr=", prefix, callid);
-  koruns_gzprint(gzout, kmer_size, kograph, flank3p_runs, nflank3p_runs,
-                 flank3pidx, kmer3poffset);
-  gzputc(gzout, '\n');
-  db_nodes_gzprint_cont(allelebuf->b+num_path_kmers,
-                        allelebuf->len-num_path_kmers,
-                        caller->db_graph, gzout);
-  gzputc(gzout, '\n');
+  strbuf_sprintf(sbuf, ">brkpnt.%s%zu.3pflank chr=", prefix, callid);
+  koruns_strbuf(sbuf, kmer_size, kograph, flank3p_runs, nflank3p_runs,
+                flank3pidx, kmer3poffset);
+  strbuf_append_char(sbuf, '\n');
+  db_nodes_strbuf_cont(allelebuf->b+num_path_kmers,
+                       allelebuf->len-num_path_kmers,
+                       caller->db_graph, sbuf);
+  strbuf_append_char(sbuf, '\n');
 
   // Print path with list of colours
-  gzprintf(gzout, ">brkpnt.%s%zu.path cols=%zu", prefix, callid, cols[0]);
-  for(i = 1; i < ncols; i++) gzprintf(gzout, ",%zu", cols[i]);
-  gzputc(gzout, '\n');
-  db_nodes_gzprint_cont(allelebuf->b, num_path_kmers, caller->db_graph, gzout);
-  gzprintf(gzout, "\n\n");
-
-  pthread_mutex_unlock(caller->out_lock);
+  strbuf_sprintf(sbuf, ">brkpnt.%s%zu.path cols=%zu", prefix, callid, cols[0]);
+  for(i = 1; i < ncols; i++) strbuf_sprintf(sbuf, ",%zu", cols[i]);
+  strbuf_append_char(sbuf, '\n');
+  db_nodes_strbuf_cont(allelebuf->b, num_path_kmers, caller->db_graph, sbuf);
+  strbuf_append_str(sbuf, "\n\n");
+
+  // thread safe, a call is never split by other threads
+  bgzf_writer_write(caller->out, sbuf->b, sbuf->end);
 }
 
 
@@ -530,10 +527,10 @@ static void breakpoint_caller(void *ptr, size_t threadid)
                     breakpoint_caller_node, caller);
 }
 
-// Print JSON header to gzout
-static void breakpoints_print_header(gzFile gzout, const char *out_path,
+// Print JSON header to out
+static void breakpoints_print_header(BgzfWriter *out, const char *out_path,
                                      char **seq_paths, size_t nseq_paths,
-                                     const read_t *reads, size_t nreads,
+                                     const KOGraph *kograph,
                                      bool load_ref_edges,
                                      size_t min_ref_nkmers,
                                      size_t max_ref_nkmers,
@@ -583,37 +580,37 @@ static void breakpoints_print_header(gzFile gzout, const char *out_path,
 
   // List contigs
   cJSON *contigs = cJSON_CreateArray();
-  for(i = 0; i < nreads; i++) {
+  for(i = 0; i < kograph->nchroms; i++) {
     cJSON *contig = cJSON_CreateObject();
-    cJSON_AddStringToObject(contig, "id", reads[i].name.b);
-    cJSON_AddNumberToObject(contig, "length", reads[i].seq.end);
+    cJSON_AddStringToObject(contig, "id", kograph->chroms[i].name);
+    cJSON_AddNumberToObject(contig, "length", kograph->chroms[i].length);
     cJSON_AddItemToArray(contigs, contig);
   }
   json_hdr_augment_cmd(json, "breakpoints", "contigs", contigs);
 
   // Write header to file
-  json_hdr_gzprint(json, gzout);
+  json_hdr_bgzfprint(json, out);
 
   // Print comments about the format
-  gzputs(gzout, "\n");
-  gzputs(gzout, "# This file was generated with McCortex\n");
-  gzputs(gzout, "#   written by Isaac Turner <turner.isaac@gmail.com>\n");
-  gzputs(gzout, "#   url: "MCCORTEX_URL"\n");
-  gzputs(gzout, "# \n");
-  gzputs(gzout, "# Comment lines begin with a # and are ignored, but must come after the header\n");
-  gzputs(gzout, "# Format is:\n");
-  gzputs(gzout, "#   chr=seq:start-end:strand:offset\n");
-  gzputs(gzout, "#   all coordinates are 1-based\n");
-  gzputs(gzout, "#   <strand> is + or -. If +, start <= end. If -, start >= end.\n");
-  gzputs(gzout, "#   <offset> is the position in the sequence where ref starts agreeing\n");
-  gzputs(gzout, "\n");
+  bgzf_writer_puts(out, "\n");
+  bgzf_writer_puts(out, "# This file was generated with McCortex\n");
+  bgzf_writer_puts(out, "#   written by Isaac Turner <turner.isaac@gmail.com>\n");
+  bgzf_writer_puts(out, "#   url: "MCCORTEX_URL"\n");
+  bgzf_writer_puts(out, "# \n");
+  bgzf_writer_puts(out, "# Comment lines begin with a # and are ignored, but must come after the header\n");
+  bgzf_writer_puts(out, "# Format is:\n");
+  bgzf_writer_puts(out, "#   chr=seq:start-end:strand:offset\n");
+  bgzf_writer_puts(out, "#   all coordinates are 1-based\n");
+  bgzf_writer_puts(out, "#   <strand> is + or -. If +, start <= end. If -, start >= end.\n");
+  bgzf_writer_puts(out, "#   <offset> is the position in the sequence where ref starts agreeing\n");
+  bgzf_writer_puts(out, "\n");
 
   cJSON_Delete(json);
 }
 
 void breakpoints_call(size_t nthreads, size_t ref_col,
-                      gzFile gzout, const char *out_path,
-                      const read_t *reads, size_t num_reads,
+                      BgzfWriter *out, const char *out_path,
+                      const KOGraph *kograph,
                       char **seq_paths, size_t num_seq_paths,
                       bool load_ref_edges,
                       size_t min_ref_nkmers, size_t max_ref_nkmers,
@@ -621,19 +618,10 @@ void breakpoints_call(size_t nthreads, size_t ref_col,
                       dBGraph *db_graph)
 {
   ctx_assert(!max_ref_nkmers || min_ref_nkmers <= max_ref_nkmers);
-  // Temporarily hide edges from kograph_create if we don't want to load edges
-  Edges *tmp_edges = db_graph->col_edges;
-  if(!load_ref_edges) db_graph->col_edges = NULL;
-
-  KOGraph kograph = kograph_create(reads, num_reads, true, ref_col,
-                                   nthreads, db_graph);
-
-  // Restore graph edges
-  db_graph->col_edges = tmp_edges;
 
-  BreakpointCaller *callers = brkpt_callers_new(nthreads, gzout,
+  BreakpointCaller *callers = brkpt_callers_new(nthreads, out,
                                                 min_ref_nkmers, max_ref_nkmers,
-                                                &kograph, db_graph);
+                                                kograph, db_graph);
 
   status("Running BreakpointCaller with %zu thread%s, output to: %s",
          nthreads, util_plural_str(nthreads),
@@ -642,9 +630,9 @@ void breakpoints_call(size_t nthreads, size_t ref_col,
   status("  Finding breakpoints after at least %zu kmers (%zubp) of homology",
          min_ref_nkmers, min_ref_nkmers+db_graph->kmer_size-1);
 
-  breakpoints_print_header(gzout, out_path,
+  breakpoints_print_header(out, out_path,
                            seq_paths, num_seq_paths,
-                           reads, num_reads,
+                           kograph,
                            load_ref_edges,
                            min_ref_nkmers, min_ref_nkmers,
                            hdrs, nhdrs,
@@ -658,5 +646,4 @@ void breakpoints_call(size_t nthreads, size_t ref_col,
   status("  %s calls printed to %s", call_num_str, futil_outpath_str(out_path));
 
   brkpt_callers_destroy(callers, nthreads);
-  kograph_dealloc(&kograph);
 }
@@ -15,7 +15,7 @@
 
 BubbleCaller* bubble_callers_new(size_t num_callers,
                                  const BubbleCallingPrefs *prefs,
-                                 gzFile gzout,
+                                 BgzfWriter *out,
                                  const dBGraph *db_graph)
 {
   ctx_assert(num_callers > 0);
@@ -26,9 +26,6 @@ BubbleCaller* bubble_callers_new(size_t num_callers,
 
   BubbleCaller *callers = ctx_malloc(num_callers * sizeof(BubbleCaller));
 
-  pthread_mutex_t *out_lock = ctx_malloc(sizeof(pthread_mutex_t));
-  if(pthread_mutex_init(out_lock, NULL) != 0) die("mutex init failed");
-
   uint64_t *nbubbles_ptr = ctx_calloc(1, sizeof(uint64_t));
 
   for(i = 0; i < num_callers; i++)
@@ -41,8 +38,7 @@ BubbleCaller* bubble_callers_new(size_t num_callers,
                         .num_serial_bubbles = 0,
                         .nbubbles_ptr = nbubbles_ptr,
                         .prefs = prefs,
-                        .db_graph = db_graph, .gzout = gzout,
-                        .out_lock = out_lock};
+                        .db_graph = db_graph, .out = out};
 
     memcpy(&callers[i], &tmp, sizeof(BubbleCaller));
 
@@ -86,14 +82,12 @@ void bubble_callers_destroy(BubbleCaller *callers, size_t num_callers)
     cache_stepptr_buf_dealloc(&callers[i].spp_reverse);
     strbuf_dealloc(&callers[i].output_buf);
   }
-  pthread_mutex_destroy(callers[0].out_lock);
-  ctx_free(callers[0].out_lock);
   ctx_free(callers[0].nbubbles_ptr);
   ctx_free(callers);
 }
 
-// Print JSON header to gzout
-static void bubble_caller_print_header(gzFile gzout, const char* out_path,
+// Print JSON header to out
+static void bubble_caller_print_header(BgzfWriter *out, const char* out_path,
                                        const BubbleCallingPrefs *prefs,
                                        cJSON **hdrs, size_t nhdrs,
                                        const dBGraph *db_graph)
@@ -119,16 +113,16 @@ static void bubble_caller_print_header(gzFile gzout, const char* out_path,
   json_hdr_augment_cmd(json, "bubbles", "haploid_colours", haploids);
 
   // Write header to file
-  json_hdr_gzprint(json, gzout);
+  json_hdr_bgzfprint(json, out);
 
   // Print comments about the format
-  gzputs(gzout, "\n");
-  gzputs(gzout, "# This file was generated with McCortex\n");
-  gzputs(gzout, "#   written by Isaac Turner <turner.isaac@gmail.com>\n");
-  gzputs(gzout, "#   url: "MCCORTEX_URL"\n");
-  gzputs(gzout, "# \n");
-  gzputs(gzout, "# Comment lines begin with a # and are ignored, but must come after the header\n");
-  gzputs(gzout, "\n");
+  bgzf_writer_puts(out, "\n");
+  bgzf_writer_puts(out, "# This file was generated with McCortex\n");
+  bgzf_writer_puts(out, "#   written by Isaac Turner <turner.isaac@gmail.com>\n");
+  bgzf_writer_puts(out, "#   url: "MCCORTEX_URL"\n");
+  bgzf_writer_puts(out, "# \n");
+  bgzf_writer_puts(out, "# Comment lines begin with a # and are ignored, but must come after the header\n");
+  bgzf_writer_puts(out, "\n");
 
   cJSON_Delete(json);
 }
@@ -181,7 +175,7 @@ static void print_bubble(BubbleCaller *caller,
   // Print Bubble
   //
 
-  // write to string buffer then flush to gzFile
+  // write to string buffer then flush to output
   StrBuf *sbuf = &caller->output_buf;
   strbuf_reset(sbuf);
 
@@ -243,10 +237,8 @@ static void print_bubble(BubbleCaller *caller,
 
   ctx_assert(strlen(sbuf->b) == sbuf->end);
 
-  // lock, print, unlock
-  pthread_mutex_lock(caller->out_lock);
-  gzwrite(caller->gzout, sbuf->b, sbuf->end);
-  pthread_mutex_unlock(caller->out_lock);
+  // thread safe, compressed by output threads
+  bgzf_writer_write(caller->out, sbuf->b, sbuf->end);
 }
 
 // `fork_node` is a node with outdegree > 1
@@ -490,14 +482,15 @@ void bubble_caller(void *args, size_t threadid)
 {
   BubbleCaller *caller = (BubbleCaller*)args;
 
-  HASH_ITERATE_PART(&caller->db_graph->ht, threadid, caller->nthreads,
-                    bubble_caller_node, caller);
+  HASH_ITERATE_STEAL(&caller->db_graph->ht, caller->ws, threadid,
+                     bubble_caller_node, caller);
 }
 
 void invoke_bubble_caller(size_t num_of_threads,
                           const BubbleCallingPrefs *prefs,
-                          gzFile gzout, const char *out_path,
+                          BgzfWriter *out, const char *out_path,
                           cJSON **hdrs, size_t nhdrs,
+                          const CompactGraph *cgraph,
                           const dBGraph *db_graph)
 {
   ctx_assert(db_graph->num_edge_cols == 1);
@@ -513,15 +506,26 @@ void invoke_bubble_caller(size_t num_of_threads,
   strbuf_dealloc(&tmpstr);
 
   // Print header
-  bubble_caller_print_header(gzout, out_path, prefs, hdrs, nhdrs, db_graph);
+  bubble_caller_print_header(out, out_path, prefs, hdrs, nhdrs, db_graph);
 
   BubbleCaller *callers = bubble_callers_new(num_of_threads, prefs,
-                                             gzout, db_graph);
+                                             out, db_graph);
+
+  WorkSteal ws;
+  work_steal_alloc(&ws, hash_table_size(&db_graph->ht), num_of_threads,
+                   WORK_STEAL_CHUNKS_PER_THREAD);
+  for(i = 0; i < num_of_threads; i++) {
+    callers[i].ws = &ws;
+    graph_cache_set_compact(&callers[i].cache, cgraph);
+  }
 
   // Run
   util_run_threads(callers, num_of_threads, sizeof(callers[0]),
                    num_of_threads, bubble_caller);
 
+  work_steal_print_stats(&ws, "bubbles");
+  work_steal_dealloc(&ws);
+
   // Report number of bubble called+printed
   uint64_t nhaploid = 0, nserial = 0, nbubbles = callers[0].nbubbles_ptr[0];
 
@@ -6,6 +6,7 @@
 #include "graph_walker.h"
 #include "repeat_walker.h"
 #include "cmd.h"
+#include "bgzf_writer.h"
 
 #include "cJSON/cJSON.h"
 
@@ -50,15 +51,15 @@ typedef struct
 
   // Shared data
   uint64_t *nbubbles_ptr; // statistics - shared pointer
+  WorkSteal *ws; // splits the hash table between threads
   const BubbleCallingPrefs *prefs;
   const dBGraph *db_graph;
-  gzFile gzout;
-  pthread_mutex_t *const out_lock;
+  BgzfWriter *out;
 } BubbleCaller;
 
 BubbleCaller* bubble_callers_new(size_t num_callers,
                                  const BubbleCallingPrefs *prefs,
-                                 gzFile gzout,
+                                 BgzfWriter *out,
                                  const dBGraph *db_graph);
 
 void bubble_callers_destroy(BubbleCaller *callers, size_t num_callers);
@@ -70,13 +71,15 @@ void find_bubbles(BubbleCaller *caller, dBNode fork_node);
 // or caller->spp_reverse (if they traverse the unitig in reverse)
 void find_bubbles_ending_with(BubbleCaller *caller, GCacheUnitig *unitig);
 
-// Run bubble caller, write output to gzout
+// Run bubble caller, write output to `out`
 // @param hdrs JSON headers of input files
 // @param nhdrs number of JSON headers of input files
+// @param cgraph compacted unitigs of db_graph to fetch branches from, or NULL
 void invoke_bubble_caller(size_t num_of_threads,
                           const BubbleCallingPrefs *prefs,
-                          gzFile gzout, const char *out_path,
+                          BgzfWriter *out, const char *out_path,
                           cJSON **hdrs, size_t nhdrs,
+                          const CompactGraph *cgraph,
                           const dBGraph *db_graph);
 
 #endif /* BUBBLE_CALLER_H_ */
@@ -96,54 +96,60 @@ static bool seq_reads_are_novel(read_t *r1, read_t *r2,
 // Add to the de bruijn graph
 //
 
-static inline dBNode _find_or_insert(dBGraph *db_graph,
-                                     BinaryKmer bkmer, size_t colour,
-                                     bool must_exist_in_graph, bool *found)
-{
-  dBNode node;
-  if(must_exist_in_graph)
-  {
-    // Doesn't have to be threadsafe find_mt, since we are not adding
-    node = db_graph_find_node(db_graph, bkmer);
-    *found = (node.key != HASH_NOT_FOUND);
-    if(*found) db_graph_update_node_mt(db_graph, node, colour);
-  }
-  else
-  {
-    node = db_graph_find_or_add_node_mt(db_graph, bkmer, found);
-    db_graph_update_node_mt(db_graph, node, colour);
-  }
-  return node;
-}
-
 // Threadsafe
 // Sequence must be entirely ACGT and len >= kmer_size
 // Returns number of non-novel kmers seen
+// Kmers are looked up in batches of HT_BATCH_SIZE so that hash table buckets
+// can be prefetched
 size_t build_graph_from_str_mt(dBGraph *db_graph, size_t colour,
                                const char *seq, size_t len,
                                bool must_exist_in_graph)
 {
   ctx_assert(len >= db_graph->kmer_size);
-  const size_t kmer_size = db_graph->kmer_size;
-  BinaryKmer bkmer;
+  const size_t kmer_size = db_graph->kmer_size, nkmers = len + 1 - kmer_size;
+  BinaryKmer bkmer, bkmers[HT_BATCH_SIZE], bkeys[HT_BATCH_SIZE];
+  hkey_t hkeys[HT_BATCH_SIZE];
+  bool found[HT_BATCH_SIZE];
   Nucleotide nuc;
-  dBNode prev, curr;
-  size_t i, num_nonnovel_kmers = 0;
+  dBNode prev = DB_NODE_INIT, curr;
+  size_t i, j, n, num_nonnovel_kmers = 0;
   size_t edge_col = db_graph->num_edge_cols == 1 ? 0 : colour;
-  bool found;
 
   bkmer = binary_kmer_from_str(seq, kmer_size);
-  prev = _find_or_insert(db_graph, bkmer, colour, must_exist_in_graph, &found);
-  num_nonnovel_kmers += found;
+  bkmer = binary_kmer_right_shift_one_base(bkmer);
 
-  for(i = kmer_size; i < len; i++, prev = curr)
+  for(i = 0; i < nkmers; i += n)
   {
-    nuc = dna_char_to_nuc(seq[i]);
-    bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
-    curr = _find_or_insert(db_graph, bkmer, colour, must_exist_in_graph, &found);
-    if(prev.key != HASH_NOT_FOUND && curr.key != HASH_NOT_FOUND)
-      db_graph_add_edge_mt(db_graph, edge_col, prev, curr);
-    num_nonnovel_kmers += found;
+    n = MIN2(nkmers - i, HT_BATCH_SIZE);
+
+    for(j = 0; j < n; j++) {
+      nuc = dna_char_to_nuc(seq[i+j+kmer_size-1]);
+      bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
+      bkmers[j] = bkmer;
+      bkeys[j] = binary_kmer_get_key(bkmer, kmer_size);
+    }
+
+    if(must_exist_in_graph) {
+      // Doesn't have to be threadsafe find_mt, since we are not adding
+      hash_table_find_batch(&db_graph->ht, bkeys, n, hkeys);
+      for(j = 0; j < n; j++) found[j] = (hkeys[j] != HASH_NOT_FOUND);
+    }
+    else {
+      hash_table_find_or_insert_mt_batch(&db_graph->ht, bkeys, n, hkeys, found,
+                                         db_graph->bktlocks);
+    }
+
+    for(j = 0; j < n; j++, prev = curr)
+    {
+      curr.key = hkeys[j];
+      curr.orient = bkmer_get_orientation(bkmers[j], bkeys[j]);
+      if(curr.key != HASH_NOT_FOUND) {
+        db_graph_update_node_mt(db_graph, curr, colour);
+        if(prev.key != HASH_NOT_FOUND)
+          db_graph_add_edge_mt(db_graph, edge_col, prev, curr);
+      }
+      num_nonnovel_kmers += found[j];
+    }
   }
 
   return num_nonnovel_kmers;
@@ -254,11 +260,10 @@ static void add_reads_to_graph(AsyncIOData *data, size_t threadid, void *ptr)
 }
 
 // One thread used per input file, nthreads used to add reads to graph
+// Uses lock-free inserts if db_graph->bktlocks is NULL
 void build_graph(dBGraph *db_graph, BuildGraphTask *files,
                  size_t nfiles, size_t nthreads)
 {
-  ctx_assert(db_graph->bktlocks != NULL);
-
   // Start async io reading
   AsyncIOInput *async_tasks = ctx_malloc(nfiles * sizeof(AsyncIOInput));
   size_t i, f;
@@ -300,9 +300,7 @@ static void correct_read(CorrectReadsWorker *wrkr, AsyncIOData *data)
     // Single ended read
     handle_read(wrkr, params, r1, rbuf1, qbuf, fq_cutoff1, hp_cutoff,
                 nodebuf, posbuf, format, wrkr->append_orig_seq);
-    pthread_mutex_lock(&output->lock_se);
-    gzwrite(output->gzout_se, rbuf1->b, rbuf1->end);
-    pthread_mutex_unlock(&output->lock_se);
+    seqout_print_ordered(output, data->idx, rbuf1, NULL);
   }
   else
   {
@@ -311,10 +309,7 @@ static void correct_read(CorrectReadsWorker *wrkr, AsyncIOData *data)
                 nodebuf, posbuf, format, wrkr->append_orig_seq);
     handle_read(wrkr, params, r2, rbuf2, qbuf, fq_cutoff2, hp_cutoff,
                 nodebuf, posbuf, format, wrkr->append_orig_seq);
-    pthread_mutex_lock(&output->lock_pe);
-    gzwrite(output->gzout_pe[0], rbuf1->b, rbuf1->end);
-    gzwrite(output->gzout_pe[1], rbuf2->b, rbuf2->end);
-    pthread_mutex_unlock(&output->lock_pe);
+    seqout_print_ordered(output, data->idx, rbuf1, rbuf2);
   }
 }
 
@@ -0,0 +1,172 @@
+#include "global.h"
+#include "dist_matrix.h"
+#include "db_node.h"
+#include "work_steal.h"
+#include "util.h"
+
+#include <math.h> // log()
+
+typedef struct
+{
+  const dBGraph *db_graph;
+  const size_t nblocks; // number of 64 kmer blocks in the hash table
+  WorkSteal *ws; // splits tiles between threads
+  uint64_t **matrices; // one ncols x ncols matrix per thread
+} DistMatrixJob;
+
+size_t dist_matrix_thread_mem(size_t ncols)
+{
+  return ncols * ncols * sizeof(uint64_t) + // matrix
+         ncols * DIST_TILE_WORDS * sizeof(uint64_t) + // tile
+         ncols * sizeof(size_t); // list of colours in tile
+}
+
+static inline uint64_t and_popcount(const uint64_t *a, const uint64_t *b)
+{
+  size_t w;
+  uint64_t n = 0;
+  for(w = 0; w < DIST_TILE_WORDS; w++) n += __builtin_popcountll(a[w] & b[w]);
+  return n;
+}
+
+// Load kmers [blk*64, (blk+nblocks)*64) into `tile`. tile[col*DIST_TILE_WORDS+b]
+// has a bit set for each kmer in block b that is in colour col. Returns
+// the number of colours with any kmers in the tile, which are listed in `cols`.
+static size_t dist_load_tile(const dBGraph *db_graph, size_t blk,
+                             size_t nblocks, uint64_t *tile, size_t *cols)
+{
+  const HashTable *ht = &db_graph->ht;
+  const size_t ncols = db_graph->num_of_cols;
+  const size_t nbytes = roundup_bits2bytes(ht->capacity);
+  const uint8_t *kset;
+  size_t b, k, col, hkey, byte, end, ncolsin = 0;
+  uint64_t assigned, word;
+
+  memset(tile, 0, ncols * DIST_TILE_WORDS * sizeof(uint64_t));
+
+  for(b = 0; b < nblocks; b++)
+  {
+    // Only count kmers that are in the hash table
+    hkey = (blk+b)*64;
+    end = MIN2(hkey+64, ht->capacity);
+    for(assigned = 0; hkey < end; hkey++)
+      if(hash_table_assigned(ht, hkey)) assigned |= 1UL << (hkey % 64);
+
+    if(!assigned) continue;
+
+    // bytes of the kset are interleaved between colours
+    byte = (blk+b)*8;
+    end = MIN2(byte+8, nbytes);
+    for(col = 0; col < ncols; col++) {
+      kset = db_graph->node_in_cols + byte*ncols + col;
+      for(word = 0, k = 0; byte+k < end; k++)
+        word |= (uint64_t)kset[k*ncols] << (8*k);
+      tile[col*DIST_TILE_WORDS+b] = word & assigned;
+    }
+  }
+
+  for(col = 0; col < ncols; col++) {
+    for(b = 0; b < nblocks && !tile[col*DIST_TILE_WORDS+b]; b++) {}
+    if(b < nblocks) cols[ncolsin++] = col;
+  }
+
+  return ncolsin;
+}
+
+// Add shared kmer counts for all pairs of colours in a tile
+static void dist_count_tile(const uint64_t *tile, const size_t *cols,
+                            size_t ncolsin, size_t ncols, uint64_t *matrix)
+{
+  size_t bi, bj, i, j, iend, jend;
+  const uint64_t *rowi;
+
+  for(bi = 0; bi < ncolsin; bi += DIST_COL_BLOCK) {
+    iend = MIN2(bi+DIST_COL_BLOCK, ncolsin);
+    for(bj = bi; bj < ncolsin; bj += DIST_COL_BLOCK) {
+      jend = MIN2(bj+DIST_COL_BLOCK, ncolsin);
+      for(i = bi; i < iend; i++) {
+        rowi = tile + cols[i]*DIST_TILE_WORDS;
+        for(j = MAX2(i, bj); j < jend; j++) {
+          matrix[ncols*cols[i]+cols[j]]
+            += and_popcount(rowi, tile + cols[j]*DIST_TILE_WORDS);
+        }
+      }
+    }
+  }
+}
+
+static void dist_matrix_thread(void *arg, size_t threadid)
+{
+  DistMatrixJob *job = (DistMatrixJob*)arg;
+  const size_t ncols = job->db_graph->num_of_cols;
+  uint64_t *tile = ctx_malloc(ncols * DIST_TILE_WORDS * sizeof(uint64_t));
+  size_t *cols = ctx_malloc(ncols * sizeof(size_t));
+  size_t start, end, t, n, ncolsin;
+
+  // work is split into tiles
+  while(work_steal_next(job->ws, threadid, &start, &end)) {
+    for(t = start; t < end; t++) {
+      n = MIN2(DIST_TILE_WORDS, job->nblocks - t*DIST_TILE_WORDS);
+      ncolsin = dist_load_tile(job->db_graph, t*DIST_TILE_WORDS, n, tile, cols);
+      dist_count_tile(tile, cols, ncolsin, ncols, job->matrices[threadid]);
+    }
+  }
+  work_steal_thread_done(job->ws, threadid);
+
+  ctx_free(tile);
+  ctx_free(cols);
+}
+
+/**
+ * Count kmers shared between each pair of colours
+ * @param matrix ncols x ncols, upper triangle (including diagonal) is set
+ */
+void dist_matrix_count(const dBGraph *db_graph, size_t nthreads,
+                       uint64_t *matrix)
+{
+  ctx_assert(db_graph->node_in_cols != NULL);
+  ctx_assert(nthreads > 0);
+
+  const size_t ncols = db_graph->num_of_cols;
+  const size_t nblocks = roundup_bits2words64(db_graph->ht.capacity);
+  const size_t ntiles = (nblocks + DIST_TILE_WORDS - 1) / DIST_TILE_WORDS;
+  size_t i, j, row, col;
+
+  WorkSteal ws;
+  work_steal_alloc_chunks(&ws, ntiles, nthreads, 1);
+
+  uint64_t **matrices = ctx_calloc(nthreads, sizeof(uint64_t*));
+  for(i = 0; i < nthreads; i++)
+    matrices[i] = ctx_calloc(ncols*ncols, sizeof(uint64_t));
+
+  DistMatrixJob job = {.db_graph = db_graph, .nblocks = nblocks,
+                       .ws = &ws, .matrices = matrices};
+  util_multi_thread(&job, nthreads, dist_matrix_thread);
+
+  work_steal_print_stats(&ws, "dist_matrix");
+  work_steal_dealloc(&ws);
+
+  // Merge matrices
+  for(i = 1; i < nthreads; i++)
+    for(j = 0; j < ncols*ncols; j++)
+      matrices[0][j] += matrices[i][j];
+
+  for(row = 0; row < ncols; row++)
+    for(col = row; col < ncols; col++)
+      matrix[ncols*row+col] = matrices[0][ncols*row+col];
+
+  for(i = 0; i < nthreads; i++) ctx_free(matrices[i]);
+  ctx_free(matrices);
+}
+
+double dist_jaccard(uint64_t nshared, uint64_t na, uint64_t nb)
+{
+  uint64_t nunion = na + nb - nshared;
+  return nunion ? (double)nshared / nunion : 1;
+}
+
+double dist_mash(double jaccard, size_t kmer_size)
+{
+  if(jaccard <= 0) return 1;
+  return MAX2(0, -log(2*jaccard / (1+jaccard)) / kmer_size);
+}
@@ -0,0 +1,37 @@
+#ifndef DIST_MATRIX_H_
+#define DIST_MATRIX_H_
+
+#include "db_graph.h"
+
+//
+// Count kmers shared between every pair of colours
+//
+// Kmers are processed in tiles of DIST_TILE_WORDS x 64 kmers. For each tile we
+// gather a 64 bit word per colour per 64 kmers from the node_in_cols kset, then
+// AND + popcount the words of each pair of colours. Colour pairs are visited in
+// blocks of DIST_COL_BLOCK colours so both rows stay in cache. Colours with no
+// kmers in a tile are skipped.
+//
+
+// Number of 64 bit words per colour in a tile
+#define DIST_TILE_WORDS 32
+
+// Colours per block when looping over pairs of colours
+#define DIST_COL_BLOCK 64
+
+// Memory used by each thread
+size_t dist_matrix_thread_mem(size_t ncols);
+
+// `matrix` is ncols x ncols, matrix[ncols*i+j] is set to the number of kmers
+// in both colour i and colour j, for i <= j. Other entries are not changed.
+// Requires db_graph->node_in_cols
+void dist_matrix_count(const dBGraph *db_graph, size_t nthreads,
+                       uint64_t *matrix);
+
+// Jaccard index of kmer sets A,B: |A & B| / |A | B|
+double dist_jaccard(uint64_t nshared, uint64_t na, uint64_t nb);
+
+// Mash distance from Jaccard index: -1/k * ln(2j / (1+j))
+double dist_mash(double jaccard, size_t kmer_size);
+
+#endif /* DIST_MATRIX_H_ */
@@ -10,9 +10,9 @@ static inline void _add_edge_to_colours(hkey_t next_hkey,
 {
   size_t col, ncols = db_graph->num_of_cols;
 
-  if(db_graph->col_covgs != NULL) {
+  if(db_graph_has_covgs(db_graph)) {
     for(col = 0; col < ncols; col++) {
-      if(covgs[col] > 0 && db_node_covg(db_graph, next_hkey, col)) {
+      if(covgs[col] > 0 && db_node_get_covg(db_graph, next_hkey, col)) {
         edges[col] |= new_edge;
       }
     }
@@ -89,16 +89,20 @@ static inline int infer_edges_node(hkey_t hkey,
                                    const dBGraph *db_graph,
                                    size_t *num_nodes_modified)
 {
+  ctx_assert(!db_graph->col_major); // edges are used as an array
   BinaryKmer bkmer = db_node_get_bkey(db_graph, hkey);
   Edges *edges = &db_node_edges(db_graph, hkey, 0);
   size_t col;
 
   // Create coverages that are zero or one depending on if node has colour
-  if(db_graph->col_covgs == NULL) {
+  if(db_graph->col_covgs != NULL) {
+    tmp_covgs = &db_node_covg(db_graph, hkey, 0);
+  } else if(db_graph->col_covgs8 != NULL) {
     for(col = 0; col < db_graph->num_of_cols; col++)
-      tmp_covgs[col] = db_node_has_col(db_graph, hkey, col);
+      tmp_covgs[col] = db_node_get_covg(db_graph, hkey, col);
   } else {
-    tmp_covgs = &db_node_covg(db_graph, hkey, 0);
+    for(col = 0; col < db_graph->num_of_cols; col++)
+      tmp_covgs[col] = db_node_has_col(db_graph, hkey, col);
   }
 
   (*num_nodes_modified) += infer_kmer_edges(bkmer, !add_all_edges,
@@ -108,7 +112,7 @@ static inline int infer_edges_node(hkey_t hkey,
 }
 
 typedef struct {
-  const size_t nthreads;
+  WorkSteal *const ws;
   const bool add_all_edges;
   const dBGraph *db_graph;
   size_t num_nodes_modified;
@@ -120,27 +124,34 @@ static void infer_edges_worker(void *arg, size_t threadid)
   size_t num_modified = 0;
   Covg covgs[wrkr->db_graph->num_of_cols];
 
-  HASH_ITERATE_PART(&wrkr->db_graph->ht, threadid, wrkr->nthreads,
-                    infer_edges_node,
-                    wrkr->add_all_edges, covgs, wrkr->db_graph,
-                    &num_modified);
+  HASH_ITERATE_STEAL(&wrkr->db_graph->ht, wrkr->ws, threadid,
+                     infer_edges_node,
+                     wrkr->add_all_edges, covgs, wrkr->db_graph,
+                     &num_modified);
 
   __sync_fetch_and_add((volatile size_t *)&wrkr->num_nodes_modified, num_modified);
 }
 
 size_t infer_edges(size_t nthreads, bool add_all_edges, const dBGraph *db_graph)
 {
-  ctx_assert(db_graph->node_in_cols != NULL || db_graph->col_covgs != NULL);
+  ctx_assert(db_graph->node_in_cols != NULL || db_graph_has_covgs(db_graph));
   ctx_assert(db_graph->col_edges != NULL);
 
   status("[inferedges] Processing stream");
 
-  InferringEdges infedges = {.nthreads = nthreads,
+  WorkSteal ws;
+  work_steal_alloc(&ws, hash_table_size(&db_graph->ht), nthreads,
+                   WORK_STEAL_CHUNKS_PER_THREAD);
+
+  InferringEdges infedges = {.ws = &ws,
                              .add_all_edges = add_all_edges,
                              .db_graph = db_graph,
                              .num_nodes_modified = 0};
 
   util_multi_thread(&infedges, nthreads, infer_edges_worker);
 
+  work_steal_print_stats(&ws, "inferedges");
+  work_steal_dealloc(&ws);
+
   return infedges.num_nodes_modified;
 }
@@ -1,11 +1,12 @@
 #include "global.h"
 #include "pop_bubbles.h"
-#include "db_unitig.h"
+#include "util.h"
+#include "work_steal.h"
 
 /*
-  Popping bubbles works by iterating over all unitigs. For each unitig
-  we attempt to pull out parallel unitigs. Once we have two parallel
-  unitigs we see if one should be removed.
+  Popping bubbles works by iterating over all unitigs of a compacted graph.
+  For each unitig we attempt to pull out parallel unitigs. Once we have two
+  parallel unitigs we see if one should be removed.
 */
 
 /*
@@ -34,74 +35,63 @@
 
 typedef struct
 {
-  uint8_t *const visited, *const rmvbits;
-  dBNodeBuffer *alts;
+  const CompactGraph *cgraph;
+  uint8_t *const visited, *const rmvbits; // per unitig, per kmer
+  dBNodeBuffer *nbufs;
   size_t *num_popped;
   const PopBubblesPrefs prefs;
-  const dBGraph *db_graph;
+  WorkSteal *const ws; // splits unitigs between threads
 } PopBubbles;
 
 /*
-  Go forward one node and back one node to get all 'parallel nodes'
-  Given node, return nodes {a,b}
+  Step forward one unitig and back one unitig to get all 'parallel unitigs'
+  Given unitig end e, return ends {a,b}
        a
         \
-  node -> x
+     e -> x
         /
        b
 */
-static inline uint8_t get_parallel_nodes(const dBGraph *db_graph, dBNode node,
-                                         dBNode nodes[16])
+static inline uint8_t get_parallel_ends(const CompactGraph *cgraph, uint64_t e,
+                                        uint64_t ends[16])
 {
-  dBNode tmp_nodes[4];
-  Nucleotide tmp_nucs[4], tmp_nucs2[4];
-  uint8_t i, num_next, tmp_n, n = 0;
+  const uint64_t *next, *prev;
+  uint8_t i, j, num_next, num_prev, n = 0;
 
-  Nucleotide lost_nuc = db_node_get_first_nuc(node, db_graph);
-  num_next = db_graph_next_nodes_union(db_graph, node, tmp_nodes, tmp_nucs);
+  num_next = compact_graph_next(cgraph, e, &next);
 
   for(i = 0; i < num_next; i++) {
-    tmp_n = db_graph_prev_nodes_with_mask(db_graph, tmp_nodes[i],
-                                          lost_nuc, -1,
-                                          nodes+n, tmp_nucs2);
-    n += tmp_n;
+    num_prev = compact_graph_next(cgraph, next[i], &prev);
+    for(j = 0; j < num_prev; j++)
+      if(prev[j] != e) ends[n++] = prev[j];
   }
 
   return n;
 }
 
-static inline void mark_node_bitarr_mt(const dBNode *nodes, size_t n,
-                                       uint8_t *bitset)
+static inline void mark_unitig_rmv(const CompactGraph *cgraph, size_t uid,
+                                   dBNodeBuffer *nbuf, uint8_t *rmvbits)
 {
   size_t i;
-  for(i = 0; i < n; i++) (void)bitset_set_mt(bitset, nodes[i].key);
+  db_node_buf_reset(nbuf);
+  compact_graph_unitig_nodes(cgraph, uid, nbuf);
+  for(i = 0; i < nbuf->len; i++) (void)bitset_set_mt(rmvbits, nbuf->b[i].key);
 }
 
 /**
  * Remove the lowest mean coverage branch, by marking the remove bit array.
  * @param min_covg keep all branches with mean coverage >= min_covg
  */
-static inline bool process_bubble(const dBNode *s1, size_t n1,
-                                  const dBNode *s2, size_t n2,
-                                  const PopBubblesPrefs *p,
-                                  uint8_t *visited, uint8_t *rmvbits,
-                                  const dBGraph *db_graph)
+static inline bool process_bubble(size_t uid1, size_t uid2,
+                                  PopBubbles *pb, dBNodeBuffer *nbuf)
 {
-  size_t i, sum_covg1 = 0, sum_covg2 = 0, mean_covg1, mean_covg2;
-
-  for(i = 0; i < n1; i++) sum_covg1 += db_node_sum_covg(db_graph, s1[i].key);
-  for(i = 0; i < n2; i++) sum_covg2 += db_node_sum_covg(db_graph, s2[i].key);
-  mean_covg1 = sum_covg1 / n1;
-  mean_covg2 = sum_covg2 / n2;
-
-  // Print alleles
-  // pthread_mutex_lock(&ctx_biglock);
-  // printf("allele1: ");
-  // db_nodes_print(s1, n1, db_graph, stdout);
-  // printf("\nallele2: ");
-  // db_nodes_print(s2, n2, db_graph, stdout);
-  // printf("\n--\n");
-  // pthread_mutex_unlock(&ctx_biglock);
+  const CompactGraph *cgraph = pb->cgraph;
+  const PopBubblesPrefs *p = &pb->prefs;
+  size_t n1 = cgraph->unitigs[uid1].nkmers, n2 = cgraph->unitigs[uid2].nkmers;
+  size_t mean_covg1, mean_covg2;
+
+  mean_covg1 = compact_graph_covg_mean(cgraph, uid1);
+  mean_covg2 = compact_graph_covg_mean(cgraph, uid2);
 
   size_t rmv_covg, rmv_klen;
   if(mean_covg1 < mean_covg2) { rmv_covg = mean_covg1; rmv_klen = n1; }
@@ -113,51 +103,42 @@ static inline bool process_bubble(const dBNode *s1, size_t n1,
   {
     if(mean_covg1 < mean_covg2) {
       // remove s1
-      mark_node_bitarr_mt(s1, n1, rmvbits);
+      mark_unitig_rmv(cgraph, uid1, nbuf, pb->rmvbits);
     }
     else {
       // remove s2
-      mark_node_bitarr_mt(s2, n2, visited);
-      mark_node_bitarr_mt(s2, n2, rmvbits);
+      (void)bitset_set_mt(pb->visited, uid2);
+      mark_unitig_rmv(cgraph, uid2, nbuf, pb->rmvbits);
     }
     return true;
   }
   return false;
 }
 
-static inline void mark_remove_bubbles(dBNodeBuffer nbuf, size_t threadid,
-                                       void *arg)
+static inline void mark_remove_bubbles(size_t uid, size_t threadid,
+                                       PopBubbles *pb)
 {
-  PopBubbles *pb = (PopBubbles*)arg;
-  dBNodeBuffer *alt = &pb->alts[threadid];
-  const dBGraph *db_graph = pb->db_graph;
-
-  dBNode node0, node1, nodes0[16], nodes1[16], endnode;
+  const CompactGraph *cgraph = pb->cgraph;
+  uint64_t ends0[16], ends1[16], endother;
   uint8_t i, j, n0, n1;
 
-  node0 = db_node_reverse(nbuf.b[0]);
-  node1 = nbuf.b[nbuf.len-1];
-
-  n0 = get_parallel_nodes(db_graph, node0, nodes0);
-  n1 = get_parallel_nodes(db_graph, node1, nodes1);
-
-  // printf("n0: %zu n1: %zu\n", (size_t)n0, (size_t)n1);
+  n0 = get_parallel_ends(cgraph, cgraph_end(uid, 0), ends0);
+  n1 = get_parallel_ends(cgraph, cgraph_end(uid, 1), ends1);
 
   if(!n0 || !n1) return;
 
   for(i = 0; i < n0; i++)
   {
-    db_node_buf_reset(alt);
-    db_node_buf_add(alt, db_node_reverse(nodes0[i]));
-    db_unitig_extend(alt, 0, db_graph);
+    // Alternative branch leaves by ends0[i] on our left,
+    // check its other end is on our right
+    if(cgraph_end_unitig(ends0[i]) == uid) continue;
+    endother = cgraph_end_other(ends0[i]);
 
-    // find end node in right hand nodes
-    endnode = alt->b[alt->len-1];
     for(j = 0; j < n1; j++) {
-      if(db_nodes_are_equal(endnode, nodes1[j])) {
+      if(endother == ends1[j]) {
         // found a bubble
-        if(process_bubble(nbuf.b, nbuf.len, alt->b, alt->len,
-                          &pb->prefs, pb->visited, pb->rmvbits, db_graph))
+        if(process_bubble(uid, cgraph_end_unitig(endother),
+                          pb, &pb->nbufs[threadid]))
         {
           // Popped a bubble
           pb->num_popped[threadid]++;
@@ -168,8 +149,28 @@ static inline void mark_remove_bubbles(dBNodeBuffer nbuf, size_t threadid,
   }
 }
 
+static void pop_bubbles_thread(void *arg, size_t threadid)
+{
+  PopBubbles *pb = (PopBubbles*)arg;
+  size_t uid, start, end;
+  bool got_lock;
+
+  while(work_steal_next(pb->ws, threadid, &start, &end))
+  {
+    for(uid = start; uid < end; uid++)
+    {
+      if(bitset_get_mt(pb->visited, uid)) continue;
+      got_lock = false;
+      bitlock_try_acquire(pb->visited, uid, &got_lock);
+      if(got_lock) mark_remove_bubbles(uid, threadid, pb);
+    }
+  }
+
+  work_steal_thread_done(pb->ws, threadid);
+}
+
 /**
- * visited, rmvbits should each have at least db_graph->capacity bits
+ * rmvbits should have at least db_graph->capacity bits
  * and should be initialised to zeros
  * rmvbits will have bits set for all nodes that should be removed
  * @param max_rmv_covg only remove contigs with covg <= max_rmv_covg,
@@ -180,9 +181,8 @@ static inline void mark_remove_bubbles(dBNodeBuffer nbuf, size_t threadid,
  *                      ignored if < 0.
  * @return number of bubbles popped
 **/
-size_t pop_bubbles(const dBGraph *db_graph, size_t nthreads,
-                   PopBubblesPrefs prefs,
-                   uint8_t *visited, uint8_t *rmvbits)
+size_t pop_bubbles(const CompactGraph *cgraph, size_t nthreads,
+                   PopBubblesPrefs prefs, uint8_t *rmvbits)
 {
   size_t i, total_popped = 0;
 
@@ -194,21 +194,31 @@ size_t pop_bubbles(const dBGraph *db_graph, size_t nthreads,
   if(prefs.max_rmv_kdiff >= 0)
     status("[pop_bubbles]   where branch length diff < %i", prefs.max_rmv_kdiff);
 
-  PopBubbles data = {.visited = visited, .rmvbits = rmvbits,
-                     .prefs = prefs, .db_graph = db_graph};
+  uint8_t *visited = ctx_calloc(roundup_bits2bytes(cgraph->num_unitigs), 1);
+
+  WorkSteal ws;
+  work_steal_alloc(&ws, cgraph->num_unitigs, nthreads,
+                   WORK_STEAL_CHUNKS_PER_THREAD);
 
-  data.alts = ctx_calloc(nthreads, sizeof(dBNodeBuffer));
+  PopBubbles data = {.cgraph = cgraph, .visited = visited, .rmvbits = rmvbits,
+                     .prefs = prefs, .ws = &ws};
+
+  data.nbufs = ctx_calloc(nthreads, sizeof(dBNodeBuffer));
   data.num_popped = ctx_calloc(nthreads, sizeof(size_t));
-  for(i = 0; i < nthreads; i++) db_node_buf_alloc(&data.alts[i], 256);
+  for(i = 0; i < nthreads; i++) db_node_buf_alloc(&data.nbufs[i], 256);
+
+  util_multi_thread(&data, nthreads, pop_bubbles_thread);
 
-  db_unitigs_iterate(nthreads, visited, db_graph, mark_remove_bubbles, &data);
+  work_steal_print_stats(&ws, "pop_bubbles");
+  work_steal_dealloc(&ws);
 
   for(i = 0; i < nthreads; i++) {
     total_popped += data.num_popped[i];
-    db_node_buf_dealloc(&data.alts[i]);
+    db_node_buf_dealloc(&data.nbufs[i]);
   }
   ctx_free(data.num_popped);
-  ctx_free(data.alts);
+  ctx_free(data.nbufs);
+  ctx_free(visited);
 
   return total_popped;
 }
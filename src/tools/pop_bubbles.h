@@ -2,6 +2,7 @@
 #define POP_BUBBLES_H_
 
 #include "db_graph.h"
+#include "compact_graph.h"
 
 typedef struct
 {
@@ -9,7 +10,7 @@ typedef struct
 } PopBubblesPrefs;
 
 /**
- * visited, rmvbits should each have at least db_graph->capacity bits
+ * rmvbits should have at least db_graph->capacity bits
  * and should be initialised to zeros
  * rmvbits will have bits set for all nodes that should be removed
  * @param max_rmv_covg only remove contigs with mean covg <= max_rmv_covg,
@@ -20,8 +21,7 @@ typedef struct
  *                      ignored if < 0.
  * @return number of bubbles popped
 **/
-size_t pop_bubbles(const dBGraph *db_graph, size_t nthreads,
-                   PopBubblesPrefs prefs,
-                   uint8_t *visited, uint8_t *rmvbits);
+size_t pop_bubbles(const CompactGraph *cgraph, size_t nthreads,
+                   PopBubblesPrefs prefs, uint8_t *rmvbits);
 
 #endif /* POP_BUBBLES_H_ */
@@ -7,6 +7,8 @@
 #include "db_unitig.h"
 #include "seq_loading_stats.h"
 #include "util.h"
+#include "graph_search.h"
+#include "graph_stream.h"
 
 typedef struct
 {
@@ -209,7 +211,7 @@ void subgraph_from_reads(dBGraph *db_graph, size_t nthreads, size_t dist,
     die("Out of memory");
 
   for(i = 0; i < num_files; i++)
-    seq_parse_se_sf(files[i], 0, &r1, store_read_nodes, &builder);
+    seq_parse_se_sf(files[i], 0, &r1, store_read_nodes, &builder, NULL);
 
   print_stats(&builder);
 
@@ -276,3 +278,343 @@ void subgraph_from_seq(dBGraph *db_graph, size_t nthreads, size_t dist,
 
   prune_nodes_lacking_flag(nthreads, kmer_mask, db_graph);
 }
+
+//
+// Subgraph from sorted graphs on disk
+//
+
+typedef struct
+{
+  dBGraph *const db_graph; // only holds the subgraph
+  GraphFileSearch **const disk;
+  BgzfCache *caches; // one per graph on disk
+  const size_t num_disk;
+  Covg *covgs; // one entry per colour
+  Edges *edges;
+  dBNodeBuffer *nbuf; // nodes added
+  SeqLoadingStats stats;
+} DiskSubgraphBuilder;
+
+// Look up a kmer in the graphs on disk and add it to the graph if it is found
+// and not already loaded. Nodes added are pushed onto builder->nbuf
+static void disk_fetch_bkmer(BinaryKmer bkmer, DiskSubgraphBuilder *builder)
+{
+  dBGraph *db_graph = builder->db_graph;
+  const size_t ncols = db_graph->num_of_cols;
+  BinaryKmer bkey = binary_kmer_get_key(bkmer, db_graph->kmer_size);
+  dBNode node = DB_NODE_INIT;
+  bool found;
+  size_t i, col;
+
+  if(db_graph_find(db_graph, bkey).key != HASH_NOT_FOUND) return;
+
+  for(i = 0; i < builder->num_disk; i++)
+  {
+    // graph_search_find only sets the colours the file loads into
+    memset(builder->covgs, 0, ncols * sizeof(Covg));
+    memset(builder->edges, 0, ncols * sizeof(Edges));
+
+    if(graph_search_find(builder->disk[i], bkey, builder->covgs, builder->edges,
+                         &builder->caches[i]))
+    {
+      if(node.key == HASH_NOT_FOUND)
+        node = db_graph_find_or_add_node(db_graph, bkey, &found);
+
+      for(col = 0; col < ncols; col++) {
+        db_node_add_col_covg(db_graph, node.key, col, builder->covgs[col]);
+        db_node_edges(db_graph, node.key, col) |= builder->edges[col];
+      }
+    }
+  }
+
+  if(node.key != HASH_NOT_FOUND) db_node_buf_add(builder->nbuf, node);
+}
+
+static void disk_store_read_nodes(read_t *r1, read_t *r2,
+                                  uint8_t qoffset1, uint8_t qoffset2, void *ptr)
+{
+  (void)qoffset1; (void)qoffset2;
+  DiskSubgraphBuilder *builder = (DiskSubgraphBuilder*)ptr;
+  const size_t kmer_size = builder->db_graph->kmer_size;
+
+  READ_TO_BKMERS(r1, kmer_size, 0, 0, &builder->stats, disk_fetch_bkmer, builder);
+  if(r2 != NULL)
+    READ_TO_BKMERS(r2, kmer_size, 0, 0, &builder->stats, disk_fetch_bkmer, builder);
+}
+
+// Call `func(bkmer,arg)` for each kmer adjacent to a node, whether or not the
+// kmer has been loaded into the graph
+static void node_neighbour_bkmers(const dBGraph *db_graph, hkey_t hkey,
+                                  void (*func)(BinaryKmer bkmer, void *arg),
+                                  void *arg)
+{
+  const size_t kmer_size = db_graph->kmer_size;
+  BinaryKmer node_bkey = db_node_get_bkey(db_graph, hkey);
+  Edges edges = db_node_get_edges_union(db_graph, hkey);
+  Orientation orient;
+  Nucleotide nuc;
+
+  for(orient = 0; orient < 2; orient++)
+    for(nuc = 0; nuc < 4; nuc++)
+      if(edges_has_edge(edges, nuc, orient))
+        func(bkmer_shift_add_last_nuc(node_bkey, orient, kmer_size, nuc), arg);
+}
+
+static void disk_fetch_neighbour(BinaryKmer bkmer, void *arg)
+{
+  disk_fetch_bkmer(bkmer, (DiskSubgraphBuilder*)arg);
+}
+
+// Remove edges to kmers that were not loaded
+static inline int trim_edges_to_missing(hkey_t hkey, dBGraph *db_graph)
+{
+  BinaryKmer bkmer = db_node_get_bkey(db_graph, hkey);
+  Edges keep_edges = db_node_get_edges_union(db_graph, hkey);
+  Orientation orient;
+  Nucleotide nuc;
+  BinaryKmer next_bkmer;
+  size_t col;
+
+  for(orient = 0; orient < 2; orient++) {
+    for(nuc = 0; nuc < 4; nuc++) {
+      if(edges_has_edge(keep_edges, nuc, orient)) {
+        next_bkmer = bkmer_shift_add_last_nuc(bkmer, orient,
+                                              db_graph->kmer_size, nuc);
+        if(db_graph_find(db_graph, next_bkmer).key == HASH_NOT_FOUND)
+          keep_edges = edges_del_edge(keep_edges, nuc, orient);
+      }
+    }
+  }
+
+  for(col = 0; col < db_graph->num_edge_cols; col++)
+    db_node_edges(db_graph, hkey, col) &= keep_edges;
+
+  return 0; // => keep iterating
+}
+
+/**
+ * Load the subgraph within `dist` edges of the seed kmers from sorted graphs
+ * on disk (see graph_search.h), so only the subgraph is held in memory.
+ * Colours are mapped by each file's filter into db_graph, which should have
+ * an edges and coverage column for every colour.
+ */
+void subgraph_from_disk(dBGraph *db_graph, size_t dist,
+                        GraphFileSearch **disk, size_t num_disk,
+                        seq_file_t **files, size_t num_files)
+{
+  ctx_assert(db_graph->num_edge_cols == db_graph->num_of_cols);
+  size_t i, d, ncols = db_graph->num_of_cols;
+
+  dBNodeBuffer nbufs[2];
+  db_node_buf_alloc(&nbufs[0], 1024);
+  db_node_buf_alloc(&nbufs[1], 1024);
+
+  DiskSubgraphBuilder builder = {.db_graph = db_graph,
+                                 .disk = disk, .num_disk = num_disk,
+                                 .caches = ctx_malloc(num_disk * sizeof(BgzfCache)),
+                                 .covgs = ctx_calloc(ncols, sizeof(Covg)),
+                                 .edges = ctx_calloc(ncols, sizeof(Edges)),
+                                 .nbuf = &nbufs[0]};
+  seq_loading_stats_init(&builder.stats);
+
+  for(i = 0; i < num_disk; i++)
+    builder.caches[i] = (BgzfCache)BGZF_CACHE_INIT;
+
+  // Fetch seed kmers
+  read_t r1;
+  if(seq_read_alloc(&r1) == NULL)
+    die("Out of memory");
+
+  for(i = 0; i < num_files; i++)
+    seq_parse_se_sf(files[i], 0, &r1, disk_store_read_nodes, &builder,
+                    NULL);
+
+  seq_read_dealloc(&r1);
+
+  size_t nseed_kmers = builder.stats.num_kmers_loaded;
+  char nseed_kmers_str[100], nkmers_found_str[100];
+  ulong_to_str(nseed_kmers, nseed_kmers_str);
+  ulong_to_str(nbufs[0].len, nkmers_found_str);
+  status("Found %s / %s (%.2f%%) seed kmers on disk",
+         nkmers_found_str, nseed_kmers_str,
+         nseed_kmers ? (100.0*nbufs[0].len)/nseed_kmers : 0.0);
+
+  // Breadth first search, only kmers new to the graph join the fringe
+  if(dist > 0)
+  {
+    char dist_str[100];
+    ulong_to_str(dist, dist_str);
+    status("Extending subgraph by %s kmers\n", dist_str);
+
+    for(d = 0; d < dist && nbufs[d&1].len > 0; d++) {
+      builder.nbuf = &nbufs[(d+1)&1];
+      db_node_buf_reset(builder.nbuf);
+      for(i = 0; i < nbufs[d&1].len; i++)
+        node_neighbour_bkmers(db_graph, nbufs[d&1].b[i].key,
+                              disk_fetch_neighbour, &builder);
+    }
+  }
+
+  HASH_ITERATE(&db_graph->ht, trim_edges_to_missing, db_graph);
+
+  for(i = 0; i < num_disk; i++) bgzf_cache_dealloc(&builder.caches[i]);
+  ctx_free(builder.caches);
+  ctx_free(builder.covgs);
+  ctx_free(builder.edges);
+  db_node_buf_dealloc(&nbufs[0]);
+  db_node_buf_dealloc(&nbufs[1]);
+}
+
+//
+// Subgraph from streaming sorted graphs past sorted batches of kmers
+//
+
+typedef struct
+{
+  dBGraph *const db_graph; // only holds the subgraph
+  GraphFileReader *const gfiles;
+  const size_t num_gfiles, nthreads;
+  KmerQueryBuffer queries;
+  size_t max_queries, file_ncols; // file_ncols: colours of file being read
+  dBNodeBuffer *nbuf; // nodes added
+  SeqLoadingStats stats;
+  GraphStreamStats strm_stats;
+} StreamSubgraphBuilder;
+
+static void stream_hit_node(const KmerQuery *q, const Covg *covgs,
+                            const Edges *edges, void *arg)
+{
+  StreamSubgraphBuilder *builder = (StreamSubgraphBuilder*)arg;
+  dBGraph *db_graph = builder->db_graph;
+  bool found;
+  size_t col;
+
+  // Only load a kmer once per file if it was queried more than once
+  if(q != builder->queries.b && binary_kmer_eq(q[-1].bkey, q->bkey)) return;
+
+  dBNode node = db_graph_find_or_add_node(db_graph, q->bkey, &found);
+
+  for(col = 0; col < builder->file_ncols; col++) {
+    db_node_add_col_covg(db_graph, node.key, col, covgs[col]);
+    db_node_edges(db_graph, node.key, col) |= edges[col];
+  }
+
+  if(!found) db_node_buf_add(builder->nbuf, node);
+}
+
+static void stream_flush(StreamSubgraphBuilder *builder)
+{
+  size_t i;
+  if(builder->queries.len == 0) return;
+  graph_stream_sort(&builder->queries, builder->nthreads);
+  for(i = 0; i < builder->num_gfiles; i++) {
+    builder->file_ncols = file_filter_into_ncols(&builder->gfiles[i].fltr);
+    graph_stream_join(&builder->gfiles[i], &builder->queries,
+                      stream_hit_node, builder, &builder->strm_stats);
+  }
+  builder->strm_stats.nqueries += builder->queries.len;
+  builder->strm_stats.nbatches++;
+  kmer_query_buf_reset(&builder->queries);
+}
+
+// Queue a kmer to be looked up, if it has not already been loaded
+static void stream_query_bkmer(BinaryKmer bkmer, void *arg)
+{
+  StreamSubgraphBuilder *builder = (StreamSubgraphBuilder*)arg;
+  const dBGraph *db_graph = builder->db_graph;
+  BinaryKmer bkey = binary_kmer_get_key(bkmer, db_graph->kmer_size);
+
+  if(db_graph_find(db_graph, bkey).key != HASH_NOT_FOUND) return;
+
+  KmerQuery q = {.bkey = bkey, .id = 0};
+  kmer_query_buf_add(&builder->queries, q);
+  if(builder->queries.len == builder->max_queries) stream_flush(builder);
+}
+
+static void stream_store_read_kmers(read_t *r1, read_t *r2,
+                                    uint8_t qoffset1, uint8_t qoffset2,
+                                    void *ptr)
+{
+  (void)qoffset1; (void)qoffset2;
+  StreamSubgraphBuilder *builder = (StreamSubgraphBuilder*)ptr;
+  const size_t kmer_size = builder->db_graph->kmer_size;
+
+  READ_TO_BKMERS(r1, kmer_size, 0, 0, &builder->stats,
+                 stream_query_bkmer, builder);
+  if(r2 != NULL)
+    READ_TO_BKMERS(r2, kmer_size, 0, 0, &builder->stats,
+                   stream_query_bkmer, builder);
+}
+
+/**
+ * Load the subgraph within `dist` edges of the seed kmers by streaming sorted
+ * graph files. Seed kmers are looked up in batches of up to `query_mem` bytes,
+ * then each step of the breadth first search is another batch.
+ */
+void subgraph_from_stream(dBGraph *db_graph, size_t nthreads, size_t dist,
+                          size_t query_mem,
+                          GraphFileReader *gfiles, size_t num_gfiles,
+                          seq_file_t **files, size_t num_files)
+{
+  ctx_assert(db_graph->num_edge_cols == db_graph->num_of_cols);
+  size_t i, d;
+
+  dBNodeBuffer nbufs[2];
+  db_node_buf_alloc(&nbufs[0], 1024);
+  db_node_buf_alloc(&nbufs[1], 1024);
+
+  StreamSubgraphBuilder builder = {.db_graph = db_graph,
+                                   .gfiles = gfiles, .num_gfiles = num_gfiles,
+                                   .nthreads = nthreads,
+                                   .max_queries = graph_stream_max_queries(query_mem),
+                                   .nbuf = &nbufs[0]};
+
+  seq_loading_stats_init(&builder.stats);
+  graph_stream_stats_init(&builder.strm_stats);
+  kmer_query_buf_alloc(&builder.queries, MIN2(builder.max_queries, 1<<20));
+
+  // Fetch seed kmers
+  read_t r1;
+  if(seq_read_alloc(&r1) == NULL)
+    die("Out of memory");
+
+  for(i = 0; i < num_files; i++)
+    seq_parse_se_sf(files[i], 0, &r1, stream_store_read_kmers, &builder,
+                    NULL);
+
+  seq_read_dealloc(&r1);
+  stream_flush(&builder);
+
+  size_t nseed_kmers = builder.stats.num_kmers_loaded;
+  char nseed_kmers_str[100], nkmers_found_str[100];
+  ulong_to_str(nseed_kmers, nseed_kmers_str);
+  ulong_to_str(nbufs[0].len, nkmers_found_str);
+  status("Found %s / %s (%.2f%%) seed kmers in stream",
+         nkmers_found_str, nseed_kmers_str,
+         nseed_kmers ? (100.0*nbufs[0].len)/nseed_kmers : 0.0);
+
+  // Breadth first search, one batch of queries per step
+  if(dist > 0)
+  {
+    char dist_str[100];
+    ulong_to_str(dist, dist_str);
+    status("Extending subgraph by %s kmers\n", dist_str);
+
+    for(d = 0; d < dist && nbufs[d&1].len > 0; d++) {
+      builder.nbuf = &nbufs[(d+1)&1];
+      db_node_buf_reset(builder.nbuf);
+      for(i = 0; i < nbufs[d&1].len; i++)
+        node_neighbour_bkmers(db_graph, nbufs[d&1].b[i].key,
+                              stream_query_bkmer, &builder);
+      stream_flush(&builder);
+    }
+  }
+
+  HASH_ITERATE(&db_graph->ht, trim_edges_to_missing, db_graph);
+
+  graph_stream_print_stats(&builder.strm_stats);
+
+  kmer_query_buf_dealloc(&builder.queries);
+  db_node_buf_dealloc(&nbufs[0]);
+  db_node_buf_dealloc(&nbufs[1]);
+}
@@ -4,6 +4,7 @@
 #include "seq_file/seq_file.h"
 
 #include "db_graph.h"
+#include "graph_search.h"
 
 //
 // Breadth first search from seed kmers,
@@ -35,4 +36,26 @@ void subgraph_from_seq(dBGraph *db_graph, size_t nthreads, size_t dist,
                        size_t fringe_mem, uint8_t *kmer_mask,
                        char **seqs, size_t *seqlens, size_t num_seqs);
 
+/**
+ * Load only the kmers within `dist` edges of the seed kmers from sorted graphs
+ * on disk, without loading the whole graph into a hash table.
+ * @param db_graph  empty graph with an edges and coverage column per colour
+ * @param disk      searchable sorted graphs, colours set by their file filters
+ */
+void subgraph_from_disk(dBGraph *db_graph, size_t dist,
+                        GraphFileSearch **disk, size_t num_disk,
+                        seq_file_t **files, size_t num_files);
+
+/**
+ * Load only the kmers within `dist` edges of the seed kmers by sorting them in
+ * batches of up to `query_mem` bytes and streaming sorted graph files past
+ * them. Memory does not depend on the size of the graphs.
+ * @param db_graph  empty graph with an edges and coverage column per colour
+ * @param gfiles    sorted graphs (not STDIN), colours set by their file filters
+ */
+void subgraph_from_stream(dBGraph *db_graph, size_t nthreads, size_t dist,
+                          size_t query_mem,
+                          GraphFileReader *gfiles, size_t num_gfiles,
+                          seq_file_t **files, size_t num_files);
+
 #endif /* SUBGRAPH_H_ */
@@ -5,6 +5,8 @@
 #include "genotyping.h"
 #include "vcf_misc.h"
 
+#include <pthread.h>
+
 #include "madcrowlib/madcrow_buffer.h"
 madcrow_buffer(covg_buf, CovgBuffer, Covg);
 
@@ -19,10 +21,19 @@ madcrow_buffer(covg_buf, CovgBuffer, Covg);
   bcf_hdr_t *globalhdr;
 #endif
 
+// Buffers for adding coverage to VCF entries and printing them
 typedef struct
 {
-  const char *path;
   const size_t *samplehdrids; // samplehdrids[x] is the sample id in VCF
+  size_t ncols;
+  bcf_hdr_t *vcfhdr;
+  int32_t *kcovgs_r, *kcovgs_a;
+  size_t geno_buf_size; // nsamples * nalts
+} VcfCovPrinter;
+
+typedef struct
+{
+  const char *path;
   size_t ncols, kmer_size; // number of colours loaded in the de Bruijn graph
   VcfCovStats stats;
   htsFile *vcffh;
@@ -37,8 +48,7 @@ typedef struct
   // aprint are waiting to be printed; apool is a memory pool
   VcfCovAltPtrList alist, anchrom, aprint, apool; // alleles
   // Format for VCF output
-  int32_t *kcovgs_r, *kcovgs_a;
-  size_t geno_buf_size; // nsamples * nalts
+  VcfCovPrinter pr;
 } VcfReader;
 
 // Genotyping buffers
@@ -71,6 +81,32 @@ static void covbuf_dealloc(VcfCovBuffers *covbuf)
 }
 
 
+static void vcfcov_printer_alloc(VcfCovPrinter *pr, bcf_hdr_t *vcfhdr,
+                                 const size_t *samplehdrids, size_t ncols)
+{
+  memset(pr, 0, sizeof(*pr));
+  pr->samplehdrids = samplehdrids;
+  pr->ncols = ncols;
+  pr->vcfhdr = vcfhdr;
+}
+
+static void vcfcov_printer_dealloc(VcfCovPrinter *pr)
+{
+  ctx_free(pr->kcovgs_r);
+  ctx_free(pr->kcovgs_a);
+}
+
+static void vcfcov_stats_merge(VcfCovStats *dst, const VcfCovStats *src)
+{
+  dst->nvcf_lines += src->nvcf_lines;
+  dst->nalts_read += src->nalts_read;
+  dst->nalts_loaded += src->nalts_loaded;
+  dst->nalts_too_long += src->nalts_too_long;
+  dst->nalts_no_covg += src->nalts_no_covg;
+  dst->nalts_with_covg += src->nalts_with_covg;
+  dst->ngt_kmers += src->ngt_kmers;
+}
+
 static void vcf_list_populate(VcfCovLinePtrList *vlist, size_t n)
 {
   size_t i;
@@ -119,7 +155,7 @@ static inline void vcfr_alloc(VcfReader *vcfr, const char *path,
 {
   memset(vcfr, 0, sizeof(*vcfr));
   vcfr->path = path;
-  vcfr->samplehdrids = samplehdrids;
+  vcfcov_printer_alloc(&vcfr->pr, vcfhdr, samplehdrids, ncols);
   vcfr->ncols = ncols;
   vcfr->kmer_size = kmer_size;
   vcfr->vcffh = vcffh;
@@ -151,8 +187,7 @@ static inline void vcfr_dealloc(VcfReader *vcfr)
   vc_alts_dealloc(&vcfr->apool);
   vc_lines_dealloc(&vcfr->vpool);
 
-  ctx_free(vcfr->kcovgs_r);
-  ctx_free(vcfr->kcovgs_a);
+  vcfcov_printer_dealloc(&vcfr->pr);
 }
 
 // return true if valid variant
@@ -177,6 +212,21 @@ static inline void init_new_alt(VcfCovAlt *var, VcfCovLine *line, uint32_t aid,
   vcfcov_alt_wipe_covg(var, ncols);
 }
 
+// Check ref allele is within the reference and matches
+static inline void check_ref_allele(bcf_hdr_t *hdr, bcf1_t *v,
+                                    const char *chr, int chrlen)
+{
+  if(v->pos + v->rlen > chrlen) {
+    die("Ref allele goes out of bounds: %s %i %s %s [chrlen: %i]",
+        bcf_seqname(hdr, v), v->pos+1, v->d.id, v->d.allele[0], chrlen);
+  }
+  if(!dna_ref_vcf_match(chr+v->pos, v->d.allele[0], v->rlen)) {
+    die("Alleles don't match: %s %i %s %s; ref: %.*s [%i]",
+        bcf_seqname(hdr, v), v->pos+1, v->d.id, v->d.allele[0],
+        v->rlen, chr+v->pos, v->rlen);
+  }
+}
+
 static inline void fetch_chrom(bcf_hdr_t *hdr, bcf1_t *v,
                                faidx_t *fai, int *refid,
                                char **chr, int *chrlen)
@@ -187,16 +237,7 @@ static inline void fetch_chrom(bcf_hdr_t *hdr, bcf1_t *v,
     if(*chr == NULL) die("Cannot find chr '%s'", bcf_seqname(hdr, v));
     *refid = v->rid;
   }
-  // Check ref allele is within the reference and matches
-  if(v->pos + v->rlen > *chrlen) {
-    die("Ref allele goes out of bounds: %s %i %s %s [chrlen: %i]",
-        bcf_seqname(hdr, v), v->pos+1, v->d.id, v->d.allele[0], *chrlen);
-  }
-  if(!dna_ref_vcf_match((*chr)+v->pos, v->d.allele[0], v->rlen)) {
-    die("Alleles don't match: %s %i %s %s; ref: %.*s [%i]",
-        bcf_seqname(hdr, v), v->pos+1, v->d.id, v->d.allele[0],
-        v->rlen, *chr+v->pos, v->rlen);
-  }
+  check_ref_allele(hdr, v, *chr, *chrlen);
 }
 
 // Returns:
@@ -323,72 +364,73 @@ static int _vcfcov_alt_cmp_vidx(const void *aa, const void *bb)
 
 // alleles should be sorted by parent->vidx, then by aid
 //  [See _vcfcov_alt_cmp_vidx(a,b).]
-static void vcfr_print_entry(VcfReader *vr, htsFile *outfh, bcf_hdr_t *outhdr,
-                             VcfCovAlt **alleles, size_t nalleles,
-                             const VcfCovPrefs *prefs)
+static void vcfcov_print_entry(VcfCovPrinter *pr, VcfCovStats *stats,
+                               htsFile *outfh, bcf_hdr_t *outhdr,
+                               VcfCovAlt **alleles, size_t nalleles,
+                               const VcfCovPrefs *prefs)
 {
   VcfCovLine *var = alleles[0]->parent;
   bcf1_t *v = &var->v;
   size_t nsamples = bcf_hdr_nsamples(outhdr);
   size_t i, col, sid, nalts = v->n_allele-1, n = nsamples * nalts;
-  size_t ncols = vr->ncols, nalts_covgs = 0;
+  size_t ncols = pr->ncols, nalts_covgs = 0;
   VarCovg *cov;
 
   ctx_assert2(nalts == nalleles, "%zu vs %zu", nalts, nalleles);
 
   // _r ref, _a alt
-  if(vr->geno_buf_size < n)
+  if(pr->geno_buf_size < n)
   {
-    vr->kcovgs_r = ctx_reallocarray(vr->kcovgs_r, n, sizeof(int32_t));
-    vr->kcovgs_a = ctx_reallocarray(vr->kcovgs_a, n, sizeof(int32_t));
-    for(i = vr->geno_buf_size; i < n; i++)
-      vr->kcovgs_r[i] = vr->kcovgs_a[i] = bcf_int32_missing;
-    vr->geno_buf_size = n;
+    pr->kcovgs_r = ctx_reallocarray(pr->kcovgs_r, n, sizeof(int32_t));
+    pr->kcovgs_a = ctx_reallocarray(pr->kcovgs_a, n, sizeof(int32_t));
+    for(i = pr->geno_buf_size; i < n; i++)
+      pr->kcovgs_r[i] = pr->kcovgs_a[i] = bcf_int32_missing;
+    pr->geno_buf_size = n;
   }
 
   // Fetch existing coverage from VCF
   if(nsamples > ncols)
   {
-    int nsize = vr->geno_buf_size;
-    bcf_get_format_int32(vr->vcfhdr, v, prefs->kcov_ref_tag, &vr->kcovgs_r, &nsize);
-    bcf_get_format_int32(vr->vcfhdr, v, prefs->kcov_alt_tag, &vr->kcovgs_a, &nsize);
-    ctx_assert2(nsize == (int)vr->geno_buf_size, "htslib resized our buffer!");
+    int nsize = pr->geno_buf_size;
+    bcf_get_format_int32(pr->vcfhdr, v, prefs->kcov_ref_tag, &pr->kcovgs_r, &nsize);
+    bcf_get_format_int32(pr->vcfhdr, v, prefs->kcov_alt_tag, &pr->kcovgs_a, &nsize);
+    ctx_assert2(nsize == (int)pr->geno_buf_size, "htslib resized our buffer!");
   }
 
   // Initiate new samples to missing
-  for(i = bcf_hdr_nsamples(vr->vcfhdr)*nalts; i < n; i++)
-    vr->kcovgs_r[i] = vr->kcovgs_a[i] = bcf_int32_missing;
+  for(i = bcf_hdr_nsamples(pr->vcfhdr)*nalts; i < n; i++)
+    pr->kcovgs_r[i] = pr->kcovgs_a[i] = bcf_int32_missing;
 
   // Add coverage
   for(i = 0; i < nalts; i++) {
     if(alleles[i]->has_covg) {
       nalts_covgs++;
       for(col = 0; col < ncols; col++) {
-        sid = vr->samplehdrids[col];
+        sid = pr->samplehdrids[col];
         cov = &alleles[i]->c[col];
-        vr->kcovgs_r[sid*nalts+i] = cov->covg[0];
-        vr->kcovgs_a[sid*nalts+i] = cov->covg[1];
+        pr->kcovgs_r[sid*nalts+i] = cov->covg[0];
+        pr->kcovgs_a[sid*nalts+i] = cov->covg[1];
       }
     }
   }
 
   // Update stats
-  vr->stats.nalts_no_covg += nalts - nalts_covgs;
-  vr->stats.nalts_with_covg += nalts_covgs;
+  stats->nalts_no_covg += nalts - nalts_covgs;
+  stats->nalts_with_covg += nalts_covgs;
 
   //
   // Update VCF entry
   //
 
   // TODO: reset sample fields on new samples
-  for(i = bcf_hdr_nsamples(vr->vcfhdr); i < nsamples; i++) {
+  for(i = bcf_hdr_nsamples(pr->vcfhdr); i < nsamples; i++) {
     /* reset fields */
   }
 
   // Update sample info
   int a,b;
-  a = bcf_update_format_int32(outhdr, v, prefs->kcov_ref_tag, vr->kcovgs_r, n);
-  b = bcf_update_format_int32(outhdr, v, prefs->kcov_alt_tag, vr->kcovgs_a, n);
+  a = bcf_update_format_int32(outhdr, v, prefs->kcov_ref_tag, pr->kcovgs_r, n);
+  b = bcf_update_format_int32(outhdr, v, prefs->kcov_alt_tag, pr->kcovgs_a, n);
 
   if(a || b) die("Cannot add format info");
   if(bcf_write(outfh, outhdr, v) != 0) die("Cannot write record");
@@ -426,7 +468,8 @@ static void vcfr_print_waiting(VcfReader *vr,
 
     // print
     if(!prefs->load_kmers_only)
-      vcfr_print_entry(vr, outfh, outhdr, alleleptr, num_a, prefs);
+      vcfcov_print_entry(&vr->pr, &vr->stats, outfh, outhdr,
+                         alleleptr, num_a, prefs);
 
     // Re-add to vpool
     vc_lines_append(&vr->vpool, line);
@@ -603,9 +646,10 @@ static void vcfcov_vars(VcfCovAlt **vars, size_t nvars,
   {
     // Add kmers to graph
     // don't need binary_kmer_get_key(), genotyping returns keys only
+    // lock-free insert, shards may be loaded on several threads at once
     bool found = false;
     for(i = 0; i < nkmers; i++) {
-      hash_table_find_or_insert(&db_graph->ht, kmers[i].bkey, &found);
+      hash_table_find_or_insert_mt(&db_graph->ht, kmers[i].bkey, &found, NULL);
 
 #ifdef DEBUG_VCFCOV
       char tmpstr[MAX_KMER_SIZE+1], binstr[65];
@@ -776,19 +820,14 @@ static size_t vcfcov_block2(VcfReader *vr, bool flush, size_t tgtidx,
   return nxttgt;
 }
 
-/**
- * @param outfh        Only required for printing
- * @param outhdr       Only required for printing
- * @param samplehdrids [col] is the index of a colour in the output vcf.
- *                     Only required for printing.
- */
-void vcfcov_file(htsFile *vcffh, bcf_hdr_t *vcfhdr,
-                 htsFile *outfh, bcf_hdr_t *outhdr,
-                 const char *path, faidx_t *fai,
-                 const size_t *samplehdrids,
-                 const VcfCovPrefs *prefs,
-                 VcfCovStats *stats,
-                 dBGraph *db_graph)
+// Read and genotype on a single thread
+static void vcfcov_file_serial(htsFile *vcffh, bcf_hdr_t *vcfhdr,
+                               htsFile *outfh, bcf_hdr_t *outhdr,
+                               const char *path, faidx_t *fai,
+                               const size_t *samplehdrids,
+                               const VcfCovPrefs *prefs,
+                               VcfCovStats *stats,
+                               dBGraph *db_graph)
 {
   VcfReader vr;
   vcfr_alloc(&vr, path, vcffh, vcfhdr, samplehdrids,
@@ -842,3 +881,454 @@ void vcfcov_file(htsFile *vcffh, bcf_hdr_t *vcfhdr,
   covbuf_dealloc(&covbuf);
   vcfr_dealloc(&vr);
 }
+
+//
+// Multithreaded: the reading thread cuts the VCF into shards, worker threads
+// genotype them and the worker that completes the oldest shard prints it.
+// Shards are cut between chromosomes, and between lines where no haplotype of
+// the earlier lines reaches the next line, so each shard is genotyped on its
+// own. Shards are cut at the same places whatever the number of threads.
+//
+
+// Start a new shard at the next gap once a shard has this many lines
+#define SHARD_MIN_LINES 1000
+// Number of shards per worker thread that can be read ahead of printing
+#define SHARDS_PER_THREAD 4
+
+// Reference chromosome, shared by the shards on it
+typedef struct
+{
+  char *seq;
+  int len, rid;
+  volatile size_t refs;
+} VcfCovChrom;
+
+typedef struct
+{
+  VcfCovChrom *chrom;
+  VcfCovLinePtrList lines, vpool; // lines in input order, spare lines
+  // alts of all lines in input order, alts to genotype, spare alts
+  VcfCovAltPtrList alts, galts, apool;
+  VcfCovStats stats;
+  bool done; // has been genotyped
+} VcfCovShard;
+
+typedef struct
+{
+  htsFile *vcffh, *outfh;
+  bcf_hdr_t *vcfhdr, *outhdr;
+  const char *path;
+  faidx_t *fai;
+  const VcfCovPrefs *prefs;
+  const dBGraph *db_graph;
+
+  // Shards [nprinted, nread) have been read. Shards from nqueued have not been
+  // picked up by a worker. Shard i is shards[i % nshards].
+  // Only the reading thread changes nread.
+  VcfCovShard *shards;
+  size_t nshards, nread, nqueued, nprinted;
+  bool eof, printing;
+
+  // Only used by the thread that is printing
+  VcfCovPrinter pr;
+  VcfCovStats stats;
+
+  pthread_mutex_t lock;
+  pthread_mutex_t hdr_lock; // held whilst reading input or printing
+  pthread_cond_t shard_read, shard_printed;
+} VcfCovEngine;
+
+typedef struct
+{
+  pthread_t thread;
+  VcfCovEngine *eng;
+  VcfCovBuffers covbuf;
+} VcfCovWorker;
+
+static VcfCovChrom* vcfcov_chrom_fetch(VcfCovEngine *eng, bcf1_t *v)
+{
+  const char *name = bcf_seqname(eng->vcfhdr, v);
+  VcfCovChrom *chrom = ctx_calloc(1, sizeof(VcfCovChrom));
+  chrom->seq = fai_fetch(eng->fai, name, &chrom->len);
+  if(chrom->seq == NULL) die("Cannot find chr '%s'", name);
+  chrom->rid = v->rid;
+  chrom->refs = 1;
+  return chrom;
+}
+
+static void vcfcov_chrom_release(VcfCovChrom *chrom)
+{
+  if(chrom != NULL && __sync_sub_and_fetch(&chrom->refs, 1) == 0) {
+    free(chrom->seq);
+    ctx_free(chrom);
+  }
+}
+
+static void vcfcov_shard_alloc(VcfCovShard *shard)
+{
+  memset(shard, 0, sizeof(*shard));
+  vc_lines_alloc(&shard->lines, INIT_BUF_SIZE);
+  vc_lines_alloc(&shard->vpool, INIT_BUF_SIZE);
+  vc_alts_alloc(&shard->alts, INIT_BUF_SIZE);
+  vc_alts_alloc(&shard->galts, INIT_BUF_SIZE);
+  vc_alts_alloc(&shard->apool, INIT_BUF_SIZE);
+}
+
+static void vcfcov_shard_dealloc(VcfCovShard *shard)
+{
+  ctx_assert(vc_lines_len(&shard->lines) == 0);
+  ctx_assert(vc_alts_len(&shard->alts) == 0);
+  vcf_list_destroy(&shard->vpool);
+  var_list_destroy(&shard->apool);
+  vc_lines_dealloc(&shard->lines);
+  vc_lines_dealloc(&shard->vpool);
+  vc_alts_dealloc(&shard->alts);
+  vc_alts_dealloc(&shard->galts);
+  vc_alts_dealloc(&shard->apool);
+}
+
+// Return lines and alts to the shard's pools so it can be read into again
+static void vcfcov_shard_reset(VcfCovShard *shard)
+{
+  size_t nlines = vc_lines_len(&shard->lines), nalts = vc_alts_len(&shard->alts);
+  if(nlines) vc_lines_push(&shard->vpool, vc_lines_getptr(&shard->lines, 0), nlines);
+  if(nalts) vc_alts_push(&shard->apool, vc_alts_getptr(&shard->alts, 0), nalts);
+  vc_lines_reset(&shard->lines);
+  vc_alts_reset(&shard->alts);
+  vc_alts_reset(&shard->galts);
+  vcfcov_chrom_release(shard->chrom);
+  shard->chrom = NULL;
+  memset(&shard->stats, 0, sizeof(shard->stats));
+  shard->done = false;
+}
+
+// Genotype all of `vars` (sorted), breaking them into blocks wherever there is
+// a gap between haplotypes
+static void vcfcov_all_blocks(VcfCovAlt **vars, size_t nvars,
+                              const char *chr, int chrlen,
+                              VcfCovBuffers *covbuf,
+                              const VcfCovPrefs *prefs, VcfCovStats *stats)
+{
+  const size_t ks = covbuf->db_graph->kmer_size;
+  size_t bs, ge, endpos = 0;
+
+  for(bs = 0, ge = 1; ge < nvars; ge++)
+  {
+    endpos = MAX2(endpos, vcfcovalt_hap_end(vars[ge-1],ks));
+    if(endpos <= vars[ge]->pos) {
+      vcfcov_block(vars+bs, ge-bs, 0, ge-bs, chr, chrlen, covbuf, prefs, stats);
+      bs = ge;
+    }
+  }
+
+  vcfcov_block(vars+bs, nvars-bs, 0, nvars-bs, chr, chrlen, covbuf, prefs, stats);
+}
+
+static void vcfcov_shard_genotype(VcfCovShard *shard, VcfCovBuffers *covbuf,
+                                  const VcfCovPrefs *prefs)
+{
+  const size_t ncols = covbuf->db_graph->num_of_cols;
+  size_t i, aid, nalts, nvars;
+  VcfCovLine *line;
+  VcfCovAlt *alt;
+
+  // Decompose lines into alts
+  for(i = 0; i < vc_lines_len(&shard->lines); i++)
+  {
+    line = vc_lines_get(&shard->lines, i);
+    nalts = line->v.n_allele - 1; // n_allele includes ref
+
+    if(vc_alts_len(&shard->apool) < nalts)
+      var_list_populate(&shard->apool, MAX2(nalts, 16), ncols);
+
+    for(aid = 1; aid <= nalts; aid++) {
+      vc_alts_pop(&shard->apool, &alt, 1);
+      init_new_alt(alt, line, aid, ncols);
+      vc_alts_append(&shard->alts, alt);
+      // alts that are too long or empty are printed without coverage
+      if(MAX2(alt->reflen, alt->altlen) > prefs->max_allele_len) {
+        shard->stats.nalts_too_long++;
+      } else if(alt->reflen > 0 || alt->altlen > 0) {
+        vc_alts_append(&shard->galts, alt);
+        shard->stats.nalts_loaded++;
+      }
+    }
+
+    shard->stats.nalts_read += nalts;
+  }
+
+  if((nvars = vc_alts_len(&shard->galts)) == 0) return;
+
+  VcfCovAlt **vars = vc_alts_getptr(&shard->galts, 0);
+  vcfcov_alts_sort(vars, nvars);
+  vcfcov_all_blocks(vars, nvars, shard->chrom->seq, shard->chrom->len,
+                    covbuf, prefs, &shard->stats);
+}
+
+static void vcfcov_shard_print(VcfCovEngine *eng, VcfCovShard *shard)
+{
+  if(!eng->prefs->load_kmers_only)
+  {
+    // Alts are in the same order as their lines
+    VcfCovAlt **alts = vc_alts_getptr(&shard->alts, 0);
+    VcfCovLine *line;
+    size_t i, nalts;
+
+    pthread_mutex_lock(&eng->hdr_lock);
+
+    // Input header may have been modified by reading an entry
+    // for instance adding a missing contig= entry
+    bcf_hdr_merge(eng->outhdr, eng->vcfhdr);
+
+    for(i = 0; i < vc_lines_len(&shard->lines); i++) {
+      line = vc_lines_get(&shard->lines, i);
+      nalts = line->v.n_allele - 1;
+      vcfcov_print_entry(&eng->pr, &shard->stats, eng->outfh, eng->outhdr,
+                         alts, nalts, eng->prefs);
+      alts += nalts;
+    }
+
+    pthread_mutex_unlock(&eng->hdr_lock);
+  }
+
+  vcfcov_stats_merge(&eng->stats, &shard->stats);
+}
+
+// Print genotyped shards in input order until we reach one that has not been
+// genotyped. Called and returns with eng->lock held.
+static void vcfcov_print_shards(VcfCovEngine *eng)
+{
+  VcfCovShard *shard;
+  eng->printing = true;
+
+  while(eng->nprinted < eng->nread &&
+        (shard = &eng->shards[eng->nprinted % eng->nshards])->done)
+  {
+    pthread_mutex_unlock(&eng->lock);
+    vcfcov_shard_print(eng, shard);
+    vcfcov_shard_reset(shard);
+    pthread_mutex_lock(&eng->lock);
+    eng->nprinted++;
+    pthread_cond_signal(&eng->shard_printed);
+  }
+
+  eng->printing = false;
+}
+
+static void* vcfcov_worker(void *arg)
+{
+  VcfCovWorker *wrkr = (VcfCovWorker*)arg;
+  VcfCovEngine *eng = wrkr->eng;
+  VcfCovShard *shard;
+
+  pthread_mutex_lock(&eng->lock);
+  while(1)
+  {
+    while(eng->nqueued == eng->nread && !eng->eof)
+      pthread_cond_wait(&eng->shard_read, &eng->lock);
+
+    if(eng->nqueued == eng->nread) break; // end of input
+
+    shard = &eng->shards[eng->nqueued++ % eng->nshards];
+    pthread_mutex_unlock(&eng->lock);
+
+    vcfcov_shard_genotype(shard, &wrkr->covbuf, eng->prefs);
+
+    pthread_mutex_lock(&eng->lock);
+    shard->done = true;
+    // If another thread is printing, it will print this shard when it gets
+    // to it
+    if(!eng->printing) vcfcov_print_shards(eng);
+  }
+  pthread_mutex_unlock(&eng->lock);
+
+  return NULL;
+}
+
+// Wait for a free shard to read into
+static VcfCovShard* vcfcov_shard_next(VcfCovEngine *eng, VcfCovChrom *chrom)
+{
+  pthread_mutex_lock(&eng->lock);
+  while(eng->nread - eng->nprinted == eng->nshards)
+    pthread_cond_wait(&eng->shard_printed, &eng->lock);
+  pthread_mutex_unlock(&eng->lock);
+
+  VcfCovShard *shard = &eng->shards[eng->nread % eng->nshards];
+  __sync_add_and_fetch(&chrom->refs, 1);
+  shard->chrom = chrom;
+  return shard;
+}
+
+// Pass the shard that has been read to the worker threads
+static void vcfcov_shard_queue(VcfCovEngine *eng)
+{
+  pthread_mutex_lock(&eng->lock);
+  eng->nread++;
+  pthread_cond_signal(&eng->shard_read);
+  pthread_mutex_unlock(&eng->lock);
+}
+
+static void vcfcov_read_shards(VcfCovEngine *eng)
+{
+  const size_t ks = eng->db_graph->kmer_size;
+  VcfCovShard *shard = NULL;
+  VcfCovChrom *chrom = NULL;
+  VcfCovLine *line = ctx_calloc(1, sizeof(VcfCovLine));
+  bcf1_t *v;
+  size_t vidx = 0;
+  int64_t prevpos = 0, shard_end = 0;
+  bool new_chrom;
+  int rc;
+
+  while(1)
+  {
+    v = &line->v;
+
+    pthread_mutex_lock(&eng->hdr_lock);
+    rc = bcf_read(eng->vcffh, eng->vcfhdr, v);
+    pthread_mutex_unlock(&eng->hdr_lock);
+    if(rc < 0) break;
+
+    // Unpack all info
+    bcf_unpack(v, BCF_UN_ALL);
+    line->vidx = vidx++;
+
+    ctx_assert(strlen(v->d.allele[0]) == (size_t)v->rlen);
+    ctx_assert2(v->n_allele > 1, "n_allele: %i", v->n_allele);
+
+    new_chrom = (chrom == NULL || chrom->rid != v->rid);
+
+    if(new_chrom) {
+      vcfcov_chrom_release(chrom);
+      chrom = vcfcov_chrom_fetch(eng, v);
+    }
+    else if(v->pos < prevpos) {
+      die("VCF is not sorted: %s:%lli", eng->path, (long long)eng->vcffh->lineno);
+    }
+
+    prevpos = v->pos;
+    check_ref_allele(eng->vcfhdr, v, chrom->seq, chrom->len);
+
+    // Start a new shard if no haplotype from the current shard reaches this
+    // line. Trimmed alleles start at or after v->pos.
+    if(shard == NULL || new_chrom ||
+       (vc_lines_len(&shard->lines) >= SHARD_MIN_LINES && v->pos >= shard_end))
+    {
+      if(shard != NULL) vcfcov_shard_queue(eng);
+      shard = vcfcov_shard_next(eng, chrom);
+      shard_end = 0;
+    }
+
+    shard_end = MAX2(shard_end, (int64_t)v->pos + v->rlen + (int64_t)ks - 1);
+    shard->stats.nvcf_lines++;
+    vc_lines_append(&shard->lines, line);
+
+    // Get a line to read into next
+    if(vc_lines_len(&shard->vpool)) vc_lines_pop(&shard->vpool, &line, 1);
+    else line = ctx_calloc(1, sizeof(VcfCovLine));
+  }
+
+  if(shard != NULL) vcfcov_shard_queue(eng);
+
+  vcfcov_chrom_release(chrom);
+  bcf_empty(&line->v);
+  ctx_free(line);
+
+  pthread_mutex_lock(&eng->lock);
+  eng->eof = true;
+  pthread_cond_broadcast(&eng->shard_read);
+  pthread_mutex_unlock(&eng->lock);
+}
+
+// Read on this thread, genotype on prefs->nthreads worker threads
+static void vcfcov_file_mt(htsFile *vcffh, bcf_hdr_t *vcfhdr,
+                           htsFile *outfh, bcf_hdr_t *outhdr,
+                           const char *path, faidx_t *fai,
+                           const size_t *samplehdrids,
+                           const VcfCovPrefs *prefs,
+                           VcfCovStats *stats,
+                           dBGraph *db_graph)
+{
+  const size_t nthreads = prefs->nthreads;
+  size_t i;
+  int rc;
+
+  VcfCovEngine eng;
+  memset(&eng, 0, sizeof(eng));
+  eng.vcffh = vcffh;
+  eng.vcfhdr = vcfhdr;
+  eng.outfh = outfh;
+  eng.outhdr = outhdr;
+  eng.path = path;
+  eng.fai = fai;
+  eng.prefs = prefs;
+  eng.db_graph = db_graph;
+  vcfcov_printer_alloc(&eng.pr, vcfhdr, samplehdrids, db_graph->num_of_cols);
+
+  eng.nshards = nthreads * SHARDS_PER_THREAD;
+  eng.shards = ctx_calloc(eng.nshards, sizeof(VcfCovShard));
+  for(i = 0; i < eng.nshards; i++) vcfcov_shard_alloc(&eng.shards[i]);
+
+  if(pthread_mutex_init(&eng.lock, NULL) != 0 ||
+     pthread_mutex_init(&eng.hdr_lock, NULL) != 0)
+    die("Mutex init failed");
+  if(pthread_cond_init(&eng.shard_read, NULL) != 0 ||
+     pthread_cond_init(&eng.shard_printed, NULL) != 0)
+    die("Condition variable init failed");
+
+  VcfCovWorker *workers = ctx_calloc(nthreads, sizeof(VcfCovWorker));
+
+  for(i = 0; i < nthreads; i++) {
+    workers[i].eng = &eng;
+    covbuf_alloc(&workers[i].covbuf, db_graph);
+    rc = pthread_create(&workers[i].thread, NULL, vcfcov_worker, &workers[i]);
+    if(rc != 0) die("Creating thread failed: %s", strerror(rc));
+  }
+
+  vcfcov_read_shards(&eng);
+
+  for(i = 0; i < nthreads; i++) {
+    rc = pthread_join(workers[i].thread, NULL);
+    if(rc != 0) die("Joining thread failed: %s", strerror(rc));
+    covbuf_dealloc(&workers[i].covbuf);
+  }
+
+  ctx_assert(eng.nprinted == eng.nread);
+  status("[vcfcov] genotyped %zu shard%s with %zu threads",
+         eng.nread, util_plural_str(eng.nread), nthreads);
+
+  memcpy(stats, &eng.stats, sizeof(*stats));
+
+  for(i = 0; i < eng.nshards; i++) vcfcov_shard_dealloc(&eng.shards[i]);
+  ctx_free(eng.shards);
+  ctx_free(workers);
+  vcfcov_printer_dealloc(&eng.pr);
+
+  pthread_mutex_destroy(&eng.lock);
+  pthread_mutex_destroy(&eng.hdr_lock);
+  pthread_cond_destroy(&eng.shard_read);
+  pthread_cond_destroy(&eng.shard_printed);
+}
+
+/**
+ * @param outfh        Only required for printing
+ * @param outhdr       Only required for printing
+ * @param samplehdrids [col] is the index of a colour in the output vcf.
+ *                     Only required for printing.
+ */
+void vcfcov_file(htsFile *vcffh, bcf_hdr_t *vcfhdr,
+                 htsFile *outfh, bcf_hdr_t *outhdr,
+                 const char *path, faidx_t *fai,
+                 const size_t *samplehdrids,
+                 const VcfCovPrefs *prefs,
+                 VcfCovStats *stats,
+                 dBGraph *db_graph)
+{
+  if(prefs->nthreads > 1) {
+    vcfcov_file_mt(vcffh, vcfhdr, outfh, outhdr, path, fai, samplehdrids,
+                   prefs, stats, db_graph);
+  } else {
+    vcfcov_file_serial(vcffh, vcfhdr, outfh, outhdr, path, fai, samplehdrids,
+                       prefs, stats, db_graph);
+  }
+}
@@ -25,6 +25,9 @@ typedef struct {
   // defaults to DEFAULT_MAX_GT_VARS
   uint32_t max_gt_vars;
   bool load_kmers_only;
+  // Number of threads to genotype with. With more than one, the VCF is cut
+  // into shards that are genotyped on worker threads and printed in order
+  size_t nthreads;
 } VcfCovPrefs;
 
 void vcfcov_file(htsFile *vcffh, bcf_hdr_t *vcfhdr,